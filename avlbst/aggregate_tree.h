@@ -0,0 +1,230 @@
+#ifndef AGGREGATE_TREE_H
+#define AGGREGATE_TREE_H
+
+#include "avlbst.h"
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <utility>
+
+// Monoids for AggregateTree. A monoid names the type it produces (Result)
+// and provides identity(), lift(value) for a single value and an
+// associative combine(a, b), where a holds the smaller keys.
+template <typename T> struct SumMonoid {
+  typedef T Result;
+  Result identity() const { return T(); }
+  Result lift(const T &value) const { return value; }
+  Result combine(const Result &a, const Result &b) const { return a + b; }
+};
+
+template <typename T> struct MinMonoid {
+  typedef T Result;
+  Result identity() const { return std::numeric_limits<T>::max(); }
+  Result lift(const T &value) const { return value; }
+  Result combine(const Result &a, const Result &b) const {
+    return b < a ? b : a;
+  }
+};
+
+template <typename T> struct MaxMonoid {
+  typedef T Result;
+  Result identity() const { return std::numeric_limits<T>::lowest(); }
+  Result lift(const T &value) const { return value; }
+  Result combine(const Result &a, const Result &b) const {
+    return a < b ? b : a;
+  }
+};
+
+template <typename T> struct CountMonoid {
+  typedef size_t Result;
+  Result identity() const { return 0; }
+  Result lift(const T &) const { return 1; }
+  Result combine(Result a, Result b) const { return a + b; }
+};
+
+// An AVLNode that also caches the aggregate of the values in its subtree.
+template <typename Key, typename Value, typename Result>
+class AggregateNode : public AVLNode<Key, Value> {
+public:
+  AggregateNode(std::pair<const Key, Value> &&item,
+                std::shared_ptr<AVLNode<Key, Value>> parent,
+                const Result &aggregate);
+  virtual ~AggregateNode();
+
+  const Result &getAggregate() const;
+  void setAggregate(const Result &aggregate);
+
+protected:
+  Result aggregate_;
+};
+
+// --------------------------------------------------
+// Begin implementations for the AggregateNode class.
+// --------------------------------------------------
+
+template <class Key, class Value, class Result>
+AggregateNode<Key, Value, Result>::AggregateNode(
+    std::pair<const Key, Value> &&item,
+    std::shared_ptr<AVLNode<Key, Value>> parent, const Result &aggregate)
+    : AVLNode<Key, Value>(std::move(item), parent), aggregate_(aggregate) {}
+
+template <class Key, class Value, class Result>
+AggregateNode<Key, Value, Result>::~AggregateNode() {}
+
+template <class Key, class Value, class Result>
+const Result &AggregateNode<Key, Value, Result>::getAggregate() const {
+  return aggregate_;
+}
+
+template <class Key, class Value, class Result>
+void AggregateNode<Key, Value, Result>::setAggregate(const Result &aggregate) {
+  aggregate_ = aggregate;
+}
+
+// ------------------------------------------------
+// End implementations for the AggregateNode class.
+// ------------------------------------------------
+
+// An AVL tree where each node caches the Monoid aggregate of its subtree's
+// values, so that the aggregate over any key range takes O(log n) instead of
+// a walk over the range. The cache is kept by the augmentation hooks of
+// AVLTree, through every rotation, insert, remove and bulk operation.
+//
+// Values must only be changed through the tree (insert, insert_or_assign,
+// upsert, modify), not by writing through an iterator, so that the cached
+// aggregates stay current.
+template <class Key, class Value, class Monoid = SumMonoid<Value>>
+class AggregateTree : public AVLTree<Key, Value> {
+public:
+  typedef typename Monoid::Result Result;
+
+  explicit AggregateTree(const Monoid &monoid = Monoid());
+
+  // Aggregate of the values whose keys lie in [lo, hi], combined in key
+  // order; identity() if there are none.
+  Result aggregate(const Key &lo, const Key &hi) const;
+  // Aggregate of the whole tree, in O(1).
+  Result aggregate() const;
+
+protected:
+  typedef AggregateNode<Key, Value, Result> ANode;
+
+  virtual std::shared_ptr<AVLNode<Key, Value>>
+  makeNode(std::pair<const Key, Value> &&item,
+           std::shared_ptr<AVLNode<Key, Value>> parent);
+  virtual void updateNode(std::shared_ptr<AVLNode<Key, Value>> n);
+  virtual void updatePath(std::shared_ptr<AVLNode<Key, Value>> n);
+
+  Result subtreeAggregate(const Node<Key, Value> *n) const;
+  Result suffixAggregate(const Node<Key, Value> *n, const Key &lo) const;
+  Result prefixAggregate(const Node<Key, Value> *n, const Key &hi) const;
+
+  Monoid monoid_;
+};
+
+template <class Key, class Value, class Monoid>
+AggregateTree<Key, Value, Monoid>::AggregateTree(const Monoid &monoid)
+    : monoid_(monoid) {}
+
+// Descends to the highest node inside [lo, hi]. Below it the range is the
+// part of its left subtree at or after lo, the node itself and the part of
+// its right subtree at or before hi; each part is one more descent that
+// picks up whole cached subtrees on the way.
+template <class Key, class Value, class Monoid>
+typename AggregateTree<Key, Value, Monoid>::Result
+AggregateTree<Key, Value, Monoid>::aggregate(const Key &lo,
+                                             const Key &hi) const {
+  const Node<Key, Value> *n = this->root_.get();
+  while (n != nullptr && (n->getKey() < lo || hi < n->getKey()))
+    n = n->getKey() < lo ? n->getRight().get() : n->getLeft().get();
+  if (n == nullptr)
+    return monoid_.identity();
+
+  Result left = suffixAggregate(n->getLeft().get(), lo);
+  Result right = prefixAggregate(n->getRight().get(), hi);
+  return monoid_.combine(monoid_.combine(left, monoid_.lift(n->getValue())),
+                         right);
+}
+
+template <class Key, class Value, class Monoid>
+typename AggregateTree<Key, Value, Monoid>::Result
+AggregateTree<Key, Value, Monoid>::aggregate() const {
+  return subtreeAggregate(this->root_.get());
+}
+
+template <class Key, class Value, class Monoid>
+std::shared_ptr<AVLNode<Key, Value>>
+AggregateTree<Key, Value, Monoid>::makeNode(
+    std::pair<const Key, Value> &&item,
+    std::shared_ptr<AVLNode<Key, Value>> parent) {
+  Result aggregate = monoid_.lift(item.second);
+  return std::make_shared<ANode>(std::move(item), parent, aggregate);
+}
+
+template <class Key, class Value, class Monoid>
+void AggregateTree<Key, Value, Monoid>::updateNode(
+    std::shared_ptr<AVLNode<Key, Value>> n) {
+  static_cast<ANode *>(n.get())->setAggregate(monoid_.combine(
+      monoid_.combine(subtreeAggregate(n->getLeft().get()),
+                      monoid_.lift(n->getValue())),
+      subtreeAggregate(n->getRight().get())));
+}
+
+template <class Key, class Value, class Monoid>
+void AggregateTree<Key, Value, Monoid>::updatePath(
+    std::shared_ptr<AVLNode<Key, Value>> n) {
+  for (; n != nullptr; n = n->getParent_AVL())
+    updateNode(n);
+}
+
+template <class Key, class Value, class Monoid>
+typename AggregateTree<Key, Value, Monoid>::Result
+AggregateTree<Key, Value, Monoid>::subtreeAggregate(
+    const Node<Key, Value> *n) const {
+  if (n == nullptr)
+    return monoid_.identity();
+  return static_cast<const ANode *>(n)->getAggregate();
+}
+
+// Aggregate of the keys >= lo in the subtree at n. Every node kept on the
+// way down comes before everything kept so far, so it is combined in front.
+template <class Key, class Value, class Monoid>
+typename AggregateTree<Key, Value, Monoid>::Result
+AggregateTree<Key, Value, Monoid>::suffixAggregate(const Node<Key, Value> *n,
+                                                   const Key &lo) const {
+  Result result = monoid_.identity();
+  while (n != nullptr) {
+    if (n->getKey() < lo)
+      n = n->getRight().get();
+    else {
+      result = monoid_.combine(
+          monoid_.combine(monoid_.lift(n->getValue()),
+                          subtreeAggregate(n->getRight().get())),
+          result);
+      n = n->getLeft().get();
+    }
+  }
+  return result;
+}
+
+// Aggregate of the keys <= hi in the subtree at n, the mirror image of
+// suffixAggregate.
+template <class Key, class Value, class Monoid>
+typename AggregateTree<Key, Value, Monoid>::Result
+AggregateTree<Key, Value, Monoid>::prefixAggregate(const Node<Key, Value> *n,
+                                                   const Key &hi) const {
+  Result result = monoid_.identity();
+  while (n != nullptr) {
+    if (hi < n->getKey())
+      n = n->getLeft().get();
+    else {
+      result = monoid_.combine(
+          result, monoid_.combine(subtreeAggregate(n->getLeft().get()),
+                                  monoid_.lift(n->getValue())));
+      n = n->getRight().get();
+    }
+  }
+  return result;
+}
+
+#endif
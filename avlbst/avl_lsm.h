@@ -0,0 +1,802 @@
+#ifndef AVL_LSM_H
+#define AVL_LSM_H
+
+#include "avlbst.h"
+#include "bloom_filter.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A memtable entry: a value, or a tombstone that hides older values of the
+// key in the runs.
+template <typename Value> struct LSMEntry {
+  Value value;
+  bool deleted;
+};
+
+// An immutable run file: fixed-size records in key order, grouped into
+// blocks, followed by the first key of each block and a Bloom filter of all
+// the keys. The index and filter are kept in memory, so a lookup reads at
+// most one block, and none at all for most keys that are not in the run.
+template <typename Key, typename Value> class SortedRun {
+public:
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<Value>::value,
+                "run files store keys and values bytewise");
+
+  struct Record {
+    Key key;
+    Value value;
+    bool deleted;
+  };
+
+  static const size_t kBlockSize = 4096;
+  static const size_t kRecordsPerBlock =
+      sizeof(Record) < kBlockSize ? kBlockSize / sizeof(Record) : 1;
+
+  // Writes a new run. Records must be added in ascending key order; the file
+  // is only complete, and synced to disk, once finish() returns.
+  class Writer {
+  public:
+    Writer(const std::string &path, size_t expected_items);
+    ~Writer();
+
+    void add(const Key &key, const Value &value, bool deleted);
+    void finish();
+
+  protected:
+    Writer(const Writer &);
+    Writer &operator=(const Writer &);
+
+    void writeBlock();
+
+    std::string path_;
+    int fd_;
+    uint64_t offset_;
+    uint64_t count_;
+    std::vector<Record> block_;
+    std::vector<Key> index_;
+    BloomFilter bloom_;
+  };
+
+  // Reads the records in order, one block at a time, from the first one or
+  // from the first one whose key is at least lo.
+  class Cursor {
+  public:
+    explicit Cursor(const SortedRun &run);
+    Cursor(const SortedRun &run, const Key &lo);
+
+    bool valid() const { return position_ < block_.size(); }
+    const Record &record() const { return block_[position_]; }
+    void next();
+
+  protected:
+    const SortedRun *run_;
+    size_t block_index_;
+    std::vector<Record> block_;
+    size_t position_;
+  };
+
+  // Opens the run at path, which holds the memtables flushed with sequence
+  // numbers first to last.
+  SortedRun(const std::string &path, uint64_t first, uint64_t last);
+  // Deletes the file too if the run has been compacted away.
+  ~SortedRun();
+
+  // Looks key up, setting record if it is in the run.
+  bool get(const Key &key, Record &record) const;
+  size_t size() const { return count_; }
+  uint64_t first() const { return first_; }
+  uint64_t last() const { return last_; }
+  void markObsolete() { obsolete_ = true; }
+
+protected:
+  SortedRun(const SortedRun &);
+  SortedRun &operator=(const SortedRun &);
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t index_offset;
+    uint64_t bloom_offset;
+    uint64_t bloom_words;
+    uint64_t bloom_probes;
+  };
+
+  size_t blockCount() const;
+  size_t blockOf(const Key &key) const;
+  void readBlock(size_t block, std::vector<Record> &out) const;
+
+  std::string path_;
+  uint64_t first_;
+  uint64_t last_;
+  int fd_;
+  size_t count_;
+  std::vector<Key> index_;
+  std::unique_ptr<BloomFilter> bloom_;
+  bool obsolete_;
+};
+
+// ----------------------------------------------------
+// Begin implementations for the SortedRun class.
+// ----------------------------------------------------
+
+template <class Key, class Value>
+SortedRun<Key, Value>::Writer::Writer(const std::string &path,
+                                      size_t expected_items)
+    : path_(path), offset_(kBlockSize), count_(0), bloom_(expected_items) {
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0)
+    throw std::runtime_error("cannot create run " + path);
+  block_.reserve(kRecordsPerBlock);
+}
+
+template <class Key, class Value> SortedRun<Key, Value>::Writer::~Writer() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+template <class Key, class Value>
+void SortedRun<Key, Value>::Writer::add(const Key &key, const Value &value,
+                                        bool deleted) {
+  if (block_.empty())
+    index_.push_back(key);
+  // zeroed so that the padding written to the file is too
+  Record record;
+  std::memset(&record, 0, sizeof(record));
+  record.key = key;
+  record.value = value;
+  record.deleted = deleted;
+  block_.push_back(record);
+  bloom_.add(std::hash<Key>()(key));
+  count_++;
+  if (block_.size() == kRecordsPerBlock)
+    writeBlock();
+}
+
+// The header goes last, in the block kept free for it at the start.
+template <class Key, class Value>
+void SortedRun<Key, Value>::Writer::finish() {
+  writeBlock();
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "AVLRUN", 7);
+  header.version = 1;
+  header.key_size = sizeof(Key);
+  header.value_size = sizeof(Value);
+  header.record_size = sizeof(Record);
+  header.count = count_;
+  header.index_offset = offset_;
+  header.bloom_offset = offset_ + index_.size() * sizeof(Key);
+  header.bloom_words = bloom_.words().size();
+  header.bloom_probes = bloom_.probes();
+
+  size_t index_bytes = index_.size() * sizeof(Key);
+  size_t bloom_bytes = bloom_.words().size() * sizeof(uint64_t);
+  if (pwrite(fd_, index_.data(), index_bytes, header.index_offset) !=
+          static_cast<ssize_t>(index_bytes) ||
+      pwrite(fd_, bloom_.words().data(), bloom_bytes, header.bloom_offset) !=
+          static_cast<ssize_t>(bloom_bytes) ||
+      pwrite(fd_, &header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+      fsync(fd_) != 0)
+    throw std::runtime_error("cannot write run " + path_);
+  close(fd_);
+  fd_ = -1;
+}
+
+template <class Key, class Value>
+void SortedRun<Key, Value>::Writer::writeBlock() {
+  size_t bytes = block_.size() * sizeof(Record);
+  if (pwrite(fd_, block_.data(), bytes, offset_) !=
+      static_cast<ssize_t>(bytes))
+    throw std::runtime_error("cannot write run " + path_);
+  offset_ += bytes;
+  block_.clear();
+}
+
+template <class Key, class Value>
+SortedRun<Key, Value>::Cursor::Cursor(const SortedRun &run)
+    : run_(&run), block_index_(0), position_(0) {
+  if (run.count_ > 0)
+    run.readBlock(0, block_);
+}
+
+template <class Key, class Value>
+SortedRun<Key, Value>::Cursor::Cursor(const SortedRun &run, const Key &lo)
+    : run_(&run), block_index_(run.blockOf(lo)), position_(0) {
+  if (run.count_ == 0)
+    return;
+  run.readBlock(block_index_, block_);
+  while (valid() && record().key < lo)
+    next();
+}
+
+template <class Key, class Value>
+void SortedRun<Key, Value>::Cursor::next() {
+  if (++position_ < block_.size() || block_index_ + 1 >= run_->blockCount())
+    return;
+  run_->readBlock(++block_index_, block_);
+  position_ = 0;
+}
+
+template <class Key, class Value>
+SortedRun<Key, Value>::SortedRun(const std::string &path, uint64_t first,
+                                 uint64_t last)
+    : path_(path), first_(first), last_(last), obsolete_(false) {
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ < 0)
+    throw std::runtime_error("cannot open run " + path);
+  Header header;
+  bool ok = pread(fd_, &header, sizeof(header), 0) ==
+                static_cast<ssize_t>(sizeof(header)) &&
+            std::memcmp(header.magic, "AVLRUN", 7) == 0 &&
+            header.version == 1 && header.key_size == sizeof(Key) &&
+            header.value_size == sizeof(Value) &&
+            header.record_size == sizeof(Record) && header.bloom_words > 0;
+  if (ok) {
+    count_ = header.count;
+    index_.resize(blockCount());
+    std::vector<uint64_t> words(header.bloom_words);
+    size_t index_bytes = index_.size() * sizeof(Key);
+    size_t bloom_bytes = words.size() * sizeof(uint64_t);
+    ok = pread(fd_, index_.data(), index_bytes, header.index_offset) ==
+             static_cast<ssize_t>(index_bytes) &&
+         pread(fd_, words.data(), bloom_bytes, header.bloom_offset) ==
+             static_cast<ssize_t>(bloom_bytes);
+    bloom_.reset(new BloomFilter(words.data(), words.size(),
+                                 static_cast<unsigned>(header.bloom_probes)));
+  }
+  if (!ok) {
+    close(fd_);
+    throw std::runtime_error("run " + path + " is corrupt");
+  }
+}
+
+template <class Key, class Value> SortedRun<Key, Value>::~SortedRun() {
+  close(fd_);
+  if (obsolete_)
+    unlink(path_.c_str());
+}
+
+template <class Key, class Value>
+bool SortedRun<Key, Value>::get(const Key &key, Record &record) const {
+  if (count_ == 0 || !bloom_->mayContain(std::hash<Key>()(key)) ||
+      key < index_[0])
+    return false;
+  std::vector<Record> block;
+  readBlock(blockOf(key), block);
+  size_t lo = 0, hi = block.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (block[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == block.size() || key < block[lo].key)
+    return false;
+  record = block[lo];
+  return true;
+}
+
+template <class Key, class Value>
+size_t SortedRun<Key, Value>::blockCount() const {
+  return (count_ + kRecordsPerBlock - 1) / kRecordsPerBlock;
+}
+
+// The last block whose first key is not greater than key, or the first.
+template <class Key, class Value>
+size_t SortedRun<Key, Value>::blockOf(const Key &key) const {
+  typename std::vector<Key>::const_iterator after =
+      std::upper_bound(index_.begin(), index_.end(), key);
+  return after == index_.begin() ? 0 : after - index_.begin() - 1;
+}
+
+template <class Key, class Value>
+void SortedRun<Key, Value>::readBlock(size_t block,
+                                      std::vector<Record> &out) const {
+  size_t left = count_ - block * kRecordsPerBlock;
+  size_t records = left < kRecordsPerBlock ? left : kRecordsPerBlock;
+  out.resize(records);
+  size_t bytes = records * sizeof(Record);
+  if (pread(fd_, out.data(), bytes,
+            kBlockSize + block * kRecordsPerBlock * sizeof(Record)) !=
+      static_cast<ssize_t>(bytes))
+    throw std::runtime_error("cannot read run " + path_);
+}
+
+// --------------------------------------------------
+// End implementations for the SortedRun class.
+// --------------------------------------------------
+
+struct LSMOptions {
+  // The memtable is flushed to a new run once it holds this many items
+  // (tombstones included).
+  size_t memtable_items;
+  // Runs of about the same size are merged into one once there are more
+  // than this many of them, at least 1; see LSMStore::tierOf.
+  size_t max_runs;
+  // Whether merging happens on a background thread or within the flush
+  // that filled a tier.
+  bool background_compaction;
+
+  LSMOptions()
+      : memtable_items(1 << 16), max_runs(4), background_compaction(true) {}
+};
+
+// A log-structured merge store in a directory. Writes go to an AVLTree
+// memtable, which is flushed as an immutable SortedRun when full. Compaction
+// is size-tiered: once more than max_runs neighbouring runs are of about the
+// same size, they are merged into one, dropping the values they shadow, and
+// the tombstones of removed keys if nothing older is left. Each item is
+// rewritten about once per tier, rather than on every compaction. Reads look
+// at the memtable and then at the runs from newest to oldest, and range
+// scans merge all of them in key order.
+//
+// Each run file is named by the range of flushes it holds, so reopening the
+// directory finds the runs, and any left behind by a crash during
+// compaction are recognised by being covered by a merged run. Items still
+// in the memtable are only written out by flush() or the destructor.
+//
+// One thread at a time may use the store; only compaction runs alongside
+// it.
+template <class Key, class Value> class LSMStore {
+public:
+  explicit LSMStore(const std::string &directory,
+                    const LSMOptions &options = LSMOptions());
+  // Flushes the memtable and waits for any compaction to finish.
+  ~LSMStore();
+
+  // Sets key's value, inserting it if needed.
+  void insert(const Key &key, const Value &value);
+  void remove(const Key &key);
+  // Sets value and returns true if key is in the store.
+  bool find(const Key &key, Value &value) const;
+  // Appends the items with keys in [lo, hi] to out, in key order.
+  void scan(const Key &lo, const Key &hi,
+            std::vector<std::pair<Key, Value>> &out) const;
+
+  // Writes the memtable out as a new run. Throws, once, if a background
+  // compaction failed since the last flush; the memtable is still written,
+  // and the compaction is retried.
+  void flush();
+  // Merges all the runs into one now, whatever their tiers.
+  void compact();
+  size_t runCount() const;
+
+protected:
+  typedef SortedRun<Key, Value> Run;
+
+  LSMStore(const LSMStore &);
+  LSMStore &operator=(const LSMStore &);
+
+  void write(const Key &key, const Value &value, bool deleted);
+  std::vector<std::shared_ptr<Run>> currentRuns() const;
+  std::string runPath(uint64_t first, uint64_t last) const;
+  void openRuns();
+  void compactLoop();
+  void compactTiers();
+  size_t tierOf(size_t items) const;
+  bool fullTier(const std::vector<std::shared_ptr<Run>> &runs, size_t &first,
+                size_t &count) const;
+  void merge(const std::vector<std::shared_ptr<Run>> &inputs, size_t first,
+             size_t count);
+  void reportCompactionError();
+
+  std::string directory_;
+  LSMOptions options_;
+  AVLTree<Key, LSMEntry<Value>> memtable_;
+  size_t memtable_items_;
+  uint64_t next_flush_;
+
+  // newest first; guarded by mutex_, as the compactor replaces them
+  std::vector<std::shared_ptr<Run>> runs_;
+  mutable std::mutex mutex_;
+  // held for a whole compaction, so that only one runs at a time
+  std::mutex compaction_mutex_;
+  std::condition_variable wake_;
+  bool stopping_;
+  std::string compaction_error_;
+  std::thread compactor_;
+};
+
+template <class Key, class Value>
+LSMStore<Key, Value>::LSMStore(const std::string &directory,
+                               const LSMOptions &options)
+    : directory_(directory), options_(options), memtable_items_(0),
+      next_flush_(1), stopping_(false) {
+  // with no runs allowed, every run would be a full tier on its own
+  if (options_.max_runs == 0)
+    throw std::invalid_argument("an LSM store needs max_runs of 1 or more");
+  openRuns();
+  if (options_.background_compaction)
+    compactor_ = std::thread(&LSMStore::compactLoop, this);
+}
+
+template <class Key, class Value> LSMStore<Key, Value>::~LSMStore() {
+  try {
+    flush();
+  } catch (const std::runtime_error &) {
+    // nothing more can be done about it here
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  if (compactor_.joinable())
+    compactor_.join();
+}
+
+template <class Key, class Value>
+void LSMStore<Key, Value>::insert(const Key &key, const Value &value) {
+  write(key, value, false);
+}
+
+template <class Key, class Value>
+void LSMStore<Key, Value>::remove(const Key &key) {
+  write(key, Value(), true);
+}
+
+template <class Key, class Value>
+bool LSMStore<Key, Value>::find(const Key &key, Value &value) const {
+  typename AVLTree<Key, LSMEntry<Value>>::iterator it = memtable_.find(key);
+  if (it != memtable_.end()) {
+    if (it->second.deleted)
+      return false;
+    value = it->second.value;
+    return true;
+  }
+
+  std::vector<std::shared_ptr<Run>> runs = currentRuns();
+  typename Run::Record record;
+  for (size_t i = 0; i < runs.size(); i++)
+    if (runs[i]->get(key, record)) {
+      if (record.deleted)
+        return false;
+      value = record.value;
+      return true;
+    }
+  return false;
+}
+
+// A k-way merge of the memtable's in-order iterator and a cursor on each
+// run. With only a handful of sources, the smallest key is found by looking
+// at each of them; on equal keys the newest source wins, and the others are
+// stepped past the key.
+template <class Key, class Value>
+void LSMStore<Key, Value>::scan(const Key &lo, const Key &hi,
+                                std::vector<std::pair<Key, Value>> &out) const {
+  std::vector<std::shared_ptr<Run>> runs = currentRuns();
+  std::vector<typename Run::Cursor> cursors;
+  for (size_t i = 0; i < runs.size(); i++)
+    cursors.push_back(typename Run::Cursor(*runs[i], lo));
+  typename AVLTree<Key, LSMEntry<Value>>::iterator mem =
+      memtable_.lower_bound(lo);
+  typename AVLTree<Key, LSMEntry<Value>>::iterator mem_end = memtable_.end();
+
+  while (true) {
+    const Key *key = nullptr;
+    const Value *value = nullptr;
+    bool deleted = false;
+    if (mem != mem_end) {
+      key = &(*mem).first;
+      value = &(*mem).second.value;
+      deleted = (*mem).second.deleted;
+    }
+    for (size_t i = 0; i < cursors.size(); i++)
+      if (cursors[i].valid() &&
+          (key == nullptr || cursors[i].record().key < *key)) {
+        key = &cursors[i].record().key;
+        value = &cursors[i].record().value;
+        deleted = cursors[i].record().deleted;
+      }
+    if (key == nullptr || hi < *key)
+      return;
+
+    std::pair<Key, Value> item(*key, *value);
+    if (!deleted)
+      out.push_back(item);
+    if (mem != mem_end && !(item.first < (*mem).first))
+      ++mem;
+    for (size_t i = 0; i < cursors.size(); i++)
+      if (cursors[i].valid() && !(item.first < cursors[i].record().key))
+        cursors[i].next();
+  }
+}
+
+// A failed background compaction is reported here once, but only after the
+// memtable is safely in a run.
+template <class Key, class Value> void LSMStore<Key, Value>::flush() {
+  if (memtable_items_ == 0) {
+    reportCompactionError();
+    return;
+  }
+
+  uint64_t sequence = next_flush_++;
+  std::string path = runPath(sequence, sequence);
+  {
+    typename Run::Writer writer(path + ".tmp", memtable_items_);
+    typename AVLTree<Key, LSMEntry<Value>>::iterator it;
+    for (it = memtable_.begin(); it != memtable_.end(); ++it)
+      writer.add((*it).first, (*it).second.value, (*it).second.deleted);
+    writer.finish();
+  }
+  if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+    throw std::runtime_error("cannot create run " + path);
+  std::shared_ptr<Run> run(new Run(path, sequence, sequence));
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    runs_.insert(runs_.begin(), run);
+  }
+  memtable_.clear();
+  memtable_items_ = 0;
+
+  size_t first, count;
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    full = fullTier(runs_, first, count);
+  }
+  if (full) {
+    if (options_.background_compaction)
+      wake_.notify_all();
+    else
+      compactTiers();
+  }
+  reportCompactionError();
+}
+
+template <class Key, class Value> void LSMStore<Key, Value>::compact() {
+  std::lock_guard<std::mutex> compacting(compaction_mutex_);
+  std::vector<std::shared_ptr<Run>> inputs = currentRuns();
+  if (inputs.size() >= 2)
+    merge(inputs, 0, inputs.size());
+}
+
+// Merges full tiers until none is left; each merge makes a run of the next
+// tier up, which may fill that one in turn.
+template <class Key, class Value> void LSMStore<Key, Value>::compactTiers() {
+  std::lock_guard<std::mutex> compacting(compaction_mutex_);
+  while (true) {
+    std::vector<std::shared_ptr<Run>> inputs = currentRuns();
+    size_t first, count;
+    if (!fullTier(inputs, first, count))
+      return;
+    merge(inputs, first, count);
+  }
+}
+
+// A run's tier is how many times larger than a memtable it is, in powers of
+// the number of runs merged at once, max_runs + 1. Merging one tier's runs
+// makes a run of about the next tier's size, so each item is rewritten once
+// per tier, and the number of tiers grows with the log of the store's size.
+template <class Key, class Value>
+size_t LSMStore<Key, Value>::tierOf(size_t items) const {
+  size_t ratio = std::max<size_t>(options_.max_runs + 1, 2);
+  size_t bound = std::max<size_t>(options_.memtable_items, 1) * ratio;
+  size_t tier = 0;
+  while (items >= bound && bound <= SIZE_MAX / ratio) {
+    bound *= ratio;
+    tier++;
+  }
+  return tier;
+}
+
+// Looks for more than max_runs runs in a row, newest first, that are no
+// larger than the tier of the first of them. Runs are always merged with
+// their neighbours, so that each still holds a contiguous range of flushes;
+// smaller runs caught between larger ones are swept up with them.
+template <class Key, class Value>
+bool LSMStore<Key, Value>::fullTier(
+    const std::vector<std::shared_ptr<Run>> &runs, size_t &first,
+    size_t &count) const {
+  for (size_t i = 0; i < runs.size(); i++) {
+    size_t tier = tierOf(runs[i]->size());
+    size_t end = i + 1;
+    while (end < runs.size() && tierOf(runs[end]->size()) <= tier)
+      end++;
+    if (end - i > options_.max_runs) {
+      first = i;
+      count = end - i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Merges count runs of inputs, a copy of runs_, from first on. Flushes may
+// add newer runs in the meantime, but those only ever go in front, so the
+// merged runs are found again by counting from the back. Tombstones are only
+// dropped when the merge includes the oldest run, as otherwise an older run
+// may still hold a value they hide.
+template <class Key, class Value>
+void LSMStore<Key, Value>::merge(const std::vector<std::shared_ptr<Run>> &inputs,
+                                 size_t first, size_t count) {
+  bool oldest = first + count == inputs.size();
+  size_t items = 0;
+  for (size_t i = first; i < first + count; i++)
+    items += inputs[i]->size();
+  uint64_t from = inputs[first + count - 1]->first();
+  uint64_t to = inputs[first]->last();
+  std::string path = runPath(from, to);
+  {
+    typename Run::Writer writer(path + ".tmp", items);
+    std::vector<typename Run::Cursor> cursors;
+    for (size_t i = first; i < first + count; i++)
+      cursors.push_back(typename Run::Cursor(*inputs[i]));
+    while (true) {
+      const typename Run::Record *newest = nullptr;
+      for (size_t i = 0; i < cursors.size(); i++)
+        if (cursors[i].valid() &&
+            (newest == nullptr || cursors[i].record().key < newest->key))
+          newest = &cursors[i].record();
+      if (newest == nullptr)
+        break;
+      typename Run::Record record = *newest;
+      if (!record.deleted || !oldest)
+        writer.add(record.key, record.value, record.deleted);
+      for (size_t i = 0; i < cursors.size(); i++)
+        if (cursors[i].valid() && !(record.key < cursors[i].record().key))
+          cursors[i].next();
+    }
+    writer.finish();
+  }
+  if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+    throw std::runtime_error("cannot create run " + path);
+  std::shared_ptr<Run> merged(new Run(path, from, to));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t start = runs_.size() - inputs.size() + first;
+  runs_.erase(runs_.begin() + start, runs_.begin() + start + count);
+  runs_.insert(runs_.begin() + start, merged);
+  // the files go once the last reader still using them is done
+  for (size_t i = first; i < first + count; i++)
+    inputs[i]->markObsolete();
+}
+
+template <class Key, class Value>
+void LSMStore<Key, Value>::reportCompactionError() {
+  std::string error;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error.swap(compaction_error_);
+  }
+  if (!error.empty())
+    throw std::runtime_error(error);
+}
+
+template <class Key, class Value>
+size_t LSMStore<Key, Value>::runCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return runs_.size();
+}
+
+// Tombstones always go in the memtable, even for keys that are only there,
+// as an older run may still hold the key.
+template <class Key, class Value>
+void LSMStore<Key, Value>::write(const Key &key, const Value &value,
+                                 bool deleted) {
+  LSMEntry<Value> entry = {value, deleted};
+  if (memtable_.insert_or_assign(key, entry).second)
+    memtable_items_++;
+  if (memtable_items_ >= options_.memtable_items)
+    flush();
+}
+
+template <class Key, class Value>
+std::vector<std::shared_ptr<SortedRun<Key, Value>>>
+LSMStore<Key, Value>::currentRuns() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return runs_;
+}
+
+template <class Key, class Value>
+std::string LSMStore<Key, Value>::runPath(uint64_t first,
+                                          uint64_t last) const {
+  char name[64];
+  std::snprintf(name, sizeof(name), "/run-%020llu-%020llu.sst",
+                static_cast<unsigned long long>(first),
+                static_cast<unsigned long long>(last));
+  return directory_ + name;
+}
+
+// Finds the runs in the directory. A run whose flushes are all covered by
+// another run was merged into it, and was only left behind because of a
+// crash, so it is deleted along with any unfinished .tmp files.
+template <class Key, class Value> void LSMStore<Key, Value>::openRuns() {
+  DIR *dir = opendir(directory_.c_str());
+  if (dir == nullptr)
+    throw std::runtime_error("cannot open store " + directory_);
+  std::vector<std::pair<uint64_t, uint64_t>> found;
+  std::vector<std::string> unfinished;
+  while (struct dirent *entry = readdir(dir)) {
+    unsigned long long first, last;
+    char rest[8];
+    int fields = std::sscanf(entry->d_name, "run-%llu-%llu.sst%7s", &first,
+                             &last, rest);
+    if (fields == 2)
+      found.push_back(std::make_pair(first, last));
+    else if (fields == 3)
+      unfinished.push_back(directory_ + "/" + entry->d_name);
+  }
+  closedir(dir);
+  for (size_t i = 0; i < unfinished.size(); i++)
+    unlink(unfinished[i].c_str());
+
+  // newest first, and widest first among runs ending at the same flush
+  std::sort(found.begin(), found.end(),
+            [](const std::pair<uint64_t, uint64_t> &a,
+               const std::pair<uint64_t, uint64_t> &b) {
+              return a.second != b.second ? a.second > b.second
+                                          : a.first < b.first;
+            });
+  uint64_t covered_from = 0;
+  for (size_t i = 0; i < found.size(); i++) {
+    std::string path = runPath(found[i].first, found[i].second);
+    if (!runs_.empty() && found[i].first >= covered_from) {
+      unlink(path.c_str());
+      continue;
+    }
+    runs_.push_back(
+        std::make_shared<Run>(path, found[i].first, found[i].second));
+    covered_from = found[i].first;
+    next_flush_ = std::max(next_flush_, found[i].second + 1);
+  }
+}
+
+// Waits for a flush to fill a tier, rechecking at least every 100 ms.
+// A failure is kept for the next flush to report, and the compaction is
+// retried after a pause.
+template <class Key, class Value> void LSMStore<Key, Value>::compactLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    size_t first, count;
+    bool work = wake_.wait_for(
+        lock, std::chrono::milliseconds(100), [this, &first, &count]() {
+          return stopping_ || fullTier(runs_, first, count);
+        });
+    if (stopping_)
+      return;
+    if (!work)
+      continue;
+    lock.unlock();
+    std::string error;
+    try {
+      compactTiers();
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+    lock.lock();
+    if (error.empty())
+      continue;
+    compaction_error_ = error;
+    wake_.wait_for(lock, std::chrono::milliseconds(100),
+                   [this]() { return stopping_; });
+  }
+}
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef AVL_SEQUENCE_H
+#define AVL_SEQUENCE_H
+
+#include "avlbst.h"
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// Sequence nodes carry no key; a node's position comes from the subtree
+// sizes above it. The comparisons only exist so that the keyed parts of
+// BinarySearchTree compile, and are never used by AVLSequence.
+struct SequenceKey {
+  bool operator<(const SequenceKey &) const { return false; }
+  bool operator==(const SequenceKey &) const { return true; }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const SequenceKey &) {
+  return out << '*';
+}
+
+// An AVLNode that also caches the number of nodes in its subtree.
+template <typename Value>
+class SequenceNode : public AVLNode<SequenceKey, Value> {
+public:
+  SequenceNode(std::pair<const SequenceKey, Value> &&item,
+               std::shared_ptr<AVLNode<SequenceKey, Value>> parent);
+  virtual ~SequenceNode();
+
+  size_t getSize() const;
+  void setSize(size_t size);
+
+protected:
+  size_t size_;
+};
+
+// -------------------------------------------------
+// Begin implementations for the SequenceNode class.
+// -------------------------------------------------
+
+template <class Value>
+SequenceNode<Value>::SequenceNode(
+    std::pair<const SequenceKey, Value> &&item,
+    std::shared_ptr<AVLNode<SequenceKey, Value>> parent)
+    : AVLNode<SequenceKey, Value>(std::move(item), parent), size_(1) {}
+
+template <class Value> SequenceNode<Value>::~SequenceNode() {}
+
+template <class Value> size_t SequenceNode<Value>::getSize() const {
+  return size_;
+}
+
+template <class Value> void SequenceNode<Value>::setSize(size_t size) {
+  size_ = size;
+}
+
+// -----------------------------------------------
+// End implementations for the SequenceNode class.
+// -----------------------------------------------
+
+// A sequence (rope) of values indexed by position, where inserting or
+// erasing in the middle, indexing, splitting and concatenating all take
+// O(log n) instead of the O(n) shifts of a vector. It is an AVLTree whose
+// in-order is the sequence: nodes cache their subtree size through the
+// augmentation hooks, and the AVLTree rotations, insertFix/removeFix and
+// split/join helpers do all of the rebalancing.
+template <class Value>
+class AVLSequence : protected AVLTree<SequenceKey, Value> {
+public:
+  class iterator {
+  public:
+    iterator();
+
+    Value &operator*() const;
+    Value *operator->() const;
+
+    bool operator==(const iterator &rhs) const;
+    bool operator!=(const iterator &rhs) const;
+
+    iterator &operator++();
+
+  protected:
+    friend class AVLSequence<Value>;
+    iterator(std::shared_ptr<Node<SequenceKey, Value>> ptr);
+    std::shared_ptr<Node<SequenceKey, Value>> current_;
+  };
+
+  AVLSequence();
+  AVLSequence(AVLSequence &&other);
+  AVLSequence &operator=(AVLSequence &&other);
+
+  size_t size() const;
+  using AVLTree<SequenceKey, Value>::empty;
+  using AVLTree<SequenceKey, Value>::clear;
+  using AVLTree<SequenceKey, Value>::isBalanced;
+
+  // Positions run from 0 to size() - 1; insertAt also accepts size(), to
+  // append. Bad positions throw std::out_of_range.
+  Value &at(size_t pos) const;
+  void insertAt(size_t pos, Value value);
+  void eraseAt(size_t pos);
+  void pushBack(Value value);
+  void pushFront(Value value);
+
+  // Moves the items from pos on into a new sequence and returns it.
+  AVLSequence split(size_t pos);
+  // Appends the items of other, leaving it empty.
+  void concat(AVLSequence &other);
+
+  iterator begin() const;
+  iterator end() const;
+
+protected:
+  typedef AVLNode<SequenceKey, Value> ANode;
+  typedef SequenceNode<Value> SNode;
+
+  virtual std::shared_ptr<ANode>
+  makeNode(std::pair<const SequenceKey, Value> &&item,
+           std::shared_ptr<ANode> parent);
+  virtual void updateNode(std::shared_ptr<ANode> n);
+  virtual void updatePath(std::shared_ptr<ANode> n);
+
+  static size_t sizeOf(const Node<SequenceKey, Value> *n);
+  std::shared_ptr<Node<SequenceKey, Value>> nodeAt(size_t pos) const;
+  void splitAt(std::shared_ptr<ANode> t, int ht, size_t pos,
+               std::shared_ptr<ANode> &left, int &hl,
+               std::shared_ptr<ANode> &right, int &hr);
+};
+
+// ------------------------------------------------------
+// Begin implementations for the AVLSequence::iterator class.
+// ------------------------------------------------------
+
+template <class Value>
+AVLSequence<Value>::iterator::iterator(
+    std::shared_ptr<Node<SequenceKey, Value>> ptr)
+    : current_(ptr) {}
+
+template <class Value> AVLSequence<Value>::iterator::iterator() {}
+
+template <class Value>
+Value &AVLSequence<Value>::iterator::operator*() const {
+  return current_->getValue();
+}
+
+template <class Value>
+Value *AVLSequence<Value>::iterator::operator->() const {
+  return &current_->getValue();
+}
+
+template <class Value>
+bool AVLSequence<Value>::iterator::operator==(const iterator &rhs) const {
+  return current_ == rhs.current_;
+}
+
+template <class Value>
+bool AVLSequence<Value>::iterator::operator!=(const iterator &rhs) const {
+  return current_ != rhs.current_;
+}
+
+template <class Value>
+typename AVLSequence<Value>::iterator &
+AVLSequence<Value>::iterator::operator++() {
+  current_ = AVLSequence<Value>::successor(current_);
+  return *this;
+}
+
+// ----------------------------------------------------
+// End implementations for the AVLSequence::iterator class.
+// ----------------------------------------------------
+
+template <class Value> AVLSequence<Value>::AVLSequence() {}
+
+// Takes over the nodes of other, leaving it empty. Sequences are never
+// copied, as the nodes of a tree are owned through its root.
+template <class Value>
+AVLSequence<Value>::AVLSequence(AVLSequence &&other) {
+  *this = std::move(other);
+}
+
+template <class Value>
+AVLSequence<Value> &AVLSequence<Value>::operator=(AVLSequence &&other) {
+  if (&other != this) {
+    this->clear();
+    this->root_ = std::move(other.root_);
+    other.root_ = nullptr;
+    this->resetExtremes();
+    other.resetExtremes();
+  }
+  return *this;
+}
+
+template <class Value> size_t AVLSequence<Value>::size() const {
+  return sizeOf(this->root_.get());
+}
+
+template <class Value> Value &AVLSequence<Value>::at(size_t pos) const {
+  if (pos >= size())
+    throw std::out_of_range("AVLSequence::at");
+  return nodeAt(pos)->getValue();
+}
+
+// The new node goes right before the one now at pos: in its empty left slot,
+// or else after its predecessor, which has an empty right slot. Appending
+// hangs it off the last node.
+template <class Value>
+void AVLSequence<Value>::insertAt(size_t pos, Value value) {
+  size_t count = size();
+  if (pos > count)
+    throw std::out_of_range("AVLSequence::insertAt");
+
+  std::shared_ptr<Node<SequenceKey, Value>> parent;
+  bool is_left = false;
+  if (pos == count)
+    parent = this->rightmost_;
+  else {
+    parent = nodeAt(pos);
+    is_left = true;
+    if (parent->getLeft() != nullptr) {
+      parent = parent->getLeft();
+      while (parent->getRight() != nullptr)
+        parent = parent->getRight();
+      is_left = false;
+    }
+  }
+  this->attachNode(parent, is_left,
+                   std::pair<const SequenceKey, Value>(SequenceKey(),
+                                                       std::move(value)));
+}
+
+template <class Value> void AVLSequence<Value>::eraseAt(size_t pos) {
+  if (pos >= size())
+    throw std::out_of_range("AVLSequence::eraseAt");
+  this->eraseNode(nodeAt(pos));
+}
+
+template <class Value> void AVLSequence<Value>::pushBack(Value value) {
+  insertAt(size(), std::move(value));
+}
+
+template <class Value> void AVLSequence<Value>::pushFront(Value value) {
+  insertAt(0, std::move(value));
+}
+
+// Cuts the tree along the path to pos, then joins the pieces on each side
+// back up with joinTrees, the same way eraseRange splits by key.
+template <class Value>
+AVLSequence<Value> AVLSequence<Value>::split(size_t pos) {
+  if (pos > size())
+    throw std::out_of_range("AVLSequence::split");
+
+  std::shared_ptr<ANode> root = std::static_pointer_cast<ANode>(this->root_);
+  int height = this->subtreeHeight(root);
+
+  // rotations below must not mistake a piece for the whole tree
+  this->root_ = nullptr;
+
+  std::shared_ptr<ANode> left, right;
+  int hl, hr;
+  splitAt(root, height, pos, left, hl, right, hr);
+
+  AVLSequence rest;
+  this->root_ = left;
+  this->resetExtremes();
+  rest.root_ = right;
+  rest.resetExtremes();
+  return rest;
+}
+
+template <class Value> void AVLSequence<Value>::concat(AVLSequence &other) {
+  if (&other == this || other.root_ == nullptr)
+    return;
+
+  std::shared_ptr<ANode> left = std::static_pointer_cast<ANode>(this->root_);
+  std::shared_ptr<ANode> right =
+      std::static_pointer_cast<ANode>(other.root_);
+  this->root_ = nullptr;
+  other.root_ = nullptr;
+  other.resetExtremes();
+
+  int height;
+  this->root_ =
+      this->joinTrees(left, this->subtreeHeight(left), right,
+                      this->subtreeHeight(right), height);
+  this->resetExtremes();
+}
+
+template <class Value>
+typename AVLSequence<Value>::iterator AVLSequence<Value>::begin() const {
+  return iterator(this->leftmost_);
+}
+
+template <class Value>
+typename AVLSequence<Value>::iterator AVLSequence<Value>::end() const {
+  return iterator(nullptr);
+}
+
+template <class Value>
+std::shared_ptr<AVLNode<SequenceKey, Value>>
+AVLSequence<Value>::makeNode(std::pair<const SequenceKey, Value> &&item,
+                             std::shared_ptr<ANode> parent) {
+  return std::make_shared<SNode>(std::move(item), parent);
+}
+
+template <class Value>
+void AVLSequence<Value>::updateNode(std::shared_ptr<ANode> n) {
+  static_cast<SNode *>(n.get())->setSize(sizeOf(n->getLeft().get()) + 1 +
+                                         sizeOf(n->getRight().get()));
+}
+
+template <class Value>
+void AVLSequence<Value>::updatePath(std::shared_ptr<ANode> n) {
+  for (; n != nullptr; n = n->getParent_AVL())
+    updateNode(n);
+}
+
+template <class Value>
+size_t AVLSequence<Value>::sizeOf(const Node<SequenceKey, Value> *n) {
+  return n == nullptr ? 0 : static_cast<const SNode *>(n)->getSize();
+}
+
+// Descends by subtree sizes to the node at pos, which must be in range.
+template <class Value>
+std::shared_ptr<Node<SequenceKey, Value>>
+AVLSequence<Value>::nodeAt(size_t pos) const {
+  std::shared_ptr<Node<SequenceKey, Value>> n = this->root_;
+  while (true) {
+    size_t left = sizeOf(n->getLeft().get());
+    if (pos == left)
+      return n;
+    if (pos < left)
+      n = n->getLeft();
+    else {
+      pos -= left + 1;
+      n = n->getRight();
+    }
+  }
+}
+
+// Splits the detached subtree t (of height ht) into its first pos nodes and
+// the rest, each a valid AVL tree.
+template <class Value>
+void AVLSequence<Value>::splitAt(std::shared_ptr<ANode> t, int ht,
+                                 size_t pos, std::shared_ptr<ANode> &left,
+                                 int &hl, std::shared_ptr<ANode> &right,
+                                 int &hr) {
+  if (t == nullptr) {
+    left = nullptr;
+    right = nullptr;
+    hl = 0;
+    hr = 0;
+    return;
+  }
+
+  // take t apart
+  char bal = t->getBalance();
+  std::shared_ptr<ANode> tl = t->getLeft_AVL();
+  std::shared_ptr<ANode> tr = t->getRight_AVL();
+  int htl = ht - (bal <= 0 ? 1 : 2);
+  int htr = ht - (bal >= 0 ? 1 : 2);
+  size_t count = sizeOf(tl.get());
+  if (tl != nullptr)
+    tl->setParent(nullptr);
+  if (tr != nullptr)
+    tr->setParent(nullptr);
+  t->setLeft(nullptr);
+  t->setRight(nullptr);
+
+  std::shared_ptr<ANode> mid;
+  int hmid;
+  // t and its right subtree go right, split the left subtree
+  if (pos <= count) {
+    splitAt(tl, htl, pos, left, hl, mid, hmid);
+    right = this->joinTrees(mid, hmid, t, tr, htr, hr);
+  }
+  // t and its left subtree go left, split the right subtree
+  else {
+    splitAt(tr, htr, pos - count - 1, mid, hmid, right, hr);
+    left = this->joinTrees(tl, htl, t, mid, hmid, hl);
+  }
+}
+
+#endif
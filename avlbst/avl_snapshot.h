@@ -0,0 +1,592 @@
+#ifndef AVL_SNAPSHOT_H
+#define AVL_SNAPSHOT_H
+
+#include "avlbst.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary snapshots of an AVLTree, for restarting without re-inserting every
+// key. The image holds no pointers: the nodes are stored in pre-order, as
+// four arrays (keys, values, right child index, and a byte with the balance
+// and whether there is a left child, which is always the next node). That
+// is enough to search the image in place, and to rebuild the exact same
+// tree in one sequential pass with no rebalancing.
+//
+// Keys and values are copied bytewise, so both must be trivially copyable,
+// and an image is only readable on a machine with the same byte order and
+// type sizes; all of this is checked when an image is opened, along with a
+// checksum of everything after the header.
+
+struct AVLSnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t key_size;
+  uint32_t value_size;
+  uint64_t count;
+  uint64_t keys_offset;
+  uint64_t values_offset;
+  uint64_t right_offset;
+  uint64_t meta_offset;
+  uint64_t file_size;
+  uint64_t checksum;
+};
+
+// CRC-32C (Castagnoli), fed in pieces of any size, eight bytes at a time
+// through the usual slicing tables. Every input bit feeds the whole
+// remainder, so flips in different words cannot cancel out the way they do
+// in a multiplicative hash over words.
+class AVLSnapshotChecksum {
+public:
+  AVLSnapshotChecksum() : crc_(0xffffffffu) {}
+
+  void update(const void *data, size_t len) {
+    const uint32_t(*table)[256] = tables();
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint32_t crc = crc_;
+    while (len >= 8) {
+      uint32_t lo, hi;
+      std::memcpy(&lo, bytes, 4);
+      std::memcpy(&hi, bytes + 4, 4);
+      if (!littleEndian()) {
+        lo = swapBytes(lo);
+        hi = swapBytes(hi);
+      }
+      lo ^= crc;
+      crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+            table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+            table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+            table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+      bytes += 8;
+      len -= 8;
+    }
+    while (len > 0) {
+      crc = table[0][(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+      len--;
+    }
+    crc_ = crc;
+  }
+
+  uint64_t finish() const { return crc_ ^ 0xffffffffu; }
+
+private:
+  // table[0] is the bytewise table; table[k] advances a byte through k more
+  // zero bytes.
+  static const uint32_t (*tables())[256] {
+    static const Tables built;
+    return built.table;
+  }
+
+  struct Tables {
+    uint32_t table[8][256];
+
+    Tables() {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+          crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+        table[0][i] = crc;
+      }
+      for (uint32_t i = 0; i < 256; i++)
+        for (int k = 1; k < 8; k++)
+          table[k][i] =
+              table[0][table[k - 1][i] & 0xff] ^ (table[k - 1][i] >> 8);
+    }
+  };
+
+  static bool littleEndian() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+  }
+
+  static uint32_t swapBytes(uint32_t x) {
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) |
+           (x << 24);
+  }
+
+  uint32_t crc_;
+};
+
+// A snapshot image mapped read-only into memory and validated. It can be
+// searched in place, without building a tree at all.
+template <class Key, class Value> class AVLSnapshotView {
+public:
+  explicit AVLSnapshotView(const std::string &path);
+  ~AVLSnapshotView();
+
+  size_t size() const;
+  bool empty() const;
+  // The value stored for key, pointing into the mapping, or null.
+  const Value *find(const Key &key) const;
+
+protected:
+  friend class AVLSnapshot;
+
+  AVLSnapshotView(const AVLSnapshotView &);
+  AVLSnapshotView &operator=(const AVLSnapshotView &);
+
+  void validate();
+
+  void *data_;
+  size_t length_;
+  size_t count_;
+  const Key *keys_;
+  const Value *values_;
+  const uint32_t *right_;
+  const unsigned char *meta_;
+};
+
+// Saves and loads whole AVLTrees (or trees derived from one, whose
+// augmentation hooks are run while loading).
+class AVLSnapshot {
+public:
+  static const uint32_t kVersion = 2;
+  static const uint32_t kByteOrder = 0x01020304;
+
+  template <class Key, class Value>
+  static void save(const AVLTree<Key, Value> &tree, const std::string &path);
+  // Replaces the contents of tree with the image at path.
+  template <class Key, class Value>
+  static void load(const std::string &path, AVLTree<Key, Value> &tree);
+  // Saves the tree that AVLTree::buildBalanced would make from count
+  // ascending keys, each with the same value, without building it. Keys
+  // are read in pre-order, so they can be a memory-mapped file.
+  template <class Key, class Value>
+  static void saveSorted(const Key *keys, size_t count, const Value &value,
+                         const std::string &path);
+  // fsyncs a file or a directory (to make a rename in it durable).
+  static void syncPath(const std::string &path);
+
+  // meta byte layout
+  static const unsigned char kHasLeft = 1;
+  static const int kBalanceShift = 1;
+
+protected:
+  static size_t alignUp(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+  static void writeChecked(std::ofstream &out, AVLSnapshotChecksum &sum,
+                           uint64_t &pos, const void *data, size_t len);
+  static void padTo(std::ofstream &out, AVLSnapshotChecksum &sum,
+                    uint64_t &pos, size_t alignment);
+  static std::string temporaryPath(const std::string &path) {
+    return path + ".tmp";
+  }
+  template <class Key, class Value>
+  static void finishImage(std::ofstream &out, AVLSnapshotHeader &header,
+                          uint64_t count, uint64_t size, uint64_t checksum,
+                          const std::string &path);
+  // Calls visit(lo, mid, hi) on the ranges of the balanced build of
+  // [lo, hi), in pre-order.
+  template <class Visit>
+  static void preOrder(size_t lo, size_t hi, Visit &visit);
+  static int balancedHeight(size_t count);
+
+  template <class Key, class Value>
+  static std::shared_ptr<AVLNode<Key, Value>>
+  build(const AVLSnapshotView<Key, Value> &view, AVLTree<Key, Value> &tree,
+        size_t &index, std::shared_ptr<AVLNode<Key, Value>> parent,
+        int depth);
+};
+
+// ---------------------------------------------------
+// Begin implementations for the AVLSnapshotView class.
+// ---------------------------------------------------
+
+template <class Key, class Value>
+AVLSnapshotView<Key, Value>::AVLSnapshotView(const std::string &path)
+    : data_(MAP_FAILED), length_(0), count_(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("cannot open snapshot " + path);
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    length_ = st.st_size;
+    data_ = mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data_ == MAP_FAILED)
+    throw std::runtime_error("cannot map snapshot " + path);
+
+  try {
+    validate();
+  } catch (...) {
+    munmap(data_, length_);
+    throw;
+  }
+}
+
+template <class Key, class Value>
+AVLSnapshotView<Key, Value>::~AVLSnapshotView() {
+  munmap(data_, length_);
+}
+
+template <class Key, class Value>
+size_t AVLSnapshotView<Key, Value>::size() const {
+  return count_;
+}
+
+template <class Key, class Value>
+bool AVLSnapshotView<Key, Value>::empty() const {
+  return count_ == 0;
+}
+
+// The same descent as on the tree, with the left child at index + 1.
+template <class Key, class Value>
+const Value *AVLSnapshotView<Key, Value>::find(const Key &key) const {
+  size_t index = 0;
+  if (count_ == 0)
+    return nullptr;
+  while (true) {
+    if (key < keys_[index]) {
+      if (!(meta_[index] & AVLSnapshot::kHasLeft))
+        return nullptr;
+      index++;
+    } else if (keys_[index] < key) {
+      if (right_[index] == 0)
+        return nullptr;
+      index = right_[index];
+    } else
+      return &values_[index];
+  }
+}
+
+// Checks the header, the checksum and that every link points forward into
+// the image, so that nothing read from it later can go out of bounds.
+template <class Key, class Value>
+void AVLSnapshotView<Key, Value>::validate() {
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<Value>::value,
+                "snapshots copy keys and values bytewise");
+
+  const unsigned char *base = static_cast<const unsigned char *>(data_);
+  AVLSnapshotHeader header;
+  if (length_ < sizeof(header))
+    throw std::runtime_error("snapshot is truncated");
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header.magic, "AVLSNAP", 8) != 0)
+    throw std::runtime_error("not an AVL snapshot");
+  if (header.version != AVLSnapshot::kVersion ||
+      header.byte_order != AVLSnapshot::kByteOrder)
+    throw std::runtime_error("unsupported snapshot version or byte order");
+  if (header.key_size != sizeof(Key) || header.value_size != sizeof(Value))
+    throw std::runtime_error("snapshot key or value type does not match");
+  if (header.file_size != length_)
+    throw std::runtime_error("snapshot is truncated");
+
+  // each array must fit, aligned, before the end of the file
+  uint64_t count = header.count;
+  const uint64_t arrays[4][3] = {
+      {header.keys_offset, sizeof(Key), alignof(Key)},
+      {header.values_offset, sizeof(Value), alignof(Value)},
+      {header.right_offset, sizeof(uint32_t), alignof(uint32_t)},
+      {header.meta_offset, 1, 1}};
+  for (int i = 0; i < 4; i++) {
+    uint64_t offset = arrays[i][0];
+    if (offset < sizeof(header) || offset > length_ ||
+        offset % arrays[i][2] != 0 ||
+        count > (length_ - offset) / arrays[i][1])
+      throw std::runtime_error("snapshot layout is corrupt");
+  }
+
+  AVLSnapshotChecksum sum;
+  sum.update(base + sizeof(header), length_ - sizeof(header));
+  if (sum.finish() != header.checksum)
+    throw std::runtime_error("snapshot checksum mismatch");
+
+  count_ = count;
+  keys_ = reinterpret_cast<const Key *>(base + header.keys_offset);
+  values_ = reinterpret_cast<const Value *>(base + header.values_offset);
+  right_ = reinterpret_cast<const uint32_t *>(base + header.right_offset);
+  meta_ = base + header.meta_offset;
+
+  for (size_t i = 0; i < count_; i++) {
+    bool bad_left = (meta_[i] & AVLSnapshot::kHasLeft) && i + 1 >= count_;
+    bool bad_right = right_[i] != 0 && (right_[i] <= i || right_[i] >= count_);
+    if (bad_left || bad_right || (meta_[i] >> AVLSnapshot::kBalanceShift) > 2)
+      throw std::runtime_error("snapshot structure is corrupt");
+  }
+}
+
+// -------------------------------------------------
+// End implementations for the AVLSnapshotView class.
+// -------------------------------------------------
+
+// Writes the image to a temporary file, with the header last once the
+// checksum of the arrays is known, then renames it over path (see
+// finishImage), so a crash never leaves a half-written snapshot behind.
+template <class Key, class Value>
+void AVLSnapshot::save(const AVLTree<Key, Value> &tree,
+                       const std::string &path) {
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<Value>::value,
+                "snapshots copy keys and values bytewise");
+
+  // the four arrays in pre-order, with each node's right child index filled
+  // in when the child is reached
+  typedef const AVLNode<Key, Value> *NodePtr;
+  std::vector<Key> keys;
+  std::vector<Value> values;
+  std::vector<uint32_t> right;
+  std::vector<unsigned char> meta;
+  std::vector<std::pair<NodePtr, size_t>> stack;
+  if (tree.root_ != nullptr)
+    stack.push_back(
+        std::make_pair(static_cast<NodePtr>(tree.root_.get()), size_t(0)));
+  while (!stack.empty()) {
+    NodePtr n = stack.back().first;
+    size_t right_of = stack.back().second;
+    stack.pop_back();
+    if (keys.size() >= std::numeric_limits<uint32_t>::max())
+      throw std::length_error("tree is too large for a snapshot");
+    if (right_of > 0)
+      right[right_of - 1] = keys.size();
+    keys.push_back(n->getKey());
+    values.push_back(n->getValue());
+    right.push_back(0);
+    meta.push_back(((n->getBalance() + 1) << kBalanceShift) |
+                   (n->getLeft() != nullptr ? kHasLeft : 0));
+    if (n->getRight() != nullptr)
+      stack.push_back(std::make_pair(
+          static_cast<NodePtr>(n->getRight().get()), keys.size()));
+    if (n->getLeft() != nullptr)
+      stack.push_back(std::make_pair(
+          static_cast<NodePtr>(n->getLeft().get()), size_t(0)));
+  }
+
+  std::ofstream out(temporaryPath(path).c_str(),
+                    std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("cannot create snapshot " + path);
+
+  AVLSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  AVLSnapshotChecksum sum;
+  uint64_t pos = sizeof(header);
+
+  padTo(out, sum, pos, alignof(Key));
+  header.keys_offset = pos;
+  writeChecked(out, sum, pos, keys.data(), keys.size() * sizeof(Key));
+  padTo(out, sum, pos, alignof(Value));
+  header.values_offset = pos;
+  writeChecked(out, sum, pos, values.data(), values.size() * sizeof(Value));
+  padTo(out, sum, pos, alignof(uint32_t));
+  header.right_offset = pos;
+  writeChecked(out, sum, pos, right.data(), right.size() * sizeof(uint32_t));
+  header.meta_offset = pos;
+  writeChecked(out, sum, pos, meta.data(), meta.size());
+
+  finishImage<Key, Value>(out, header, keys.size(), pos, sum.finish(), path);
+}
+
+// Each array is written by its own pre-order walk, so nothing but the
+// stream buffer is held in memory.
+template <class Key, class Value>
+void AVLSnapshot::saveSorted(const Key *keys, size_t count,
+                             const Value &value, const std::string &path) {
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<Value>::value,
+                "snapshots copy keys and values bytewise");
+  if (count >= std::numeric_limits<uint32_t>::max())
+    throw std::length_error("tree is too large for a snapshot");
+
+  std::ofstream out(temporaryPath(path).c_str(),
+                    std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("cannot create snapshot " + path);
+
+  AVLSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  AVLSnapshotChecksum sum;
+  uint64_t pos = sizeof(header);
+
+  padTo(out, sum, pos, alignof(Key));
+  header.keys_offset = pos;
+  auto write_key = [&](size_t, size_t mid, size_t) {
+    writeChecked(out, sum, pos, &keys[mid], sizeof(Key));
+  };
+  preOrder(0, count, write_key);
+
+  padTo(out, sum, pos, alignof(Value));
+  header.values_offset = pos;
+  for (size_t i = 0; i < count; i++)
+    writeChecked(out, sum, pos, &value, sizeof(Value));
+
+  // a node's right child follows its left subtree in pre-order
+  padTo(out, sum, pos, alignof(uint32_t));
+  header.right_offset = pos;
+  uint32_t index = 0;
+  auto write_right = [&](size_t lo, size_t mid, size_t hi) {
+    uint32_t right = mid + 1 < hi ? index + 1 + (mid - lo) : 0;
+    writeChecked(out, sum, pos, &right, sizeof(right));
+    index++;
+  };
+  preOrder(0, count, write_right);
+
+  header.meta_offset = pos;
+  auto write_meta = [&](size_t lo, size_t mid, size_t hi) {
+    int balance = balancedHeight(hi - mid - 1) - balancedHeight(mid - lo);
+    unsigned char meta =
+        ((balance + 1) << kBalanceShift) | (mid > lo ? kHasLeft : 0);
+    writeChecked(out, sum, pos, &meta, 1);
+  };
+  preOrder(0, count, write_meta);
+
+  finishImage<Key, Value>(out, header, count, pos, sum.finish(), path);
+}
+
+template <class Key, class Value>
+void AVLSnapshot::load(const std::string &path, AVLTree<Key, Value> &tree) {
+  AVLSnapshotView<Key, Value> view(path);
+  std::shared_ptr<AVLNode<Key, Value>> root;
+  if (view.count_ > 0) {
+    size_t index = 0;
+    root = build(view, tree, index,
+                 std::shared_ptr<AVLNode<Key, Value>>(), 0);
+  }
+  tree.clear();
+  tree.root_ = root;
+  tree.resetExtremes();
+}
+
+// Builds the subtree whose pre-order starts at index, advancing index past
+// it. Balances are copied, so nothing is rotated; the augmentation hooks run
+// bottom-up as each node is finished.
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>>
+AVLSnapshot::build(const AVLSnapshotView<Key, Value> &view,
+                   AVLTree<Key, Value> &tree, size_t &index,
+                   std::shared_ptr<AVLNode<Key, Value>> parent, int depth) {
+  // an AVL tree of 2^32 nodes is under 48 levels deep
+  if (depth > 64)
+    throw std::runtime_error("snapshot structure is corrupt");
+
+  size_t i = index++;
+  std::shared_ptr<AVLNode<Key, Value>> n = tree.makeNode(
+      std::pair<const Key, Value>(view.keys_[i], view.values_[i]), parent);
+  n->setBalance((view.meta_[i] >> kBalanceShift) - 1);
+  try {
+    if (view.meta_[i] & kHasLeft)
+      n->setLeft(build(view, tree, index, n, depth + 1));
+    if (view.right_[i] != 0) {
+      if (view.right_[i] != index)
+        throw std::runtime_error("snapshot structure is corrupt");
+      n->setRight(build(view, tree, index, n, depth + 1));
+    }
+  } catch (...) {
+    // n's children point back at it, so dropping it would leak them
+    AVLTree<Key, Value>::freeSubtree(n);
+    throw;
+  }
+  tree.updateNode(n);
+  return n;
+}
+
+// Completes the image in the temporary file, syncs it and renames it over
+// path. The previous snapshot at path stays whole until the rename, and the
+// directory is synced after it so that the rename itself is durable.
+template <class Key, class Value>
+void AVLSnapshot::finishImage(std::ofstream &out, AVLSnapshotHeader &header,
+                              uint64_t count, uint64_t size,
+                              uint64_t checksum, const std::string &path) {
+  std::memcpy(header.magic, "AVLSNAP", 8);
+  header.version = kVersion;
+  header.byte_order = kByteOrder;
+  header.key_size = sizeof(Key);
+  header.value_size = sizeof(Value);
+  header.count = count;
+  header.file_size = size;
+  header.checksum = checksum;
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.close();
+
+  std::string temporary = temporaryPath(path);
+  try {
+    if (!out)
+      throw std::runtime_error("cannot write snapshot " + path);
+    syncPath(temporary);
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+      throw std::runtime_error("cannot replace snapshot " + path);
+  } catch (...) {
+    std::remove(temporary.c_str());
+    throw;
+  }
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos)
+    syncPath(".");
+  else
+    syncPath(path.substr(0, std::max<size_t>(slash, 1)));
+}
+
+// The middle item is the root and the halves below and above it are the
+// subtrees, as in AVLTree::buildBalanced.
+template <class Visit>
+void AVLSnapshot::preOrder(size_t lo, size_t hi, Visit &visit) {
+  if (lo == hi)
+    return;
+  size_t mid = lo + (hi - lo) / 2;
+  visit(lo, mid, hi);
+  preOrder(lo, mid, visit);
+  preOrder(mid + 1, hi, visit);
+}
+
+// The left half of count items is never smaller than the right, so the
+// height is one more than that of count / 2 items: the bit length of count.
+inline int AVLSnapshot::balancedHeight(size_t count) {
+  int height = 0;
+  for (; count > 0; count >>= 1)
+    height++;
+  return height;
+}
+
+inline void AVLSnapshot::syncPath(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("cannot open " + path);
+  int synced = fsync(fd);
+  close(fd);
+  if (synced != 0)
+    throw std::runtime_error("cannot sync " + path);
+}
+
+inline void AVLSnapshot::writeChecked(std::ofstream &out,
+                                      AVLSnapshotChecksum &sum, uint64_t &pos,
+                                      const void *data, size_t len) {
+  out.write(static_cast<const char *>(data), len);
+  sum.update(data, len);
+  pos += len;
+}
+
+inline void AVLSnapshot::padTo(std::ofstream &out, AVLSnapshotChecksum &sum,
+                               uint64_t &pos, size_t alignment) {
+  static const char zeros[16] = {0};
+  size_t padding = alignUp(pos, std::max<size_t>(alignment, 8)) - pos;
+  // over-aligned types can need more padding than one buffer holds
+  while (padding > 0) {
+    size_t chunk = std::min(padding, sizeof(zeros));
+    writeChecked(out, sum, pos, zeros, chunk);
+    padding -= chunk;
+  }
+}
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef AVL_STREAM_H
+#define AVL_STREAM_H
+
+#include "avlbst.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <unistd.h>
+
+// Streams AVLTrees to and from any std::ostream / std::istream, for sending
+// them over pipes and sockets. A tree is written as a short header with its
+// size followed by its items in key order, each encoded by a codec, so
+// nothing but the stream's own buffer is held while writing. Reading builds
+// a perfectly balanced tree in the same order the items arrive, in O(n) time
+// and O(log n) extra memory.
+//
+// Codecs have a write(std::ostream &, const T &) and a read(std::istream &,
+// T &). A fresh copy of each codec is used for every tree, so codecs may keep
+// state between items; the key codec sees the keys in ascending order.
+
+// LEB128 varints, written and read straight through the stream buffer.
+struct Varint {
+  static void write(std::ostream &out, uint64_t x) {
+    std::streambuf *buf = out.rdbuf();
+    while (x >= 0x80) {
+      if (buf->sputc(static_cast<char>(x | 0x80)) == EOF)
+        out.setstate(std::ios::badbit);
+      x >>= 7;
+    }
+    if (buf->sputc(static_cast<char>(x)) == EOF)
+      out.setstate(std::ios::badbit);
+  }
+
+  static uint64_t read(std::istream &in) {
+    std::streambuf *buf = in.rdbuf();
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      int byte = buf->sbumpc();
+      if (byte == EOF)
+        throw std::runtime_error("stream ended in the middle of a tree");
+      x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return x;
+    }
+    throw std::runtime_error("malformed varint in stream");
+  }
+
+  // Maps signed values to unsigned so that small magnitudes stay short.
+  static uint64_t zigzag(int64_t x) {
+    return (static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63);
+  }
+  static int64_t unzigzag(uint64_t x) {
+    return static_cast<int64_t>((x >> 1) ^ (0 - (x & 1)));
+  }
+};
+
+// Copies the bytes of a trivially copyable value.
+template <typename T> struct RawCodec {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "RawCodec copies values bytewise");
+
+  void write(std::ostream &out, const T &value) {
+    if (out.rdbuf()->sputn(reinterpret_cast<const char *>(&value),
+                           sizeof(T)) != sizeof(T))
+      out.setstate(std::ios::badbit);
+  }
+  void read(std::istream &in, T &value) {
+    if (in.rdbuf()->sgetn(reinterpret_cast<char *>(&value), sizeof(T)) !=
+        sizeof(T))
+      throw std::runtime_error("stream ended in the middle of a tree");
+  }
+};
+
+// Integers as varints, zigzag encoded if signed.
+template <typename T> struct VarintCodec {
+  static_assert(std::is_integral<T>::value && sizeof(T) <= 8,
+                "VarintCodec encodes integers of up to 64 bits");
+
+  void write(std::ostream &out, const T &value) {
+    Varint::write(out, std::is_signed<T>::value
+                           ? Varint::zigzag(static_cast<int64_t>(value))
+                           : static_cast<uint64_t>(value));
+  }
+  void read(std::istream &in, T &value) {
+    uint64_t x = Varint::read(in);
+    value = std::is_signed<T>::value ? static_cast<T>(Varint::unzigzag(x))
+                                     : static_cast<T>(x);
+  }
+};
+
+// Ascending integers as the varint gap from the previous one, so dense keys
+// take a byte each whatever their magnitude. Only for keys.
+template <typename T> struct DeltaCodec {
+  static_assert(std::is_integral<T>::value && sizeof(T) <= 8,
+                "DeltaCodec encodes integers of up to 64 bits");
+
+  DeltaCodec() : first_(true), previous_(0) {}
+
+  void write(std::ostream &out, const T &value) {
+    uint64_t x = static_cast<uint64_t>(value);
+    if (first_)
+      VarintCodec<T>().write(out, value);
+    else
+      Varint::write(out, x - previous_);
+    first_ = false;
+    previous_ = x;
+  }
+  void read(std::istream &in, T &value) {
+    if (first_)
+      VarintCodec<T>().read(in, value);
+    else
+      value = static_cast<T>(previous_ + Varint::read(in));
+    first_ = false;
+    previous_ = static_cast<uint64_t>(value);
+  }
+
+private:
+  bool first_;
+  uint64_t previous_;
+};
+
+// Strings as a varint length and their bytes.
+struct StringCodec {
+  void write(std::ostream &out, const std::string &value) {
+    Varint::write(out, value.size());
+    if (out.rdbuf()->sputn(value.data(), value.size()) !=
+        static_cast<std::streamsize>(value.size()))
+      out.setstate(std::ios::badbit);
+  }
+  void read(std::istream &in, std::string &value) {
+    uint64_t length = Varint::read(in);
+    value.clear();
+    char chunk[256];
+    while (length > 0) {
+      std::streamsize want =
+          static_cast<std::streamsize>(std::min<uint64_t>(length, 256));
+      if (in.rdbuf()->sgetn(chunk, want) != want)
+        throw std::runtime_error("stream ended in the middle of a tree");
+      value.append(chunk, want);
+      length -= want;
+    }
+  }
+};
+
+// A stream buffer over a file descriptor (a pipe, socket or file), so that
+// trees can be streamed through one with std::ostream / std::istream.
+// Closing the descriptor is left to the caller.
+class FdStreamBuf : public std::streambuf {
+public:
+  explicit FdStreamBuf(int fd) : fd_(fd) {
+    setg(in_, in_, in_);
+    setp(out_, out_ + sizeof(out_));
+  }
+  virtual ~FdStreamBuf() { sync(); }
+
+protected:
+  virtual int_type overflow(int_type c) {
+    if (!flushOut())
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      sputc(traits_type::to_char_type(c));
+    return traits_type::not_eof(c);
+  }
+
+  virtual int sync() { return flushOut() ? 0 : -1; }
+
+  virtual int_type underflow() {
+    ssize_t got;
+    do
+      got = ::read(fd_, in_, sizeof(in_));
+    while (got < 0 && errno == EINTR);
+    if (got <= 0)
+      return traits_type::eof();
+    setg(in_, in_, in_ + got);
+    return traits_type::to_int_type(in_[0]);
+  }
+
+  bool flushOut() {
+    char *next = pbase();
+    while (next < pptr()) {
+      ssize_t put = ::write(fd_, next, pptr() - next);
+      if (put < 0 && errno == EINTR)
+        continue;
+      if (put <= 0)
+        return false;
+      next += put;
+    }
+    setp(out_, out_ + sizeof(out_));
+    return true;
+  }
+
+  int fd_;
+  char in_[1 << 16];
+  char out_[1 << 16];
+};
+
+// Writes and reads whole AVLTrees (or trees derived from one, whose
+// augmentation hooks are run while reading).
+class AVLStream {
+public:
+  static const uint32_t kVersion = 1;
+
+  template <class Key, class Value, class KeyCodec, class ValueCodec>
+  static void write(std::ostream &out, const AVLTree<Key, Value> &tree,
+                    KeyCodec key_codec, ValueCodec value_codec);
+  template <class Key, class Value>
+  static void write(std::ostream &out, const AVLTree<Key, Value> &tree) {
+    write(out, tree, RawCodec<Key>(), RawCodec<Value>());
+  }
+
+  // Replaces the contents of tree with the next tree in the stream.
+  template <class Key, class Value, class KeyCodec, class ValueCodec>
+  static void read(std::istream &in, AVLTree<Key, Value> &tree,
+                   KeyCodec key_codec, ValueCodec value_codec);
+  template <class Key, class Value>
+  static void read(std::istream &in, AVLTree<Key, Value> &tree) {
+    read(in, tree, RawCodec<Key>(), RawCodec<Value>());
+  }
+
+protected:
+  template <class Key, class Value>
+  static size_t countNodes(const Node<Key, Value> *n);
+  template <class Key, class Value, class KeyCodec, class ValueCodec>
+  static void writeInOrder(std::ostream &out, const Node<Key, Value> *n,
+                           KeyCodec &key_codec, ValueCodec &value_codec);
+  template <class Key, class Value, class KeyCodec, class ValueCodec>
+  static std::shared_ptr<AVLNode<Key, Value>>
+  build(std::istream &in, AVLTree<Key, Value> &tree, size_t count,
+        KeyCodec &key_codec, ValueCodec &value_codec,
+        const Key *&last, int &height);
+
+  static const char *magic() { return "AVLSTRM"; }
+};
+
+// The size goes first so that the reader knows the shape of the tree it is
+// building before the first item arrives.
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void AVLStream::write(std::ostream &out, const AVLTree<Key, Value> &tree,
+                      KeyCodec key_codec, ValueCodec value_codec) {
+  out.write(magic(), 8);
+  Varint::write(out, kVersion);
+  Varint::write(out, countNodes(tree.root_.get()));
+  writeInOrder(out, tree.root_.get(), key_codec, value_codec);
+  out.flush();
+  if (!out)
+    throw std::runtime_error("cannot write tree to stream");
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void AVLStream::read(std::istream &in, AVLTree<Key, Value> &tree,
+                     KeyCodec key_codec, ValueCodec value_codec) {
+  char header[8];
+  if (in.rdbuf()->sgetn(header, 8) != 8 || std::memcmp(header, magic(), 8) != 0)
+    throw std::runtime_error("stream does not hold an AVL tree");
+  if (Varint::read(in) != kVersion)
+    throw std::runtime_error("unsupported tree stream version");
+  uint64_t count = Varint::read(in);
+
+  const Key *last = nullptr;
+  int height;
+  std::shared_ptr<AVLNode<Key, Value>> root =
+      build(in, tree, count, key_codec, value_codec, last, height);
+  tree.clear();
+  tree.root_ = root;
+  tree.resetExtremes();
+}
+
+template <class Key, class Value>
+size_t AVLStream::countNodes(const Node<Key, Value> *n) {
+  if (n == nullptr)
+    return 0;
+  return countNodes(n->getLeft().get()) + 1 + countNodes(n->getRight().get());
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void AVLStream::writeInOrder(std::ostream &out, const Node<Key, Value> *n,
+                             KeyCodec &key_codec, ValueCodec &value_codec) {
+  if (n == nullptr)
+    return;
+  writeInOrder(out, n->getLeft().get(), key_codec, value_codec);
+  key_codec.write(out, n->getKey());
+  value_codec.write(out, n->getValue());
+  writeInOrder(out, n->getRight().get(), key_codec, value_codec);
+}
+
+// Builds a balanced subtree from the next count items, splitting them the
+// same way as AVLTree::buildBalanced: the left subtree is read first, then
+// its root, then the right subtree. last is the key read most recently, to
+// check that the keys really are ascending. If a read fails, every node
+// built so far is freed before the exception is passed on.
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+std::shared_ptr<AVLNode<Key, Value>>
+AVLStream::build(std::istream &in, AVLTree<Key, Value> &tree, size_t count,
+                 KeyCodec &key_codec, ValueCodec &value_codec,
+                 const Key *&last, int &height) {
+  if (count == 0) {
+    height = 0;
+    return nullptr;
+  }
+  int hl, hr;
+  std::shared_ptr<AVLNode<Key, Value>> left =
+      build(in, tree, count / 2, key_codec, value_codec, last, hl);
+
+  std::shared_ptr<AVLNode<Key, Value>> n, right;
+  try {
+    Key key;
+    Value value;
+    key_codec.read(in, key);
+    value_codec.read(in, value);
+    if (last != nullptr && !(*last < key))
+      throw std::runtime_error("tree stream keys are out of order");
+    n = tree.makeNode(
+        std::pair<const Key, Value>(std::move(key), std::move(value)),
+        std::shared_ptr<AVLNode<Key, Value>>());
+    last = &n->getKey();
+
+    right = build(in, tree, count - count / 2 - 1, key_codec, value_codec,
+                  last, hr);
+  } catch (...) {
+    // left's nodes point at their parents, so dropping it would leak them
+    AVLTree<Key, Value>::freeSubtree(left);
+    throw;
+  }
+  n->setLeft(left);
+  if (left != nullptr)
+    left->setParent(n);
+  n->setRight(right);
+  if (right != nullptr)
+    right->setParent(n);
+  n->setBalance(hr - hl);
+  tree.updateNode(n);
+  height = std::max(hl, hr) + 1;
+  return n;
+}
+
+#endif
@@ -0,0 +1,321 @@
+#ifndef AVL_WAL_H
+#define AVL_WAL_H
+
+#include "avl_snapshot.h"
+#include "avl_stream.h"
+#include "avlbst.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// How often a DurableAVLStore forces its log to disk.
+struct WALOptions {
+  // Operations per group commit. The log records of a group are written
+  // with one write() and one fsync() once the group is full, so a crash
+  // loses at most the last, uncommitted group. 1 makes every operation
+  // durable before it returns. 0 never fsyncs: records are written once
+  // 64 KiB have built up and the OS writes them back in its own time.
+  size_t group_size;
+  // Operations between automatic checkpoints, or 0 to only checkpoint when
+  // asked to.
+  size_t checkpoint_every;
+
+  WALOptions() : group_size(1), checkpoint_every(0) {}
+};
+
+// An AVLTree kept durable in a directory by a write-ahead log of its
+// inserts and removes plus checkpoints of the whole tree. Opening the
+// directory recovers the tree: the last checkpoint is loaded and the log
+// written since then is replayed, up to the first torn or corrupt record.
+//
+// A checkpoint is written to a temporary file, synced and renamed over the
+// previous one, and only then is the log emptied. A crash between the two
+// replays a log that the checkpoint already contains, which is harmless as
+// replaying an insert or remove twice leaves the same tree.
+//
+// Checkpoints are streamed with AVLStream, and log records encoded with a
+// fresh copy of each codec, so the codecs must not depend on the order of
+// the keys they see.
+template <class Key, class Value, class KeyCodec = RawCodec<Key>,
+          class ValueCodec = RawCodec<Value>>
+class DurableAVLStore {
+public:
+  explicit DurableAVLStore(const std::string &directory,
+                           const WALOptions &options = WALOptions());
+  // Commits whatever is pending, as sync() would.
+  ~DurableAVLStore();
+
+  const AVLTree<Key, Value> &tree() const;
+  // Log records replayed when the store was opened.
+  size_t replayed() const;
+
+  // Sets key's value, inserting it if needed. An operation is applied to
+  // the tree only once its record has been added to the pending group, and
+  // that group written if it is full, so an insert or remove that throws
+  // leaves the tree as it was. The one exception is an automatic checkpoint
+  // that fails after the operation is already logged.
+  void insert(const Key &key, const Value &value);
+  void remove(const Key &key);
+  // Writes and fsyncs the records of every operation so far. If that fails
+  // the records stay pending and the next commit writes them again.
+  void sync();
+  // Saves the whole tree and empties the log.
+  void checkpoint();
+
+protected:
+  DurableAVLStore(const DurableAVLStore &);
+  DurableAVLStore &operator=(const DurableAVLStore &);
+
+  enum Operation : char { kInsert = 'I', kRemove = 'R' };
+  // length and checksum of the payload
+  static const size_t kRecordHeader = sizeof(uint32_t) + sizeof(uint64_t);
+  static const size_t kUnsyncedBuffer = 1 << 16;
+
+  void recover();
+  bool replay(const std::string &payload);
+  void append(const std::string &payload);
+  void logged();
+  void commit(bool durable);
+  static void writeAll(int fd, const char *data, size_t len,
+                       const std::string &path);
+
+  AVLTree<Key, Value> tree_;
+  WALOptions options_;
+  std::string directory_;
+  std::string log_path_;
+  std::string checkpoint_path_;
+  int log_fd_;
+  std::string pending_;
+  size_t pending_ops_;
+  size_t since_checkpoint_;
+  size_t replayed_;
+};
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::DurableAVLStore(
+    const std::string &directory, const WALOptions &options)
+    : options_(options), directory_(directory), log_path_(directory + "/wal"),
+      checkpoint_path_(directory + "/checkpoint"), log_fd_(-1),
+      pending_ops_(0), since_checkpoint_(0), replayed_(0) {
+  recover();
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::~DurableAVLStore() {
+  try {
+    sync();
+  } catch (const std::runtime_error &) {
+    // nothing more can be done about it here
+  }
+  close(log_fd_);
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+const AVLTree<Key, Value> &
+DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::tree() const {
+  return tree_;
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+size_t DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::replayed() const {
+  return replayed_;
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::insert(
+    const Key &key, const Value &value) {
+  std::ostringstream payload;
+  payload.put(kInsert);
+  KeyCodec().write(payload, key);
+  ValueCodec().write(payload, value);
+  append(payload.str());
+  tree_.insert_or_assign(key, value);
+  logged();
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::remove(
+    const Key &key) {
+  std::ostringstream payload;
+  payload.put(kRemove);
+  KeyCodec().write(payload, key);
+  append(payload.str());
+  tree_.remove(key);
+  logged();
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::sync() {
+  commit(true);
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::checkpoint() {
+  commit(true);
+
+  std::string temporary = checkpoint_path_ + ".tmp";
+  {
+    std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+    AVLStream::write(out, tree_, KeyCodec(), ValueCodec());
+    out.close();
+    if (!out)
+      throw std::runtime_error("cannot write checkpoint " + temporary);
+  }
+  AVLSnapshot::syncPath(temporary);
+  if (std::rename(temporary.c_str(), checkpoint_path_.c_str()) != 0)
+    throw std::runtime_error("cannot replace checkpoint " + checkpoint_path_);
+  AVLSnapshot::syncPath(directory_);
+
+  if (ftruncate(log_fd_, 0) != 0 || fsync(log_fd_) != 0)
+    throw std::runtime_error("cannot empty write-ahead log " + log_path_);
+  since_checkpoint_ = 0;
+}
+
+// Loads the checkpoint, replays the log, and cuts off a torn or corrupt
+// tail so that new records follow the last good one.
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::recover() {
+  std::ifstream checkpoint(checkpoint_path_.c_str(), std::ios::binary);
+  if (checkpoint)
+    AVLStream::read(checkpoint, tree_, KeyCodec(), ValueCodec());
+
+  log_fd_ = open(log_path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (log_fd_ < 0)
+    throw std::runtime_error("cannot open write-ahead log " + log_path_);
+
+  std::string log;
+  char chunk[1 << 16];
+  ssize_t got;
+  while ((got = ::read(log_fd_, chunk, sizeof(chunk))) > 0 ||
+         (got < 0 && errno == EINTR))
+    if (got > 0)
+      log.append(chunk, got);
+
+  size_t good = 0;
+  while (log.size() - good >= kRecordHeader) {
+    uint32_t length;
+    uint64_t checksum;
+    std::memcpy(&length, log.data() + good, sizeof(length));
+    std::memcpy(&checksum, log.data() + good + sizeof(length),
+                sizeof(checksum));
+    if (length > log.size() - good - kRecordHeader)
+      break;
+    std::string payload = log.substr(good + kRecordHeader, length);
+    AVLSnapshotChecksum sum;
+    sum.update(payload.data(), payload.size());
+    if (sum.finish() != checksum || !replay(payload))
+      break;
+    good += kRecordHeader + length;
+    replayed_++;
+  }
+  if (good < log.size() && (ftruncate(log_fd_, good) != 0 || fsync(log_fd_)))
+    throw std::runtime_error("cannot repair write-ahead log " + log_path_);
+  since_checkpoint_ = replayed_;
+}
+
+// Applies one logged operation, or returns false if it does not decode.
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+bool DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::replay(
+    const std::string &payload) {
+  std::istringstream in(payload);
+  char operation = in.get();
+  Key key;
+  Value value;
+  try {
+    KeyCodec().read(in, key);
+    if (operation == kInsert)
+      ValueCodec().read(in, value);
+  } catch (const std::runtime_error &) {
+    return false;
+  }
+  if (operation == kInsert)
+    tree_.insert_or_assign(key, value);
+  else if (operation == kRemove)
+    tree_.remove(key);
+  else
+    return false;
+  return true;
+}
+
+// Adds a record to the pending group and commits the group if it is full.
+// If the commit fails the record is taken back out, as its operation will
+// not be applied, but the records before it stay pending.
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::append(
+    const std::string &payload) {
+  uint32_t length = payload.size();
+  AVLSnapshotChecksum sum;
+  sum.update(payload.data(), payload.size());
+  uint64_t checksum = sum.finish();
+  size_t mark = pending_.size();
+  pending_.append(reinterpret_cast<const char *>(&length), sizeof(length));
+  pending_.append(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+  pending_.append(payload);
+  pending_ops_++;
+  try {
+    if (options_.group_size == 0) {
+      if (pending_.size() >= kUnsyncedBuffer)
+        commit(false);
+    } else if (pending_ops_ >= options_.group_size)
+      commit(true);
+  } catch (const std::runtime_error &) {
+    pending_.resize(mark);
+    pending_ops_--;
+    throw;
+  }
+}
+
+// Called once an operation is logged and applied to the tree.
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::logged() {
+  since_checkpoint_++;
+  if (options_.checkpoint_every > 0 &&
+      since_checkpoint_ >= options_.checkpoint_every)
+    checkpoint();
+}
+
+// Writes the pending group. The group is only cleared once it is written
+// (and synced, if durable); on failure whatever part of it reached the log
+// is cut off again, so that writing it once more does not leave a torn
+// record in the middle of the log.
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::commit(bool durable) {
+  off_t end = lseek(log_fd_, 0, SEEK_END);
+  try {
+    writeAll(log_fd_, pending_.data(), pending_.size(), log_path_);
+    if (durable && fsync(log_fd_) != 0)
+      throw std::runtime_error("cannot sync write-ahead log " + log_path_);
+  } catch (const std::runtime_error &) {
+    if (end < 0 || ftruncate(log_fd_, end) != 0)
+      throw std::runtime_error("cannot roll back write-ahead log " +
+                               log_path_);
+    throw;
+  }
+  pending_.clear();
+  pending_ops_ = 0;
+}
+
+template <class Key, class Value, class KeyCodec, class ValueCodec>
+void DurableAVLStore<Key, Value, KeyCodec, ValueCodec>::writeAll(
+    int fd, const char *data, size_t len, const std::string &path) {
+  while (len > 0) {
+    ssize_t put = ::write(fd, data, len);
+    if (put < 0 && errno == EINTR)
+      continue;
+    if (put <= 0)
+      throw std::runtime_error("cannot write to " + path);
+    data += put;
+    len -= put;
+  }
+}
+
+#endif
@@ -7,6 +7,8 @@
 #include <exception>
 #include <iostream>
 #include <memory>
+#include <utility>
+#include <vector>
 
 struct KeyError {};
 
@@ -21,6 +23,8 @@ public:
   // Constructor/destructor.
   AVLNode(const Key &key, const Value &value,
           std::shared_ptr<AVLNode<Key, Value>> parent);
+  AVLNode(std::pair<const Key, Value> &&item,
+          std::shared_ptr<AVLNode<Key, Value>> parent);
   virtual ~AVLNode();
 
   // Getter/setter for the node's height.
@@ -50,6 +54,12 @@ AVLNode<Key, Value>::AVLNode(const Key &key, const Value &value,
                              std::shared_ptr<AVLNode<Key, Value>> parent)
     : Node<Key, Value>(key, value, parent), balance_(0) {}
 
+// Same as above, moving an already built item into the node.
+template <class Key, class Value>
+AVLNode<Key, Value>::AVLNode(std::pair<const Key, Value> &&item,
+                             std::shared_ptr<AVLNode<Key, Value>> parent)
+    : Node<Key, Value>(std::move(item), parent), balance_(0) {}
+
 // A destructor which does nothing.
 template <class Key, class Value> AVLNode<Key, Value>::~AVLNode() {}
 
@@ -106,17 +116,77 @@ public:
   // Resultant tree after the insert and remove function should be a balanced
   // tree Make appropriate calls to rotateLeft(...) and rotateRight(...) in
   // insert and remove for balancing the height of the AVLTree
-  virtual void insert(const std::pair<const Key, Value> &new_item); // TODO
-  virtual void remove(const Key &key);                              // TODO
+  // insert() is inherited; new nodes are rebalanced through attachNode()
+  // remove() is inherited; nodes are unlinked and rebalanced by detachNode()
   void insertFix(std::shared_ptr<AVLNode<Key, Value>> p,
                  std::shared_ptr<AVLNode<Key, Value>> n);
   void removeFix(std::shared_ptr<AVLNode<Key, Value>> n, char diff);
 
+  // Inserts every key/value pair in [first, last) with a single merge
+  // descent and one bottom-up rebalancing pass. Later duplicates win, the
+  // same as calling insert() once per pair.
+  template <typename InputIterator>
+  void insertBatch(InputIterator first, InputIterator last);
+
 protected:
+  // read and rebuild the tree structure directly (see avl_snapshot.h,
+  // avl_stream.h and external_build.h)
+  friend class AVLSnapshot;
+  friend class AVLStream;
+  friend class ExternalBuild;
+
   // Helper function already provided to you.
   virtual void nodeSwap(std::shared_ptr<AVLNode<Key, Value>> n1,
                         std::shared_ptr<AVLNode<Key, Value>> n2);
 
+  virtual std::shared_ptr<Node<Key, Value>>
+  attachNode(std::shared_ptr<Node<Key, Value>> parent, bool is_left,
+             std::pair<const Key, Value> &&new_item);
+  virtual void detachNode(std::shared_ptr<Node<Key, Value>> to_remove);
+  virtual void eraseRange(std::shared_ptr<Node<Key, Value>> first,
+                          std::shared_ptr<Node<Key, Value>> last);
+
+  // Augmentation hooks for subclasses that cache something about each
+  // subtree in their nodes. makeNode builds every node the tree links in.
+  // updateNode recomputes n's cached data from n and its children, and
+  // updatePath does that for n and each of its ancestors. The tree calls
+  // them after every structural change; here they do nothing.
+  virtual std::shared_ptr<AVLNode<Key, Value>>
+  makeNode(std::pair<const Key, Value> &&item,
+           std::shared_ptr<AVLNode<Key, Value>> parent);
+  virtual void updateNode(std::shared_ptr<AVLNode<Key, Value>> n);
+  virtual void updatePath(std::shared_ptr<AVLNode<Key, Value>> n);
+  virtual void valueChanged(std::shared_ptr<Node<Key, Value>> node);
+
+  // split/join helpers for eraseRange. They work on detached subtrees
+  // (root has no parent) whose heights are passed alongside them.
+  std::shared_ptr<AVLNode<Key, Value>>
+  joinTrees(std::shared_ptr<AVLNode<Key, Value>> left, int hl,
+            std::shared_ptr<AVLNode<Key, Value>> mid,
+            std::shared_ptr<AVLNode<Key, Value>> right, int hr, int &height);
+  std::shared_ptr<AVLNode<Key, Value>>
+  joinTrees(std::shared_ptr<AVLNode<Key, Value>> left, int hl,
+            std::shared_ptr<AVLNode<Key, Value>> right, int hr, int &height);
+  void splitTree(std::shared_ptr<AVLNode<Key, Value>> t, int ht,
+                 const Key &key, std::shared_ptr<AVLNode<Key, Value>> &left,
+                 int &hl, std::shared_ptr<AVLNode<Key, Value>> &right,
+                 int &hr);
+  std::shared_ptr<AVLNode<Key, Value>>
+  rebalanceRoot(std::shared_ptr<AVLNode<Key, Value>> n, int hl, int hr,
+                int &height);
+  static void freeSubtree(std::shared_ptr<AVLNode<Key, Value>> n);
+
+  // insertBatch helpers
+  int mergeBatch(std::shared_ptr<AVLNode<Key, Value>> &subtree,
+                 const std::shared_ptr<AVLNode<Key, Value>> &parent,
+                 int height, std::vector<std::pair<Key, Value>> &batch,
+                 size_t lo, size_t hi);
+  static int subtreeHeight(std::shared_ptr<AVLNode<Key, Value>> n);
+  std::shared_ptr<AVLNode<Key, Value>>
+  buildBalanced(const std::vector<std::shared_ptr<AVLNode<Key, Value>>> &nodes,
+                size_t lo, size_t hi,
+                std::shared_ptr<AVLNode<Key, Value>> parent, int &height);
+
   // Add helper functions here
   // Consider adding functions like getBalance(...) given a key in the Tree
   // setBalance(...) given a key to a node and balance value, etc
@@ -134,7 +204,7 @@ void AVLTree<Key, Value>::rotateLeft(std::shared_ptr<AVLNode<Key, Value>> p,
   // left|right child of gp.
   if (p->getParent_AVL() != nullptr) {
     std::shared_ptr<AVLNode<Key, Value>> gp = p->getParent_AVL();
-    if (gp->getKey() > p->getKey()) {
+    if (gp->getLeft() == p) {
       // then update gp to point at n, and n to gp.
       gp->setLeft(n);
       n->setParent(gp);
@@ -159,9 +229,12 @@ void AVLTree<Key, Value>::rotateLeft(std::shared_ptr<AVLNode<Key, Value>> p,
   // then update n left child to p, p parent to n
   n->setLeft(p);
   p->setParent(n);
+  updateNode(p);
+  updateNode(n);
 
-  // if rotation involved root, then update.
-  if (this->root_->getKey() == p->getKey())
+  // if rotation involved root, then update. A parentless p that is not the
+  // root is a detached subtree (see splitTree) and the caller tracks it.
+  if (n->getParent() == nullptr && this->root_ == p)
     this->root_ = n;
 }
 
@@ -179,7 +252,7 @@ void AVLTree<Key, Value>::rotateRight(std::shared_ptr<AVLNode<Key, Value>> p,
   // left|right child of gp.
   if (p->getParent_AVL() != nullptr) {
     std::shared_ptr<AVLNode<Key, Value>> gp = p->getParent_AVL();
-    if (gp->getKey() > p->getKey()) {
+    if (gp->getLeft() == p) {
       // then update gp to point at n, and n to gp.
       gp->setLeft(n);
       n->setParent(gp);
@@ -204,403 +277,639 @@ void AVLTree<Key, Value>::rotateRight(std::shared_ptr<AVLNode<Key, Value>> p,
   // then update n left child to p, p parent to n
   n->setRight(p);
   p->setParent(n);
+  updateNode(p);
+  updateNode(n);
 
-  // if rotation involved root, then update.
-  if (this->root_->getKey() == p->getKey())
+  // if rotation involved root, then update. A parentless p that is not the
+  // root is a detached subtree (see splitTree) and the caller tracks it.
+  if (n->getParent() == nullptr && this->root_ == p)
     this->root_ = n;
 }
 
+// Links a new AVLNode into the empty is_left slot of parent (or as the root)
+// and rebalances the tree above it.
 template <class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item) {
-  // if tree is empty make root node
-  if (this->empty()) {
-    this->root_ = std::make_shared<AVLNode<Key, Value>>(
-        new_item.first, new_item.second, nullptr);
-    return;
-  }
-
-  // Once insert location is found, cur_node will be assigned updated parent
+std::shared_ptr<Node<Key, Value>>
+AVLTree<Key, Value>::attachNode(std::shared_ptr<Node<Key, Value>> base_parent,
+                                bool is_left,
+                                std::pair<const Key, Value> &&new_item) {
   std::shared_ptr<AVLNode<Key, Value>> parent =
-      std::static_pointer_cast<AVLNode<Key, Value>>(this->root_);
+      std::static_pointer_cast<AVLNode<Key, Value>>(base_parent);
   std::shared_ptr<AVLNode<Key, Value>> cur_node =
-      std::static_pointer_cast<AVLNode<Key, Value>>(this->root_);
-  bool is_left;
-
-  while (1) {
-
-    // node has found place on tree. update parent and child to point to each
-    // other
-    if (cur_node == nullptr) {
-      // determine and set child
-      cur_node = std::make_shared<AVLNode<Key, Value>>(new_item.first,
-                                                       new_item.second, parent);
-      char bal = parent->getBalance();
-      if (is_left) {
-        parent->setLeft(cur_node);
-        bal--;
-        parent->setBalance(bal);
-        if (bal == -1) {
-          insertFix(parent, parent->getLeft_AVL());
-        }
-      } else {
-        parent->setRight(cur_node);
-        bal++;
-        parent->setBalance(bal);
-        if (bal == 1) {
-          insertFix(parent, parent->getRight_AVL());
-        }
-      }
-      return;
-    }
+      makeNode(std::move(new_item), parent);
+  this->updateExtremes(parent, is_left, cur_node);
+  if (parent == nullptr) {
+    this->root_ = cur_node;
+    return cur_node;
+  }
 
-    // less-than, go left
-    else if (new_item.first < cur_node->getKey()) {
-      parent = cur_node;
-      cur_node = cur_node->getLeft_AVL();
-      is_left = true;
-      continue;
-    }
-    // greater-than, go right
-    else if (new_item.first > cur_node->getKey()) {
-      parent = cur_node;
-      cur_node = cur_node->getRight_AVL();
-      is_left = false;
-      continue;
+  // ancestors are brought up to date before any rotation reads them
+  if (is_left)
+    parent->setLeft(cur_node);
+  else
+    parent->setRight(cur_node);
+  updatePath(parent);
+
+  char bal = parent->getBalance();
+  if (is_left) {
+    bal--;
+    parent->setBalance(bal);
+    if (bal == -1) {
+      insertFix(parent, parent->getLeft_AVL());
     }
-    // equal, overwrite
-    else if (new_item.first == cur_node->getKey()) {
-      cur_node->setValue(new_item.second);
-      return;
+  } else {
+    bal++;
+    parent->setBalance(bal);
+    if (bal == 1) {
+      insertFix(parent, parent->getRight_AVL());
     }
   }
+  return cur_node;
 }
 
+// p's subtree just got taller through its child n. Walks up the ancestors,
+// stopping as soon as one absorbs the growth or a rotation restores the
+// subtree's old height.
 template <class Key, class Value>
 void AVLTree<Key, Value>::insertFix(std::shared_ptr<AVLNode<Key, Value>> p,
                                     std::shared_ptr<AVLNode<Key, Value>> n) {
-  if (p == nullptr || p->getParent_AVL() == nullptr)
+  if (p == nullptr)
     return;
-  //    std::shared_ptr<AVLNode<Key, Value>>  gp =
-  //    std::static_pointer_cast<AVLNode<Key,Value>>(p->getParent_AVL());
   std::shared_ptr<AVLNode<Key, Value>> gp = p->getParent_AVL();
-  //    this->printRoot(this->root_);
-
-  char bal = gp->getBalance();
-  //  p is left child of gp
-  if (p == gp->getLeft_AVL()) {
-    bal--;
-    gp->setBalance(bal);
-    if (gp->getBalance() == 0) {
-      return;
-    } else if (gp->getBalance() == -1) {
-      // recurse up ancestor chain
-      insertFix(gp, p);
-    } else if (gp->getBalance() == -2) {
-      // check for zig zig
-      if (p->getBalance() == -1) {
-        rotateRight(gp, p);
-        gp->setBalance('0');
-        p->setBalance('0');
-      } else { // zig-zag
-        std::shared_ptr<AVLNode<Key, Value>> n = p->getRight_AVL();
-        rotateLeft(p, n);
-        rotateRight(gp, n);
-
-        // handle balance updates for 3 subcases:
-        if (n->getBalance() == -1) { // case 1
-          gp->setBalance(1);
-          p->setBalance(0);
-          n->setBalance(0);
-        } else if (n->getBalance() == 0) { // case 2
+  while (gp != nullptr) {
+    //  p is left child of gp
+    if (gp->getLeft() == p) {
+      char bal = gp->getBalance() - 1;
+      gp->setBalance(bal);
+      if (bal == 0)
+        return;
+      if (bal == -2) {
+        // check for zig zig
+        if (p->getBalance() == -1) {
+          rotateRight(gp, p);
           gp->setBalance(0);
           p->setBalance(0);
+        } else { // zig-zag
+          n = p->getRight_AVL();
+          rotateLeft(p, n);
+          rotateRight(gp, n);
+          gp->setBalance(n->getBalance() == -1 ? 1 : 0);
+          p->setBalance(n->getBalance() == 1 ? -1 : 0);
           n->setBalance(0);
-        } else if (n->getBalance() == 1) { // case 3
-          gp->setBalance(0);
-          p->setBalance(0);
-          n->setBalance(-1);
         }
+        return;
       }
     }
 
     //  p is right child of gp
-  } else {
-    bal = gp->getBalance();
-    bal++;
-    gp->setBalance(bal);
-    if (gp->getBalance() == 0) {
-      return;
-    } else if (gp->getBalance() == 1) {
-      // recurse up ancestor chain
-      insertFix(gp, p);
-    } else if (gp->getBalance() == 2) {
-      // check for zig zig
-      if (p->getBalance() == 1) {
-        rotateLeft(gp, p);
-        gp->setBalance('0');
-        p->setBalance('0');
-      } else { // zig-zag
-        std::shared_ptr<AVLNode<Key, Value>> n = p->getLeft_AVL();
-        rotateRight(p, n);
-        rotateLeft(gp, n);
-
-        // handle balance updates for 3 subcases:
-        if (n->getBalance() == -1) { // case 1
-          gp->setBalance(-1);
-          p->setBalance(0);
-          n->setBalance(0);
-        } else if (n->getBalance() == 0) { // case 2
+    else {
+      char bal = gp->getBalance() + 1;
+      gp->setBalance(bal);
+      if (bal == 0)
+        return;
+      if (bal == 2) {
+        // check for zig zig
+        if (p->getBalance() == 1) {
+          rotateLeft(gp, p);
           gp->setBalance(0);
           p->setBalance(0);
+        } else { // zig-zag
+          n = p->getLeft_AVL();
+          rotateRight(p, n);
+          rotateLeft(gp, n);
+          gp->setBalance(n->getBalance() == 1 ? -1 : 0);
+          p->setBalance(n->getBalance() == -1 ? 1 : 0);
           n->setBalance(0);
-        } else if (n->getBalance() == 1) { // case 3
-          gp->setBalance(0);
-          p->setBalance(0);
-          n->setBalance(-1);
         }
+        return;
       }
     }
+
+    // gp now leans toward p and is one taller, keep going up
+    n = std::move(p);
+    p = std::move(gp);
+    gp = p->getParent_AVL();
   }
-  //    this->printRoot(this->root_);
 }
+
+// Unlinks a node that is in the tree and rebalances above it.
 template <class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key &key) {
-  // if tree is empty, do nothing
-  if (this->empty())
-    return;
+void AVLTree<Key, Value>::detachNode(
+    std::shared_ptr<Node<Key, Value>> base_node) {
+  char balance = std::static_pointer_cast<AVLNode<Key, Value>>(base_node)
+                     ->getBalance();
+  std::shared_ptr<Node<Key, Value>> shrunk, moved;
+  bool from_left;
+  this->unlinkNode(std::move(base_node), shrunk, from_left, moved);
+
+  // the predecessor took over the removed node's position, and its balance
+  if (moved != nullptr)
+    std::static_pointer_cast<AVLNode<Key, Value>>(moved)->setBalance(balance);
+
+  updatePath(std::static_pointer_cast<AVLNode<Key, Value>>(shrunk));
+  if (shrunk != nullptr)
+    removeFix(std::static_pointer_cast<AVLNode<Key, Value>>(shrunk),
+              from_left ? 1 : -1);
+}
+
+// n's subtree on one side just got shorter: diff is +1 if it was the left
+// side, -1 if it was the right. Rotates where n goes out of balance and
+// walks up while the height of n's subtree keeps shrinking.
+template <class Key, class Value>
+void AVLTree<Key, Value>::removeFix(std::shared_ptr<AVLNode<Key, Value>> n,
+                                    char diff) {
+  while (n != nullptr) {
+    // work out the diff for the next step before rotations move n
+    std::shared_ptr<AVLNode<Key, Value>> p = n->getParent_AVL();
+    char ndiff = 0;
+    if (p != nullptr)
+      ndiff = (p->getLeft() == n) ? 1 : -1;
 
-  char diff;
-  std::shared_ptr<AVLNode<Key, Value>> rf_parent;
-  // attempt to find node
-  std::shared_ptr<AVLNode<Key, Value>> to_remove =
-      std::static_pointer_cast<AVLNode<Key, Value>>(this->internalFind(key));
+    char bal = n->getBalance() + diff;
 
-  // nothing found
-  if (to_remove == nullptr)
-    return;
+    // right side removal, left side now too tall
+    if (bal == -2) {
+      std::shared_ptr<AVLNode<Key, Value>> tall_child = n->getLeft_AVL();
 
-  // remove case 1: root node w/ no children
-  if (to_remove->getLeft_AVL() == nullptr &&
-      to_remove->getRight_AVL() == nullptr &&
-      to_remove->getParent_AVL() == nullptr) {
-    this->root_ = nullptr;
-  }
-  // remove case 2: leaf node
-  else if (to_remove->getLeft_AVL() == nullptr &&
-           to_remove->getRight_AVL() == nullptr) {
-    std::shared_ptr<AVLNode<Key, Value>> parent = to_remove->getParent_AVL();
-    if (parent != nullptr) {
-      if (to_remove->getKey() < parent->getKey()) {
-        parent->setLeft(nullptr);
-        rf_parent = parent;
-        diff = 1;
-      } else {
-        parent->setRight(nullptr);
-        rf_parent = parent;
-        diff = -1;
+      if (tall_child->getBalance() == -1) { // zig-zig
+        rotateRight(n, tall_child);
+        n->setBalance(0);
+        tall_child->setBalance(0);
+      } else if (tall_child->getBalance() == 0) { // zig-zig, height unchanged
+        rotateRight(n, tall_child);
+        n->setBalance(-1);
+        tall_child->setBalance(1);
+        return;
+      } else { // zig-zag
+        std::shared_ptr<AVLNode<Key, Value>> tc_rc = tall_child->getRight_AVL();
+        rotateLeft(tall_child, tc_rc);
+        rotateRight(n, tc_rc);
+        n->setBalance(tc_rc->getBalance() == -1 ? 1 : 0);
+        tall_child->setBalance(tc_rc->getBalance() == 1 ? -1 : 0);
+        tc_rc->setBalance(0);
       }
     }
-  }
 
-  // remove case 3: node has children, swap w/ predecessor, then delete as leaf
-  // (if no left child!) if left child, then have parent right point to left
-  // child
-  else if (to_remove->getLeft_AVL() != nullptr &&
-           to_remove->getRight_AVL() != nullptr) {
-    std::shared_ptr<AVLNode<Key, Value>> pred =
-        std::static_pointer_cast<AVLNode<Key, Value>>(
-            this->predecessor(to_remove));
-    this->nodeSwap(to_remove, pred);
-
-    // sub-case 1 : after swap, to remove has left child. Point parent to child
-    // and child to parent sub-case 2 : remove parent pointer to leaf and reset
-    // remove ptr
-    std::shared_ptr<AVLNode<Key, Value>> parent = to_remove->getParent_AVL();
-    if (parent->getLeft_AVL() == to_remove) {
-      if (to_remove->getLeft_AVL() != nullptr) {
-        parent->setLeft(to_remove->getLeft_AVL());
-        parent->getLeft_AVL()->setParent(parent);
-        rf_parent = parent;
-        diff = -1;
-      } else {
-        // remove as leaf
-        parent->setLeft(nullptr);
-        rf_parent = parent;
-        diff = 1;
-      }
-    } else {
-      // if remove node is not leaf, and has left child, point parent right to
-      // left child
-      if (to_remove->getLeft_AVL() != nullptr) {
-        parent->setRight(to_remove->getLeft_AVL());
-        parent->getRight_AVL()->setParent(parent);
-        rf_parent = parent;
-        diff = -1;
-      } else {
-        parent->setRight(nullptr);
-        rf_parent = parent;
-        diff = -1;
+    // left side removal, right side now too tall
+    else if (bal == 2) {
+      std::shared_ptr<AVLNode<Key, Value>> tall_child = n->getRight_AVL();
+
+      if (tall_child->getBalance() == 1) { // zig-zig
+        rotateLeft(n, tall_child);
+        n->setBalance(0);
+        tall_child->setBalance(0);
+      } else if (tall_child->getBalance() == 0) { // zig-zig, height unchanged
+        rotateLeft(n, tall_child);
+        n->setBalance(1);
+        tall_child->setBalance(-1);
+        return;
+      } else { // zig-zag
+        std::shared_ptr<AVLNode<Key, Value>> tc_lc = tall_child->getLeft_AVL();
+        rotateRight(tall_child, tc_lc);
+        rotateLeft(n, tc_lc);
+        n->setBalance(tc_lc->getBalance() == 1 ? -1 : 0);
+        tall_child->setBalance(tc_lc->getBalance() == -1 ? 1 : 0);
+        tc_lc->setBalance(0);
       }
     }
+
+    // n was balanced, now leans one way but its height is unchanged
+    else if (bal == -1 || bal == 1) {
+      n->setBalance(bal);
+      return;
+    }
+
+    // n got shorter
+    else
+      n->setBalance(0);
+
+    // the subtree that was rooted at n is one shorter, keep going up
+    n = std::move(p);
+    diff = ndiff;
   }
+}
 
-  // remove case 4: node has a child, promote child and delete
-  else if (to_remove->getLeft_AVL() != nullptr ||
-           to_remove->getRight_AVL() != nullptr) {
-    std::shared_ptr<AVLNode<Key, Value>> child = to_remove;
+// Removes [first, last) by splitting the tree into the keys before first,
+// the range itself and the keys from last on, then joining the outer two
+// back together. That is O(log n) of restructuring plus O(k) to free the
+// range, instead of k separate removals.
+template <class Key, class Value>
+void AVLTree<Key, Value>::eraseRange(std::shared_ptr<Node<Key, Value>> first,
+                                     std::shared_ptr<Node<Key, Value>> last) {
+  std::shared_ptr<AVLNode<Key, Value>> root =
+      std::static_pointer_cast<AVLNode<Key, Value>>(this->root_);
+  int height = subtreeHeight(root);
 
-    // promote child to removal node position
-    if (to_remove->getLeft_AVL() != nullptr) {
-      child = to_remove->getLeft_AVL();
-      this->nodeSwap(to_remove, child);
-    } else {
-      child = to_remove->getRight_AVL();
-      this->nodeSwap(to_remove, child);
-    }
+  // rotations below must not mistake a piece for the whole tree
+  this->root_ = nullptr;
 
-    // point child back to its children and reset to_remove pointer
-    if (to_remove->getLeft_AVL() != nullptr) {
-      child->setLeft(to_remove->getLeft_AVL());
-      child->getLeft_AVL()->setParent(child);
-      rf_parent = child;
-      diff = 1;
-    } else {
-      child->setLeft(nullptr);
-      rf_parent = child;
-      diff = 1;
+  std::shared_ptr<AVLNode<Key, Value>> before, range, after;
+  int hb, hrange, ha;
+  splitTree(root, height, first->getKey(), before, hb, range, hrange);
+  if (last != nullptr) {
+    std::shared_ptr<AVLNode<Key, Value>> rest = range;
+    splitTree(rest, hrange, last->getKey(), range, hrange, after, ha);
+  } else
+    ha = 0;
+  freeSubtree(range);
+
+  this->root_ = joinTrees(before, hb, after, ha, height);
+  this->resetExtremes();
+}
+
+// Joins left, mid and right (keys in that order) into one AVL tree and
+// returns its root; height receives its height. Walks down the taller
+// side to a subtree of matching height, hangs mid there, then rebalances
+// on the way back up.
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>>
+AVLTree<Key, Value>::joinTrees(std::shared_ptr<AVLNode<Key, Value>> left,
+                               int hl, std::shared_ptr<AVLNode<Key, Value>> mid,
+                               std::shared_ptr<AVLNode<Key, Value>> right,
+                               int hr, int &height) {
+  // left is too tall, join into its right spine
+  if (hl > hr + 1) {
+    char bal = left->getBalance();
+    std::shared_ptr<AVLNode<Key, Value>> lr = left->getRight_AVL();
+    if (lr != nullptr)
+      lr->setParent(nullptr);
+    int ht;
+    std::shared_ptr<AVLNode<Key, Value>> t =
+        joinTrees(lr, hl - (bal >= 0 ? 1 : 2), mid, right, hr, ht);
+    left->setRight(t);
+    t->setParent(left);
+    return rebalanceRoot(left, hl - (bal <= 0 ? 1 : 2), ht, height);
+  }
+
+  // right is too tall, join into its left spine
+  if (hr > hl + 1) {
+    char bal = right->getBalance();
+    std::shared_ptr<AVLNode<Key, Value>> rl = right->getLeft_AVL();
+    if (rl != nullptr)
+      rl->setParent(nullptr);
+    int ht;
+    std::shared_ptr<AVLNode<Key, Value>> t =
+        joinTrees(left, hl, mid, rl, hr - (bal <= 0 ? 1 : 2), ht);
+    right->setLeft(t);
+    t->setParent(right);
+    return rebalanceRoot(right, ht, hr - (bal >= 0 ? 1 : 2), height);
+  }
+
+  // close enough in height, mid becomes the root
+  mid->setParent(nullptr);
+  mid->setLeft(left);
+  mid->setRight(right);
+  if (left != nullptr)
+    left->setParent(mid);
+  if (right != nullptr)
+    right->setParent(mid);
+  mid->setBalance(hr - hl);
+  updateNode(mid);
+  height = std::max(hl, hr) + 1;
+  return mid;
+}
+
+// Joins left and right (all keys in left smaller) with no middle node, by
+// pulling the smallest node out of right to use as one.
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>>
+AVLTree<Key, Value>::joinTrees(std::shared_ptr<AVLNode<Key, Value>> left,
+                               int hl,
+                               std::shared_ptr<AVLNode<Key, Value>> right,
+                               int hr, int &height) {
+  if (right == nullptr) {
+    height = hl;
+    return left;
+  }
+
+  std::shared_ptr<AVLNode<Key, Value>> mid = right;
+  while (mid->getLeft_AVL() != nullptr)
+    mid = mid->getLeft_AVL();
+
+  // unlink mid; it has no left child, so its right child takes its place
+  std::shared_ptr<AVLNode<Key, Value>> parent = mid->getParent_AVL();
+  std::shared_ptr<AVLNode<Key, Value>> child = mid->getRight_AVL();
+  if (child != nullptr)
+    child->setParent(parent);
+  if (parent == nullptr) {
+    right = child;
+    hr--;
+  } else {
+    parent->setLeft(child);
+    updatePath(parent);
+    removeFix(parent, 1);
+    // rotations may have replaced the root of right
+    right = parent;
+    while (right->getParent_AVL() != nullptr)
+      right = right->getParent_AVL();
+    hr = subtreeHeight(right);
+  }
+  mid->setParent(nullptr);
+  mid->setRight(nullptr);
+
+  return joinTrees(left, hl, mid, right, hr, height);
+}
+
+// Splits the detached subtree t (of height ht) into the keys less than key
+// and the keys not less than key, each a valid AVL tree.
+template <class Key, class Value>
+void AVLTree<Key, Value>::splitTree(
+    std::shared_ptr<AVLNode<Key, Value>> t, int ht, const Key &key,
+    std::shared_ptr<AVLNode<Key, Value>> &left, int &hl,
+    std::shared_ptr<AVLNode<Key, Value>> &right, int &hr) {
+  if (t == nullptr) {
+    left = nullptr;
+    right = nullptr;
+    hl = 0;
+    hr = 0;
+    return;
+  }
+
+  // take t apart
+  char bal = t->getBalance();
+  std::shared_ptr<AVLNode<Key, Value>> tl = t->getLeft_AVL();
+  std::shared_ptr<AVLNode<Key, Value>> tr = t->getRight_AVL();
+  int htl = ht - (bal <= 0 ? 1 : 2);
+  int htr = ht - (bal >= 0 ? 1 : 2);
+  if (tl != nullptr)
+    tl->setParent(nullptr);
+  if (tr != nullptr)
+    tr->setParent(nullptr);
+  t->setLeft(nullptr);
+  t->setRight(nullptr);
+
+  // t and its left subtree go left, split the right subtree
+  if (t->getKey() < key) {
+    std::shared_ptr<AVLNode<Key, Value>> mid;
+    int hmid;
+    splitTree(tr, htr, key, mid, hmid, right, hr);
+    left = joinTrees(tl, htl, t, mid, hmid, hl);
+  }
+  // t and its right subtree go right, split the left subtree
+  else {
+    std::shared_ptr<AVLNode<Key, Value>> mid;
+    int hmid;
+    splitTree(tl, htl, key, left, hl, mid, hmid);
+    right = joinTrees(mid, hmid, t, tr, htr, hr);
+  }
+}
+
+// Sets the balance of the detached root n from its children's heights,
+// rotating if it is out of AVL bounds. Returns the (possibly new) root and
+// its height.
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>>
+AVLTree<Key, Value>::rebalanceRoot(std::shared_ptr<AVLNode<Key, Value>> n,
+                                   int hl, int hr, int &height) {
+  // right side too tall
+  if (hr - hl == 2) {
+    std::shared_ptr<AVLNode<Key, Value>> c = n->getRight_AVL();
+    if (c->getBalance() == 1) { // zig-zig
+      rotateLeft(n, c);
+      n->setBalance(0);
+      c->setBalance(0);
+      height = hr;
+      return c;
+    } else if (c->getBalance() == 0) { // zig-zig
+      rotateLeft(n, c);
+      n->setBalance(1);
+      c->setBalance(-1);
+      height = hr + 1;
+      return c;
     }
-    if (to_remove->getRight_AVL() != nullptr) {
-      child->setRight(to_remove->getRight_AVL());
-      child->getRight_AVL()->setParent(child);
-      rf_parent = child;
-      diff = -1;
-    } else {
-      child->setRight(nullptr);
-      rf_parent = child;
-      diff = -1;
+    std::shared_ptr<AVLNode<Key, Value>> g = c->getLeft_AVL(); // zig-zag
+    rotateRight(c, g);
+    rotateLeft(n, g);
+    n->setBalance(g->getBalance() == 1 ? -1 : 0);
+    c->setBalance(g->getBalance() == -1 ? 1 : 0);
+    g->setBalance(0);
+    height = hr;
+    return g;
+  }
+
+  // left side too tall
+  if (hl - hr == 2) {
+    std::shared_ptr<AVLNode<Key, Value>> c = n->getLeft_AVL();
+    if (c->getBalance() == -1) { // zig-zig
+      rotateRight(n, c);
+      n->setBalance(0);
+      c->setBalance(0);
+      height = hl;
+      return c;
+    } else if (c->getBalance() == 0) { // zig-zig
+      rotateRight(n, c);
+      n->setBalance(-1);
+      c->setBalance(1);
+      height = hl + 1;
+      return c;
     }
+    std::shared_ptr<AVLNode<Key, Value>> g = c->getRight_AVL(); // zig-zag
+    rotateLeft(c, g);
+    rotateRight(n, g);
+    n->setBalance(g->getBalance() == -1 ? 1 : 0);
+    c->setBalance(g->getBalance() == 1 ? -1 : 0);
+    g->setBalance(0);
+    height = hl;
+    return g;
   }
-  to_remove.reset();
 
-  if (diff == 1 || diff == -1)
-    removeFix(rf_parent, diff);
+  n->setBalance(hr - hl);
+  updateNode(n);
+  height = std::max(hl, hr) + 1;
+  return n;
 }
 
+// Breaks every link in a detached subtree so that its nodes (which point at
+// each other through shared_ptrs) are freed.
 template <class Key, class Value>
-void AVLTree<Key, Value>::removeFix(std::shared_ptr<AVLNode<Key, Value>> n,
-                                    char diff) {
+void AVLTree<Key, Value>::freeSubtree(std::shared_ptr<AVLNode<Key, Value>> n) {
+  std::vector<std::shared_ptr<AVLNode<Key, Value>>> stack;
+  if (n != nullptr)
+    stack.push_back(n);
+  while (!stack.empty()) {
+    n = stack.back();
+    stack.pop_back();
+    if (n->getLeft_AVL() != nullptr)
+      stack.push_back(n->getLeft_AVL());
+    if (n->getRight_AVL() != nullptr)
+      stack.push_back(n->getRight_AVL());
+    n->setParent(nullptr);
+    n->setLeft(nullptr);
+    n->setRight(nullptr);
+  }
+}
 
-  // base case
-  if (n == nullptr)
+// Sorts a copy of the batch, then walks it down the tree once. Each node
+// splits the (sorted) batch range into the keys belonging to its left and
+// right subtrees, so no key re-descends from the root. Keys that fall off
+// the bottom of the tree are hung there as a perfectly balanced subtree, and
+// on the way back up each node joins its two merged subtrees (see
+// joinTrees), which costs O(1) rotations per level of height difference.
+template <class Key, class Value>
+template <typename InputIterator>
+void AVLTree<Key, Value>::insertBatch(InputIterator first,
+                                      InputIterator last) {
+  std::vector<std::pair<Key, Value>> batch;
+  for (; first != last; ++first)
+    batch.emplace_back(first->first, first->second);
+  if (batch.empty())
     return;
 
-  std::shared_ptr<AVLNode<Key, Value>> p = n->getParent_AVL();
-  char ndiff;
-  if (p != nullptr) {
-    if (p->getLeft_AVL() == n)
-      ndiff = 1;
-    else
-      ndiff = -1;
-  } else
-    ndiff = -1;
+  // stable, so that among equal keys the last one in the input stays last
+  std::stable_sort(batch.begin(), batch.end(),
+                   [](const std::pair<Key, Value> &a,
+                      const std::pair<Key, Value> &b) {
+                     return a.first < b.first;
+                   });
+
+  // collapse duplicates, keeping the value inserted last
+  size_t kept = 0;
+  for (size_t i = 1; i < batch.size(); i++) {
+    if (batch[kept].first == batch[i].first)
+      batch[kept].second = std::move(batch[i].second);
+    else if (++kept != i)
+      batch[kept] = std::move(batch[i]);
+  }
+  batch.resize(kept + 1);
 
-  // right side removal
-  if (ndiff == -1) {
+  std::shared_ptr<AVLNode<Key, Value>> root =
+      std::static_pointer_cast<AVLNode<Key, Value>>(this->root_);
+  // rotations below must not mistake a subtree for the whole tree
+  this->root_ = nullptr;
+  mergeBatch(root, nullptr, subtreeHeight(root), batch, 0, batch.size());
+  this->root_ = root;
+  this->resetExtremes();
+}
 
-    std::shared_ptr<AVLNode<Key, Value>> tall_child = n->getLeft_AVL();
+// Merges batch[lo, hi) into the subtree of the given height, which may be
+// replaced, moving the items out of the batch. Returns the height of the
+// resulting subtree and leaves every balance on the way correct. Subtrees
+// that no key lands in are not visited at all.
+template <class Key, class Value>
+int AVLTree<Key, Value>::mergeBatch(
+    std::shared_ptr<AVLNode<Key, Value>> &subtree,
+    const std::shared_ptr<AVLNode<Key, Value>> &parent, int height,
+    std::vector<std::pair<Key, Value>> &batch, size_t lo, size_t hi) {
+  // fell off the tree, hang the remaining keys as a balanced subtree
+  if (subtree == nullptr) {
+    std::vector<std::shared_ptr<AVLNode<Key, Value>>> nodes;
+    nodes.reserve(hi - lo);
+    for (size_t i = lo; i < hi; i++)
+      nodes.push_back(makeNode(std::pair<const Key, Value>(
+                                   std::move(batch[i].first),
+                                   std::move(batch[i].second)),
+                               nullptr));
+    subtree = buildBalanced(nodes, 0, nodes.size(), parent, height);
+    return height;
+  }
 
-    // Case 1
-    if (diff == -1) {
+  // split the range around this node's key
+  size_t mid = lo;
+  size_t count = hi - lo;
+  while (count > 0) {
+    size_t step = count / 2;
+    if (batch[mid + step].first < subtree->getKey()) {
+      mid += step + 1;
+      count -= step + 1;
+    } else
+      count = step;
+  }
+  size_t right_lo = mid;
+  if (mid < hi && batch[mid].first == subtree->getKey()) {
+    subtree->setValue(std::move(batch[mid].second));
+    valueChanged(subtree);
+    right_lo++;
+  }
 
-      if (tall_child->getBalance() == -1) { // zig-zig
-        n->setBalance(0);
-        tall_child->setBalance(0);
-        rotateRight(n, tall_child);
-      } else if (tall_child->getBalance() == 0) { // zig-zig
-        n->setBalance(-1);
-        tall_child->setBalance(1);
-        rotateRight(n, tall_child);
-      } else if (tall_child->getBalance() == 1) { // zig-zag
-        std::shared_ptr<AVLNode<Key, Value>> tc_rc = tall_child->getRight_AVL();
-        rotateLeft(tc_rc, tc_rc->getRight_AVL());
-        rotateRight(n, tc_rc);
+  char bal = subtree->getBalance();
+  int hl = height - (bal <= 0 ? 1 : 2);
+  int hr = height - (bal >= 0 ? 1 : 2);
+  std::shared_ptr<AVLNode<Key, Value>> left, right;
+  if (lo < mid) {
+    left = subtree->getLeft_AVL();
+    hl = mergeBatch(left, subtree, hl, batch, lo, mid);
+    subtree->setLeft(left);
+  }
+  if (right_lo < hi) {
+    right = subtree->getRight_AVL();
+    hr = mergeBatch(right, subtree, hr, batch, right_lo, hi);
+    subtree->setRight(right);
+  }
 
-        // update balances
-        if (tc_rc->getBalance() == 1) {
-          n->setBalance(-1);
-          tall_child->setBalance(0);
-          tc_rc->setBalance(0);
-        } else if (tc_rc->getBalance() == 0) {
-          n->setBalance(0);
-          tall_child->setBalance(0);
-          tc_rc->setBalance(0);
-        } else if (tc_rc->getBalance() == -1) {
-          n->setBalance(1);
-          tall_child->setBalance(0);
-          tc_rc->setBalance(0);
-        }
-        removeFix(p, ndiff);
-      }
-      return;
-    }
+  // still within AVL bounds, just record the new balance
+  if (hr - hl >= -1 && hr - hl <= 1) {
+    subtree->setBalance(hr - hl);
+    updateNode(subtree);
+    return std::max(hl, hr) + 1;
+  }
 
-    // Case 2
-    else if (diff == 0) {
-      return;
-    }
-    // Case 3
-    else if (diff == 1) {
-      removeFix(p, ndiff);
-    }
+  // otherwise join the two sides back together through this node, which
+  // walks down the taller side and rotates on the way back up
+  left = subtree->getLeft_AVL();
+  right = subtree->getRight_AVL();
+  if (left != nullptr)
+    left->setParent(nullptr);
+  if (right != nullptr)
+    right->setParent(nullptr);
+  subtree->setParent(nullptr);
+  subtree = joinTrees(left, hl, subtree, right, hr, height);
+  subtree->setParent(parent);
+  return height;
+}
+
+// Height of an AVL subtree in O(log n), following the taller child.
+template <class Key, class Value>
+int AVLTree<Key, Value>::subtreeHeight(std::shared_ptr<AVLNode<Key, Value>> n) {
+  int height = 0;
+  while (n != nullptr) {
+    height++;
+    n = n->getBalance() < 0 ? n->getLeft_AVL() : n->getRight_AVL();
   }
-  // left side removal
-  if (ndiff == 1) {
+  return height;
+}
 
-    std::shared_ptr<AVLNode<Key, Value>> tall_child = n->getRight_AVL();
+// Links nodes[lo, hi) (already in key order) into a perfectly balanced
+// subtree under parent, setting every balance. height receives its height.
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>> AVLTree<Key, Value>::buildBalanced(
+    const std::vector<std::shared_ptr<AVLNode<Key, Value>>> &nodes, size_t lo,
+    size_t hi, std::shared_ptr<AVLNode<Key, Value>> parent, int &height) {
+  if (lo == hi) {
+    height = 0;
+    return nullptr;
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  std::shared_ptr<AVLNode<Key, Value>> n = nodes[mid];
+  int hl, hr;
+  n->setParent(parent);
+  n->setLeft(buildBalanced(nodes, lo, mid, n, hl));
+  n->setRight(buildBalanced(nodes, mid + 1, hi, n, hr));
+  n->setBalance(hr - hl);
+  updateNode(n);
+  height = std::max(hl, hr) + 1;
+  return n;
+}
+
+// Builds a plain AVLNode.
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>>
+AVLTree<Key, Value>::makeNode(std::pair<const Key, Value> &&item,
+                              std::shared_ptr<AVLNode<Key, Value>> parent) {
+  return std::make_shared<AVLNode<Key, Value>>(std::move(item), parent);
+}
 
-    // Case 1
-    if (diff == 1) {
+// A plain AVLTree caches nothing per subtree.
+template <class Key, class Value>
+void AVLTree<Key, Value>::updateNode(std::shared_ptr<AVLNode<Key, Value>>) {}
 
-      if (tall_child->getBalance() == 1) { // zig-zig
-        n->setBalance(0);
-        tall_child->setBalance(0);
-        rotateLeft(n, tall_child);
-      } else if (tall_child->getBalance() == 0) { // zig-zig
-        n->setBalance(-1);
-        tall_child->setBalance(1);
-        rotateLeft(n, tall_child);
-      } else if (tall_child->getBalance() == 1) { // zig-zag
-        std::shared_ptr<AVLNode<Key, Value>> tc_lc = tall_child->getLeft_AVL();
-        rotateRight(tc_lc, tc_lc->getRight_AVL());
-        rotateLeft(n, tc_lc);
+template <class Key, class Value>
+void AVLTree<Key, Value>::updatePath(std::shared_ptr<AVLNode<Key, Value>>) {}
 
-        // update balances
-        if (tc_lc->getBalance() == 1) {
-          n->setBalance(1);
-          tall_child->setBalance(0);
-          tc_lc->setBalance(0);
-        } else if (tc_lc->getBalance() == 0) {
-          n->setBalance(0);
-          tall_child->setBalance(0);
-          tc_lc->setBalance(0);
-        } else if (tc_lc->getBalance() == -1) {
-          n->setBalance(-1);
-          tall_child->setBalance(0);
-          tc_lc->setBalance(0);
-        }
-        removeFix(p, ndiff);
-      }
-      return;
-    }
-    // Case 2
-    else if (diff == 0) {
-      return;
-    }
-    // Case 3
-    else if (diff == -1) {
-      removeFix(p, ndiff);
-    }
-  }
+// An overwritten value changes what every subtree holding it caches.
+template <class Key, class Value>
+void AVLTree<Key, Value>::valueChanged(
+    std::shared_ptr<Node<Key, Value>> node) {
+  updatePath(std::static_pointer_cast<AVLNode<Key, Value>>(node));
 }
 
 // Function already completed for you
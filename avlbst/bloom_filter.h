@@ -0,0 +1,155 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A blocked Bloom filter: each item sets all of its bits inside one 64-byte
+// block, so a lookup costs a single cache miss however many probes it makes.
+// Items are given as 64-bit hashes (e.g. from std::hash), which are mixed
+// again here, so weak hashes such as the identity are fine.
+class BloomFilter {
+public:
+  static const size_t kBlockWords = 8;
+
+  // Sized for bits_per_item bits for each of expected_items items, which
+  // gives about a 1% false positive rate at the default of 10.
+  explicit BloomFilter(size_t expected_items = 0, size_t bits_per_item = 10)
+      : words_(blockCount(expected_items, bits_per_item) * kBlockWords),
+        probes_(probeCount(bits_per_item)) {}
+  // A filter with the given bits, as returned by words() and probes().
+  BloomFilter(const uint64_t *words, size_t word_count, unsigned probes)
+      : words_(words, words + word_count), probes_(probes) {}
+
+  void add(uint64_t hash) {
+    uint64_t *block = &words_[blockOf(hash)];
+    uint64_t bits = mix(hash);
+    for (unsigned i = 0; i < probes_; i++, bits >>= 9)
+      block[(bits >> 6) & 7] |= uint64_t(1) << (bits & 63);
+  }
+
+  // False means the item was never added; true means it probably was.
+  bool mayContain(uint64_t hash) const {
+    const uint64_t *block = &words_[blockOf(hash)];
+    uint64_t bits = mix(hash);
+    for (unsigned i = 0; i < probes_; i++, bits >>= 9)
+      if (!(block[(bits >> 6) & 7] & (uint64_t(1) << (bits & 63))))
+        return false;
+    return true;
+  }
+
+  void clear() { words_.assign(words_.size(), 0); }
+
+  const std::vector<uint64_t> &words() const { return words_; }
+  unsigned probes() const { return probes_; }
+
+  // The splitmix64 finalizer.
+  static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+protected:
+  static size_t blockCount(size_t items, size_t bits_per_item) {
+    return (items * bits_per_item + 511) / 512 + 1;
+  }
+  // The optimal number of probes, bits_per_item * ln 2, within the 7 probes
+  // of 9 bits each that one 64-bit mixed hash provides.
+  static unsigned probeCount(size_t bits_per_item) {
+    long probes = std::lround(bits_per_item * 0.693);
+    return probes < 1 ? 1 : probes > 7 ? 7 : probes;
+  }
+
+  // The block comes from a second, differently seeded mix of the hash, so
+  // that it is independent of the bits chosen inside it.
+  size_t blockOf(uint64_t hash) const {
+    uint64_t x = mix(hash ^ 0x5851f42d4c957f2dULL);
+    return static_cast<size_t>(x % (words_.size() / kBlockWords)) *
+           kBlockWords;
+  }
+
+  std::vector<uint64_t> words_;
+  unsigned probes_;
+};
+
+// A blocked Bloom filter of 4-bit counters instead of bits, so that items
+// can be removed again. Each 64-byte block holds 128 counters. A counter
+// that reaches 15 sticks there, as its true count is no longer known; that
+// only costs false positives. Removing an item that was never added can
+// cause false negatives.
+class CountingBloomFilter {
+public:
+  static const size_t kBlockWords = 8;
+
+  // Sized for counters_per_item counters for each of expected_items items,
+  // as BloomFilter is with bits.
+  explicit CountingBloomFilter(size_t expected_items = 0,
+                               size_t counters_per_item = 10)
+      : words_(blockCount(expected_items, counters_per_item) * kBlockWords),
+        probes_(probeCount(counters_per_item)) {}
+
+  void add(uint64_t hash) {
+    uint64_t *block = &words_[blockOf(hash)];
+    uint64_t bits = BloomFilter::mix(hash);
+    for (unsigned i = 0; i < probes_; i++, bits >>= 7) {
+      uint64_t &word = block[(bits >> 4) & 7];
+      unsigned shift = (bits & 15) * 4;
+      if (((word >> shift) & 15) != 15)
+        word += uint64_t(1) << shift;
+    }
+  }
+
+  void remove(uint64_t hash) {
+    uint64_t *block = &words_[blockOf(hash)];
+    uint64_t bits = BloomFilter::mix(hash);
+    for (unsigned i = 0; i < probes_; i++, bits >>= 7) {
+      uint64_t &word = block[(bits >> 4) & 7];
+      unsigned shift = (bits & 15) * 4;
+      uint64_t counter = (word >> shift) & 15;
+      if (counter != 15 && counter != 0)
+        word -= uint64_t(1) << shift;
+    }
+  }
+
+  // False means the item is not in the filter; true means it probably is.
+  bool mayContain(uint64_t hash) const {
+    const uint64_t *block = &words_[blockOf(hash)];
+    uint64_t bits = BloomFilter::mix(hash);
+    for (unsigned i = 0; i < probes_; i++, bits >>= 7)
+      if (!((block[(bits >> 4) & 7] >> ((bits & 15) * 4)) & 15))
+        return false;
+    return true;
+  }
+
+  void clear() { words_.assign(words_.size(), 0); }
+
+  unsigned probes() const { return probes_; }
+  // Counters in the filter.
+  size_t capacity() const { return words_.size() * 16; }
+
+protected:
+  static size_t blockCount(size_t items, size_t counters_per_item) {
+    return (items * counters_per_item + 127) / 128 + 1;
+  }
+  // As in BloomFilter, within the 9 probes of 7 bits that one mixed hash
+  // provides.
+  static unsigned probeCount(size_t counters_per_item) {
+    long probes = std::lround(counters_per_item * 0.693);
+    return probes < 1 ? 1 : probes > 9 ? 9 : probes;
+  }
+
+  size_t blockOf(uint64_t hash) const {
+    uint64_t x = BloomFilter::mix(hash ^ 0x5851f42d4c957f2dULL);
+    return static_cast<size_t>(x % (words_.size() / kBlockWords)) *
+           kBlockWords;
+  }
+
+  std::vector<uint64_t> words_;
+  unsigned probes_;
+};
+
+#endif
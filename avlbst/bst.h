@@ -6,7 +6,18 @@
 #include <exception>
 #include <iostream>
 #include <memory>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+// Hint the CPU to start loading a node before it is dereferenced. Compiles to
+// nothing where the builtin is unavailable.
+#if defined(__GNUC__) || defined(__clang__)
+#define BST_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define BST_PREFETCH(ptr) ((void)0)
+#endif
 
 // A templated class for a Node in a search tree.
 // The getters for parent/left/right are virtual so
@@ -20,6 +31,8 @@ template <typename Key, typename Value> class Node {
 public:
   Node(const Key &key, const Value &value,
        std::shared_ptr<Node<Key, Value>> parent);
+  Node(std::pair<const Key, Value> &&item,
+       std::shared_ptr<Node<Key, Value>> parent);
   virtual ~Node();
 
   const std::pair<const Key, Value> &getItem() const;
@@ -31,11 +44,16 @@ public:
   virtual std::shared_ptr<Node<Key, Value>> getParent() const;
   virtual std::shared_ptr<Node<Key, Value>> getLeft() const;
   virtual std::shared_ptr<Node<Key, Value>> getRight() const;
+  // The child links themselves, for walks that only read the tree and so
+  // need not copy (and reference count) every node they pass.
+  const std::shared_ptr<Node<Key, Value>> &leftLink() const;
+  const std::shared_ptr<Node<Key, Value>> &rightLink() const;
 
   void setParent(std::shared_ptr<Node<Key, Value>> parent);
   void setLeft(std::shared_ptr<Node<Key, Value>> left);
   void setRight(std::shared_ptr<Node<Key, Value>> right);
   void setValue(const Value &value);
+  void setValue(Value &&value);
 
 protected:
   std::pair<const Key, Value> item_;
@@ -56,6 +74,12 @@ Node<Key, Value>::Node(const Key &key, const Value &value,
                        std::shared_ptr<Node<Key, Value>> parent)
     : item_(key, value), parent_(parent), left_(NULL), right_(NULL) {}
 
+// Constructor that moves an already built item into the node.
+template <typename Key, typename Value>
+Node<Key, Value>::Node(std::pair<const Key, Value> &&item,
+                       std::shared_ptr<Node<Key, Value>> parent)
+    : item_(std::move(item)), parent_(parent), left_(NULL), right_(NULL) {}
+
 /*
  * Destructor, which does not need to do anything since the pointers inside of a
  * node are only used as references to existing nodes. The nodes pointed to by
@@ -127,12 +151,25 @@ std::shared_ptr<Node<Key, Value>> Node<Key, Value>::getRight() const {
   return right_;
 }
 
+/**
+ * Getters for the child links, without copying them.
+ */
+template <typename Key, typename Value>
+const std::shared_ptr<Node<Key, Value>> &Node<Key, Value>::leftLink() const {
+  return left_;
+}
+
+template <typename Key, typename Value>
+const std::shared_ptr<Node<Key, Value>> &Node<Key, Value>::rightLink() const {
+  return right_;
+}
+
 /**
  * A setter for setting the parent of a node.
  */
 template <typename Key, typename Value>
 void Node<Key, Value>::setParent(std::shared_ptr<Node<Key, Value>> parent) {
-  parent_ = parent;
+  parent_ = std::move(parent);
 }
 
 /**
@@ -140,7 +177,7 @@ void Node<Key, Value>::setParent(std::shared_ptr<Node<Key, Value>> parent) {
  */
 template <typename Key, typename Value>
 void Node<Key, Value>::setLeft(std::shared_ptr<Node<Key, Value>> left) {
-  left_ = left;
+  left_ = std::move(left);
 }
 
 /**
@@ -148,7 +185,7 @@ void Node<Key, Value>::setLeft(std::shared_ptr<Node<Key, Value>> left) {
  */
 template <typename Key, typename Value>
 void Node<Key, Value>::setRight(std::shared_ptr<Node<Key, Value>> right) {
-  right_ = right;
+  right_ = std::move(right);
 }
 
 /**
@@ -159,6 +196,14 @@ void Node<Key, Value>::setValue(const Value &value) {
   item_.second = value;
 }
 
+/**
+ * A setter that moves a new value into the node.
+ */
+template <typename Key, typename Value>
+void Node<Key, Value>::setValue(Value &&value) {
+  item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -172,8 +217,13 @@ template <typename Key, typename Value> class BinarySearchTree {
 public:
   BinarySearchTree();                                                   // TODO
   virtual ~BinarySearchTree();                                          // TODO
-  virtual void insert(const std::pair<const Key, Value> &keyValuePair); // TODO
+  // Not virtual, so that it is only compiled where it is used: a tree of
+  // move-only values can be built as long as nothing copies one in.
+  void insert(const std::pair<const Key, Value> &keyValuePair); // TODO
+  void insert(std::pair<const Key, Value> &&keyValuePair);
   virtual void remove(const Key &key);                                  // TODO
+  void pop_min();
+  void pop_max();
   void clear();                                                         // TODO
   bool isBalanced() const;                                              // TODO
   void print() const;
@@ -203,16 +253,60 @@ public:
     std::shared_ptr<Node<Key, Value>> current_;
   };
 
+  // Same as iterator, but ++ walks from the largest item down.
+  class reverse_iterator : public iterator {
+  public:
+    reverse_iterator();
+
+    reverse_iterator &operator++();
+
+  protected:
+    friend class BinarySearchTree<Key, Value>;
+    reverse_iterator(std::shared_ptr<Node<Key, Value>> ptr);
+  };
+
 public:
   // Functions already completed for you
   iterator begin() const;
   iterator end() const;
+  reverse_iterator rbegin() const;
+  reverse_iterator rend() const;
   iterator find(const Key &key) const;
+  // The first item whose key is not less than key, or end().
+  iterator lower_bound(const Key &key) const;
+  iterator erase(iterator pos);
+  iterator erase(iterator first, iterator last);
+  iterator insert(iterator hint,
+                  const std::pair<const Key, Value> &keyValuePair);
+  iterator insert(iterator hint, std::pair<const Key, Value> &&keyValuePair);
+  template <typename... Args>
+  iterator emplace_hint(iterator hint, Args &&...args);
+
+  // std::map style insertion. These never overwrite an existing value
+  // (except insert_or_assign) and report whether an item was inserted.
+  template <typename... Args> std::pair<iterator, bool> emplace(Args &&...args);
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const Key &key, Args &&...args);
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(Key &&key, Args &&...args);
+  template <typename M>
+  std::pair<iterator, bool> insert_or_assign(const Key &key, M &&obj);
+  template <typename M>
+  std::pair<iterator, bool> insert_or_assign(Key &&key, M &&obj);
+
+  // Read-modify-write in a single descent. fn is called with a reference to
+  // the stored value.
+  template <typename Function>
+  std::pair<iterator, bool> upsert(const Key &key, Function fn);
+  template <typename Function> bool modify(const Key &key, Function fn);
+  void findBatch(const std::vector<Key> &keys,
+                 std::vector<iterator> &out) const;
 
 protected:
   // Mandatory helper functions you need to complete
   std::shared_ptr<Node<Key, Value>> internalFind(const Key &k) const; // TODO
   std::shared_ptr<Node<Key, Value>> getSmallestNode() const;          // TODO
+  std::shared_ptr<Node<Key, Value>> getLargestNode() const;
   static std::shared_ptr<Node<Key, Value>>
   predecessor(std::shared_ptr<Node<Key, Value>> current); // TODO
   static std::shared_ptr<Node<Key, Value>>
@@ -234,10 +328,35 @@ protected:
   bool isRightChild(std::shared_ptr<Node<Key, Value>> child);
   const int height_help(const std::shared_ptr<Node<Key, Value>> ptr,
                         bool &balanced) const;
+  bool hintPosition(std::shared_ptr<Node<Key, Value>> pos, const Key &key,
+                    std::shared_ptr<Node<Key, Value>> &parent,
+                    bool &is_left) const;
+  std::shared_ptr<Node<Key, Value>>
+  findInsertSlot(const Key &key, std::shared_ptr<Node<Key, Value>> &parent,
+                 bool &is_left) const;
+  virtual std::shared_ptr<Node<Key, Value>>
+  attachNode(std::shared_ptr<Node<Key, Value>> parent, bool is_left,
+             std::pair<const Key, Value> &&keyValuePair);
+  void updateExtremes(std::shared_ptr<Node<Key, Value>> parent, bool is_left,
+                      std::shared_ptr<Node<Key, Value>> node);
+  void resetExtremes();
+  void eraseNode(std::shared_ptr<Node<Key, Value>> to_remove);
+  virtual void detachNode(std::shared_ptr<Node<Key, Value>> to_remove);
+  void unlinkNode(std::shared_ptr<Node<Key, Value>> to_remove,
+                  std::shared_ptr<Node<Key, Value>> &shrunk, bool &from_left,
+                  std::shared_ptr<Node<Key, Value>> &moved);
+  virtual void eraseRange(std::shared_ptr<Node<Key, Value>> first,
+                          std::shared_ptr<Node<Key, Value>> last);
+  // Called after the tree overwrites the value of a node already in it.
+  virtual void valueChanged(std::shared_ptr<Node<Key, Value>> node);
+  static iterator makeIterator(std::shared_ptr<Node<Key, Value>> node);
 
 protected:
   std::shared_ptr<Node<Key, Value>> root_;
-  // You should not add other data members
+  // smallest and largest nodes, kept current by every insert and remove
+  // (rotations never change them) so begin() and pop_min() are O(1)
+  std::shared_ptr<Node<Key, Value>> leftmost_;
+  std::shared_ptr<Node<Key, Value>> rightmost_;
 };
 
 /*
@@ -272,27 +391,23 @@ operator*() const {
 template <class Key, class Value>
 std::shared_ptr<std::pair<const Key, Value>>
     BinarySearchTree<Key, Value>::iterator::operator->() const {
-  // TODO
-  std::pair<const Key, Value> cur = current_->getItem();
-  std::shared_ptr<std::pair<const Key, Value>> cur_share =
-      std::make_shared<std::pair<const Key, Value>>(cur);
-  return cur_share;
+  // alias the node's own item rather than copying it
+  return std::shared_ptr<std::pair<const Key, Value>>(current_,
+                                                      &current_->getItem());
 }
 
 // Checks if 'this' iterator's internals have the same value as 'rhs'
 template <class Key, class Value>
 bool BinarySearchTree<Key, Value>::iterator::
 operator==(const BinarySearchTree<Key, Value>::iterator &rhs) const {
-  // TODO
-  return &current_->getKey() == &rhs.current_->getKey();
+  return current_ == rhs.current_;
 }
 
 // Checks if 'this' iterator's internals have a different value as 'rhs'
 template <class Key, class Value>
 bool BinarySearchTree<Key, Value>::iterator::
 operator!=(const BinarySearchTree<Key, Value>::iterator &rhs) const {
-  // TODO
-  return &current_->getKey() != &rhs.current_->getKey();
+  return current_ != rhs.current_;
 }
 
 // Advances the iterator's location using an in-order sequencing
@@ -303,6 +418,25 @@ BinarySearchTree<Key, Value>::iterator::operator++() {
   return *this;
 }
 
+// Explicit constructor that initializes a reverse iterator with a given node.
+template <class Key, class Value>
+BinarySearchTree<Key, Value>::reverse_iterator::reverse_iterator(
+    std::shared_ptr<Node<Key, Value>> ptr)
+    : iterator(ptr) {}
+
+// A default constructor that initializes the reverse iterator to NULL.
+template <class Key, class Value>
+BinarySearchTree<Key, Value>::reverse_iterator::reverse_iterator()
+    : iterator() {}
+
+// Advances the reverse iterator to the next smaller item
+template <class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator &
+BinarySearchTree<Key, Value>::reverse_iterator::operator++() {
+  this->current_ = predecessor(this->current_);
+  return *this;
+}
+
 // -------------------------------------------------------------
 // End implementations for the BinarySearchTree::iterator class.
 // -------------------------------------------------------------
@@ -352,6 +486,20 @@ BinarySearchTree<Key, Value>::end() const {
   return end;
 }
 
+// Returns a reverse iterator to the "largest" item in the tree
+template <class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rbegin() const {
+  return reverse_iterator(getLargestNode());
+}
+
+// Returns a reverse iterator whose value means INVALID
+template <class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rend() const {
+  return reverse_iterator(NULL);
+}
+
 // Returns an iterator to the item with the given key, k
 // or the end iterator if k does not exist in the tree
 template <class Key, class Value>
@@ -362,6 +510,69 @@ BinarySearchTree<Key, Value>::find(const Key &k) const {
   return it;
 }
 
+template <class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::lower_bound(const Key &key) const {
+  std::shared_ptr<Node<Key, Value>> found;
+  std::shared_ptr<Node<Key, Value>> curr = root_;
+  while (curr != nullptr) {
+    if (curr->getKey() < key)
+      curr = curr->getRight();
+    else {
+      found = curr;
+      curr = curr->getLeft();
+    }
+  }
+  return iterator(found);
+}
+
+// Looks up every key in keys, storing find(keys[i]) in out[i].
+// Lookups are advanced one level at a time in groups, prefetching each
+// cursor's next node so that the cache misses of a group overlap instead of
+// being paid one after another. Each cursor points at the link to its node
+// rather than holding a copy of it: copying a shared_ptr writes to the
+// node's reference count, which would take the cache miss right away.
+template <class Key, class Value>
+void BinarySearchTree<Key, Value>::findBatch(
+    const std::vector<Key> &keys,
+    std::vector<BinarySearchTree<Key, Value>::iterator> &out) const {
+  const size_t GROUP_SIZE = 16;
+  out.assign(keys.size(), end());
+
+  for (size_t base = 0; base < keys.size(); base += GROUP_SIZE) {
+    size_t group = std::min(GROUP_SIZE, keys.size() - base);
+    const std::shared_ptr<Node<Key, Value>> *cursor[GROUP_SIZE];
+    for (size_t i = 0; i < group; i++)
+      cursor[i] = &root_;
+
+    // step every live cursor down one level per pass
+    size_t live = root_ == nullptr ? 0 : group;
+    while (live > 0) {
+      for (size_t i = 0; i < group; i++) {
+        if (cursor[i] == nullptr)
+          continue;
+        const Node<Key, Value> *n = cursor[i]->get();
+        const Key &key = keys[base + i];
+        if (key < n->getKey())
+          cursor[i] = &n->leftLink();
+        else if (n->getKey() < key)
+          cursor[i] = &n->rightLink();
+        else {
+          out[base + i] = iterator(*cursor[i]);
+          cursor[i] = nullptr;
+        }
+
+        if (cursor[i] != nullptr && *cursor[i] == nullptr)
+          cursor[i] = nullptr;
+        if (cursor[i] == nullptr)
+          live--;
+        else
+          BST_PREFETCH(cursor[i]->get());
+      }
+    }
+  }
+}
+
 // An insert method to insert into a Binary Search Tree.
 // If the key is already present in the tree,
 // update the current value with the new value.
@@ -369,58 +580,341 @@ BinarySearchTree<Key, Value>::find(const Key &k) const {
 template <class Key, class Value>
 void BinarySearchTree<Key, Value>::insert(
     const std::pair<const Key, Value> &keyValuePair) {
+  static_assert(std::is_copy_constructible<Value>::value,
+                "cannot insert a copy of a move-only value");
+  insert(std::pair<const Key, Value>(keyValuePair));
+}
+
+// Links a new node for keyValuePair as the is_left child of parent, or as
+// the root when parent is null, and returns it. The slot must be empty.
+template <class Key, class Value>
+std::shared_ptr<Node<Key, Value>> BinarySearchTree<Key, Value>::attachNode(
+    std::shared_ptr<Node<Key, Value>> parent, bool is_left,
+    std::pair<const Key, Value> &&keyValuePair) {
+  std::shared_ptr<Node<Key, Value>> node =
+      std::make_shared<Node<Key, Value>>(std::move(keyValuePair), parent);
+  if (parent == nullptr)
+    root_ = node;
+  else if (is_left)
+    parent->setLeft(node);
+  else
+    parent->setRight(node);
+  updateExtremes(parent, is_left, node);
+  return node;
+}
+
+// Records node as the new min/max if it was just linked below the old one
+// on the outer side (or is the only node).
+template <class Key, class Value>
+void BinarySearchTree<Key, Value>::updateExtremes(
+    std::shared_ptr<Node<Key, Value>> parent, bool is_left,
+    std::shared_ptr<Node<Key, Value>> node) {
+  if (parent == nullptr) {
+    leftmost_ = node;
+    rightmost_ = node;
+  } else if (is_left && parent == leftmost_)
+    leftmost_ = node;
+  else if (!is_left && parent == rightmost_)
+    rightmost_ = node;
+}
 
-  // if tree is empty make root node
-  if (this->empty()) {
-    root_ = std::make_shared<Node<Key, Value>>(keyValuePair.first,
-                                               keyValuePair.second, nullptr);
-    //          printRoot(root_);
+// Recomputes the min/max by walking the spines, for bulk restructuring.
+template <class Key, class Value>
+void BinarySearchTree<Key, Value>::resetExtremes() {
+  leftmost_ = root_;
+  rightmost_ = root_;
+  if (root_ == nullptr)
     return;
+  while (leftmost_->getLeft() != nullptr)
+    leftmost_ = leftmost_->getLeft();
+  while (rightmost_->getRight() != nullptr)
+    rightmost_ = rightmost_->getRight();
+}
+
+// Inserts keyValuePair, using hint as the position the key would be
+// inserted before (as std::map does). When the hint is right, the new node is
+// linked next to it without a descent from the root; otherwise this falls
+// back to a normal insert. Passing end() appends keys larger than the max.
+// Returns an iterator to the inserted or updated item.
+template <class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::insert(
+    BinarySearchTree<Key, Value>::iterator hint,
+    const std::pair<const Key, Value> &keyValuePair) {
+  return insert(hint, std::pair<const Key, Value>(keyValuePair));
+}
+
+// Same as above, moving the value into the tree.
+template <class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::insert(
+    BinarySearchTree<Key, Value>::iterator hint,
+    std::pair<const Key, Value> &&keyValuePair) {
+  std::shared_ptr<Node<Key, Value>> pos = hint.current_;
+
+  // the hint is the key itself, overwrite
+  if (pos != nullptr && pos->getKey() == keyValuePair.first) {
+    pos->setValue(std::move(keyValuePair.second));
+    valueChanged(pos);
+    return hint;
   }
 
-  // Once insert location is found, cur_node will be assigned updated parent
-  std::shared_ptr<Node<Key, Value>> parent = root_;
-  std::shared_ptr<Node<Key, Value>> cur_node = root_;
+  std::shared_ptr<Node<Key, Value>> parent;
+  bool is_left = false;
+  if (this->empty() ||
+      !hintPosition(pos, keyValuePair.first, parent, is_left)) {
+    // bad hint, or empty tree
+    std::shared_ptr<Node<Key, Value>> found =
+        findInsertSlot(keyValuePair.first, parent, is_left);
+    if (found != nullptr) {
+      found->setValue(std::move(keyValuePair.second));
+      valueChanged(found);
+      return iterator(found);
+    }
+  }
+  return iterator(attachNode(parent, is_left, std::move(keyValuePair)));
+}
+
+// Constructs the item from args and inserts it with insert(hint, item).
+template <class Key, class Value>
+template <typename... Args>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::emplace_hint(
+    BinarySearchTree<Key, Value>::iterator hint, Args &&...args) {
+  return insert(hint,
+                std::pair<const Key, Value>(std::forward<Args>(args)...));
+}
+
+// Inserts keyValuePair, moving its value into the new node (or over the
+// existing value when the key is already present).
+template <class Key, class Value>
+void BinarySearchTree<Key, Value>::insert(
+    std::pair<const Key, Value> &&keyValuePair) {
+  std::shared_ptr<Node<Key, Value>> parent;
   bool is_left;
+  std::shared_ptr<Node<Key, Value>> found =
+      findInsertSlot(keyValuePair.first, parent, is_left);
+  if (found != nullptr) {
+    found->setValue(std::move(keyValuePair.second));
+    valueChanged(found);
+  } else
+    attachNode(parent, is_left, std::move(keyValuePair));
+}
 
-  while (1) {
-
-    // node has found place on tree. update parent and child to point to each
-    // other
-    if (cur_node == nullptr) {
-      // determine and set child
-      cur_node = std::make_shared<Node<Key, Value>>(
-          keyValuePair.first, keyValuePair.second, parent);
-      if (is_left) {
-        parent->setLeft(cur_node);
-      } else {
-        parent->setRight(cur_node);
-      }
-      //            printRoot(root_);
-      return;
-    }
+// Builds the item from args and inserts it unless the key is already
+// present, in which case the tree is left unchanged.
+template <class Key, class Value>
+template <typename... Args>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::emplace(Args &&...args) {
+  std::pair<const Key, Value> item(std::forward<Args>(args)...);
+  std::shared_ptr<Node<Key, Value>> parent;
+  bool is_left;
+  std::shared_ptr<Node<Key, Value>> found =
+      findInsertSlot(item.first, parent, is_left);
+  if (found != nullptr)
+    return std::make_pair(iterator(found), false);
+  return std::make_pair(iterator(attachNode(parent, is_left, std::move(item))),
+                        true);
+}
+
+// Like emplace, but the value is only constructed (from args) if key is
+// missing, and args are left untouched otherwise.
+template <class Key, class Value>
+template <typename... Args>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::try_emplace(const Key &key, Args &&...args) {
+  std::shared_ptr<Node<Key, Value>> parent;
+  bool is_left;
+  std::shared_ptr<Node<Key, Value>> found =
+      findInsertSlot(key, parent, is_left);
+  if (found != nullptr)
+    return std::make_pair(iterator(found), false);
+  return std::make_pair(
+      iterator(attachNode(parent, is_left,
+                          std::pair<const Key, Value>(
+                              std::piecewise_construct,
+                              std::forward_as_tuple(key),
+                              std::forward_as_tuple(
+                                  std::forward<Args>(args)...)))),
+      true);
+}
+
+// Same as above, moving the key into the new node.
+template <class Key, class Value>
+template <typename... Args>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::try_emplace(Key &&key, Args &&...args) {
+  std::shared_ptr<Node<Key, Value>> parent;
+  bool is_left;
+  std::shared_ptr<Node<Key, Value>> found =
+      findInsertSlot(key, parent, is_left);
+  if (found != nullptr)
+    return std::make_pair(iterator(found), false);
+  return std::make_pair(
+      iterator(attachNode(parent, is_left,
+                          std::pair<const Key, Value>(
+                              std::piecewise_construct,
+                              std::forward_as_tuple(std::move(key)),
+                              std::forward_as_tuple(
+                                  std::forward<Args>(args)...)))),
+      true);
+}
+
+// Assigns obj to the value at key, or inserts it if key is missing.
+// The bool is true if an item was inserted.
+template <class Key, class Value>
+template <typename M>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::insert_or_assign(const Key &key, M &&obj) {
+  std::shared_ptr<Node<Key, Value>> parent;
+  bool is_left;
+  std::shared_ptr<Node<Key, Value>> found =
+      findInsertSlot(key, parent, is_left);
+  if (found != nullptr) {
+    found->getValue() = std::forward<M>(obj);
+    valueChanged(found);
+    return std::make_pair(iterator(found), false);
+  }
+  return std::make_pair(
+      iterator(attachNode(parent, is_left,
+                          std::pair<const Key, Value>(
+                              key, std::forward<M>(obj)))),
+      true);
+}
+
+// Same as above, moving the key into the new node.
+template <class Key, class Value>
+template <typename M>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::insert_or_assign(Key &&key, M &&obj) {
+  std::shared_ptr<Node<Key, Value>> parent;
+  bool is_left;
+  std::shared_ptr<Node<Key, Value>> found =
+      findInsertSlot(key, parent, is_left);
+  if (found != nullptr) {
+    found->getValue() = std::forward<M>(obj);
+    valueChanged(found);
+    return std::make_pair(iterator(found), false);
+  }
+  return std::make_pair(
+      iterator(attachNode(parent, is_left,
+                          std::pair<const Key, Value>(std::move(key),
+                                                      std::forward<M>(obj)))),
+      true);
+}
+
+// Applies fn to the value at key, first inserting a value-initialized Value
+// if key is missing. The bool is true if an item was inserted.
+template <class Key, class Value>
+template <typename Function>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::upsert(const Key &key, Function fn) {
+  std::shared_ptr<Node<Key, Value>> parent;
+  bool is_left;
+  std::shared_ptr<Node<Key, Value>> node =
+      findInsertSlot(key, parent, is_left);
+  bool inserted = node == nullptr;
+  if (inserted)
+    node = attachNode(parent, is_left,
+                      std::pair<const Key, Value>(key, Value()));
+  fn(node->getValue());
+  valueChanged(node);
+  return std::make_pair(iterator(node), inserted);
+}
+
+// Applies fn to the value at key in place. Returns false (and does not call
+// fn) if key is missing.
+template <class Key, class Value>
+template <typename Function>
+bool BinarySearchTree<Key, Value>::modify(const Key &key, Function fn) {
+  std::shared_ptr<Node<Key, Value>> node = internalFind(key);
+  if (node == nullptr)
+    return false;
+  fn(node->getValue());
+  valueChanged(node);
+  return true;
+}
 
-    // less-than, go left
-    else if (keyValuePair.first < cur_node->getKey()) {
+// Descends to key. Returns its node if present; otherwise returns null and
+// sets parent/is_left to the empty slot the key would be linked into
+// (parent is null for an empty tree).
+template <class Key, class Value>
+std::shared_ptr<Node<Key, Value>> BinarySearchTree<Key, Value>::findInsertSlot(
+    const Key &key, std::shared_ptr<Node<Key, Value>> &parent,
+    bool &is_left) const {
+  parent = nullptr;
+  is_left = false;
+  std::shared_ptr<Node<Key, Value>> cur_node = root_;
+  while (cur_node != nullptr) {
+    if (key < cur_node->getKey()) {
       parent = cur_node;
       cur_node = cur_node->getLeft();
       is_left = true;
-      continue;
-    }
-    // greater-than, go right
-    else if (keyValuePair.first > cur_node->getKey()) {
+    } else if (cur_node->getKey() < key) {
       parent = cur_node;
       cur_node = cur_node->getRight();
       is_left = false;
-      continue;
+    } else
+      return cur_node;
+  }
+  return nullptr;
+}
+
+// Checks whether key belongs directly before pos (the largest node when pos
+// is null, i.e. end()). If so, sets parent/is_left to the empty slot the new
+// node goes in and returns true. Only looks at pos and its neighbour.
+template <class Key, class Value>
+bool BinarySearchTree<Key, Value>::hintPosition(
+    std::shared_ptr<Node<Key, Value>> pos, const Key &key,
+    std::shared_ptr<Node<Key, Value>> &parent, bool &is_left) const {
+
+  // before end(): must be larger than the current max
+  if (pos == nullptr) {
+    std::shared_ptr<Node<Key, Value>> last = getLargestNode();
+    if (!(last->getKey() < key))
+      return false;
+    parent = last;
+    is_left = false;
+    return true;
+  }
+
+  // key is past the hint, accept it as the hint's successor slot
+  // (this is the "hint is the last insert" pattern)
+  if (pos->getKey() < key) {
+    // appending past the max needs no neighbour check
+    if (pos == rightmost_) {
+      parent = pos;
+      is_left = false;
+      return true;
     }
-    // equal, overwrite
-    else if (keyValuePair.first == cur_node->getKey()) {
-      cur_node->setValue(keyValuePair.second);
-      //            printRoot(root_);
-      return;
+    std::shared_ptr<Node<Key, Value>> after = successor(pos);
+    if (after != nullptr && !(key < after->getKey()))
+      return false;
+    if (pos->getRight() == nullptr) {
+      parent = pos;
+      is_left = false;
+    } else {
+      // successor is the leftmost node of the right subtree
+      parent = after;
+      is_left = true;
     }
+    return true;
   }
+
+  // key goes before the hint, check it is after the predecessor
+  std::shared_ptr<Node<Key, Value>> before = predecessor(pos);
+  if (before != nullptr && !(before->getKey() < key))
+    return false;
+  if (pos->getLeft() == nullptr) {
+    parent = pos;
+    is_left = true;
+  } else {
+    // predecessor is the rightmost node of the left subtree
+    parent = before;
+    is_left = false;
+  }
+  return true;
 }
 
 // A remove method to remove a specific key from a Binary Search Tree.
@@ -440,86 +934,168 @@ void BinarySearchTree<Key, Value>::remove(const Key &key) {
   if (to_remove == nullptr)
     return;
 
-  // remove case 1: root node w/ no children
-  if (to_remove->getLeft() == nullptr && to_remove->getRight() == nullptr &&
-      to_remove->getParent() == nullptr) {
-    root_ = nullptr;
-  }
-  // remove case 2: leaf node
-  else if (to_remove->getLeft() == nullptr &&
-           to_remove->getRight() == nullptr) {
-    std::shared_ptr<Node<Key, Value>> parent = to_remove->getParent();
-    if (parent != nullptr) {
-      if (to_remove->getKey() < parent->getKey())
-        parent->setLeft(nullptr);
-      else
-        parent->setRight(nullptr);
-    }
-  }
+  eraseNode(to_remove);
+}
 
-  // remove case 3: node has children, swap w/ predecessor, then delete as leaf
-  // (if no left child!) if left child, then have parent right point to left
-  // child
-  else if (to_remove->getLeft() != nullptr &&
-           to_remove->getRight() != nullptr) {
-    std::shared_ptr<Node<Key, Value>> pred = predecessor(to_remove);
-    nodeSwap(to_remove, pred);
-
-    // sub-case 1 : after swap, to remove has left child. Point parent to child
-    // and child to parent sub-case 2 : remove parent pointer to leaf and reset
-    // remove ptr
-    std::shared_ptr<Node<Key, Value>> parent = to_remove->getParent();
-    if (parent->getLeft() == to_remove) {
-      if (to_remove->getLeft() != nullptr) {
-        parent->setLeft(to_remove->getLeft());
-        parent->getLeft()->setParent(parent);
-      } else {
-        // remove as leaf
-        parent->setLeft(nullptr);
-      }
-    } else {
-      // if remove node is not leaf, and has left child, point parent right to
-      // left child
-      if (to_remove->getLeft() != nullptr) {
-        parent->setRight(to_remove->getLeft());
-        parent->getRight()->setParent(parent);
-      } else {
-        parent->setRight(nullptr);
-      }
-    }
+// Removes the smallest item, without searching for it.
+// Does nothing if the tree is empty.
+template <typename Key, typename Value>
+void BinarySearchTree<Key, Value>::pop_min() {
+  if (!this->empty())
+    eraseNode(leftmost_);
+}
+
+// Removes the largest item, without searching for it.
+// Does nothing if the tree is empty.
+template <typename Key, typename Value>
+void BinarySearchTree<Key, Value>::pop_max() {
+  if (!this->empty())
+    eraseNode(rightmost_);
+}
+
+// Removes the item at pos (which must not be end()) without searching for
+// it. Returns an iterator to the item that followed it.
+template <typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(
+    BinarySearchTree<Key, Value>::iterator pos) {
+  std::shared_ptr<Node<Key, Value>> next = successor(pos.current_);
+  eraseNode(pos.current_);
+  return iterator(next);
+}
+
+// Removes every item in [first, last). Returns last, which (like every
+// iterator outside the range) stays valid.
+template <typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(
+    BinarySearchTree<Key, Value>::iterator first,
+    BinarySearchTree<Key, Value>::iterator last) {
+  if (first.current_ != last.current_)
+    eraseRange(first.current_, last.current_);
+  return last;
+}
+
+// Removes the nodes from first up to (not including) last, a null last
+// meaning the end of the tree. Walks the range with successor() so there is
+// no descent per item.
+template <typename Key, typename Value>
+void BinarySearchTree<Key, Value>::eraseRange(
+    std::shared_ptr<Node<Key, Value>> first,
+    std::shared_ptr<Node<Key, Value>> last) {
+  while (first != last) {
+    std::shared_ptr<Node<Key, Value>> next = successor(first);
+    eraseNode(first);
+    first = next;
   }
+}
 
-  // remove case 4: node has a child, promote child and delete
-  else if (to_remove->getLeft() != nullptr ||
-           to_remove->getRight() != nullptr) {
-    std::shared_ptr<Node<Key, Value>> child = to_remove;
+// Nothing depends on the values here; trees that cache something derived
+// from them override this.
+template <typename Key, typename Value>
+void BinarySearchTree<Key, Value>::valueChanged(
+    std::shared_ptr<Node<Key, Value>>) {}
 
-    // promote child to removal node position
-    if (to_remove->getLeft() != nullptr) {
-      child = to_remove->getLeft();
-      nodeSwap(to_remove, child);
-    } else {
-      child = to_remove->getRight();
-      nodeSwap(to_remove, child);
-    }
+// Lets subclasses hand out iterators to nodes they find themselves.
+template <typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::makeIterator(
+    std::shared_ptr<Node<Key, Value>> node) {
+  return iterator(node);
+}
 
-    // point child back to its children and reset to_remove pointer
-    if (to_remove->getLeft() != nullptr) {
-      child->setLeft(to_remove->getLeft());
-      child->getLeft()->setParent(child);
-    } else {
-      child->setLeft(nullptr);
-    }
-    if (to_remove->getRight() != nullptr) {
-      child->setRight(to_remove->getRight());
-      child->getRight()->setParent(child);
+// Removes a node that is in the tree, keeping the cached min/max current.
+template <typename Key, typename Value>
+void BinarySearchTree<Key, Value>::eraseNode(
+    std::shared_ptr<Node<Key, Value>> to_remove) {
+  if (to_remove == leftmost_)
+    leftmost_ = successor(to_remove);
+  if (to_remove == rightmost_)
+    rightmost_ = predecessor(to_remove);
+  detachNode(to_remove);
+}
+
+// Unlinks a node that is in the tree. Rotations and balancing are left to
+// overrides.
+template <typename Key, typename Value>
+void BinarySearchTree<Key, Value>::detachNode(
+    std::shared_ptr<Node<Key, Value>> to_remove) {
+  std::shared_ptr<Node<Key, Value>> shrunk, moved;
+  bool from_left;
+  unlinkNode(std::move(to_remove), shrunk, from_left, moved);
+}
+
+// Takes to_remove out of the tree by relinking pointers only; no node other
+// than to_remove changes position relative to its subtree, so iterators to
+// them stay valid. A node with two children is replaced by its predecessor,
+// which is spliced out of the left subtree and put in to_remove's place
+// (returned in moved). shrunk is the lowest node whose subtree lost height,
+// from_left the side it lost it on; shrunk is null if the root was removed
+// without a replacement.
+template <typename Key, typename Value>
+void BinarySearchTree<Key, Value>::unlinkNode(
+    std::shared_ptr<Node<Key, Value>> to_remove,
+    std::shared_ptr<Node<Key, Value>> &shrunk, bool &from_left,
+    std::shared_ptr<Node<Key, Value>> &moved) {
+  std::shared_ptr<Node<Key, Value>> parent = to_remove->getParent();
+  std::shared_ptr<Node<Key, Value>> left = to_remove->getLeft();
+  std::shared_ptr<Node<Key, Value>> right = to_remove->getRight();
+  bool is_left = parent != nullptr && parent->getLeft() == to_remove;
+
+  // zero or one child: the child (if any) takes to_remove's place
+  std::shared_ptr<Node<Key, Value>> replacement;
+  if (left == nullptr || right == nullptr) {
+    replacement = left != nullptr ? std::move(left) : std::move(right);
+    if (replacement != nullptr)
+      replacement->setParent(parent);
+    shrunk = parent;
+    from_left = is_left;
+  }
+  // two children: the predecessor (rightmost of the left subtree, so it has
+  // no right child) takes to_remove's place
+  else {
+    replacement = left;
+    while (replacement->getRight() != nullptr)
+      replacement = replacement->getRight();
+
+    if (replacement == left) {
+      // left child moves up, keeping its own left subtree
+      shrunk = replacement;
+      from_left = true;
     } else {
-      child->setRight(nullptr);
+      // splice the predecessor out, its left child takes its place
+      std::shared_ptr<Node<Key, Value>> pred_parent = replacement->getParent();
+      std::shared_ptr<Node<Key, Value>> pred_left = replacement->getLeft();
+      if (pred_left != nullptr)
+        pred_left->setParent(pred_parent);
+      pred_parent->setRight(std::move(pred_left));
+      left->setParent(replacement);
+      replacement->setLeft(std::move(left));
+      shrunk = std::move(pred_parent);
+      from_left = false;
     }
+    right->setParent(replacement);
+    replacement->setRight(std::move(right));
+    replacement->setParent(parent);
+    moved = replacement;
   }
-  to_remove.reset();
+
+  if (parent == nullptr)
+    root_ = std::move(replacement);
+  else if (is_left)
+    parent->setLeft(std::move(replacement));
+  else
+    parent->setRight(std::move(replacement));
+
+  // to_remove keeps no links into the tree
+  to_remove->setParent(nullptr);
+  to_remove->setLeft(nullptr);
+  to_remove->setRight(nullptr);
 }
 
+// Returns the next node in key order, or null. Without a right subtree
+// it climbs until it leaves a left subtree; the sides are told by the links,
+// so no keys are compared.
 template <class Key, class Value>
 std::shared_ptr<Node<Key, Value>> BinarySearchTree<Key, Value>::successor(
     std::shared_ptr<Node<Key, Value>> current) {
@@ -530,50 +1106,21 @@ std::shared_ptr<Node<Key, Value>> BinarySearchTree<Key, Value>::successor(
   // Path down tree
   if (current->getRight() != nullptr) {
     current = current->getRight();
-    while (current != nullptr) {
-      if (current->getLeft() == nullptr) {
-        return current;
-      }
+    while (current->getLeft() != nullptr)
       current = current->getLeft();
-    }
-    return nullptr;
+    return current;
   }
 
   // Path up tree
-  if (current->getRight() == nullptr && current->getParent() != nullptr) {
-
-    // if parent is less than child, right_child
-    // this means skip over the parent and go straight to gp looking for first
-    // l.c.
-    bool right_child = false;
-    std::shared_ptr<Node<Key, Value>> parent = current->getParent();
-    if (parent->getKey() < current->getKey()) {
-      right_child = true;
-    }
-
-    // case for right child, path up tree towards successor
-    while (parent != nullptr && right_child) {
-      // c is now b
-      current = current->getParent();
-      // parent = d
-      parent = current->getParent();
-      if (parent != nullptr) {
-        // left child check
-        if (parent->getKey() > current->getKey()) {
-          return parent;
-        }
-      }
-    }
-    if (parent != nullptr && !right_child) {
-      if (parent->getKey() > current->getKey()) {
-        return parent;
-      }
-      return nullptr;
-    }
+  std::shared_ptr<Node<Key, Value>> parent = current->getParent();
+  while (parent != nullptr && parent->getRight() == current) {
+    current = std::move(parent);
+    parent = current->getParent();
   }
-  return nullptr;
+  return parent;
 }
 
+// Mirror image of successor().
 template <class Key, class Value>
 std::shared_ptr<Node<Key, Value>> BinarySearchTree<Key, Value>::predecessor(
     std::shared_ptr<Node<Key, Value>> current) {
@@ -585,46 +1132,18 @@ std::shared_ptr<Node<Key, Value>> BinarySearchTree<Key, Value>::predecessor(
   // Path down tree
   if (current->getLeft() != nullptr) {
     current = current->getLeft();
-    while (current != nullptr) {
-      if (current->getRight() == nullptr) {
-        return current;
-      }
+    while (current->getRight() != nullptr)
       current = current->getRight();
-    }
-    return nullptr;
+    return current;
   }
 
   // Path up tree
-  if (current->getLeft() == nullptr && current->getParent() != nullptr) {
-    // if parent is less than child, right_child
-    // this means skip over the parent and go straight to gp looking for first
-    // l.c.
-    bool left_child = false;
-    std::shared_ptr<Node<Key, Value>> parent = current->getParent();
-    if (parent->getKey() > current->getKey()) {
-      left_child = true;
-    }
-    // case for left child, path up tree towards predecessor
-    while (parent != nullptr && left_child) {
-      // e is now f
-      current = current->getParent();
-      // parent = d
-      parent = current->getParent();
-      if (parent != nullptr) {
-        // left child check
-        if (parent->getKey() < current->getKey()) {
-          return parent;
-        }
-      }
-    }
-    if (parent != nullptr && !left_child) {
-      if (parent->getKey() < current->getKey()) {
-        return parent;
-      }
-      return nullptr;
-    }
+  std::shared_ptr<Node<Key, Value>> parent = current->getParent();
+  while (parent != nullptr && parent->getLeft() == current) {
+    current = std::move(parent);
+    parent = current->getParent();
   }
-  return nullptr;
+  return parent;
 }
 
 // A method to remove all contents of the tree and
@@ -634,6 +1153,8 @@ void BinarySearchTree<Key, Value>::clear() {
   std::shared_ptr<Node<Key, Value>> root = root_;
   clear_help(root);
   root_.reset();
+  leftmost_.reset();
+  rightmost_.reset();
 }
 
 template <typename Key, typename Value>
@@ -652,13 +1173,8 @@ void BinarySearchTree<Key, Value>::clear_help(
     return;
   }
 
-  // delete node
-  bool isLeft = true;
-  if (ptr->getParent() != nullptr) {
-    if (ptr->getKey() > ptr->getParent()->getKey()) {
-      isLeft = false;
-    }
-  }
+  // delete node, telling the side from the links rather than the keys
+  bool isLeft = ptr->getParent()->getLeft() == ptr;
   ptr = ptr->getParent();
   if (isLeft)
     ptr->setLeft(nullptr);
@@ -670,13 +1186,14 @@ void BinarySearchTree<Key, Value>::clear_help(
 template <typename Key, typename Value>
 std::shared_ptr<Node<Key, Value>>
 BinarySearchTree<Key, Value>::getSmallestNode() const {
-  std::shared_ptr<Node<Key, Value>> ptr = root_;
-  if (ptr == nullptr)
-    return ptr;
-  while (ptr->getLeft() != nullptr) {
-    ptr = ptr->getLeft();
-  }
-  return ptr;
+  return leftmost_;
+}
+
+// A helper function to find the largest node in the tree.
+template <typename Key, typename Value>
+std::shared_ptr<Node<Key, Value>>
+BinarySearchTree<Key, Value>::getLargestNode() const {
+  return rightmost_;
 }
 
 // Helper function to find a node with given key, k and
@@ -700,7 +1217,7 @@ BinarySearchTree<Key, Value>::internalFind(const Key &key) const {
       return ptr;
 
     // look left
-    else if (ptr->getKey() > key)
+    else if (key < ptr->getKey())
       ptr = ptr->getLeft();
 
     // look right
@@ -0,0 +1,238 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A fixed number of in-memory frames caching the pages of one file, read
+// and written with pread/pwrite. Pages are pinned while in use and only
+// unpinned pages are evicted, chosen by the clock algorithm: a hand sweeps
+// the frames, passing over (and clearing) the ones used since its last
+// visit. Dirty pages are written back when evicted or flushed.
+class BufferPool {
+public:
+  static const size_t kPageSize = 4096;
+  static const uint32_t kNoPage = 0xffffffff;
+
+  // A pinned page, unpinned when the last copy of the handle goes away.
+  class Page {
+  public:
+    Page() : pool_(nullptr), frame_(0) {}
+    Page(const Page &other) : pool_(other.pool_), frame_(other.frame_) {
+      if (pool_ != nullptr)
+        pool_->frames_[frame_].pins++;
+    }
+    Page &operator=(const Page &other) {
+      Page copy(other);
+      std::swap(pool_, copy.pool_);
+      std::swap(frame_, copy.frame_);
+      return *this;
+    }
+    ~Page() {
+      if (pool_ != nullptr)
+        pool_->frames_[frame_].pins--;
+    }
+
+    bool valid() const { return pool_ != nullptr; }
+    uint32_t id() const { return pool_->frames_[frame_].page; }
+    char *data() const { return pool_->frameData(frame_); }
+    // Marks the page as changed, so it is written back before eviction.
+    void dirty() const { pool_->frames_[frame_].dirty = true; }
+    BufferPool *pool() const { return pool_; }
+
+  protected:
+    friend class BufferPool;
+    Page(BufferPool *pool, size_t frame) : pool_(pool), frame_(frame) {
+      pool_->frames_[frame_].pins++;
+    }
+
+    BufferPool *pool_;
+    size_t frame_;
+  };
+
+  BufferPool(const std::string &path, size_t frames);
+  // Writes back dirty pages, but does not fsync.
+  ~BufferPool();
+
+  Page pin(uint32_t page);
+  // Pins a page that is about to be overwritten: it is zeroed rather than
+  // read.
+  Page pinNew(uint32_t page);
+  // Writes back every dirty page and fsyncs the file.
+  void flush();
+
+  // Pages in the file when it was opened.
+  size_t filePages() const { return file_pages_; }
+  size_t frames() const { return frames_.size(); }
+  size_t reads() const { return reads_; }
+  size_t writes() const { return writes_; }
+
+protected:
+  BufferPool(const BufferPool &);
+  BufferPool &operator=(const BufferPool &);
+
+  struct Frame {
+    uint32_t page;
+    unsigned pins;
+    bool referenced;
+    bool dirty;
+  };
+
+  char *frameData(size_t frame) {
+    return reinterpret_cast<char *>(&memory_[frame * kPageSize / 8]);
+  }
+  size_t frameFor(uint32_t page, bool read);
+  size_t victim();
+  void writeBack(size_t frame);
+
+  std::string path_;
+  int fd_;
+  size_t file_pages_;
+  // 8-byte words so that every frame is aligned for any key or value
+  std::vector<uint64_t> memory_;
+  std::vector<Frame> frames_;
+  std::unordered_map<uint32_t, size_t> resident_;
+  size_t hand_;
+  size_t reads_;
+  size_t writes_;
+};
+
+// -----------------------------------------------
+// Begin implementations for the BufferPool class.
+// -----------------------------------------------
+
+inline BufferPool::BufferPool(const std::string &path, size_t frames)
+    : path_(path), memory_(frames * kPageSize / 8), frames_(frames), hand_(0),
+      reads_(0), writes_(0) {
+  if (frames == 0)
+    throw std::invalid_argument("a buffer pool needs at least one frame");
+  for (size_t i = 0; i < frames; i++) {
+    frames_[i].page = kNoPage;
+    frames_[i].pins = 0;
+    frames_[i].referenced = false;
+    frames_[i].dirty = false;
+  }
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat info;
+  if (fd_ < 0 || fstat(fd_, &info) != 0) {
+    if (fd_ >= 0)
+      close(fd_);
+    throw std::runtime_error("cannot open " + path);
+  }
+  file_pages_ = info.st_size / kPageSize;
+}
+
+inline BufferPool::~BufferPool() {
+  try {
+    for (size_t i = 0; i < frames_.size(); i++)
+      writeBack(i);
+  } catch (const std::runtime_error &) {
+    // nothing more can be done about it here
+  }
+  close(fd_);
+}
+
+inline BufferPool::Page BufferPool::pin(uint32_t page) {
+  return Page(this, frameFor(page, true));
+}
+
+inline BufferPool::Page BufferPool::pinNew(uint32_t page) {
+  size_t frame = frameFor(page, false);
+  std::memset(frameData(frame), 0, kPageSize);
+  frames_[frame].dirty = true;
+  return Page(this, frame);
+}
+
+inline void BufferPool::flush() {
+  for (size_t i = 0; i < frames_.size(); i++)
+    writeBack(i);
+  if (fsync(fd_) != 0)
+    throw std::runtime_error("cannot sync " + path_);
+}
+
+inline size_t BufferPool::frameFor(uint32_t page, bool read) {
+  std::unordered_map<uint32_t, size_t>::iterator found = resident_.find(page);
+  if (found != resident_.end()) {
+    frames_[found->second].referenced = true;
+    return found->second;
+  }
+
+  size_t frame = victim();
+  writeBack(frame);
+  if (frames_[frame].page != kNoPage)
+    resident_.erase(frames_[frame].page);
+  frames_[frame].page = kNoPage;
+
+  if (read) {
+    char *data = frameData(frame);
+    size_t got = 0;
+    while (got < kPageSize) {
+      ssize_t n = pread(fd_, data + got, kPageSize - got,
+                        static_cast<off_t>(page) * kPageSize + got);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        throw std::runtime_error("cannot read " + path_);
+      if (n == 0)
+        throw std::runtime_error(path_ + " is shorter than its pages");
+      got += n;
+    }
+    reads_++;
+  }
+  frames_[frame].page = page;
+  frames_[frame].referenced = true;
+  frames_[frame].dirty = false;
+  resident_[page] = frame;
+  return frame;
+}
+
+// Two sweeps clear every reference bit, so an unpinned frame is always
+// found by then if there is one.
+inline size_t BufferPool::victim() {
+  for (size_t step = 0; step < 2 * frames_.size(); step++) {
+    size_t frame = hand_;
+    hand_ = (hand_ + 1) % frames_.size();
+    if (frames_[frame].pins > 0)
+      continue;
+    if (frames_[frame].referenced) {
+      frames_[frame].referenced = false;
+      continue;
+    }
+    return frame;
+  }
+  throw std::runtime_error("every page in the buffer pool is pinned");
+}
+
+inline void BufferPool::writeBack(size_t frame) {
+  if (!frames_[frame].dirty)
+    return;
+  const char *data = frameData(frame);
+  off_t offset = static_cast<off_t>(frames_[frame].page) * kPageSize;
+  size_t put = 0;
+  while (put < kPageSize) {
+    ssize_t n = pwrite(fd_, data + put, kPageSize - put, offset + put);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw std::runtime_error("cannot write " + path_);
+    put += n;
+  }
+  frames_[frame].dirty = false;
+  writes_++;
+}
+
+// ---------------------------------------------
+// End implementations for the BufferPool class.
+// ---------------------------------------------
+
+#endif
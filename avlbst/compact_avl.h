@@ -0,0 +1,841 @@
+#ifndef COMPACT_AVL_H
+#define COMPACT_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// AVL trees for very large key counts. Nodes live in one contiguous arena
+// and link to each other with 32-bit indices instead of shared_ptrs, and the
+// balance factor is packed into the top two bits of the parent index. A node
+// is its payload and 12 bytes of links, so a <uint64_t, uint64_t> node is 32
+// bytes with no control block and no vtable.
+//
+// Index 0 is the null link and node i lives in nodes_[i - 1]. Removed slots
+// are chained through their left link and reused by later inserts. The arena
+// may move when it grows, but an index (and so an iterator) stays valid
+// until its own item is removed.
+
+// Node holding a key and its value inline.
+template <class Key, class Value> struct CompactAVLSlot {
+  CompactAVLSlot(const Key &k, const Value &v, uint32_t parent_bal)
+      : key(k), value(v), left(0), right(0), parent_bal(parent_bal) {}
+
+  Key key;
+  Value value;
+  uint32_t left;
+  uint32_t right;
+  // parent index in the low 30 bits, balance + 1 in the top 2
+  uint32_t parent_bal;
+};
+
+// Node holding only a key, for sets and for trees that keep values apart.
+template <class Key> struct CompactAVLKeySlot {
+  CompactAVLKeySlot(const Key &k, uint32_t parent_bal)
+      : key(k), left(0), right(0), parent_bal(parent_bal) {}
+
+  Key key;
+  uint32_t left;
+  uint32_t right;
+  uint32_t parent_bal;
+};
+
+// The arena, links and rebalancing shared by CompactAVLTree and AVLSet.
+// Slot is any node type with key, left, right and parent_bal members.
+template <class Key, class Slot> class CompactAVLBase {
+public:
+  CompactAVLBase();
+
+  bool empty() const;
+  size_t size() const;
+  bool isBalanced() const;
+
+protected:
+  static const uint32_t kNil = 0;
+  static const uint32_t kIndexMask = 0x3FFFFFFF;
+  static const int kBalanceShift = 30;
+
+  Slot &slot(uint32_t n) { return nodes_[n - 1]; }
+  const Slot &slot(uint32_t n) const { return nodes_[n - 1]; }
+
+  uint32_t parent(uint32_t n) const;
+  void setParent(uint32_t n, uint32_t parent);
+  int balance(uint32_t n) const;
+  void setBalance(uint32_t n, int balance);
+
+  uint32_t allocate(const Slot &node);
+  void release(uint32_t n);
+  void clearNodes();
+
+  uint32_t findIndex(const Key &key) const;
+  uint32_t findSlot(const Key &key, uint32_t &parent, bool &is_left) const;
+  uint32_t first() const;
+  uint32_t successor(uint32_t n) const;
+  void attach(uint32_t parent, bool is_left, uint32_t n);
+  void unlink(uint32_t n);
+  void replaceChild(uint32_t parent, uint32_t old_child, uint32_t new_child);
+
+  void rotateLeft(uint32_t p, uint32_t n);
+  void rotateRight(uint32_t p, uint32_t n);
+  void insertFix(uint32_t p, uint32_t n);
+  void removeFix(uint32_t n, int diff);
+  int checkHeight(uint32_t n) const;
+
+  std::vector<Slot> nodes_;
+  uint32_t root_;
+  uint32_t free_;
+  size_t size_;
+};
+
+// An ordered map on the compact arena.
+//
+// With ColdValues set, nodes hold only the key and links and the values go
+// in a parallel array, so a descent touches keys alone and more nodes fit in
+// each cache line. A value is only loaded when its key is found. This pays
+// off once values are larger than the keys.
+template <class Key, class Value, bool ColdValues = false>
+class CompactAVLTree
+    : public CompactAVLBase<
+          Key, typename std::conditional<ColdValues, CompactAVLKeySlot<Key>,
+                                         CompactAVLSlot<Key, Value>>::type> {
+public:
+  // What an iterator points at. The key is read-only, the value writable.
+  struct reference {
+    const Key &first;
+    Value &second;
+  };
+
+  class iterator {
+  public:
+    // Lets it->first / it->second work on the proxy reference.
+    struct pointer {
+      reference ref;
+      const reference *operator->() const { return &ref; }
+    };
+
+    iterator();
+
+    reference operator*() const;
+    pointer operator->() const;
+
+    bool operator==(const iterator &rhs) const;
+    bool operator!=(const iterator &rhs) const;
+
+    iterator &operator++();
+
+  protected:
+    friend class CompactAVLTree<Key, Value, ColdValues>;
+    iterator(CompactAVLTree<Key, Value, ColdValues> *tree, uint32_t index);
+    CompactAVLTree<Key, Value, ColdValues> *tree_;
+    uint32_t index_;
+  };
+
+  void insert(const std::pair<const Key, Value> &keyValuePair);
+  void remove(const Key &key);
+  void clear();
+  void reserve(size_t count);
+
+  iterator begin() const;
+  iterator end() const;
+  iterator find(const Key &key) const;
+
+protected:
+  typedef typename std::conditional<ColdValues, CompactAVLKeySlot<Key>,
+                                    CompactAVLSlot<Key, Value>>::type Slot;
+  typedef CompactAVLBase<Key, Slot> Base;
+  typedef std::integral_constant<bool, ColdValues> ColdTag;
+
+  using Base::kNil;
+  using Base::kBalanceShift;
+  using Base::slot;
+  using Base::nodes_;
+
+  Value &value(uint32_t n) { return value(n, ColdTag()); }
+  Value &value(uint32_t n, std::false_type) { return slot(n).value; }
+  Value &value(uint32_t n, std::true_type) { return values_[n - 1]; }
+  uint32_t allocate(const Key &key, const Value &value, uint32_t parent,
+                    std::false_type);
+  uint32_t allocate(const Key &key, const Value &value, uint32_t parent,
+                    std::true_type);
+
+  // values by node index, only used with ColdValues
+  std::vector<Value> values_;
+};
+
+// An ordered set on the compact arena. Nodes hold only the key, so there is
+// no dummy value per item.
+template <class Key>
+class AVLSet : public CompactAVLBase<Key, CompactAVLKeySlot<Key>> {
+public:
+  class iterator {
+  public:
+    iterator();
+
+    const Key &operator*() const;
+    const Key *operator->() const;
+
+    bool operator==(const iterator &rhs) const;
+    bool operator!=(const iterator &rhs) const;
+
+    iterator &operator++();
+
+  protected:
+    friend class AVLSet<Key>;
+    iterator(const AVLSet<Key> *set, uint32_t index);
+    const AVLSet<Key> *set_;
+    uint32_t index_;
+  };
+
+  bool insert(const Key &key);
+  bool contains(const Key &key) const;
+  void remove(const Key &key);
+  void clear();
+  void reserve(size_t count);
+
+  iterator begin() const;
+  iterator end() const;
+  iterator find(const Key &key) const;
+
+protected:
+  typedef CompactAVLKeySlot<Key> Slot;
+  typedef CompactAVLBase<Key, Slot> Base;
+
+  using Base::kNil;
+  using Base::kBalanceShift;
+  using Base::slot;
+};
+
+// -----------------------------------------------
+// Begin implementations for the CompactAVLBase class.
+// -----------------------------------------------
+
+template <class Key, class Slot>
+CompactAVLBase<Key, Slot>::CompactAVLBase()
+    : root_(kNil), free_(kNil), size_(0) {}
+
+template <class Key, class Slot>
+bool CompactAVLBase<Key, Slot>::empty() const {
+  return size_ == 0;
+}
+
+template <class Key, class Slot>
+size_t CompactAVLBase<Key, Slot>::size() const {
+  return size_;
+}
+
+// Checks every stored balance against the real subtree heights.
+template <class Key, class Slot>
+bool CompactAVLBase<Key, Slot>::isBalanced() const {
+  return checkHeight(root_) >= 0;
+}
+
+template <class Key, class Slot>
+uint32_t CompactAVLBase<Key, Slot>::parent(uint32_t n) const {
+  return slot(n).parent_bal & kIndexMask;
+}
+
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::setParent(uint32_t n, uint32_t parent) {
+  Slot &s = slot(n);
+  s.parent_bal = (s.parent_bal & ~kIndexMask) | parent;
+}
+
+template <class Key, class Slot>
+int CompactAVLBase<Key, Slot>::balance(uint32_t n) const {
+  return static_cast<int>(slot(n).parent_bal >> kBalanceShift) - 1;
+}
+
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::setBalance(uint32_t n, int balance) {
+  Slot &s = slot(n);
+  s.parent_bal = (s.parent_bal & kIndexMask) |
+                 (static_cast<uint32_t>(balance + 1) << kBalanceShift);
+}
+
+// Stores node in a slot off the free list, or grows the arena if there is
+// none. Returns its index.
+template <class Key, class Slot>
+uint32_t CompactAVLBase<Key, Slot>::allocate(const Slot &node) {
+  if (free_ != kNil) {
+    uint32_t n = free_;
+    free_ = slot(n).left;
+    slot(n) = node;
+    size_++;
+    return n;
+  }
+  if (nodes_.size() >= kIndexMask)
+    throw std::length_error("compact AVL arena is full");
+  nodes_.push_back(node);
+  size_++;
+  return static_cast<uint32_t>(nodes_.size());
+}
+
+// Puts a slot on the free list. Its payload is only overwritten when the
+// slot is reused.
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::release(uint32_t n) {
+  size_--;
+  slot(n).left = free_;
+  free_ = n;
+}
+
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::clearNodes() {
+  nodes_.clear();
+  root_ = kNil;
+  free_ = kNil;
+  size_ = 0;
+}
+
+template <class Key, class Slot>
+uint32_t CompactAVLBase<Key, Slot>::findIndex(const Key &key) const {
+  uint32_t cur = root_;
+  while (cur != kNil) {
+    const Slot &s = slot(cur);
+    if (key < s.key)
+      cur = s.left;
+    else if (s.key < key)
+      cur = s.right;
+    else
+      return cur;
+  }
+  return kNil;
+}
+
+// Returns the node holding key, or kNil with parent and is_left set to the
+// empty link where it would go.
+template <class Key, class Slot>
+uint32_t CompactAVLBase<Key, Slot>::findSlot(const Key &key,
+                                             uint32_t &parent,
+                                             bool &is_left) const {
+  parent = kNil;
+  is_left = false;
+  uint32_t cur = root_;
+  while (cur != kNil) {
+    const Slot &s = slot(cur);
+    if (key < s.key) {
+      parent = cur;
+      cur = s.left;
+      is_left = true;
+    } else if (s.key < key) {
+      parent = cur;
+      cur = s.right;
+      is_left = false;
+    } else
+      return cur;
+  }
+  return kNil;
+}
+
+template <class Key, class Slot>
+uint32_t CompactAVLBase<Key, Slot>::first() const {
+  uint32_t n = root_;
+  if (n != kNil) {
+    while (slot(n).left != kNil)
+      n = slot(n).left;
+  }
+  return n;
+}
+
+template <class Key, class Slot>
+uint32_t CompactAVLBase<Key, Slot>::successor(uint32_t n) const {
+  if (slot(n).right != kNil) {
+    n = slot(n).right;
+    while (slot(n).left != kNil)
+      n = slot(n).left;
+    return n;
+  }
+  uint32_t p = parent(n);
+  while (p != kNil && slot(p).right == n) {
+    n = p;
+    p = parent(p);
+  }
+  return p;
+}
+
+// Links the new leaf n into the empty is_left link of parent (or as the
+// root) and rebalances above it.
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::attach(uint32_t parent, bool is_left,
+                                       uint32_t n) {
+  if (parent == kNil) {
+    root_ = n;
+    return;
+  }
+
+  int bal;
+  if (is_left) {
+    slot(parent).left = n;
+    bal = balance(parent) - 1;
+  } else {
+    slot(parent).right = n;
+    bal = balance(parent) + 1;
+  }
+  setBalance(parent, bal);
+  if (bal != 0)
+    insertFix(parent, n);
+}
+
+// Unlinks n and rebalances. A node with two children is replaced by its
+// predecessor, which is relinked into its place and takes its balance.
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::unlink(uint32_t n) {
+  uint32_t p = parent(n);
+  uint32_t left = slot(n).left;
+  uint32_t right = slot(n).right;
+  uint32_t shrunk;
+  int diff;
+
+  // zero or one child: the child (if any) takes n's place
+  if (left == kNil || right == kNil) {
+    uint32_t child = left != kNil ? left : right;
+    if (child != kNil)
+      setParent(child, p);
+    shrunk = p;
+    diff = (p != kNil && slot(p).left == n) ? 1 : -1;
+    replaceChild(p, n, child);
+  }
+  // two children: the predecessor takes n's place and balance
+  else {
+    uint32_t pred = left;
+    while (slot(pred).right != kNil)
+      pred = slot(pred).right;
+
+    if (pred == left) {
+      shrunk = pred;
+      diff = 1;
+    } else {
+      uint32_t pred_parent = parent(pred);
+      uint32_t pred_left = slot(pred).left;
+      if (pred_left != kNil)
+        setParent(pred_left, pred_parent);
+      slot(pred_parent).right = pred_left;
+      slot(pred).left = left;
+      setParent(left, pred);
+      shrunk = pred_parent;
+      diff = -1;
+    }
+    slot(pred).right = right;
+    setParent(right, pred);
+    setParent(pred, p);
+    setBalance(pred, balance(n));
+    replaceChild(p, n, pred);
+  }
+
+  if (shrunk != kNil)
+    removeFix(shrunk, diff);
+}
+
+// Points whichever link of parent held old_child (or the root) at new_child.
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::replaceChild(uint32_t parent,
+                                             uint32_t old_child,
+                                             uint32_t new_child) {
+  if (parent == kNil)
+    root_ = new_child;
+  else if (slot(parent).left == old_child)
+    slot(parent).left = new_child;
+  else
+    slot(parent).right = new_child;
+}
+
+// Pre condition: p is the parent of n
+// Post condition: p is the left child of n
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::rotateLeft(uint32_t p, uint32_t n) {
+  uint32_t gp = parent(p);
+  replaceChild(gp, p, n);
+  setParent(n, gp);
+
+  uint32_t inner = slot(n).left;
+  slot(p).right = inner;
+  if (inner != kNil)
+    setParent(inner, p);
+
+  slot(n).left = p;
+  setParent(p, n);
+}
+
+// Pre condition: p is the parent of n
+// Post condition: p is the right child of n
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::rotateRight(uint32_t p, uint32_t n) {
+  uint32_t gp = parent(p);
+  replaceChild(gp, p, n);
+  setParent(n, gp);
+
+  uint32_t inner = slot(n).right;
+  slot(p).left = inner;
+  if (inner != kNil)
+    setParent(inner, p);
+
+  slot(n).right = p;
+  setParent(p, n);
+}
+
+// p's subtree just got taller through its child n. Same walk as
+// AVLTree::insertFix.
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::insertFix(uint32_t p, uint32_t n) {
+  uint32_t gp = parent(p);
+  while (gp != kNil) {
+    //  p is left child of gp
+    if (slot(gp).left == p) {
+      int bal = balance(gp) - 1;
+      setBalance(gp, bal);
+      if (bal == 0)
+        return;
+      if (bal == -2) {
+        if (balance(p) == -1) { // zig-zig
+          rotateRight(gp, p);
+          setBalance(gp, 0);
+          setBalance(p, 0);
+        } else { // zig-zag
+          n = slot(p).right;
+          rotateLeft(p, n);
+          rotateRight(gp, n);
+          setBalance(gp, balance(n) == -1 ? 1 : 0);
+          setBalance(p, balance(n) == 1 ? -1 : 0);
+          setBalance(n, 0);
+        }
+        return;
+      }
+    }
+
+    //  p is right child of gp
+    else {
+      int bal = balance(gp) + 1;
+      setBalance(gp, bal);
+      if (bal == 0)
+        return;
+      if (bal == 2) {
+        if (balance(p) == 1) { // zig-zig
+          rotateLeft(gp, p);
+          setBalance(gp, 0);
+          setBalance(p, 0);
+        } else { // zig-zag
+          n = slot(p).left;
+          rotateRight(p, n);
+          rotateLeft(gp, n);
+          setBalance(gp, balance(n) == 1 ? -1 : 0);
+          setBalance(p, balance(n) == -1 ? 1 : 0);
+          setBalance(n, 0);
+        }
+        return;
+      }
+    }
+
+    n = p;
+    p = gp;
+    gp = parent(p);
+  }
+}
+
+// n's subtree on one side just got shorter: diff is +1 if it was the left
+// side, -1 if it was the right. Same walk as AVLTree::removeFix.
+template <class Key, class Slot>
+void CompactAVLBase<Key, Slot>::removeFix(uint32_t n, int diff) {
+  while (n != kNil) {
+    uint32_t p = parent(n);
+    int ndiff = (p != kNil && slot(p).left == n) ? 1 : -1;
+    int bal = balance(n) + diff;
+
+    // left side now too tall
+    if (bal == -2) {
+      uint32_t c = slot(n).left;
+      if (balance(c) == -1) { // zig-zig
+        rotateRight(n, c);
+        setBalance(n, 0);
+        setBalance(c, 0);
+      } else if (balance(c) == 0) { // zig-zig, height unchanged
+        rotateRight(n, c);
+        setBalance(n, -1);
+        setBalance(c, 1);
+        return;
+      } else { // zig-zag
+        uint32_t g = slot(c).right;
+        rotateLeft(c, g);
+        rotateRight(n, g);
+        setBalance(n, balance(g) == -1 ? 1 : 0);
+        setBalance(c, balance(g) == 1 ? -1 : 0);
+        setBalance(g, 0);
+      }
+    }
+
+    // right side now too tall
+    else if (bal == 2) {
+      uint32_t c = slot(n).right;
+      if (balance(c) == 1) { // zig-zig
+        rotateLeft(n, c);
+        setBalance(n, 0);
+        setBalance(c, 0);
+      } else if (balance(c) == 0) { // zig-zig, height unchanged
+        rotateLeft(n, c);
+        setBalance(n, 1);
+        setBalance(c, -1);
+        return;
+      } else { // zig-zag
+        uint32_t g = slot(c).left;
+        rotateRight(c, g);
+        rotateLeft(n, g);
+        setBalance(n, balance(g) == 1 ? -1 : 0);
+        setBalance(c, balance(g) == -1 ? 1 : 0);
+        setBalance(g, 0);
+      }
+    }
+
+    // n leans one way but its height is unchanged
+    else if (bal == -1 || bal == 1) {
+      setBalance(n, bal);
+      return;
+    }
+
+    // n got shorter
+    else
+      setBalance(n, 0);
+
+    n = p;
+    diff = ndiff;
+  }
+}
+
+// Returns the height of n's subtree, or -1 if any stored balance (or the
+// AVL property) is wrong below it.
+template <class Key, class Slot>
+int CompactAVLBase<Key, Slot>::checkHeight(uint32_t n) const {
+  if (n == kNil)
+    return 0;
+  int hl = checkHeight(slot(n).left);
+  int hr = checkHeight(slot(n).right);
+  if (hl < 0 || hr < 0 || hr - hl != balance(n) || hr - hl < -1 ||
+      hr - hl > 1)
+    return -1;
+  return (hl > hr ? hl : hr) + 1;
+}
+
+// -----------------------------------------------
+// End implementations for the CompactAVLBase class.
+// -----------------------------------------------
+
+// -----------------------------------------------
+// Begin implementations for the CompactAVLTree class.
+// -----------------------------------------------
+
+template <class Key, class Value, bool ColdValues>
+CompactAVLTree<Key, Value, ColdValues>::iterator::iterator()
+    : tree_(NULL), index_(kNil) {}
+
+template <class Key, class Value, bool ColdValues>
+CompactAVLTree<Key, Value, ColdValues>::iterator::iterator(
+    CompactAVLTree<Key, Value, ColdValues> *tree, uint32_t index)
+    : tree_(tree), index_(index) {}
+
+template <class Key, class Value, bool ColdValues>
+typename CompactAVLTree<Key, Value, ColdValues>::reference
+    CompactAVLTree<Key, Value, ColdValues>::iterator::operator*() const {
+  reference ref = {tree_->slot(index_).key, tree_->value(index_)};
+  return ref;
+}
+
+template <class Key, class Value, bool ColdValues>
+typename CompactAVLTree<Key, Value, ColdValues>::iterator::pointer
+    CompactAVLTree<Key, Value, ColdValues>::iterator::operator->() const {
+  pointer ptr = {**this};
+  return ptr;
+}
+
+template <class Key, class Value, bool ColdValues>
+bool CompactAVLTree<Key, Value, ColdValues>::iterator::operator==(
+    const iterator &rhs) const {
+  return index_ == rhs.index_;
+}
+
+template <class Key, class Value, bool ColdValues>
+bool CompactAVLTree<Key, Value, ColdValues>::iterator::operator!=(
+    const iterator &rhs) const {
+  return index_ != rhs.index_;
+}
+
+template <class Key, class Value, bool ColdValues>
+typename CompactAVLTree<Key, Value, ColdValues>::iterator &
+CompactAVLTree<Key, Value, ColdValues>::iterator::operator++() {
+  index_ = tree_->successor(index_);
+  return *this;
+}
+
+// Inserts the pair, overwriting the value if the key is already present.
+template <class Key, class Value, bool ColdValues>
+void CompactAVLTree<Key, Value, ColdValues>::insert(
+    const std::pair<const Key, Value> &keyValuePair) {
+  uint32_t p;
+  bool is_left;
+  uint32_t n = this->findSlot(keyValuePair.first, p, is_left);
+  if (n != kNil) {
+    value(n) = keyValuePair.second;
+    return;
+  }
+  n = allocate(keyValuePair.first, keyValuePair.second, p, ColdTag());
+  this->attach(p, is_left, n);
+}
+
+// Removes the key if present.
+template <class Key, class Value, bool ColdValues>
+void CompactAVLTree<Key, Value, ColdValues>::remove(const Key &key) {
+  uint32_t n = this->findIndex(key);
+  if (n == kNil)
+    return;
+  this->unlink(n);
+  this->release(n);
+}
+
+template <class Key, class Value, bool ColdValues>
+void CompactAVLTree<Key, Value, ColdValues>::clear() {
+  this->clearNodes();
+  values_.clear();
+}
+
+// Reserves arena space for count items, so inserting them never moves it.
+template <class Key, class Value, bool ColdValues>
+void CompactAVLTree<Key, Value, ColdValues>::reserve(size_t count) {
+  nodes_.reserve(count);
+  if (ColdValues)
+    values_.reserve(count);
+}
+
+template <class Key, class Value, bool ColdValues>
+typename CompactAVLTree<Key, Value, ColdValues>::iterator
+CompactAVLTree<Key, Value, ColdValues>::begin() const {
+  return iterator(const_cast<CompactAVLTree<Key, Value, ColdValues> *>(this),
+                  this->first());
+}
+
+template <class Key, class Value, bool ColdValues>
+typename CompactAVLTree<Key, Value, ColdValues>::iterator
+CompactAVLTree<Key, Value, ColdValues>::end() const {
+  return iterator(const_cast<CompactAVLTree<Key, Value, ColdValues> *>(this),
+                  kNil);
+}
+
+template <class Key, class Value, bool ColdValues>
+typename CompactAVLTree<Key, Value, ColdValues>::iterator
+CompactAVLTree<Key, Value, ColdValues>::find(const Key &key) const {
+  return iterator(const_cast<CompactAVLTree<Key, Value, ColdValues> *>(this),
+                  this->findIndex(key));
+}
+
+// Inline layout: the value goes in the node.
+template <class Key, class Value, bool ColdValues>
+uint32_t CompactAVLTree<Key, Value, ColdValues>::allocate(const Key &key,
+                                                          const Value &value,
+                                                          uint32_t parent,
+                                                          std::false_type) {
+  return Base::allocate(Slot(key, value, parent | (1u << kBalanceShift)));
+}
+
+// Cold layout: the value goes in values_ at the node's index, growing it to
+// match nodes_.
+template <class Key, class Value, bool ColdValues>
+uint32_t CompactAVLTree<Key, Value, ColdValues>::allocate(const Key &key,
+                                                          const Value &value,
+                                                          uint32_t parent,
+                                                          std::true_type) {
+  uint32_t n = Base::allocate(Slot(key, parent | (1u << kBalanceShift)));
+  if (values_.size() < n)
+    values_.push_back(value);
+  else
+    values_[n - 1] = value;
+  return n;
+}
+
+// -----------------------------------------------
+// End implementations for the CompactAVLTree class.
+// -----------------------------------------------
+
+// -----------------------------------------------
+// Begin implementations for the AVLSet class.
+// -----------------------------------------------
+
+template <class Key>
+AVLSet<Key>::iterator::iterator() : set_(NULL), index_(kNil) {}
+
+template <class Key>
+AVLSet<Key>::iterator::iterator(const AVLSet<Key> *set, uint32_t index)
+    : set_(set), index_(index) {}
+
+template <class Key> const Key &AVLSet<Key>::iterator::operator*() const {
+  return set_->slot(index_).key;
+}
+
+template <class Key> const Key *AVLSet<Key>::iterator::operator->() const {
+  return &set_->slot(index_).key;
+}
+
+template <class Key>
+bool AVLSet<Key>::iterator::operator==(const iterator &rhs) const {
+  return index_ == rhs.index_;
+}
+
+template <class Key>
+bool AVLSet<Key>::iterator::operator!=(const iterator &rhs) const {
+  return index_ != rhs.index_;
+}
+
+template <class Key>
+typename AVLSet<Key>::iterator &AVLSet<Key>::iterator::operator++() {
+  index_ = set_->successor(index_);
+  return *this;
+}
+
+// Adds key to the set. Returns false if it was already there.
+template <class Key> bool AVLSet<Key>::insert(const Key &key) {
+  uint32_t p;
+  bool is_left;
+  if (this->findSlot(key, p, is_left) != kNil)
+    return false;
+  uint32_t n = this->allocate(Slot(key, p | (1u << kBalanceShift)));
+  this->attach(p, is_left, n);
+  return true;
+}
+
+template <class Key> bool AVLSet<Key>::contains(const Key &key) const {
+  return this->findIndex(key) != kNil;
+}
+
+// Removes key if present.
+template <class Key> void AVLSet<Key>::remove(const Key &key) {
+  uint32_t n = this->findIndex(key);
+  if (n == kNil)
+    return;
+  this->unlink(n);
+  this->release(n);
+}
+
+template <class Key> void AVLSet<Key>::clear() { this->clearNodes(); }
+
+// Reserves arena space for count keys, so inserting them never moves it.
+template <class Key> void AVLSet<Key>::reserve(size_t count) {
+  this->nodes_.reserve(count);
+}
+
+template <class Key>
+typename AVLSet<Key>::iterator AVLSet<Key>::begin() const {
+  return iterator(this, this->first());
+}
+
+template <class Key> typename AVLSet<Key>::iterator AVLSet<Key>::end() const {
+  return iterator(this, kNil);
+}
+
+template <class Key>
+typename AVLSet<Key>::iterator AVLSet<Key>::find(const Key &key) const {
+  return iterator(this, this->findIndex(key));
+}
+
+// -----------------------------------------------
+// End implementations for the AVLSet class.
+// -----------------------------------------------
+
+#endif
@@ -0,0 +1,525 @@
+#ifndef EXTERNAL_BUILD_H
+#define EXTERNAL_BUILD_H
+
+#include "avl_snapshot.h"
+#include "avlbst.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct ExternalBuildOptions {
+  // Memory for the keys being sorted into runs. Half of it holds the chunk
+  // being read while the other half is sorted and written out.
+  size_t memory_bytes;
+  // Threads sorting each chunk; 0 for one per core.
+  unsigned threads;
+  // Runs merged at once, at least 2. With more runs than this, they are
+  // merged in several passes.
+  size_t fan_in;
+  // Read buffer of each run during a merge.
+  size_t merge_buffer_bytes;
+
+  ExternalBuildOptions()
+      : memory_bytes(256 << 20), threads(0), fan_in(64),
+        merge_buffer_bytes(1 << 20) {}
+};
+
+// Builds trees from files of keys too large to sort in memory. Input files
+// hold raw keys (trivially copyable) in any order, possibly repeated.
+//
+// The keys are read in fixed-size chunks, each sorted by several threads
+// while the next is read, and spilled as a sorted run; the runs are then
+// merged with a heap, dropping repeats, into one sorted file. That file is
+// read once more, in order, to build a balanced tree or to write a snapshot
+// of one. All file access is sequential except for the snapshot's pre-order
+// walk over the sorted keys.
+//
+// Temporary files are kept next to the output, named after it.
+class ExternalBuild {
+public:
+  // Sorts the keys in input into output, without repeats, and returns how
+  // many there are.
+  template <class Key>
+  static size_t sortFile(const std::string &input, const std::string &output,
+                         const ExternalBuildOptions &options =
+                             ExternalBuildOptions());
+  // Replaces the contents of tree with the keys in input, each with a
+  // default Value. Only the tree needs to fit in memory. scratch names the
+  // temporary files.
+  template <class Key, class Value>
+  static void buildTree(const std::string &input, AVLTree<Key, Value> &tree,
+                        const std::string &scratch,
+                        const ExternalBuildOptions &options =
+                            ExternalBuildOptions());
+  // Writes an AVLSnapshot of the tree buildTree would make, without
+  // building it.
+  template <class Key, class Value>
+  static void buildSnapshot(const std::string &input,
+                            const std::string &snapshot,
+                            const ExternalBuildOptions &options =
+                                ExternalBuildOptions());
+
+protected:
+  // Buffered sequential reads and writes of raw keys.
+  template <class Key> class Reader {
+  public:
+    Reader(const std::string &path, size_t buffer_items);
+    ~Reader() { close(fd_); }
+    // Reads up to count keys into out, returning how many it read.
+    size_t read(Key *out, size_t count);
+    bool next(Key &key);
+
+  protected:
+    Reader(const Reader &);
+    Reader &operator=(const Reader &);
+
+    std::string path_;
+    int fd_;
+    std::vector<Key> buffer_;
+    size_t position_;
+    size_t filled_;
+  };
+
+  template <class Key> class Writer {
+  public:
+    Writer(const std::string &path, size_t buffer_items);
+    ~Writer() { close(fd_); }
+    void write(const Key &key);
+    void write(const Key *keys, size_t count);
+    void finish();
+
+  protected:
+    Writer(const Writer &);
+    Writer &operator=(const Writer &);
+
+    std::string path_;
+    int fd_;
+    std::vector<Key> buffer_;
+  };
+
+  static void readAll(int fd, char *data, size_t len, size_t &got,
+                      const std::string &path);
+  static void writeAll(int fd, const char *data, size_t len,
+                       const std::string &path);
+  static void removeFiles(const std::vector<std::string> &paths);
+
+  template <class Key>
+  static void parallelSort(Key *keys, size_t count, unsigned threads);
+  template <class Key>
+  static void spill(std::vector<Key> &chunk, size_t count, unsigned threads,
+                    const std::string &path);
+  template <class Key>
+  static size_t merge(const std::vector<std::string> &runs,
+                      const std::string &output,
+                      const ExternalBuildOptions &options);
+  template <class Key>
+  static size_t mergeRuns(const std::vector<std::string> &runs,
+                          const std::string &output,
+                          const ExternalBuildOptions &options);
+  template <class Key, class Value>
+  static std::shared_ptr<AVLNode<Key, Value>>
+  build(Reader<Key> &reader, AVLTree<Key, Value> &tree, size_t count,
+        int &height);
+};
+
+// --------------------------------------------------
+// Begin implementations for the ExternalBuild class.
+// --------------------------------------------------
+
+template <class Key>
+ExternalBuild::Reader<Key>::Reader(const std::string &path,
+                                   size_t buffer_items)
+    : path_(path), buffer_(std::max<size_t>(buffer_items, 1)), position_(0),
+      filled_(0) {
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ < 0)
+    throw std::runtime_error("cannot open " + path);
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+template <class Key>
+size_t ExternalBuild::Reader<Key>::read(Key *out, size_t count) {
+  size_t got;
+  readAll(fd_, reinterpret_cast<char *>(out), count * sizeof(Key), got,
+          path_);
+  if (got % sizeof(Key) != 0)
+    throw std::runtime_error(path_ + " does not hold a whole number of keys");
+  return got / sizeof(Key);
+}
+
+template <class Key> bool ExternalBuild::Reader<Key>::next(Key &key) {
+  if (position_ == filled_) {
+    filled_ = read(buffer_.data(), buffer_.size());
+    position_ = 0;
+    if (filled_ == 0)
+      return false;
+  }
+  key = buffer_[position_++];
+  return true;
+}
+
+template <class Key>
+ExternalBuild::Writer<Key>::Writer(const std::string &path,
+                                   size_t buffer_items)
+    : path_(path) {
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0)
+    throw std::runtime_error("cannot create " + path);
+  buffer_.reserve(std::max<size_t>(buffer_items, 1));
+}
+
+template <class Key> void ExternalBuild::Writer<Key>::write(const Key &key) {
+  buffer_.push_back(key);
+  if (buffer_.size() == buffer_.capacity())
+    finish();
+}
+
+template <class Key>
+void ExternalBuild::Writer<Key>::write(const Key *keys, size_t count) {
+  finish();
+  writeAll(fd_, reinterpret_cast<const char *>(keys), count * sizeof(Key),
+           path_);
+}
+
+// Writes out what is buffered; the writer can still be used afterwards.
+template <class Key> void ExternalBuild::Writer<Key>::finish() {
+  writeAll(fd_, reinterpret_cast<const char *>(buffer_.data()),
+           buffer_.size() * sizeof(Key), path_);
+  buffer_.clear();
+}
+
+inline void ExternalBuild::readAll(int fd, char *data, size_t len,
+                                   size_t &got, const std::string &path) {
+  got = 0;
+  while (got < len) {
+    ssize_t n = ::read(fd, data + got, len - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw std::runtime_error("cannot read " + path);
+    if (n == 0)
+      return;
+    got += n;
+  }
+}
+
+inline void ExternalBuild::writeAll(int fd, const char *data, size_t len,
+                                    const std::string &path) {
+  while (len > 0) {
+    ssize_t n = ::write(fd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw std::runtime_error("cannot write " + path);
+    data += n;
+    len -= n;
+  }
+}
+
+// Deletes each of paths, ignoring any that do not exist.
+inline void ExternalBuild::removeFiles(const std::vector<std::string> &paths) {
+  for (size_t i = 0; i < paths.size(); i++)
+    unlink(paths[i].c_str());
+}
+
+// While one chunk is sorted and spilled on other threads, the next is read
+// into the other half of the memory.
+template <class Key>
+size_t ExternalBuild::sortFile(const std::string &input,
+                               const std::string &output,
+                               const ExternalBuildOptions &options) {
+  static_assert(std::is_trivially_copyable<Key>::value,
+                "keys are read and written bytewise");
+  // a pass with fan_in < 2 would never reduce the number of runs
+  if (options.fan_in < 2)
+    throw std::invalid_argument("an external sort needs a fan-in of 2 or more");
+  unsigned threads = options.threads;
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t chunk_items =
+      std::max<size_t>(options.memory_bytes / 2 / sizeof(Key), 1);
+
+  Reader<Key> reader(input, 1);
+  std::vector<Key> chunks[2];
+  chunks[0].resize(chunk_items);
+  chunks[1].resize(chunk_items);
+  std::vector<std::string> runs;
+  std::thread spiller;
+  std::exception_ptr spill_error;
+
+  // a failed read must still wait for the chunk being spilled, and no run
+  // outlives an error
+  try {
+    for (int current = 0;; current ^= 1) {
+      size_t count = reader.read(chunks[current].data(), chunk_items);
+      if (spiller.joinable())
+        spiller.join();
+      if (spill_error)
+        std::rethrow_exception(spill_error);
+      if (count == 0)
+        break;
+
+      char suffix[32];
+      std::snprintf(suffix, sizeof(suffix), ".run-%zu", runs.size());
+      runs.push_back(output + suffix);
+      std::vector<Key> *chunk = &chunks[current];
+      std::string path = runs.back();
+      spiller = std::thread([chunk, count, threads, path, &spill_error]() {
+        try {
+          spill(*chunk, count, threads, path);
+        } catch (...) {
+          spill_error = std::current_exception();
+        }
+      });
+    }
+  } catch (...) {
+    if (spiller.joinable())
+      spiller.join();
+    removeFiles(runs);
+    throw;
+  }
+  chunks[0] = std::vector<Key>();
+  chunks[1] = std::vector<Key>();
+
+  // merge passes, until one merge can take every run
+  std::vector<std::string> merged;
+  try {
+    for (size_t pass = 0; runs.size() > options.fan_in; pass++) {
+      merged.clear();
+      for (size_t first = 0; first < runs.size(); first += options.fan_in) {
+        std::vector<std::string> group(
+            runs.begin() + first,
+            runs.begin() + std::min(runs.size(), first + options.fan_in));
+        char suffix[48];
+        std::snprintf(suffix, sizeof(suffix), ".run-%zu-%zu", pass,
+                      merged.size());
+        merged.push_back(output + suffix);
+        merge<Key>(group, merged.back(), options);
+      }
+      runs.swap(merged);
+    }
+    return merge<Key>(runs, output, options);
+  } catch (...) {
+    removeFiles(runs);
+    removeFiles(merged);
+    throw;
+  }
+}
+
+template <class Key, class Value>
+void ExternalBuild::buildTree(const std::string &input,
+                              AVLTree<Key, Value> &tree,
+                              const std::string &scratch,
+                              const ExternalBuildOptions &options) {
+  std::string sorted = scratch + ".sorted";
+  size_t count = sortFile<Key>(input, sorted, options);
+  std::shared_ptr<AVLNode<Key, Value>> root;
+  try {
+    Reader<Key> reader(sorted, options.merge_buffer_bytes / sizeof(Key));
+    int height;
+    root = build(reader, tree, count, height);
+  } catch (...) {
+    unlink(sorted.c_str());
+    throw;
+  }
+  unlink(sorted.c_str());
+  tree.clear();
+  tree.root_ = root;
+  tree.resetExtremes();
+}
+
+template <class Key, class Value>
+void ExternalBuild::buildSnapshot(const std::string &input,
+                                  const std::string &snapshot,
+                                  const ExternalBuildOptions &options) {
+  std::string sorted = snapshot + ".sorted";
+  size_t count = sortFile<Key>(input, sorted, options);
+  void *keys = MAP_FAILED;
+  int fd = open(sorted.c_str(), O_RDONLY);
+  if (fd >= 0 && count > 0)
+    keys = mmap(nullptr, count * sizeof(Key), PROT_READ, MAP_PRIVATE, fd, 0);
+  if (fd >= 0)
+    close(fd);
+  if (count > 0 && keys == MAP_FAILED) {
+    unlink(sorted.c_str());
+    throw std::runtime_error("cannot map " + sorted);
+  }
+
+  try {
+    AVLSnapshot::saveSorted(count > 0 ? static_cast<const Key *>(keys)
+                                      : nullptr,
+                            count, Value(), snapshot);
+  } catch (...) {
+    if (count > 0)
+      munmap(keys, count * sizeof(Key));
+    unlink(sorted.c_str());
+    throw;
+  }
+  if (count > 0)
+    munmap(keys, count * sizeof(Key));
+  unlink(sorted.c_str());
+}
+
+// Sorts count keys in place: each thread sorts a slice, and the slices are
+// then merged pairwise, in parallel, until one is left.
+template <class Key>
+void ExternalBuild::parallelSort(Key *keys, size_t count, unsigned threads) {
+  size_t slices = std::min<size_t>(threads, count / 4096 + 1);
+  std::vector<size_t> bounds;
+  for (size_t i = 0; i <= slices; i++)
+    bounds.push_back(count * i / slices);
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < slices; i++)
+    workers.push_back(std::thread([keys, &bounds, i]() {
+      std::sort(keys + bounds[i], keys + bounds[i + 1]);
+    }));
+  std::sort(keys + bounds[0], keys + bounds[1]);
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  for (size_t width = 1; width < slices; width *= 2) {
+    workers.clear();
+    for (size_t i = 0; i + width < slices; i += 2 * width) {
+      Key *first = keys + bounds[i];
+      Key *middle = keys + bounds[i + width];
+      Key *last = keys + bounds[std::min(i + 2 * width, slices)];
+      workers.push_back(std::thread([first, middle, last]() {
+        std::inplace_merge(first, middle, last);
+      }));
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+  }
+}
+
+template <class Key>
+void ExternalBuild::spill(std::vector<Key> &chunk, size_t count,
+                          unsigned threads, const std::string &path) {
+  parallelSort(chunk.data(), count, threads);
+  size_t unique = std::unique(chunk.begin(), chunk.begin() + count,
+                              [](const Key &a, const Key &b) {
+                                return !(a < b) && !(b < a);
+                              }) -
+                  chunk.begin();
+  Writer<Key> writer(path, 0);
+  writer.write(chunk.data(), unique);
+}
+
+// Merges runs into output and deletes them, whether or not the merge
+// succeeds; output is deleted as well if it fails.
+template <class Key>
+size_t ExternalBuild::merge(const std::vector<std::string> &runs,
+                            const std::string &output,
+                            const ExternalBuildOptions &options) {
+  try {
+    size_t count = mergeRuns<Key>(runs, output, options);
+    removeFiles(runs);
+    return count;
+  } catch (...) {
+    removeFiles(runs);
+    unlink(output.c_str());
+    throw;
+  }
+}
+
+// A k-way merge of sorted runs into output through a heap of each run's
+// next key, dropping repeats.
+template <class Key>
+size_t ExternalBuild::mergeRuns(const std::vector<std::string> &runs,
+                                const std::string &output,
+                                const ExternalBuildOptions &options) {
+  size_t buffer_items = std::max<size_t>(
+      options.merge_buffer_bytes / sizeof(Key) / (runs.size() + 1), 1);
+  std::vector<std::unique_ptr<Reader<Key>>> readers;
+  for (size_t i = 0; i < runs.size(); i++)
+    readers.push_back(
+        std::unique_ptr<Reader<Key>>(new Reader<Key>(runs[i], buffer_items)));
+  Writer<Key> writer(output, buffer_items);
+
+  typedef std::pair<Key, size_t> Head;
+  auto later = [](const Head &a, const Head &b) { return b.first < a.first; };
+  std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+  Key key;
+  for (size_t i = 0; i < readers.size(); i++)
+    if (readers[i]->next(key))
+      heads.push(Head(key, i));
+
+  size_t count = 0;
+  while (!heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+    if (count == 0 || key < head.first) {
+      key = head.first;
+      writer.write(key);
+      count++;
+    }
+    Key next;
+    if (readers[head.second]->next(next))
+      heads.push(Head(next, head.second));
+  }
+  writer.finish();
+  return count;
+}
+
+// Builds a balanced subtree from the next count keys in reader, splitting
+// them the same way as AVLTree::buildBalanced. If the keys run out, every
+// node built so far is freed before the exception is passed on.
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>>
+ExternalBuild::build(Reader<Key> &reader, AVLTree<Key, Value> &tree,
+                     size_t count, int &height) {
+  if (count == 0) {
+    height = 0;
+    return nullptr;
+  }
+  int hl, hr;
+  std::shared_ptr<AVLNode<Key, Value>> left =
+      build(reader, tree, count / 2, hl);
+  std::shared_ptr<AVLNode<Key, Value>> n, right;
+  try {
+    Key key;
+    if (!reader.next(key))
+      throw std::runtime_error("sorted keys ended early");
+    n = tree.makeNode(std::pair<const Key, Value>(key, Value()),
+                      std::shared_ptr<AVLNode<Key, Value>>());
+    right = build(reader, tree, count - count / 2 - 1, hr);
+  } catch (...) {
+    // left's nodes point at their parents, so dropping it would leak them
+    AVLTree<Key, Value>::freeSubtree(left);
+    throw;
+  }
+
+  n->setLeft(left);
+  if (left != nullptr)
+    left->setParent(n);
+  n->setRight(right);
+  if (right != nullptr)
+    right->setParent(n);
+  n->setBalance(hr - hl);
+  tree.updateNode(n);
+  height = std::max(hl, hr) + 1;
+  return n;
+}
+
+// ------------------------------------------------
+// End implementations for the ExternalBuild class.
+// ------------------------------------------------
+
+#endif
@@ -2,7 +2,13 @@
 // CS104 AVL tree runtime tests
 //
 
-#include "publicified_avlbst.h"
+#include "check_avl.h"
+#include <radix_tree.h>
+#include <veb_set.h>
+#include <aggregate_tree.h>
+#include <avl_sequence.h>
+#include <avl_wal.h>
+#include <filtered_tree.h>
 
 
 #include <create_bst.h>
@@ -11,6 +17,14 @@
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
 // runtime test for keys in increasing order
 TEST(AVLRuntime, InsertAscending)
 {
@@ -145,3 +159,339 @@ TEST(AVLRuntime, RemoveMax)
 
 	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
 }
+
+// the root always has two children here, so this times the predecessor
+// relink as well as the rebalancing
+TEST(AVLRuntime, RemoveRoot)
+{
+	RuntimeEvaluator runtimeEvaluator("AVLTree::remove() on root element", 2, 14, 30, [&](uint64_t numElements, RandomSeed seed)
+	{
+		AVLTree<uint64_t, uint64_t> tree;
+
+		std::vector<uint64_t> elements = makeRandomNumberVector<uint64_t>(numElements, 0, numElements * 10, seed, false);
+		for(uint64_t element : elements)
+		{
+			tree.insert(std::make_pair(element, element));
+		}
+
+		BenchmarkTimer timer;
+		tree.remove(tree.root_->getKey());
+		timer.stop();
+
+		return timer.getTime();
+	});
+
+	//runtimeEvaluator.enableDebugging();
+	runtimeEvaluator.setCorrelationThreshold(1.4);
+	runtimeEvaluator.evaluate();
+
+	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
+}
+
+// string keys make every comparison expensive, so this also shows that
+// rebalancing does not compare keys
+TEST(AVLRuntime, InsertRemoveRandomStrings)
+{
+	RuntimeEvaluator runtimeEvaluator("AVLTree::insert() and remove() with random string keys", 2, 14, 30, [&](uint64_t numElements, RandomSeed seed)
+	{
+		AVLTree<std::string, uint64_t> tree;
+
+		std::vector<std::string> elements = makeRandomAlphaStringVector(numElements, seed, 24, false);
+		for(size_t elementIndex = 0; elementIndex < numElements - 1; ++elementIndex)
+		{
+			tree.insert(std::make_pair(elements[elementIndex], elementIndex));
+		}
+
+		BenchmarkTimer timer;
+		tree.insert(std::make_pair(elements[numElements - 1], numElements - 1));
+		tree.remove(elements[0]);
+		timer.stop();
+
+		return timer.getTime();
+	});
+
+	//runtimeEvaluator.enableDebugging();
+	runtimeEvaluator.setCorrelationThreshold(1.4);
+	runtimeEvaluator.evaluate();
+
+	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
+}
+
+// the same workloads on RadixTree, whose depth depends on key length only
+TEST(RadixRuntime, InsertAscending)
+{
+	RuntimeEvaluator runtimeEvaluator("RadixTree::insert() with keys in ascending order", 0, 14, 30, [&](uint64_t numElements, RandomSeed seed)
+	{
+		RadixTree<uint64_t, uint64_t> tree;
+
+		// fill the tree in ascending order
+		for(uint64_t element = 0; element < numElements; ++element)
+		{
+			tree.insert(std::make_pair(element, element));
+		}
+
+		// time a run of inserts, a single one is too quick to measure
+		BenchmarkTimer timer;
+		for(uint64_t element = numElements; element < numElements + 64; ++element)
+		{
+			tree.insert(std::make_pair(element, element));
+		}
+		timer.stop();
+
+		return timer.getTime();
+	});
+
+	//runtimeEvaluator.enableDebugging();
+	runtimeEvaluator.setCorrelationThreshold(1.4);
+	runtimeEvaluator.evaluate();
+
+	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
+}
+
+TEST(RadixRuntime, InsertRandom)
+{
+	RuntimeEvaluator runtimeEvaluator("RadixTree::insert() with keys in random order", 0, 14, 30, [&](uint64_t numElements, RandomSeed seed)
+	{
+		RadixTree<uint64_t, uint64_t> tree;
+
+		std::vector<uint64_t> elements = makeRandomNumberVector<uint64_t>(numElements, 0, numElements * 10, seed, false);
+
+		for(size_t elementIndex = 0; elementIndex < numElements - 1; ++elementIndex)
+		{
+			tree.insert(std::make_pair(elements[elementIndex], elements[elementIndex]));
+		}
+
+		BenchmarkTimer timer;
+		tree.insert(std::make_pair(elements[numElements - 1], elements[numElements - 1]));
+		timer.stop();
+
+		return timer.getTime();
+	});
+
+	//runtimeEvaluator.enableDebugging();
+	runtimeEvaluator.setCorrelationThreshold(1.4);
+	runtimeEvaluator.evaluate();
+
+	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
+}
+
+TEST(VEBRuntime, SuccessorRandom)
+{
+	RuntimeEvaluator runtimeEvaluator("VEBSet::successor() with random keys", 0, 14, 30, [&](uint64_t numElements, RandomSeed seed)
+	{
+		VEBSet set;
+
+		std::vector<uint32_t> elements = makeRandomNumberVector<uint32_t>(numElements, 0, UINT32_MAX, seed, false);
+		for(uint32_t element : elements)
+		{
+			set.insert(element);
+		}
+
+		// time a run of queries, a single one is too quick to measure
+		uint32_t result = 0;
+		BenchmarkTimer timer;
+		for(size_t index = 0; index < 64; ++index)
+		{
+			set.successor(elements[index % numElements] ^ 0x5555, result);
+		}
+		timer.stop();
+
+		return timer.getTime();
+	});
+
+	//runtimeEvaluator.enableDebugging();
+	runtimeEvaluator.setCorrelationThreshold(1.4);
+	runtimeEvaluator.evaluate();
+
+	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
+}
+
+// the range covers about half the tree, so summing it item by item is linear
+TEST(AggregateRuntime, RangeSum)
+{
+	RuntimeEvaluator runtimeEvaluator("AggregateTree::aggregate() over half the keys", 0, 14, 30, [&](uint64_t numElements, RandomSeed seed)
+	{
+		AggregateTree<uint64_t, uint64_t> tree;
+
+		std::vector<uint64_t> elements = makeRandomNumberVector<uint64_t>(numElements, 0, numElements * 10, seed, false);
+		for(uint64_t element : elements)
+		{
+			tree.insert(std::make_pair(element, element));
+		}
+
+		// time a run of queries, a single one is too quick to measure
+		BenchmarkTimer timer;
+		for(uint64_t lo = 0; lo < 64; ++lo)
+		{
+			tree.aggregate(lo, lo + numElements * 5);
+		}
+		timer.stop();
+
+		return timer.getTime();
+	});
+
+	//runtimeEvaluator.enableDebugging();
+	runtimeEvaluator.setCorrelationThreshold(1.4);
+	runtimeEvaluator.evaluate();
+
+	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
+}
+
+// inserting in the middle shifts half of a vector, but is logarithmic here
+TEST(SequenceRuntime, InsertMiddle)
+{
+	RuntimeEvaluator runtimeEvaluator("AVLSequence::insertAt() in the middle", 0, 14, 30, [&](uint64_t numElements, RandomSeed seed)
+	{
+		AVLSequence<uint64_t> sequence;
+		for(uint64_t element = 0; element < numElements; ++element)
+		{
+			sequence.pushBack(element);
+		}
+
+		// time a run of inserts, a single one is too quick to measure
+		BenchmarkTimer timer;
+		for(uint64_t element = 0; element < 64; ++element)
+		{
+			sequence.insertAt(sequence.size() / 2, element);
+		}
+		timer.stop();
+
+		return timer.getTime();
+	});
+
+	//runtimeEvaluator.enableDebugging();
+	runtimeEvaluator.setCorrelationThreshold(1.4);
+	runtimeEvaluator.evaluate();
+
+	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LOGARITHMIC));
+}
+
+// Throughput of DurableAVLStore under each fsync policy. fsync time is spent
+// waiting rather than on the CPU, so this measures wall time instead of using
+// BenchmarkTimer, and reports the numbers rather than a complexity.
+TEST(DurableRuntime, SyncPolicies)
+{
+	size_t const groupSizes[] = {1, 8, 64, 0};
+	double throughput[4];
+	for(size_t policy = 0; policy < 4; ++policy)
+	{
+		std::string directory = makeTempDirectory("avl_wal_bench");
+
+		WALOptions options;
+		options.group_size = groupSizes[policy];
+		uint64_t operations = groupSizes[policy] == 1 ? 1000 : 20000;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		{
+			DurableAVLStore<uint64_t, uint64_t> store(directory, options);
+			for(uint64_t key = 0; key < operations; ++key)
+			{
+				store.insert(key * 7919 % 100003, key);
+			}
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		throughput[policy] = operations / elapsed.count();
+		std::cout << "group size " << groupSizes[policy] << ": " << static_cast<uint64_t>(throughput[policy]) << " inserts/s" << std::endl;
+
+		removeTempDirectory(directory);
+	}
+
+	EXPECT_GT(throughput[2], throughput[0]);
+}
+
+// lookups at several hit/miss ratios, with and without the filter; misses
+// are odd keys, which are never inserted
+TEST(FilteredRuntime, MissRatios)
+{
+	uint64_t const numKeys = 1 << 17;
+	AVLTree<uint64_t, uint64_t> plain;
+	FilteredAVLTree<uint64_t, uint64_t> filtered(numKeys);
+	std::vector<uint64_t> keys = makeRandomNumberVector<uint64_t>(numKeys, 0, 1ULL << 40, 119, false);
+	for(uint64_t & key : keys)
+	{
+		key *= 2;
+		plain.insert(std::make_pair(key, key));
+		filtered.insert(std::make_pair(key, key));
+	}
+
+	double const missRatios[] = {0.0, 0.5, 0.7, 0.9};
+	double plainTime[4], filteredTime[4];
+	for(size_t ratio = 0; ratio < 4; ++ratio)
+	{
+		std::vector<uint64_t> lookups;
+		for(uint64_t i = 0; i < numKeys; ++i)
+		{
+			uint64_t key = keys[(i * 7919) % numKeys];
+			lookups.push_back(i % 100 < missRatios[ratio] * 100 ? key + 1 : key);
+		}
+
+		uint64_t found = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(uint64_t key : lookups)
+		{
+			found += plain.find(key) != plain.end();
+		}
+		std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+		for(uint64_t key : lookups)
+		{
+			found -= filtered.find(key) != filtered.end();
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		EXPECT_EQ(0U, found);
+
+		plainTime[ratio] = std::chrono::duration<double, std::nano>(middle - start).count() / numKeys;
+		filteredTime[ratio] = std::chrono::duration<double, std::nano>(end - middle).count() / numKeys;
+		std::cout << static_cast<int>(missRatios[ratio] * 100) << "% misses: " << static_cast<uint64_t>(plainTime[ratio]) << " ns plain, " << static_cast<uint64_t>(filteredTime[ratio]) << " ns filtered" << std::endl;
+	}
+
+	EXPECT_LT(filteredTime[3], plainTime[3]);
+}
+
+// batches of random keys into a large tree, against inserting them one at a
+// time; reports the numbers, as with DurableRuntime. Sparse batches share
+// little of their descents and only break even, so only the densest one is
+// expected to win.
+TEST(AVLRuntime, InsertBatchRandom)
+{
+	uint64_t const numKeys = 1 << 20;
+	std::vector<uint64_t> keys = makeRandomNumberVector<uint64_t>(numKeys, 0, 1ULL << 40, 120, false);
+	AVLTree<uint64_t, uint64_t> single, batched;
+	for(uint64_t key : keys)
+	{
+		single.insert(std::make_pair(key, key));
+		batched.insert(std::make_pair(key, key));
+	}
+
+	size_t const batchSizes[] = {1000, 10000, 100000};
+	for(size_t size = 0; size < 3; ++size)
+	{
+		std::vector<std::pair<uint64_t, uint64_t>> batch;
+		for(uint64_t key : makeRandomNumberVector<uint64_t>(batchSizes[size], 0, 1ULL << 40, 121 + size, false))
+		{
+			batch.push_back(std::make_pair(key, key));
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(std::pair<uint64_t, uint64_t> const & item : batch)
+		{
+			single.insert(item);
+		}
+		std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+		batched.insertBatch(batch.begin(), batch.end());
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		double singleTime = std::chrono::duration<double, std::milli>(middle - start).count();
+		double batchTime = std::chrono::duration<double, std::milli>(end - middle).count();
+		std::cout << batchSizes[size] << " keys: " << singleTime << " ms one at a time, " << batchTime << " ms batched" << std::endl;
+		if(size == 2)
+		{
+			EXPECT_LT(batchTime, singleTime);
+		}
+	}
+
+	AVLTree<uint64_t, uint64_t>::iterator singleIt = single.begin(), batchedIt = batched.begin();
+	for(; singleIt != single.end() && batchedIt != batched.end(); ++singleIt, ++batchedIt)
+	{
+		ASSERT_EQ(singleIt->first, batchedIt->first);
+	}
+	EXPECT_TRUE(singleIt == single.end() && batchedIt == batched.end());
+}
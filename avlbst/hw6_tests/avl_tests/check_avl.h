@@ -11,6 +11,14 @@
 #include <check_bst.h>
 
 #include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 template<typename Key, typename Value>
 testing::AssertionResult checkHeightsHelper(AVLTree<Key, Value> & tree, std::shared_ptr<AVLNode<Key, Value>> currRoot);
@@ -186,4 +194,85 @@ testing::AssertionResult verifyAVL(AVLTree<Key, Value> & tree)
 }
 
 
+// keys and balances in pre-order, which together pin down the whole shape
+template<typename Key, typename Value>
+void preOrderShape(std::shared_ptr<Node<Key, Value>> node, std::vector<std::pair<Key, int>> & out)
+{
+	if(node == nullptr)
+	{
+		return;
+	}
+	out.push_back(std::make_pair(node->getKey(), static_cast<int>(std::static_pointer_cast<AVLNode<Key, Value>>(node)->getBalance())));
+	preOrderShape(node->getLeft(), out);
+	preOrderShape(node->getRight(), out);
+}
+
+// A fresh, empty directory under the test temp directory, named from prefix.
+inline std::string makeTempDirectory(std::string const & prefix)
+{
+	std::string pattern = testing::TempDir() + prefix + "_XXXXXX";
+	std::vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+	EXPECT_NE(nullptr, mkdtemp(path.data()));
+	return std::string(path.data());
+}
+
+// names of the files in directory, without . and ..
+inline std::vector<std::string> directoryFiles(std::string const & directory)
+{
+	std::vector<std::string> files;
+	DIR * dir = opendir(directory.c_str());
+	while(struct dirent * entry = readdir(dir))
+	{
+		if(entry->d_name[0] != '.')
+		{
+			files.push_back(entry->d_name);
+		}
+	}
+	closedir(dir);
+	return files;
+}
+
+// deletes every file in directory, then directory itself
+inline void removeTempDirectory(std::string const & directory)
+{
+	for(std::string const & file : directoryFiles(directory))
+	{
+		unlink((directory + "/" + file).c_str());
+	}
+	rmdir(directory.c_str());
+}
+
+// An AVL tree that remembers every node it builds, so that a test can check
+// none of them outlives it. Nodes hold their parents through shared_ptrs, so
+// a subtree that is dropped without being unlinked leaks as a cycle.
+template<typename Key, typename Value>
+class TrackingAVLTree : public AVLTree<Key, Value>
+{
+public:
+	// nodes built by this tree that are still alive
+	size_t liveNodes() const
+	{
+		size_t live = 0;
+		for(std::weak_ptr<AVLNode<Key, Value>> const & node : made_)
+		{
+			if(!node.expired())
+			{
+				live++;
+			}
+		}
+		return live;
+	}
+
+	std::shared_ptr<AVLNode<Key, Value>> makeNode(std::pair<const Key, Value> && item, std::shared_ptr<AVLNode<Key, Value>> parent)
+	{
+		std::shared_ptr<AVLNode<Key, Value>> node = AVLTree<Key, Value>::makeNode(std::move(item), parent);
+		made_.push_back(node);
+		return node;
+	}
+
+private:
+	std::vector<std::weak_ptr<AVLNode<Key, Value>>> made_;
+};
+
 #endif //CS104_HW7_TEST_SUITE_CHECK_AVL_H
@@ -0,0 +1,14 @@
+//
+// Wrapper around compact_avl.h to make all private/protected functions public
+//
+
+#ifndef CS104_HW7_TEST_SUITE_PUBLICIFIED_COMPACT_AVL_H
+#define CS104_HW7_TEST_SUITE_PUBLICIFIED_COMPACT_AVL_H
+
+#define private public
+#define protected public
+#include <compact_avl.h>
+#undef private
+#undef protected
+
+#endif //CS104_HW7_TEST_SUITE_PUBLICIFIED_COMPACT_AVL_H
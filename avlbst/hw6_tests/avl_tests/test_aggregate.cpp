@@ -0,0 +1,166 @@
+#include "check_avl.h"
+#include <aggregate_tree.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// string concatenation, a monoid that is not commutative, so aggregates
+// only come out right if they are combined in key order
+struct ConcatMonoid
+{
+	typedef std::string Result;
+	Result identity() const { return std::string(); }
+	Result lift(std::string const & value) const { return value; }
+	Result combine(Result const & a, Result const & b) const { return a + b; }
+};
+
+// checks aggregate() over every range [lo, hi] with ends from probes against
+// folding the matching items of a std::map
+template<typename Key, typename Value, typename Monoid>
+testing::AssertionResult sameAggregates(AggregateTree<Key, Value, Monoid> & tree, std::map<Key, Value> const & expected, std::vector<Key> const & probes)
+{
+	std::set<Key> keys;
+	Monoid monoid;
+	typename Monoid::Result total = monoid.identity();
+	for(std::pair<const Key, Value> const & item : expected)
+	{
+		keys.insert(item.first);
+		total = monoid.combine(total, monoid.lift(item.second));
+	}
+	testing::AssertionResult avlResult = verifyAVL(tree, keys);
+	if(!avlResult)
+	{
+		return avlResult;
+	}
+	if(tree.aggregate() != total)
+	{
+		return testing::AssertionFailure() << "aggregate() of the whole tree is wrong";
+	}
+
+	for(Key const & lo : probes)
+	{
+		for(Key const & hi : probes)
+		{
+			typename Monoid::Result result = monoid.identity();
+			for(typename std::map<Key, Value>::const_iterator it = expected.lower_bound(lo); it != expected.end() && !(hi < it->first); ++it)
+			{
+				result = monoid.combine(result, monoid.lift(it->second));
+			}
+			if(tree.aggregate(lo, hi) != result)
+			{
+				return testing::AssertionFailure() << "aggregate(" << lo << ", " << hi << ") is " << tree.aggregate(lo, hi) << ", expected " << result;
+			}
+		}
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(AggregateTree, EmptyTree)
+{
+	AggregateTree<int, int> sumTree;
+	AggregateTree<int, int, MinMonoid<int>> minTree;
+
+	EXPECT_EQ(0, sumTree.aggregate());
+	EXPECT_EQ(0, sumTree.aggregate(-10, 10));
+	EXPECT_EQ(std::numeric_limits<int>::max(), minTree.aggregate(-10, 10));
+}
+
+TEST(AggregateTree, Monoids)
+{
+	AggregateTree<int, int> sumTree;
+	AggregateTree<int, int, MinMonoid<int>> minTree;
+	AggregateTree<int, int, MaxMonoid<int>> maxTree;
+	AggregateTree<int, int, CountMonoid<int>> countTree;
+	std::map<int, int> expected;
+
+	for(int key = 0; key < 50; ++key)
+	{
+		int value = (key * 37) % 23 - 11;
+		sumTree.insert(std::make_pair(key, value));
+		minTree.insert(std::make_pair(key, value));
+		maxTree.insert(std::make_pair(key, value));
+		countTree.insert(std::make_pair(key, value));
+		expected[key] = value;
+	}
+
+	std::vector<int> probes = {-1, 0, 1, 7, 24, 25, 48, 49, 50};
+	EXPECT_TRUE(sameAggregates(sumTree, expected, probes));
+	EXPECT_TRUE(sameAggregates(minTree, expected, probes));
+	EXPECT_TRUE(sameAggregates(maxTree, expected, probes));
+	EXPECT_TRUE(sameAggregates(countTree, expected, probes));
+	EXPECT_EQ(50u, countTree.aggregate());
+}
+
+TEST(AggregateTree, ChangedValues)
+{
+	AggregateTree<int, int> tree;
+	std::map<int, int> expected;
+	for(int key = 0; key < 100; ++key)
+	{
+		tree.insert(std::make_pair(key, key));
+		expected[key] = key;
+	}
+	std::vector<int> probes = {0, 10, 50, 99};
+
+	// every way of overwriting a value through the tree updates the cache
+	tree.insert(std::make_pair(10, 1000));
+	expected[10] = 1000;
+	tree.insert_or_assign(20, 2000);
+	expected[20] = 2000;
+	tree.upsert(30, [](int & value) { value += 3000; });
+	expected[30] += 3000;
+	tree.modify(40, [](int & value) { value = -40; });
+	expected[40] = -40;
+	tree.insert(tree.find(50), std::make_pair(50, 5000));
+	expected[50] = 5000;
+	EXPECT_TRUE(sameAggregates(tree, expected, probes));
+}
+
+TEST(AggregateTree, Random10x300ele)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 9137);
+	for(RandomSeed seed : seeds)
+	{
+		AggregateTree<std::string, std::string, ConcatMonoid> tree;
+		std::map<std::string, std::string> expected;
+
+		std::vector<std::string> keys = makeRandomAlphaStringVector(300, seed, 3, true);
+		std::vector<std::string> probes = makeRandomAlphaStringVector(20, seed + 1, 2, true);
+		probes.push_back(keys[0]);
+		probes.push_back(keys[1]);
+
+		for(size_t index = 0; index < keys.size(); ++index)
+		{
+			tree.insert(std::make_pair(keys[index], keys[index].substr(0, 1)));
+			expected[keys[index]] = keys[index].substr(0, 1);
+		}
+		ASSERT_TRUE(sameAggregates(tree, expected, probes));
+
+		for(size_t index = 0; index < keys.size(); index += 3)
+		{
+			tree.remove(keys[index]);
+			expected.erase(keys[index]);
+		}
+		ASSERT_TRUE(sameAggregates(tree, expected, probes));
+
+		// bulk paths restructure through split/join and merging
+		tree.erase(tree.find(std::next(expected.begin(), expected.size() / 4)->first), tree.find(std::next(expected.begin(), expected.size() / 2)->first));
+		expected.erase(std::next(expected.begin(), expected.size() / 4), std::next(expected.begin(), expected.size() / 2));
+		ASSERT_TRUE(sameAggregates(tree, expected, probes));
+
+		std::vector<std::pair<std::string, std::string>> batch;
+		for(size_t index = 0; index < keys.size(); index += 2)
+		{
+			batch.push_back(std::make_pair(keys[index], std::string("*")));
+			expected[keys[index]] = "*";
+		}
+		tree.insertBatch(batch.begin(), batch.end());
+		ASSERT_TRUE(sameAggregates(tree, expected, probes));
+	}
+}
@@ -0,0 +1,170 @@
+#include <bloom_filter.h>
+#include <filtered_tree.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+TEST(BloomFilter, NoFalseNegatives)
+{
+	std::vector<uint64_t> items = makeRandomNumberVector<uint64_t>(10000, 0, 1000000000, 110, false);
+	BloomFilter filter(items.size());
+	for(uint64_t item : items)
+	{
+		filter.add(item);
+	}
+	for(uint64_t item : items)
+	{
+		EXPECT_TRUE(filter.mayContain(item));
+	}
+}
+
+// about 1% at 10 bits per item; blocking costs a little over that
+TEST(BloomFilter, FalsePositiveRate)
+{
+	BloomFilter filter(100000);
+	for(uint64_t item = 0; item < 100000; ++item)
+	{
+		filter.add(item);
+	}
+	size_t falsePositives = 0;
+	for(uint64_t item = 100000; item < 200000; ++item)
+	{
+		falsePositives += filter.mayContain(item);
+	}
+	EXPECT_LT(falsePositives, 2000U);
+}
+
+TEST(BloomFilter, RebuiltFromWords)
+{
+	BloomFilter filter(1000);
+	for(uint64_t item = 0; item < 1000; item += 2)
+	{
+		filter.add(item);
+	}
+	BloomFilter copy(filter.words().data(), filter.words().size(), filter.probes());
+	for(uint64_t item = 0; item < 1000; ++item)
+	{
+		EXPECT_EQ(filter.mayContain(item), copy.mayContain(item));
+	}
+
+	filter.clear();
+	EXPECT_FALSE(filter.mayContain(0));
+}
+
+TEST(CountingBloomFilter, RemoveForgetsItems)
+{
+	CountingBloomFilter filter(20000);
+	for(uint64_t item = 0; item < 20000; ++item)
+	{
+		filter.add(item);
+	}
+	for(uint64_t item = 0; item < 20000; item += 2)
+	{
+		filter.remove(item);
+	}
+
+	// the odd items are all still there, and few of the even ones seem to be
+	size_t falsePositives = 0;
+	for(uint64_t item = 0; item < 20000; ++item)
+	{
+		if(item % 2)
+		{
+			EXPECT_TRUE(filter.mayContain(item));
+		}
+		else
+		{
+			falsePositives += filter.mayContain(item);
+		}
+	}
+	EXPECT_LT(falsePositives, 200U);
+
+	for(uint64_t item = 1; item < 20000; item += 2)
+	{
+		filter.remove(item);
+	}
+	for(uint64_t item = 0; item < 20000; ++item)
+	{
+		EXPECT_FALSE(filter.mayContain(item));
+	}
+}
+
+// an item added many times saturates its counters, which then never drop
+TEST(CountingBloomFilter, SaturatedCountersStick)
+{
+	CountingBloomFilter filter(100);
+	for(int i = 0; i < 20; ++i)
+	{
+		filter.add(7);
+	}
+	for(int i = 0; i < 30; ++i)
+	{
+		filter.remove(7);
+	}
+	EXPECT_TRUE(filter.mayContain(7));
+}
+
+TEST(FilteredAVLTree, MatchesSetThroughChanges)
+{
+	FilteredAVLTree<int, int> tree(1000);
+	std::set<int> expected;
+	std::vector<int> keys = makeRandomNumberVector<int>(4000, 0, 8000, 118, true);
+	for(size_t i = 0; i < keys.size(); ++i)
+	{
+		if(i % 4 == 3)
+		{
+			tree.remove(keys[i]);
+			expected.erase(keys[i]);
+		}
+		else
+		{
+			tree.insert(std::make_pair(keys[i], keys[i]));
+			expected.insert(keys[i]);
+		}
+	}
+
+	std::vector<std::pair<int, int>> batch;
+	for(int key = 8000; key < 8500; ++key)
+	{
+		batch.push_back(std::make_pair(key, key));
+		expected.insert(key);
+	}
+	tree.insertBatch(batch.begin(), batch.end());
+
+	tree.erase(tree.lower_bound(2000), tree.lower_bound(3000));
+	expected.erase(expected.lower_bound(2000), expected.lower_bound(3000));
+	tree.erase(tree.begin());
+	expected.erase(expected.begin());
+	EXPECT_EQ(expected.size(), tree.filteredItems());
+
+	// far past the size the filter was made for, but never a false negative
+	for(int key = -100; key < 8600; ++key)
+	{
+		bool present = expected.count(key) > 0;
+		EXPECT_EQ(present, tree.find(key) != tree.end());
+		if(present)
+		{
+			EXPECT_TRUE(tree.mayContain(key));
+		}
+	}
+
+	tree.rebuildFilter();
+	size_t falsePositives = 0;
+	for(int key = 10000; key < 20000; ++key)
+	{
+		falsePositives += tree.mayContain(key);
+	}
+	EXPECT_LT(falsePositives, 300U);
+	for(std::set<int>::iterator it = expected.begin(); it != expected.end(); ++it)
+	{
+		EXPECT_TRUE(tree.find(*it) != tree.end());
+	}
+
+	tree.clear();
+	EXPECT_EQ(0U, tree.filteredItems());
+	EXPECT_FALSE(tree.mayContain(*expected.begin()));
+}
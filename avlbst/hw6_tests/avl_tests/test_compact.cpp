@@ -0,0 +1,191 @@
+#include "publicified_compact_avl.h"
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+// checks the tree against a std::map holding the same items
+template<typename Key, typename Value, bool ColdValues>
+testing::AssertionResult sameItems(CompactAVLTree<Key, Value, ColdValues> & tree, std::map<Key, Value> const & expected)
+{
+	if(tree.size() != expected.size())
+	{
+		return testing::AssertionFailure() << "size() is " << tree.size() << ", expected " << expected.size();
+	}
+
+	typename CompactAVLTree<Key, Value, ColdValues>::iterator it = tree.begin();
+	for(typename std::map<Key, Value>::const_iterator exp = expected.begin(); exp != expected.end(); ++exp, ++it)
+	{
+		if(it == tree.end() || it->first != exp->first || it->second != exp->second)
+		{
+			return testing::AssertionFailure() << "Item mismatch at key " << exp->first;
+		}
+	}
+	if(it != tree.end())
+	{
+		return testing::AssertionFailure() << "Tree has extra items";
+	}
+	if(!tree.isBalanced())
+	{
+		return testing::AssertionFailure() << "Stored balances are wrong";
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(CompactAVL, NodeSize)
+{
+	EXPECT_LE(sizeof(CompactAVLTree<uint64_t, uint64_t>::Slot), 32u);
+	EXPECT_LE(sizeof(CompactAVLTree<uint32_t, uint32_t>::Slot), 20u);
+
+	// cold values leave only the key and links in the node
+	EXPECT_LE(sizeof(CompactAVLTree<uint64_t, std::string, true>::Slot), 24u);
+}
+
+TEST(CompactAVL, EmptyTree)
+{
+	CompactAVLTree<int, int> testTree;
+
+	EXPECT_TRUE(testTree.empty());
+	EXPECT_EQ(testTree.end(), testTree.begin());
+	EXPECT_EQ(testTree.end(), testTree.find(5));
+	testTree.remove(5);
+	EXPECT_TRUE(testTree.isBalanced());
+}
+
+TEST(CompactAVL, InsertOverwrite)
+{
+	CompactAVLTree<std::string, int> testTree;
+
+	testTree.insert(std::make_pair("b", 1));
+	testTree.insert(std::make_pair("a", 2));
+	testTree.insert(std::make_pair("b", 3));
+	testTree.find("a")->second = 4;
+
+	EXPECT_TRUE(sameItems(testTree, std::map<std::string, int>({{"a", 4}, {"b", 3}})));
+}
+
+TEST(CompactAVL, Random10x500ele)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 3511);
+	for(RandomSeed seed : seeds)
+	{
+		CompactAVLTree<int, int> testTree;
+		std::map<int, int> expected;
+
+		std::vector<int> keys = makeRandomIntVector(500, seed, true);
+		for(size_t index = 0; index < keys.size(); ++index)
+		{
+			testTree.insert(std::make_pair(keys[index], static_cast<int>(index)));
+			expected[keys[index]] = static_cast<int>(index);
+		}
+		ASSERT_TRUE(sameItems(testTree, expected));
+
+		// remove half, then insert again into the freed slots
+		size_t arenaSize = testTree.nodes_.size();
+		for(size_t index = 0; index < keys.size(); index += 2)
+		{
+			testTree.remove(keys[index]);
+			expected.erase(keys[index]);
+		}
+		ASSERT_TRUE(sameItems(testTree, expected));
+		for(size_t index = 0; index < keys.size(); index += 2)
+		{
+			testTree.insert(std::make_pair(keys[index], -1));
+			expected[keys[index]] = -1;
+		}
+		ASSERT_TRUE(sameItems(testTree, expected));
+		EXPECT_EQ(arenaSize, testTree.nodes_.size());
+
+		for(int key : keys)
+		{
+			testTree.remove(key);
+		}
+		EXPECT_TRUE(testTree.empty());
+		EXPECT_EQ(testTree.end(), testTree.begin());
+	}
+}
+
+TEST(CompactAVL, ColdValues)
+{
+	CompactAVLTree<int, std::string, true> testTree;
+	std::map<int, std::string> expected;
+
+	std::vector<int> keys = makeRandomIntVector(300, 3611, true);
+	for(size_t index = 0; index < keys.size(); ++index)
+	{
+		std::string value(100, static_cast<char>('a' + index % 26));
+		testTree.insert(std::make_pair(keys[index], value));
+		expected[keys[index]] = value;
+	}
+	ASSERT_TRUE(sameItems(testTree, expected));
+	EXPECT_EQ(testTree.nodes_.size(), testTree.values_.size());
+
+	// freed slots get their new value, not the old one
+	for(size_t index = 0; index < keys.size(); index += 3)
+	{
+		testTree.remove(keys[index]);
+		expected.erase(keys[index]);
+	}
+	for(size_t index = 0; index < keys.size(); index += 3)
+	{
+		testTree.insert(std::make_pair(keys[index], std::string("new")));
+		expected[keys[index]] = "new";
+	}
+	ASSERT_TRUE(sameItems(testTree, expected));
+
+	testTree.find(keys[1])->second = "changed";
+	EXPECT_EQ("changed", testTree.find(keys[1])->second);
+}
+
+TEST(AVLSet, InsertContains)
+{
+	AVLSet<std::string> testSet;
+
+	EXPECT_TRUE(testSet.insert("m"));
+	EXPECT_TRUE(testSet.insert("c"));
+	EXPECT_TRUE(testSet.insert("x"));
+	EXPECT_FALSE(testSet.insert("c"));
+
+	EXPECT_EQ(3u, testSet.size());
+	EXPECT_TRUE(testSet.contains("x"));
+	EXPECT_FALSE(testSet.contains("a"));
+	EXPECT_EQ(1u, testSet.find("m")->size());
+	EXPECT_EQ(testSet.end(), testSet.find("a"));
+}
+
+TEST(AVLSet, Random10x500ele)
+{
+	// the key is the whole node
+	EXPECT_LE(sizeof(CompactAVLKeySlot<uint64_t>), 24u);
+
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 3711);
+	for(RandomSeed seed : seeds)
+	{
+		AVLSet<int> testSet;
+		std::set<int> expected;
+
+		std::vector<int> keys = makeRandomIntVector(500, seed, true);
+		for(int key : keys)
+		{
+			EXPECT_EQ(expected.insert(key).second, testSet.insert(key));
+		}
+		for(size_t index = 0; index < keys.size(); index += 3)
+		{
+			testSet.remove(keys[index]);
+			expected.erase(keys[index]);
+		}
+
+		ASSERT_EQ(expected.size(), testSet.size());
+		ASSERT_TRUE(testSet.isBalanced());
+		std::set<int>::iterator exp = expected.begin();
+		for(AVLSet<int>::iterator it = testSet.begin(); it != testSet.end(); ++it, ++exp)
+		{
+			ASSERT_EQ(*exp, *it);
+		}
+	}
+}
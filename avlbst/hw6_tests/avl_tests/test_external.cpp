@@ -0,0 +1,204 @@
+#include "check_avl.h"
+#include <avl_snapshot.h>
+#include <external_build.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+std::string externalPath(std::string const & name)
+{
+	return testing::TempDir() + "avl_external_" + name;
+}
+
+void writeKeys(std::string const & path, std::vector<int> const & keys)
+{
+	std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char *>(keys.data()), keys.size() * sizeof(int));
+}
+
+std::vector<int> readKeys(std::string const & path)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	std::vector<int> keys;
+	int key;
+	while(in.read(reinterpret_cast<char *>(&key), sizeof(key)))
+	{
+		keys.push_back(key);
+	}
+	return keys;
+}
+
+bool fileExists(std::string const & path)
+{
+	struct stat info;
+	return stat(path.c_str(), &info) == 0;
+}
+
+// reaches the protected pieces of the build
+struct ExternalBuildAccess : ExternalBuild
+{
+	using ExternalBuild::Reader;
+	using ExternalBuild::build;
+};
+
+// small chunks and fan-in, so the sort spills many runs and merges them in
+// several passes
+ExternalBuildOptions smallOptions()
+{
+	ExternalBuildOptions options;
+	options.memory_bytes = 2 * 1000 * sizeof(int);
+	options.threads = 4;
+	options.fan_in = 3;
+	options.merge_buffer_bytes = 256;
+	return options;
+}
+
+TEST(ExternalBuild, SortFileMatchesSet)
+{
+	std::vector<int> keys = makeRandomNumberVector<int>(20000, -5000, 5000, 114, true);
+	std::string input = externalPath("sort_input");
+	std::string output = externalPath("sort_output");
+	writeKeys(input, keys);
+
+	size_t count = ExternalBuild::sortFile<int>(input, output, smallOptions());
+
+	std::set<int> expected(keys.begin(), keys.end());
+	EXPECT_EQ(expected.size(), count);
+	EXPECT_EQ(std::vector<int>(expected.begin(), expected.end()), readKeys(output));
+	// the runs are all gone
+	EXPECT_FALSE(fileExists(output + ".run-0"));
+	EXPECT_FALSE(fileExists(output + ".run-0-0"));
+
+	std::remove(input.c_str());
+	std::remove(output.c_str());
+}
+
+TEST(ExternalBuild, TreeAndSnapshotAgree)
+{
+	std::vector<int> keys = makeRandomNumberVector<int>(15000, 0, 100000, 115, true);
+	std::string input = externalPath("build_input");
+	std::string snapshot = externalPath("build_snapshot");
+	writeKeys(input, keys);
+
+	AVLTree<int, int> built;
+	built.insert(std::make_pair(-1, -1));
+	ExternalBuild::buildTree<int, int>(input, built, externalPath("build_scratch"), smallOptions());
+	std::set<int> expected(keys.begin(), keys.end());
+	EXPECT_TRUE(verifyAVL(built, expected));
+	EXPECT_FALSE(fileExists(externalPath("build_scratch.sorted")));
+
+	ExternalBuild::buildSnapshot<int, int>(input, snapshot, smallOptions());
+	AVLTree<int, int> loaded;
+	AVLSnapshot::load(snapshot, loaded);
+	EXPECT_TRUE(verifyAVL(loaded, expected));
+
+	std::vector<std::pair<int, int>> builtShape, loadedShape;
+	preOrderShape(built.root_, builtShape);
+	preOrderShape(loaded.root_, loadedShape);
+	EXPECT_EQ(builtShape, loadedShape);
+
+	AVLSnapshotView<int, int> view(snapshot);
+	EXPECT_EQ(expected.size(), view.size());
+	ASSERT_NE(nullptr, view.find(*expected.begin()));
+	EXPECT_EQ(0, *view.find(*expected.begin()));
+
+	std::remove(input.c_str());
+	std::remove(snapshot.c_str());
+}
+
+TEST(ExternalBuild, EmptyInput)
+{
+	std::string input = externalPath("empty_input");
+	std::string snapshot = externalPath("empty_snapshot");
+	writeKeys(input, std::vector<int>());
+
+	AVLTree<int, int> built;
+	built.insert(std::make_pair(1, 1));
+	ExternalBuild::buildTree<int, int>(input, built, externalPath("empty_scratch"), smallOptions());
+	EXPECT_TRUE(built.empty());
+
+	ExternalBuild::buildSnapshot<int, int>(input, snapshot, smallOptions());
+	AVLTree<int, int> loaded;
+	AVLSnapshot::load(snapshot, loaded);
+	EXPECT_TRUE(loaded.empty());
+
+	EXPECT_THROW(ExternalBuild::sortFile<int>(externalPath("missing"), externalPath("missing_output")), std::runtime_error);
+
+	std::remove(input.c_str());
+	std::remove(snapshot.c_str());
+}
+
+TEST(ExternalBuild, MalformedInputLeavesNoRuns)
+{
+	// many whole chunks, then a partial key, so the read fails while a run
+	// is still being spilled
+	std::vector<int> keys = makeRandomNumberVector<int>(20000, 0, 100000, 116, true);
+	std::string input = externalPath("malformed_input");
+	std::string output = externalPath("malformed_output");
+	writeKeys(input, keys);
+	{
+		std::ofstream out(input.c_str(), std::ios::binary | std::ios::app);
+		out.write("abc", 3);
+	}
+
+	EXPECT_THROW(ExternalBuild::sortFile<int>(input, output, smallOptions()), std::runtime_error);
+	for(size_t i = 0; i < 20; i++)
+	{
+		EXPECT_FALSE(fileExists(output + ".run-" + std::to_string(i)));
+	}
+	EXPECT_FALSE(fileExists(output));
+
+	std::remove(input.c_str());
+}
+
+TEST(ExternalBuild, RejectsFanInBelowTwo)
+{
+	std::vector<int> keys = makeRandomNumberVector<int>(5000, 0, 100000, 117, true);
+	std::string input = externalPath("fan_in_input");
+	std::string output = externalPath("fan_in_output");
+	writeKeys(input, keys);
+
+	for(size_t fanIn : {0, 1})
+	{
+		ExternalBuildOptions options = smallOptions();
+		options.fan_in = fanIn;
+		EXPECT_THROW(ExternalBuild::sortFile<int>(input, output, options), std::invalid_argument);
+		EXPECT_FALSE(fileExists(output + ".run-0"));
+		EXPECT_FALSE(fileExists(output));
+	}
+
+	std::remove(input.c_str());
+}
+
+// a sorted file shorter than promised frees the subtrees already built
+TEST(ExternalBuild, KeysEndingEarlyFreeBuiltNodes)
+{
+	std::string sorted = externalPath("short_sorted");
+	std::vector<int> keys;
+	for(int key = 0; key < 60; ++key)
+	{
+		keys.push_back(key);
+	}
+	writeKeys(sorted, keys);
+
+	TrackingAVLTree<int, int> tree;
+	{
+		ExternalBuildAccess::Reader<int> reader(sorted, 16);
+		int height;
+		EXPECT_THROW(ExternalBuildAccess::build(reader, tree, 100, height), std::runtime_error);
+	}
+	EXPECT_EQ(0U, tree.liveNodes());
+
+	std::remove(sorted.c_str());
+}
@@ -131,6 +131,74 @@ TEST(AVLInsert, Duplicates)
 }
 
 
+TEST(AVLInsertHint, AppendAtEnd)
+{
+	AVLTree<uint16_t, uint16_t> testTree;
+	std::set<uint16_t> keys;
+
+	for(uint16_t key = 0; key < 7; ++key)
+	{
+		AVLTree<uint16_t, uint16_t>::iterator it = testTree.emplace_hint(testTree.end(), key, key);
+		EXPECT_EQ(key, it->first);
+		keys.insert(key);
+	}
+
+	EXPECT_TRUE(verifyAVL(testTree, keys));
+}
+
+TEST(AVLInsertHint, WrongHint)
+{
+	AVLTree<uint16_t, uint16_t> testTree;
+
+	testTree.insert(std::make_pair(5, 8));
+	testTree.insert(testTree.end(), std::make_pair(3, 159));
+	testTree.insert(testTree.find(5), std::make_pair(1, 9));
+
+	EXPECT_TRUE(verifyAVL(testTree, std::set<uint16_t>({1, 3, 5})));
+}
+
+
+TEST(AVLInsertMove, MoveOnlyValue)
+{
+	AVLTree<int, std::unique_ptr<int>> testTree;
+
+	for(int key = 0; key < 7; ++key)
+	{
+		testTree.insert(std::make_pair(key, std::unique_ptr<int>(new int(key))));
+	}
+	EXPECT_TRUE(testTree.try_emplace(10, std::unique_ptr<int>(new int(10))).second);
+	EXPECT_FALSE(testTree.try_emplace(3, std::unique_ptr<int>(new int(-1))).second);
+	EXPECT_FALSE(testTree.insert_or_assign(4, std::unique_ptr<int>(new int(40))).second);
+
+	EXPECT_EQ(3, *testTree.find(3)->second);
+	EXPECT_EQ(40, *testTree.find(4)->second);
+	EXPECT_TRUE(verifyAVL(testTree, std::set<int>({0, 1, 2, 3, 4, 5, 6, 10})));
+}
+
+TEST(AVLUpsert, Counters)
+{
+	AVLTree<int, int> testTree;
+	std::set<int> keys;
+
+	// every key is seen (key % 3) + 1 times
+	for(int round = 0; round < 3; ++round)
+	{
+		for(int key = 0; key < 30; ++key)
+		{
+			if(key % 3 >= round)
+			{
+				testTree.upsert(key, [](int & count) { ++count; });
+				keys.insert(key);
+			}
+		}
+	}
+
+	for(int key = 0; key < 30; ++key)
+	{
+		EXPECT_EQ(key % 3 + 1, testTree.find(key)->second);
+	}
+	EXPECT_TRUE(verifyAVL(testTree, keys));
+}
 
 TEST(AVLInsert, Random50x30ele)
 {
@@ -179,3 +247,94 @@ TEST(AVLInsert, Random3x1000ele)
 
 
 }
+
+TEST(AVLInsertBatch, EmptyTree)
+{
+	AVLTree<int, int> testTree;
+
+	std::vector<std::pair<int, int>> batch = {{4, 4}, {1, 1}, {7, 7}, {3, 3}, {9, 9}, {2, 2}};
+	testTree.insertBatch(batch.begin(), batch.end());
+
+	EXPECT_TRUE(verifyAVL(testTree, std::set<int>({1, 2, 3, 4, 7, 9})));
+}
+
+TEST(AVLInsertBatch, Duplicates)
+{
+	AVLTree<uint16_t, uint16_t> testTree;
+
+	testTree.insert(std::make_pair(5, 8));
+	testTree.insert(std::make_pair(3, 159));
+
+	std::vector<std::pair<uint16_t, uint16_t>> batch = {{3, 1}, {1, 9}, {3, 2}, {1, 4}};
+	testTree.insertBatch(batch.begin(), batch.end());
+
+	EXPECT_TRUE(verifyAVL(testTree, std::set<uint16_t>({1, 3, 5})));
+	EXPECT_EQ(4, testTree.find(1)->second);
+	EXPECT_EQ(2, testTree.find(3)->second);
+	EXPECT_EQ(8, testTree.find(5)->second);
+}
+
+TEST(AVLInsertBatch, Random10x500ele)
+{
+	const RandomSeed masterSeed = 2611;
+	const size_t numElements = 500;
+	const size_t numTrials = 10;
+
+	AVLTree<int, int> testTree;
+	std::set<int> allData;
+
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(numTrials, masterSeed);
+
+	// each batch lands on top of the tree built by the previous ones
+	for(size_t counter = 0; counter < numTrials; ++counter)
+	{
+		std::vector<int> randomData = makeRandomIntVector(numElements, seeds.at(counter), true);
+		std::vector<std::pair<int, int>> batch;
+		for(int element : randomData)
+		{
+			batch.push_back(std::make_pair(element, element));
+			allData.insert(element);
+		}
+
+		testTree.insertBatch(batch.begin(), batch.end());
+		EXPECT_TRUE(verifyAVL(testTree, allData));
+	}
+}
+
+// batches far larger than one side of the tree leave subtrees well out of
+// balance, to be joined back together
+TEST(AVLInsertBatch, Lopsided)
+{
+	AVLTree<int, int> testTree;
+	std::set<int> allData;
+	for(int key = 0; key < 100; ++key)
+	{
+		testTree.insert(std::make_pair(key * 10, key));
+		allData.insert(key * 10);
+	}
+
+	// everything past the largest key
+	std::vector<std::pair<int, int>> batch;
+	for(int key = 1000; key < 3000; ++key)
+	{
+		batch.push_back(std::make_pair(key, key));
+		allData.insert(key);
+	}
+	testTree.insertBatch(batch.begin(), batch.end());
+	EXPECT_TRUE(verifyAVL(testTree, allData));
+
+	// everything between two neighbouring keys, deep in the tree
+	batch.clear();
+	for(int key = -3000; key < 0; ++key)
+	{
+		batch.push_back(std::make_pair(key, key));
+		allData.insert(key);
+	}
+	for(int key = 501; key < 510; ++key)
+	{
+		batch.push_back(std::make_pair(key, key));
+		allData.insert(key);
+	}
+	testTree.insertBatch(batch.begin(), batch.end());
+	EXPECT_TRUE(verifyAVL(testTree, allData));
+}
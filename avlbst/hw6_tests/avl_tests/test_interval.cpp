@@ -0,0 +1,184 @@
+#include "check_avl.h"
+#include <interval_tree.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+// checks that every node caches the largest end in its subtree, returning
+// that end through maxEnd
+template<typename Key, typename Value>
+testing::AssertionResult checkMaxEnds(std::shared_ptr<Node<Key, Value>> node, Value & maxEnd)
+{
+	maxEnd = node->getValue();
+	for(std::shared_ptr<Node<Key, Value>> child : {node->getLeft(), node->getRight()})
+	{
+		Value childEnd;
+		if(child == nullptr)
+		{
+			continue;
+		}
+		testing::AssertionResult childResult = checkMaxEnds(child, childEnd);
+		if(!childResult)
+		{
+			return childResult;
+		}
+		maxEnd = std::max(maxEnd, childEnd);
+	}
+
+	if(std::static_pointer_cast<IntervalNode<Key, Value>>(node)->getMaxEnd() != maxEnd)
+	{
+		return testing::AssertionFailure() << "Wrong max end at key " << node->getKey();
+	}
+	return testing::AssertionSuccess();
+}
+
+// checks the tree's structure, cached ends and overlap queries against a
+// std::map of the same intervals
+testing::AssertionResult sameOverlaps(IntervalTree<int, int> & tree, std::map<int, int> const & expected, std::vector<std::pair<int, int>> const & queries)
+{
+	std::set<int> keys;
+	for(std::pair<const int, int> const & interval : expected)
+	{
+		keys.insert(interval.first);
+	}
+	testing::AssertionResult avlResult = verifyAVL(tree, keys);
+	if(!avlResult)
+	{
+		return avlResult;
+	}
+	int maxEnd;
+	if(tree.root_ != nullptr && !checkMaxEnds(tree.root_, maxEnd))
+	{
+		return checkMaxEnds(tree.root_, maxEnd);
+	}
+
+	std::vector<IntervalTree<int, int>::iterator> found;
+	for(std::pair<int, int> const & query : queries)
+	{
+		std::vector<int> starts;
+		for(std::pair<const int, int> const & interval : expected)
+		{
+			if(interval.first <= query.second && query.first <= interval.second)
+			{
+				starts.push_back(interval.first);
+			}
+		}
+
+		tree.overlapping(query.first, query.second, found);
+		if(found.size() != starts.size())
+		{
+			return testing::AssertionFailure() << "overlapping(" << query.first << ", " << query.second << ") found " << found.size() << " intervals, expected " << starts.size();
+		}
+		for(size_t index = 0; index < found.size(); ++index)
+		{
+			if(found[index]->first != starts[index])
+			{
+				return testing::AssertionFailure() << "overlapping(" << query.first << ", " << query.second << ") returned the wrong interval";
+			}
+		}
+		if(tree.overlaps(query.first, query.second) != !starts.empty())
+		{
+			return testing::AssertionFailure() << "overlaps(" << query.first << ", " << query.second << ") is wrong";
+		}
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(IntervalTree, EmptyTree)
+{
+	IntervalTree<int, int> tree;
+	std::vector<IntervalTree<int, int>::iterator> found;
+
+	tree.overlapping(0, 100, found);
+	EXPECT_TRUE(found.empty());
+	EXPECT_FALSE(tree.overlaps(0, 100));
+}
+
+TEST(IntervalTree, Touching)
+{
+	IntervalTree<int, int> tree;
+	std::map<int, int> expected = {{0, 10}, {10, 20}, {21, 21}, {30, 40}};
+	for(std::pair<const int, int> const & interval : expected)
+	{
+		tree.insert(interval);
+	}
+
+	// intervals are closed, so sharing an end point counts
+	std::vector<std::pair<int, int>> queries = {{10, 10}, {20, 21}, {22, 29}, {-5, -1}, {40, 50}, {41, 50}, {-100, 100}};
+	EXPECT_TRUE(sameOverlaps(tree, expected, queries));
+}
+
+// a long interval early on must still be found through the cached ends
+TEST(IntervalTree, LongInterval)
+{
+	IntervalTree<int, int> tree;
+	std::map<int, int> expected;
+	for(int start = 0; start < 200; start += 2)
+	{
+		tree.insert(std::make_pair(start, start + 1));
+		expected[start] = start + 1;
+	}
+	tree.insert(std::make_pair(1, 1000));
+	expected[1] = 1000;
+
+	std::vector<std::pair<int, int>> queries = {{500, 600}, {150, 150}, {151, 151}, {999, 2000}, {1001, 2000}};
+	ASSERT_TRUE(sameOverlaps(tree, expected, queries));
+
+	// shrinking it through the tree updates the cached ends
+	tree.modify(1, [](int & end) { end = 1; });
+	expected[1] = 1;
+	ASSERT_TRUE(sameOverlaps(tree, expected, queries));
+}
+
+TEST(IntervalTree, Random10x400ele)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 4409);
+	for(RandomSeed seed : seeds)
+	{
+		IntervalTree<int, int> tree;
+		std::map<int, int> expected;
+
+		std::vector<int> starts = makeRandomNumberVector<int>(400, 0, 10000, seed, true);
+		std::vector<int> lengths = makeRandomNumberVector<int>(400, 0, 300, seed + 1, true);
+		std::vector<int> queryStarts = makeRandomNumberVector<int>(100, -100, 10100, seed + 2, true);
+		std::vector<int> queryLengths = makeRandomNumberVector<int>(100, 0, 200, seed + 3, true);
+		std::vector<std::pair<int, int>> queries;
+		for(size_t index = 0; index < queryStarts.size(); ++index)
+		{
+			queries.push_back(std::make_pair(queryStarts[index], queryStarts[index] + queryLengths[index]));
+		}
+
+		for(size_t index = 0; index < starts.size(); ++index)
+		{
+			tree.insert(std::make_pair(starts[index], starts[index] + lengths[index]));
+			expected[starts[index]] = starts[index] + lengths[index];
+		}
+		ASSERT_TRUE(sameOverlaps(tree, expected, queries));
+
+		for(size_t index = 0; index < starts.size(); index += 3)
+		{
+			tree.remove(starts[index]);
+			expected.erase(starts[index]);
+		}
+		ASSERT_TRUE(sameOverlaps(tree, expected, queries));
+
+		// bulk paths restructure through split/join and merging
+		tree.erase(tree.find(expected.begin()->first), tree.find(std::next(expected.begin(), expected.size() / 2)->first));
+		expected.erase(expected.begin(), std::next(expected.begin(), expected.size() / 2));
+		ASSERT_TRUE(sameOverlaps(tree, expected, queries));
+
+		std::vector<std::pair<int, int>> batch;
+		for(size_t index = 0; index < starts.size(); index += 2)
+		{
+			batch.push_back(std::make_pair(starts[index], starts[index] + 2 * lengths[index]));
+			expected[starts[index]] = starts[index] + 2 * lengths[index];
+		}
+		tree.insertBatch(batch.begin(), batch.end());
+		ASSERT_TRUE(sameOverlaps(tree, expected, queries));
+	}
+}
@@ -0,0 +1,315 @@
+#include "check_avl.h"
+#include <avl_lsm.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// checks every key in [0, maxKey] and a few scans against the reference
+testing::AssertionResult sameContents(LSMStore<int, long> const & store, std::map<int, long> const & expected, int maxKey)
+{
+	for(int key = 0; key <= maxKey; ++key)
+	{
+		long value = 0;
+		bool found = store.find(key, value);
+		std::map<int, long>::const_iterator match = expected.find(key);
+		if(found != (match != expected.end()) || (found && value != match->second))
+		{
+			return testing::AssertionFailure() << "wrong result for key " << key;
+		}
+	}
+	for(int lo = 0; lo <= maxKey; lo += maxKey / 7 + 1)
+	{
+		int hi = lo + maxKey / 3;
+		std::vector<std::pair<int, long>> scanned;
+		store.scan(lo, hi, scanned);
+		std::vector<std::pair<int, long>> wanted(expected.lower_bound(lo), expected.upper_bound(hi));
+		if(scanned != wanted)
+		{
+			return testing::AssertionFailure() << "wrong scan of [" << lo << ", " << hi << "]";
+		}
+	}
+	return testing::AssertionSuccess();
+}
+
+void randomOperations(LSMStore<int, long> & store, std::map<int, long> & expected, size_t count, int maxKey, RandomSeed seed)
+{
+	std::vector<int> keys = makeRandomNumberVector<int>(count, 0, maxKey, seed, true);
+	for(size_t i = 0; i < keys.size(); ++i)
+	{
+		if(i % 3 == 2)
+		{
+			store.remove(keys[i]);
+			expected.erase(keys[i]);
+		}
+		else
+		{
+			store.insert(keys[i], static_cast<long>(i));
+			expected[keys[i]] = static_cast<long>(i);
+		}
+	}
+}
+
+// inserts keys [first, last), ignoring the error a flush may report
+void insertRange(LSMStore<int, long> & store, std::map<int, long> & expected, int first, int last)
+{
+	for(int key = first; key < last; ++key)
+	{
+		try
+		{
+			store.insert(key, key * 2);
+		}
+		catch(std::runtime_error const &)
+		{
+		}
+		expected[key] = key * 2;
+	}
+}
+
+TEST(LSMStore, MemtableOnly)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	std::map<int, long> expected;
+	{
+		LSMStore<int, long> store(directory);
+		randomOperations(store, expected, 500, 300, 111);
+		EXPECT_EQ(0U, store.runCount());
+		EXPECT_TRUE(sameContents(store, expected, 300));
+	}
+	// the destructor flushed the memtable
+	LSMStore<int, long> reopened(directory);
+	EXPECT_EQ(1U, reopened.runCount());
+	EXPECT_TRUE(sameContents(reopened, expected, 300));
+	removeTempDirectory(directory);
+}
+
+// values and tombstones spread over the memtable and many runs
+TEST(LSMStore, ForegroundCompaction)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	LSMOptions options;
+	options.memtable_items = 200;
+	options.max_runs = 3;
+	options.background_compaction = false;
+	std::map<int, long> expected;
+
+	LSMStore<int, long> store(directory, options);
+	randomOperations(store, expected, 5000, 2000, 112);
+	// no run holds more than the 2000 keys, so there are only two tiers
+	EXPECT_LE(store.runCount(), 6U);
+	EXPECT_TRUE(sameContents(store, expected, 2000));
+
+	store.flush();
+	store.compact();
+	EXPECT_EQ(1U, store.runCount());
+	EXPECT_EQ(1U, directoryFiles(directory).size());
+	EXPECT_TRUE(sameContents(store, expected, 2000));
+	removeTempDirectory(directory);
+}
+
+TEST(LSMStore, BackgroundCompaction)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	LSMOptions options;
+	options.memtable_items = 100;
+	options.max_runs = 2;
+	std::map<int, long> expected;
+	{
+		LSMStore<int, long> store(directory, options);
+		randomOperations(store, expected, 20000, 5000, 113);
+		EXPECT_TRUE(sameContents(store, expected, 5000));
+	}
+
+	LSMStore<int, long> reopened(directory, options);
+	EXPECT_TRUE(sameContents(reopened, expected, 5000));
+	reopened.compact();
+	EXPECT_EQ(1U, reopened.runCount());
+	EXPECT_TRUE(sameContents(reopened, expected, 5000));
+	removeTempDirectory(directory);
+}
+
+// with distinct keys, every run of a tier is the same size, so the runs and
+// the flushes they hold are known exactly
+TEST(LSMStore, TieredCompaction)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	LSMOptions options;
+	options.memtable_items = 100;
+	options.max_runs = 3;
+	options.background_compaction = false;
+	std::map<int, long> expected;
+
+	LSMStore<int, long> store(directory, options);
+	insertRange(store, expected, 0, 1600);
+	// four runs of 100 make one of 400, and four of those one of 1600
+	EXPECT_EQ(std::vector<std::string>(1, "run-00000000000000000001-00000000000000000016.sst"), directoryFiles(directory));
+
+	insertRange(store, expected, 1600, 2400);
+	// the run of 1600 is left alone while the newer runs fill their tiers
+	std::vector<std::string> files = directoryFiles(directory);
+	std::sort(files.begin(), files.end());
+	std::vector<std::string> wanted;
+	wanted.push_back("run-00000000000000000001-00000000000000000016.sst");
+	wanted.push_back("run-00000000000000000017-00000000000000000020.sst");
+	wanted.push_back("run-00000000000000000021-00000000000000000024.sst");
+	EXPECT_EQ(wanted, files);
+
+	// a tombstone merged into a newer run still hides the older value
+	store.remove(5);
+	expected.erase(5);
+	insertRange(store, expected, 2400, 2799);
+	EXPECT_EQ(4U, store.runCount());
+	EXPECT_TRUE(sameContents(store, expected, 2800));
+	removeTempDirectory(directory);
+}
+
+// runs covered by a merged run were left by a crash during compaction
+TEST(LSMStore, ReopenDropsMergedRuns)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	LSMOptions options;
+	options.memtable_items = 50;
+	options.background_compaction = false;
+	std::map<int, long> expected;
+	{
+		LSMStore<int, long> store(directory, options);
+		for(int key = 0; key < 100; ++key)
+		{
+			store.insert(key, key);
+			expected[key] = key;
+		}
+		// keep the first run's file to put back after it is merged away
+		std::ifstream first((directory + "/" + directoryFiles(directory)[0]).c_str(), std::ios::binary);
+		std::string bytes((std::istreambuf_iterator<char>(first)), std::istreambuf_iterator<char>());
+		for(int key = 0; key < 50; ++key)
+		{
+			store.remove(key);
+			expected.erase(key);
+		}
+		store.compact();
+		EXPECT_EQ(1U, store.runCount());
+
+		std::ofstream stale((directory + "/run-00000000000000000001-00000000000000000001.sst").c_str(), std::ios::binary);
+		stale << bytes;
+		std::ofstream((directory + "/run-00000000000000000009-00000000000000000009.sst.tmp").c_str()) << "unfinished";
+	}
+
+	LSMStore<int, long> reopened(directory, options);
+	EXPECT_EQ(1U, reopened.runCount());
+	EXPECT_EQ(1U, directoryFiles(directory).size());
+	EXPECT_TRUE(sameContents(reopened, expected, 100));
+	removeTempDirectory(directory);
+}
+
+// a removed key leaves the caller's value alone, whether its tombstone is in
+// the memtable or in a run
+TEST(LSMStore, FindMissLeavesValue)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	LSMOptions options;
+	options.background_compaction = false;
+	{
+		LSMStore<int, long> store(directory, options);
+		store.insert(1, 10);
+		store.insert(2, 20);
+		store.flush();
+		store.remove(1);
+		long value = -1;
+		EXPECT_FALSE(store.find(1, value));
+		EXPECT_EQ(-1, value);
+
+		store.flush();
+		store.remove(2);
+		store.flush();
+		EXPECT_FALSE(store.find(1, value));
+		EXPECT_FALSE(store.find(2, value));
+		EXPECT_EQ(-1, value);
+	}
+	removeTempDirectory(directory);
+}
+
+// a directory in the way of the merged run makes the first compaction fail
+TEST(LSMStore, CompactionFailureKeepsFlushing)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	LSMOptions options;
+	options.memtable_items = 10;
+	options.max_runs = 2;
+	std::map<int, long> expected;
+	std::string blocker = directory + "/run-00000000000000000001-00000000000000000003.sst.tmp";
+	{
+		LSMStore<int, long> store(directory, options);
+		ASSERT_EQ(0, mkdir(blocker.c_str(), 0755));
+		insertRange(store, expected, 0, 30);
+
+		// reported once by a flush
+		bool reported = false;
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while(!reported && std::chrono::steady_clock::now() < deadline)
+		{
+			try
+			{
+				store.flush();
+				usleep(10000);
+			}
+			catch(std::runtime_error const &)
+			{
+				reported = true;
+			}
+		}
+		EXPECT_TRUE(reported);
+		EXPECT_EQ(3U, store.runCount());
+
+		// the retries keep failing while the directory is there, and are
+		// retried once it is gone
+		usleep(300000);
+		rmdir(blocker.c_str());
+		deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while(store.runCount() > 1 && std::chrono::steady_clock::now() < deadline)
+		{
+			usleep(10000);
+		}
+		EXPECT_EQ(1U, store.runCount());
+
+		// with an error still to report, the destructor writes the memtable
+		insertRange(store, expected, 30, 35);
+	}
+
+	LSMStore<int, long> reopened(directory, options);
+	EXPECT_TRUE(sameContents(reopened, expected, 40));
+	removeTempDirectory(directory);
+}
+
+// with max_runs 0 every run was a full tier, and compaction never ended
+TEST(LSMStore, RejectsNoRuns)
+{
+	std::string directory = makeTempDirectory("avl_lsm");
+	LSMOptions options;
+	options.memtable_items = 4;
+	options.max_runs = 0;
+	options.background_compaction = false;
+	EXPECT_THROW((LSMStore<int, long>(directory, options)), std::invalid_argument);
+
+	// a single run is fine: every second flush merges
+	options.max_runs = 1;
+	std::map<int, long> expected;
+	{
+		LSMStore<int, long> store(directory, options);
+		insertRange(store, expected, 0, 40);
+		EXPECT_GE(2U, store.runCount());
+		EXPECT_TRUE(sameContents(store, expected, 50));
+	}
+	removeTempDirectory(directory);
+}
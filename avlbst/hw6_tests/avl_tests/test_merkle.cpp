@@ -0,0 +1,144 @@
+#include "check_avl.h"
+#include <merkle_tree.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// the keys whose items differ between two maps, in order
+template<typename Key, typename Value>
+std::vector<Key> expectedDiff(std::map<Key, Value> const & a, std::map<Key, Value> const & b)
+{
+	std::vector<Key> keys;
+	for(std::pair<const Key, Value> const & item : a)
+	{
+		typename std::map<Key, Value>::const_iterator match = b.find(item.first);
+		if(match == b.end() || match->second != item.second)
+		{
+			keys.push_back(item.first);
+		}
+	}
+	for(std::pair<const Key, Value> const & item : b)
+	{
+		if(a.count(item.first) == 0)
+		{
+			keys.push_back(item.first);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	return keys;
+}
+
+TEST(MerkleTree, EmptyTrees)
+{
+	MerkleTree<int, int> a, b;
+	std::vector<int> diff;
+
+	EXPECT_EQ(a.hash(), b.hash());
+	a.diff(b, diff);
+	EXPECT_TRUE(diff.empty());
+
+	b.insert(std::make_pair(1, 1));
+	EXPECT_NE(a.hash(), b.hash());
+	a.diff(b, diff);
+	EXPECT_EQ(std::vector<int>{1}, diff);
+	b.diff(a, diff);
+	EXPECT_EQ(std::vector<int>{1}, diff);
+}
+
+// replicas built in different orders have different shapes but equal hashes
+TEST(MerkleTree, ShapeIndependent)
+{
+	MerkleTree<int, int> ascending, descending;
+	for(int key = 0; key < 1000; ++key)
+	{
+		ascending.insert(std::make_pair(key, key * 2));
+		descending.insert(std::make_pair(999 - key, (999 - key) * 2));
+	}
+	EXPECT_EQ(ascending.hash(), descending.hash());
+
+	std::vector<int> diff;
+	ascending.diff(descending, diff);
+	EXPECT_TRUE(diff.empty());
+
+	descending.modify(500, [](int & value) { value = -1; });
+	EXPECT_NE(ascending.hash(), descending.hash());
+	ascending.diff(descending, diff);
+	EXPECT_EQ(std::vector<int>{500}, diff);
+
+	descending.insert_or_assign(500, 1000);
+	EXPECT_EQ(ascending.hash(), descending.hash());
+}
+
+TEST(MerkleTree, Random10x1000ele)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 7717);
+	for(RandomSeed seed : seeds)
+	{
+		MerkleTree<std::string, int> a, b;
+		std::map<std::string, int> expectedA, expectedB;
+
+		std::vector<std::string> keys = makeRandomAlphaStringVector(1000, seed, 6, false);
+		std::vector<int> changes = makeRandomNumberVector<int>(30, 0, 999, seed + 1, true);
+		for(size_t index = 0; index < keys.size(); ++index)
+		{
+			a.insert(std::make_pair(keys[index], index));
+			expectedA[keys[index]] = index;
+		}
+		for(size_t index = keys.size(); index-- > 0;)
+		{
+			b.insert(std::make_pair(keys[index], index));
+			expectedB[keys[index]] = index;
+		}
+
+		// a few removals, new keys and changed values on either side
+		for(size_t index = 0; index < changes.size(); ++index)
+		{
+			std::string const & key = keys[changes[index]];
+			switch(index % 4)
+			{
+			case 0:
+				a.remove(key);
+				expectedA.erase(key);
+				break;
+			case 1:
+				b.insert(std::make_pair(key + "x", 1));
+				expectedB[key + "x"] = 1;
+				break;
+			case 2:
+				b.insert(std::make_pair(key, -1));
+				expectedB[key] = -1;
+				break;
+			default:
+				b.remove(key);
+				expectedB.erase(key);
+				break;
+			}
+		}
+
+		std::vector<std::string> diff;
+		a.diff(b, diff);
+		ASSERT_EQ(expectedDiff(expectedA, expectedB), diff);
+		b.diff(a, diff);
+		ASSERT_EQ(expectedDiff(expectedA, expectedB), diff);
+
+		// bulk paths keep the hashes current too
+		std::vector<std::pair<std::string, int>> batch;
+		for(size_t index = 0; index < keys.size(); index += 3)
+		{
+			batch.push_back(std::make_pair(keys[index], 7));
+			expectedA[keys[index]] = 7;
+		}
+		a.insertBatch(batch.begin(), batch.end());
+		a.erase(a.find(std::next(expectedA.begin(), 100)->first), a.find(std::next(expectedA.begin(), 200)->first));
+		expectedA.erase(std::next(expectedA.begin(), 100), std::next(expectedA.begin(), 200));
+		a.diff(b, diff);
+		ASSERT_EQ(expectedDiff(expectedA, expectedB), diff);
+	}
+}
@@ -0,0 +1,171 @@
+#include <paged_btree.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+std::string pagedPath(std::string const & name)
+{
+	std::string path = testing::TempDir() + "avl_paged_" + name + ".db";
+	std::remove(path.c_str());
+	return path;
+}
+
+// wide enough that only 16 fit in a page, so that small trees are several
+// levels deep
+struct WideKey
+{
+	int id;
+	char padding[244];
+
+	bool operator<(WideKey const & other) const
+	{
+		return id < other.id;
+	}
+};
+
+WideKey wideKey(int id)
+{
+	WideKey key = WideKey();
+	key.id = id;
+	return key;
+}
+
+template<typename Key, typename Value, typename Expected>
+void checkContents(PagedBTree<Key, Value> const & tree, Expected const & expected)
+{
+	EXPECT_EQ(expected.size(), tree.size());
+	typename Expected::const_iterator want = expected.begin();
+	for(typename PagedBTree<Key, Value>::iterator it = tree.begin(); it != tree.end(); ++it, ++want)
+	{
+		ASSERT_TRUE(want != expected.end());
+		EXPECT_FALSE(it->first < want->first || want->first < it->first);
+		EXPECT_EQ(want->second, it->second);
+	}
+	EXPECT_TRUE(want == expected.end());
+}
+
+TEST(PagedBTree, RandomOperationsMatchMap)
+{
+	std::string path = pagedPath("random");
+	PagedBTree<WideKey, int> tree(path, 16);
+	std::map<int, int> expected;
+
+	std::vector<int> keys = makeRandomNumberVector<int>(20000, 0, 5000, 116, true);
+	for(size_t i = 0; i < keys.size(); i++)
+	{
+		if(i % 3 == 2)
+		{
+			tree.remove(wideKey(keys[i]));
+			expected.erase(keys[i]);
+		}
+		else
+		{
+			tree.insert(std::make_pair(wideKey(keys[i]), static_cast<int>(i)));
+			expected[keys[i]] = i;
+		}
+	}
+	EXPECT_GE(tree.height(), 3u);
+	// far more pages than frames, so pages were evicted and read back
+	EXPECT_GT(tree.pool().reads(), 0u);
+
+	std::map<WideKey, int> wide;
+	for(std::map<int, int>::iterator it = expected.begin(); it != expected.end(); ++it)
+	{
+		wide[wideKey(it->first)] = it->second;
+	}
+	checkContents(tree, wide);
+
+	// removing everything collapses the tree back to a single leaf
+	for(std::map<int, int>::iterator it = expected.begin(); it != expected.end(); ++it)
+	{
+		tree.remove(wideKey(it->first));
+	}
+	EXPECT_TRUE(tree.empty());
+	EXPECT_EQ(1u, tree.height());
+	EXPECT_TRUE(tree.begin() == tree.end());
+	std::remove(path.c_str());
+}
+
+TEST(PagedBTree, FindAndLowerBound)
+{
+	std::string path = pagedPath("find");
+	PagedBTree<int, int> tree(path);
+	for(int i = 0; i < 5000; i++)
+	{
+		tree.insert(std::make_pair(2 * i, i));
+	}
+	tree.insert(std::make_pair(10, -1));
+
+	ASSERT_TRUE(tree.find(10) != tree.end());
+	EXPECT_EQ(-1, tree.find(10)->second);
+	EXPECT_TRUE(tree.find(11) == tree.end());
+	EXPECT_TRUE(tree.find(-2) == tree.end());
+
+	PagedBTree<int, int>::iterator it = tree.lower_bound(4001);
+	ASSERT_TRUE(it != tree.end());
+	EXPECT_EQ(4002, (*it).first);
+	++it;
+	EXPECT_EQ(4004, it->first);
+	EXPECT_TRUE(tree.lower_bound(9999) == tree.end());
+	EXPECT_EQ(0, tree.lower_bound(-5)->first);
+	std::remove(path.c_str());
+}
+
+TEST(PagedBTree, ReopenKeepsItems)
+{
+	std::string path = pagedPath("reopen");
+	std::map<int, int> expected;
+	{
+		PagedBTree<int, int> tree(path, 16);
+		std::vector<int> keys = makeRandomNumberVector<int>(30000, -100000, 100000, 117, false);
+		for(size_t i = 0; i < keys.size(); i++)
+		{
+			tree.insert(std::make_pair(keys[i], static_cast<int>(i)));
+			expected[keys[i]] = i;
+		}
+		for(size_t i = 0; i < keys.size(); i += 4)
+		{
+			tree.remove(keys[i]);
+			expected.erase(keys[i]);
+		}
+	}
+
+	PagedBTree<int, int> reopened(path, 16);
+	checkContents(reopened, expected);
+	EXPECT_THROW((PagedBTree<int, long>(path)), std::runtime_error);
+	std::remove(path.c_str());
+}
+
+TEST(PagedBTree, ClearReusesPages)
+{
+	std::string path = pagedPath("clear");
+	PagedBTree<int, int> tree(path);
+	off_t first_size = 0;
+	for(int round = 0; round < 3; round++)
+	{
+		for(int i = 0; i < 20000; i++)
+		{
+			tree.insert(std::make_pair(i, round));
+		}
+		tree.flush();
+		struct stat info;
+		ASSERT_EQ(0, stat(path.c_str(), &info));
+		if(round == 0)
+		{
+			first_size = info.st_size;
+		}
+		EXPECT_EQ(first_size, info.st_size);
+		tree.clear();
+		EXPECT_TRUE(tree.empty());
+	}
+	std::remove(path.c_str());
+}
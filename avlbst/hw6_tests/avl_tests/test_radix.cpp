@@ -0,0 +1,140 @@
+#include <radix_tree.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// checks the tree against a std::map holding the same items, in order
+template<typename Key, typename Value>
+testing::AssertionResult sameItems(RadixTree<Key, Value> & tree, std::map<Key, Value> const & expected)
+{
+	if(tree.size() != expected.size())
+	{
+		return testing::AssertionFailure() << "size() is " << tree.size() << ", expected " << expected.size();
+	}
+
+	typename RadixTree<Key, Value>::iterator it = tree.begin();
+	for(typename std::map<Key, Value>::const_iterator exp = expected.begin(); exp != expected.end(); ++exp, ++it)
+	{
+		if(it == tree.end() || it->first != exp->first || it->second != exp->second)
+		{
+			return testing::AssertionFailure() << "Item mismatch at key " << exp->first;
+		}
+		if(tree.find(exp->first) != it)
+		{
+			return testing::AssertionFailure() << "find() did not return key " << exp->first;
+		}
+	}
+	if(it != tree.end())
+	{
+		return testing::AssertionFailure() << "Tree has extra items";
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(RadixTree, EmptyTree)
+{
+	RadixTree<uint64_t, int> testTree;
+
+	EXPECT_TRUE(testTree.empty());
+	EXPECT_EQ(testTree.end(), testTree.begin());
+	EXPECT_EQ(testTree.end(), testTree.find(7));
+	testTree.remove(7);
+	EXPECT_TRUE(testTree.empty());
+}
+
+TEST(RadixTree, StringPrefixes)
+{
+	RadixTree<std::string, int> testTree;
+	std::map<std::string, int> expected;
+
+	// keys that are prefixes of each other end at inner nodes
+	const char * keys[] = {"romane", "romanus", "romulus", "rubens", "ruber", "rubicon", "rubicundus", "r", "rom", "", "roman"};
+	int value = 0;
+	for(const char * key : keys)
+	{
+		testTree.insert(std::make_pair(std::string(key), value));
+		expected[key] = value++;
+	}
+	ASSERT_TRUE(sameItems(testTree, expected));
+	EXPECT_EQ(testTree.end(), testTree.find("ro"));
+	EXPECT_EQ(testTree.end(), testTree.find("romanes"));
+
+	testTree.insert(std::make_pair(std::string("rom"), 100));
+	expected["rom"] = 100;
+	ASSERT_TRUE(sameItems(testTree, expected));
+
+	for(const char * key : keys)
+	{
+		testTree.remove(key);
+		expected.erase(key);
+		ASSERT_TRUE(sameItems(testTree, expected));
+	}
+	EXPECT_TRUE(testTree.empty());
+}
+
+TEST(RadixTree, SignedKeys)
+{
+	RadixTree<int, int> testTree;
+	std::map<int, int> expected;
+
+	for(int key = -300; key <= 300; key += 7)
+	{
+		testTree.insert(std::make_pair(key, key));
+		expected[key] = key;
+	}
+	EXPECT_TRUE(sameItems(testTree, expected));
+}
+
+// dense keys fill nodes up to Node256 and back down again
+TEST(RadixTree, GrowAndShrinkNodes)
+{
+	RadixTree<uint32_t, uint32_t> testTree;
+	std::map<uint32_t, uint32_t> expected;
+
+	for(uint32_t key = 0; key < 4096; ++key)
+	{
+		testTree.insert(std::make_pair(key * 3, key));
+		expected[key * 3] = key;
+	}
+	ASSERT_TRUE(sameItems(testTree, expected));
+
+	for(uint32_t key = 0; key < 4096; ++key)
+	{
+		if(key % 5 != 0)
+		{
+			testTree.remove(key * 3);
+			expected.erase(key * 3);
+		}
+	}
+	ASSERT_TRUE(sameItems(testTree, expected));
+}
+
+TEST(RadixTree, Random10x1000ele)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 3811);
+	for(RandomSeed seed : seeds)
+	{
+		RadixTree<uint64_t, uint64_t> testTree;
+		std::map<uint64_t, uint64_t> expected;
+
+		std::vector<uint64_t> keys = makeRandomNumberVector<uint64_t>(1000, 0, UINT64_MAX, seed, true);
+		for(size_t index = 0; index < keys.size(); ++index)
+		{
+			testTree.insert(std::make_pair(keys[index], index));
+			expected[keys[index]] = index;
+		}
+		ASSERT_TRUE(sameItems(testTree, expected));
+
+		for(size_t index = 0; index < keys.size(); index += 2)
+		{
+			testTree.remove(keys[index]);
+			expected.erase(keys[index]);
+		}
+		ASSERT_TRUE(sameItems(testTree, expected));
+	}
+}
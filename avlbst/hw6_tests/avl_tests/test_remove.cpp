@@ -3,7 +3,9 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdlib>
 #include <initializer_list>
+#include <iterator>
 #include <utility>
 
 TEST(AVLRemove, EmptyTree)
@@ -142,6 +144,105 @@ TEST(AVLRemove, Random50x30ele)
 
 }
 
+TEST(AVLPop, PriorityQueue)
+{
+	AVLTree<int, int> testTree;
+	std::set<int> randomData = makeRandomIntSet(100, 3141);
+	fillTree(testTree, randomData, 3142);
+
+	// drain from both ends, as a double-ended priority queue would
+	while(!randomData.empty())
+	{
+		ASSERT_EQ(*randomData.begin(), testTree.begin()->first);
+		ASSERT_EQ(*randomData.rbegin(), testTree.rbegin()->first);
+
+		testTree.pop_min();
+		randomData.erase(randomData.begin());
+		if(!randomData.empty())
+		{
+			testTree.pop_max();
+			randomData.erase(std::prev(randomData.end()));
+		}
+		ASSERT_TRUE(verifyAVL(testTree, randomData));
+	}
+
+	EXPECT_TRUE(testTree.empty());
+}
+
+TEST(AVLErase, Iterator)
+{
+	AVLTree<int, int> testTree;
+	std::set<int> randomData = makeRandomIntSet(50, 3231);
+	fillTree(testTree, randomData, 3232);
+
+	// erase by iterator, reaching the item through its predecessor
+	while(randomData.size() > 1)
+	{
+		std::set<int>::iterator expected =
+			std::next(randomData.begin(), randomData.size() / 3);
+		AVLTree<int, int>::iterator it = testTree.find(*expected);
+		++it;
+		expected = randomData.erase(std::next(expected));
+		it = testTree.erase(it);
+		if(expected == randomData.end())
+		{
+			ASSERT_EQ(testTree.end(), it);
+		}
+		else
+		{
+			ASSERT_EQ(*expected, it->first);
+		}
+		ASSERT_TRUE(verifyAVL(testTree, randomData));
+	}
+}
+
+TEST(AVLErase, Random10x200ele)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 3241);
+	for(RandomSeed seed : seeds)
+	{
+		AVLTree<int, int> testTree;
+		std::set<int> randomData = makeRandomIntSet(200, seed);
+		fillTree(testTree, randomData, seed + 1);
+
+		// cut random ranges until the tree is small
+		std::srand(seed);
+		while(randomData.size() > 10)
+		{
+			size_t a = std::rand() % randomData.size();
+			size_t b = std::rand() % (randomData.size() + 1);
+			if(a > b)
+			{
+				std::swap(a, b);
+			}
+			std::set<int>::iterator lo = std::next(randomData.begin(), a);
+			std::set<int>::iterator hi = std::next(randomData.begin(), b);
+
+			AVLTree<int, int>::iterator before = testTree.begin();
+			AVLTree<int, int>::iterator last =
+				hi == randomData.end() ? testTree.end() : testTree.find(*hi);
+			EXPECT_EQ(last, testTree.erase(testTree.find(*lo), last));
+			randomData.erase(lo, hi);
+			ASSERT_TRUE(verifyAVL(testTree, randomData));
+
+			// iterators outside the range are untouched
+			if(a > 0)
+			{
+				ASSERT_EQ(*randomData.begin(), before->first);
+			}
+			if(last != testTree.end())
+			{
+				ASSERT_EQ(*hi, last->first);
+			}
+			if(!randomData.empty())
+			{
+				ASSERT_EQ(*randomData.begin(), testTree.begin()->first);
+				ASSERT_EQ(*randomData.rbegin(), testTree.rbegin()->first);
+			}
+		}
+	}
+}
+
 // extensive combined insert-remove test
 // author credit: Shreya Havaldar
 TEST(AVLStress, InsertRemove)
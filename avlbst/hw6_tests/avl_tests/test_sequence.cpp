@@ -0,0 +1,139 @@
+#include <avl_sequence.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// checks the sequence's balance, iteration order and at() against a vector
+template<typename Value>
+testing::AssertionResult sameSequence(AVLSequence<Value> & sequence, std::vector<Value> const & expected)
+{
+	if(!sequence.isBalanced())
+	{
+		return testing::AssertionFailure() << "Sequence is not balanced";
+	}
+	if(sequence.size() != expected.size())
+	{
+		return testing::AssertionFailure() << "size() is " << sequence.size() << ", expected " << expected.size();
+	}
+
+	typename AVLSequence<Value>::iterator it = sequence.begin();
+	for(size_t index = 0; index < expected.size(); ++index, ++it)
+	{
+		if(it == sequence.end() || *it != expected[index])
+		{
+			return testing::AssertionFailure() << "Iteration mismatch at position " << index;
+		}
+		if(sequence.at(index) != expected[index])
+		{
+			return testing::AssertionFailure() << "at(" << index << ") is wrong";
+		}
+	}
+	if(it != sequence.end())
+	{
+		return testing::AssertionFailure() << "Sequence has extra items";
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(AVLSequence, EmptySequence)
+{
+	AVLSequence<int> sequence;
+
+	EXPECT_TRUE(sequence.empty());
+	EXPECT_EQ(0u, sequence.size());
+	EXPECT_EQ(sequence.end(), sequence.begin());
+	EXPECT_THROW(sequence.at(0), std::out_of_range);
+	EXPECT_THROW(sequence.eraseAt(0), std::out_of_range);
+	EXPECT_THROW(sequence.insertAt(1, 5), std::out_of_range);
+}
+
+TEST(AVLSequence, PushAndErase)
+{
+	AVLSequence<std::string> sequence;
+	std::vector<std::string> expected;
+
+	sequence.pushBack("b");
+	sequence.pushFront("a");
+	sequence.pushBack("d");
+	sequence.insertAt(2, "c");
+	expected = {"a", "b", "c", "d"};
+	ASSERT_TRUE(sameSequence(sequence, expected));
+
+	sequence.at(1) = "B";
+	sequence.eraseAt(0);
+	sequence.eraseAt(2);
+	expected = {"B", "c"};
+	ASSERT_TRUE(sameSequence(sequence, expected));
+}
+
+TEST(AVLSequence, Random10x500ops)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 6133);
+	for(RandomSeed seed : seeds)
+	{
+		AVLSequence<int> sequence;
+		std::vector<int> expected;
+
+		std::vector<int> positions = makeRandomNumberVector<int>(500, 0, 1000000, seed, true);
+		for(size_t index = 0; index < positions.size(); ++index)
+		{
+			size_t pos = positions[index] % (expected.size() + 1);
+			sequence.insertAt(pos, index);
+			expected.insert(expected.begin() + pos, index);
+		}
+		ASSERT_TRUE(sameSequence(sequence, expected));
+
+		for(size_t index = 0; index < positions.size(); index += 2)
+		{
+			size_t pos = positions[index] % expected.size();
+			sequence.eraseAt(pos);
+			expected.erase(expected.begin() + pos);
+		}
+		ASSERT_TRUE(sameSequence(sequence, expected));
+	}
+}
+
+TEST(AVLSequence, SplitConcat)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 2713);
+	for(RandomSeed seed : seeds)
+	{
+		AVLSequence<int> sequence;
+		std::vector<int> expected;
+		for(int value = 0; value < 300; ++value)
+		{
+			sequence.pushBack(value);
+			expected.push_back(value);
+		}
+
+		// cut into three pieces at random points, then glue them back in
+		// another order
+		std::vector<int> cuts = makeRandomNumberVector<int>(2, 0, 300, seed, true);
+		size_t first = std::min(cuts[0], cuts[1]);
+		size_t second = std::max(cuts[0], cuts[1]);
+		AVLSequence<int> tail = sequence.split(second);
+		AVLSequence<int> middle = sequence.split(first);
+		ASSERT_TRUE(sameSequence(sequence, std::vector<int>(expected.begin(), expected.begin() + first)));
+		ASSERT_TRUE(sameSequence(middle, std::vector<int>(expected.begin() + first, expected.begin() + second)));
+		ASSERT_TRUE(sameSequence(tail, std::vector<int>(expected.begin() + second, expected.end())));
+
+		tail.concat(sequence);
+		tail.concat(middle);
+		EXPECT_TRUE(sequence.empty());
+		EXPECT_TRUE(middle.empty());
+		std::vector<int> reordered(expected.begin() + second, expected.end());
+		reordered.insert(reordered.end(), expected.begin(), expected.begin() + first);
+		reordered.insert(reordered.end(), expected.begin() + first, expected.begin() + second);
+		ASSERT_TRUE(sameSequence(tail, reordered));
+
+		// the result is still a working sequence
+		tail.insertAt(tail.size() / 2, -1);
+		reordered.insert(reordered.begin() + reordered.size() / 2, -1);
+		ASSERT_TRUE(sameSequence(tail, reordered));
+	}
+}
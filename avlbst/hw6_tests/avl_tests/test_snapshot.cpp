@@ -0,0 +1,314 @@
+#include "check_avl.h"
+#include <aggregate_tree.h>
+#include <avl_snapshot.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+std::string snapshotPath(std::string const & name)
+{
+	return testing::TempDir() + "avl_snapshot_" + name + ".bin";
+}
+
+void flipByte(std::string const & path, long offset, char mask = 0x40)
+{
+	std::fstream file(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	file.seekg(offset);
+	char byte = file.get();
+	file.seekp(offset);
+	file.put(static_cast<char>(byte ^ mask));
+}
+
+TEST(AVLSnapshot, EmptyTree)
+{
+	std::string path = snapshotPath("empty");
+	AVLTree<int, int> tree, loaded;
+	AVLSnapshot::save(tree, path);
+
+	loaded.insert(std::make_pair(1, 1));
+	AVLSnapshot::load(path, loaded);
+	EXPECT_TRUE(loaded.empty());
+
+	AVLSnapshotView<int, int> view(path);
+	EXPECT_TRUE(view.empty());
+	EXPECT_EQ(nullptr, view.find(1));
+	std::remove(path.c_str());
+}
+
+// the loaded tree has the same shape and balances, not just the same items
+TEST(AVLSnapshot, RoundTripKeepsShape)
+{
+	std::string path = snapshotPath("shape");
+	std::vector<int> keys = makeRandomNumberVector<int>(3000, -100000, 100000, 104, false);
+	AVLTree<int, double> tree;
+	std::set<int> keySet;
+	for(int key : keys)
+	{
+		tree.insert(std::make_pair(key, key * 0.5));
+		keySet.insert(key);
+	}
+	for(size_t i = 0; i < keys.size(); i += 3)
+	{
+		tree.remove(keys[i]);
+		keySet.erase(keys[i]);
+	}
+	AVLSnapshot::save(tree, path);
+
+	AVLTree<int, double> loaded;
+	loaded.insert(std::make_pair(123456789, 0.0));
+	AVLSnapshot::load(path, loaded);
+	EXPECT_TRUE(verifyAVL(loaded, keySet));
+
+	std::vector<std::pair<int, int>> expectedShape, loadedShape;
+	preOrderShape(tree.root_, expectedShape);
+	preOrderShape(loaded.root_, loadedShape);
+	EXPECT_EQ(expectedShape, loadedShape);
+
+	for(int key : keySet)
+	{
+		EXPECT_EQ(key * 0.5, loaded.find(key)->second);
+	}
+	EXPECT_EQ(*keySet.begin(), loaded.begin()->first);
+
+	// and the loaded tree is an ordinary, modifiable tree
+	loaded.insert(std::make_pair(100001, 1.0));
+	loaded.remove(*keySet.begin());
+	EXPECT_TRUE(verifyAVL(loaded));
+	std::remove(path.c_str());
+}
+
+TEST(AVLSnapshot, ViewFind)
+{
+	std::string path = snapshotPath("view");
+	std::vector<int> keys = makeRandomNumberVector<int>(2000, 0, 50000, 105, false);
+	AVLTree<int, long> tree;
+	std::set<int> keySet(keys.begin(), keys.end());
+	for(int key : keys)
+	{
+		tree.insert(std::make_pair(key, key * 3L));
+	}
+	AVLSnapshot::save(tree, path);
+
+	AVLSnapshotView<int, long> view(path);
+	EXPECT_EQ(keySet.size(), view.size());
+	for(int probe = -1; probe <= 50001; ++probe)
+	{
+		long const * value = view.find(probe);
+		if(keySet.count(probe) == 0)
+		{
+			EXPECT_EQ(nullptr, value);
+		}
+		else
+		{
+			ASSERT_NE(nullptr, value);
+			EXPECT_EQ(probe * 3L, *value);
+		}
+	}
+	std::remove(path.c_str());
+}
+
+// more padding than the writer's zero buffer holds before each section
+struct alignas(32) WideValue
+{
+	int value;
+};
+
+TEST(AVLSnapshot, OverAlignedValue)
+{
+	std::string path = snapshotPath("over_aligned");
+	AVLTree<int, WideValue> tree;
+	for(int key = 0; key < 37; ++key)
+	{
+		WideValue value;
+		value.value = -key;
+		tree.insert(std::make_pair(key, value));
+	}
+	AVLSnapshot::save(tree, path);
+
+	AVLSnapshotView<int, WideValue> view(path);
+	EXPECT_EQ(37U, view.size());
+	for(int key = 0; key < 37; ++key)
+	{
+		WideValue const * value = view.find(key);
+		ASSERT_NE(nullptr, value);
+		EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(value) % alignof(WideValue));
+		EXPECT_EQ(-key, value->value);
+	}
+	std::remove(path.c_str());
+}
+
+// the augmentation hooks run while loading, so cached aggregates are rebuilt
+TEST(AVLSnapshot, LoadAugmentedTree)
+{
+	std::string path = snapshotPath("augmented");
+	AVLTree<int, int> tree;
+	long total = 0;
+	for(int key = 1; key <= 500; ++key)
+	{
+		tree.insert(std::make_pair(key, key));
+		total += key;
+	}
+	AVLSnapshot::save(tree, path);
+
+	AggregateTree<int, int> loaded;
+	AVLSnapshot::load(path, loaded);
+	EXPECT_TRUE(verifyAVL(loaded));
+	EXPECT_EQ(total, loaded.aggregate());
+	EXPECT_EQ(10 + 11 + 12, loaded.aggregate(10, 12));
+	std::remove(path.c_str());
+}
+
+TEST(AVLSnapshot, RejectsBadImages)
+{
+	std::string path = snapshotPath("bad");
+	AVLTree<int, int> tree;
+	for(int key = 0; key < 100; ++key)
+	{
+		tree.insert(std::make_pair(key, key));
+	}
+
+	EXPECT_THROW((AVLSnapshotView<int, int>(snapshotPath("missing"))), std::runtime_error);
+
+	AVLSnapshot::save(tree, path);
+	AVLTree<long, int> wrongKey;
+	EXPECT_THROW(AVLSnapshot::load(path, wrongKey), std::runtime_error);
+	EXPECT_TRUE(wrongKey.empty());
+
+	// every corrupted byte is caught, in the header or the arrays
+	for(long offset : {0L, 20L, 100L, 500L, 1000L})
+	{
+		AVLSnapshot::save(tree, path);
+		flipByte(path, offset);
+		AVLTree<int, int> loaded;
+		loaded.insert(std::make_pair(-1, -1));
+		EXPECT_THROW(AVLSnapshot::load(path, loaded), std::runtime_error);
+		// a failed load leaves the tree as it was
+		EXPECT_EQ(-1, loaded.begin()->first);
+	}
+
+	AVLSnapshot::save(tree, path);
+	std::ofstream(path.c_str(), std::ios::binary | std::ios::app).put(0);
+	EXPECT_THROW((AVLSnapshotView<int, int>(path)), std::runtime_error);
+	std::remove(path.c_str());
+}
+
+TEST(AVLSnapshot, ChecksumIsCRC32C)
+{
+	std::string check = "123456789";
+	AVLSnapshotChecksum whole;
+	whole.update(check.data(), check.size());
+	EXPECT_EQ(0xe3069283U, whole.finish());
+
+	// fed in pieces that straddle the eight-byte steps
+	std::string text = makeRandomAlphaStringVector(1, 117, 100, false)[0];
+	AVLSnapshotChecksum all, pieces;
+	all.update(text.data(), text.size());
+	pieces.update(text.data(), 3);
+	pieces.update(text.data() + 3, 12);
+	pieces.update(text.data() + 15, text.size() - 15);
+	EXPECT_EQ(all.finish(), pieces.finish());
+}
+
+// flipping the top bit of two words cancelled out under FNV-1a over words
+TEST(AVLSnapshot, RejectsTwoHighBitFlips)
+{
+	std::string path = snapshotPath("high_bits");
+	AVLTree<int, long> tree;
+	for(int key = 0; key < 50; ++key)
+	{
+		tree.insert(std::make_pair(key, static_cast<long>(key)));
+	}
+	AVLSnapshot::save(tree, path);
+
+	AVLSnapshotHeader header;
+	{
+		std::ifstream in(path.c_str(), std::ios::binary);
+		in.read(reinterpret_cast<char *>(&header), sizeof(header));
+	}
+	long top = static_cast<long>(header.values_offset) + sizeof(long) - 1;
+	flipByte(path, top, static_cast<char>(0x80));
+	flipByte(path, top + 7 * sizeof(long), static_cast<char>(0x80));
+
+	AVLTree<int, long> loaded;
+	EXPECT_THROW(AVLSnapshot::load(path, loaded), std::runtime_error);
+	EXPECT_TRUE(loaded.empty());
+	std::remove(path.c_str());
+}
+
+// an image whose checksum is right but whose links are not
+TEST(AVLSnapshot, BadLinksFreeBuiltNodes)
+{
+	std::string path = snapshotPath("bad_links");
+	AVLTree<int, int> tree;
+	for(int key = 0; key < 100; ++key)
+	{
+		tree.insert(std::make_pair(key, key));
+	}
+	AVLSnapshot::save(tree, path);
+
+	std::string image;
+	{
+		std::ifstream in(path.c_str(), std::ios::binary);
+		image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	AVLSnapshotHeader header;
+	std::memcpy(&header, image.data(), sizeof(header));
+	// the root's right child moved one node later, still inside the image
+	uint32_t right;
+	std::memcpy(&right, image.data() + header.right_offset, sizeof(right));
+	right++;
+	std::memcpy(&image[header.right_offset], &right, sizeof(right));
+	AVLSnapshotChecksum sum;
+	sum.update(image.data() + sizeof(header), image.size() - sizeof(header));
+	header.checksum = sum.finish();
+	std::memcpy(&image[0], &header, sizeof(header));
+	std::ofstream(path.c_str(), std::ios::binary | std::ios::trunc).write(image.data(), image.size());
+
+	TrackingAVLTree<int, int> loaded;
+	loaded.insert(std::make_pair(-1, -1));
+	EXPECT_THROW(AVLSnapshot::load(path, loaded), std::runtime_error);
+	EXPECT_EQ(1U, loaded.liveNodes());
+	EXPECT_EQ(-1, loaded.begin()->first);
+	std::remove(path.c_str());
+}
+
+// saving writes a new file and renames it into place, so an image that is
+// already open is left whole
+TEST(AVLSnapshot, ResaveKeepsOpenImage)
+{
+	std::string path = snapshotPath("resave");
+	AVLTree<int, int> tree;
+	for(int key = 0; key < 1000; ++key)
+	{
+		tree.insert(std::make_pair(key, key));
+	}
+	AVLSnapshot::save(tree, path);
+	AVLSnapshotView<int, int> before(path);
+
+	AVLTree<int, int> smaller;
+	smaller.insert(std::make_pair(5, -5));
+	AVLSnapshot::save(smaller, path);
+	std::vector<int> keys = {10, 20, 30};
+	AVLSnapshot::saveSorted(keys.data(), keys.size(), 1, path);
+
+	EXPECT_EQ(1000U, before.size());
+	ASSERT_NE(nullptr, before.find(999));
+	EXPECT_EQ(999, *before.find(999));
+	AVLSnapshotView<int, int> after(path);
+	EXPECT_EQ(3U, after.size());
+	EXPECT_EQ(nullptr, after.find(5));
+	EXPECT_FALSE(std::ifstream((path + ".tmp").c_str()).good());
+	std::remove(path.c_str());
+}
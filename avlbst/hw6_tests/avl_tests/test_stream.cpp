@@ -0,0 +1,179 @@
+#include "check_avl.h"
+#include <aggregate_tree.h>
+#include <avl_stream.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+template<typename Key, typename Value>
+testing::AssertionResult sameItems(AVLTree<Key, Value> & tree, std::map<Key, Value> const & expected)
+{
+	std::set<Key> keys;
+	for(std::pair<const Key, Value> const & item : expected)
+	{
+		keys.insert(item.first);
+	}
+	testing::AssertionResult avlResult = verifyAVL(tree, keys);
+	if(!avlResult)
+	{
+		return avlResult;
+	}
+	for(std::pair<const Key, Value> const & item : expected)
+	{
+		if(tree.find(item.first)->second != item.second)
+		{
+			return testing::AssertionFailure() << "wrong value for key " << item.first;
+		}
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(AVLStream, EmptyTree)
+{
+	std::stringstream stream;
+	AVLTree<int, int> tree, loaded;
+	AVLStream::write(stream, tree);
+
+	loaded.insert(std::make_pair(1, 1));
+	AVLStream::read(stream, loaded);
+	EXPECT_TRUE(loaded.empty());
+}
+
+TEST(AVLStream, RawRoundTrip)
+{
+	std::vector<int> keys = makeRandomNumberVector<int>(5000, -1000000, 1000000, 106, false);
+	AVLTree<int, double> tree;
+	std::map<int, double> expected;
+	for(int key : keys)
+	{
+		tree.insert(std::make_pair(key, key / 4.0));
+		expected[key] = key / 4.0;
+	}
+
+	std::stringstream stream;
+	AVLStream::write(stream, tree);
+	AVLTree<int, double> loaded;
+	AVLStream::read(stream, loaded);
+	EXPECT_TRUE(sameItems(loaded, expected));
+	EXPECT_EQ(expected.begin()->first, loaded.begin()->first);
+}
+
+// several trees back to back, each with its own codec state
+TEST(AVLStream, CompactCodecs)
+{
+	AVLTree<long, int> dense;
+	std::map<long, int> expectedDense;
+	for(long key = -5000; key < 5000; ++key)
+	{
+		dense.insert(std::make_pair(key * 3, static_cast<int>(key % 100)));
+		expectedDense[key * 3] = static_cast<int>(key % 100);
+	}
+	AVLTree<std::string, unsigned> words;
+	std::map<std::string, unsigned> expectedWords;
+	std::vector<std::string> strings = makeRandomAlphaStringVector(500, 107, 12, false);
+	for(size_t i = 0; i < strings.size(); ++i)
+	{
+		words.insert(std::make_pair(strings[i], static_cast<unsigned>(i)));
+		expectedWords[strings[i]] = static_cast<unsigned>(i);
+	}
+
+	std::stringstream raw, stream;
+	AVLStream::write(raw, dense);
+	AVLStream::write(stream, dense, DeltaCodec<long>(), VarintCodec<int>());
+	// one byte per key gap and at most two per value, against 12 raw
+	EXPECT_LT(stream.str().size() * 4, raw.str().size());
+	AVLStream::write(stream, words, StringCodec(), VarintCodec<unsigned>());
+	AVLStream::write(stream, dense, DeltaCodec<long>(), VarintCodec<int>());
+
+	AVLTree<long, int> loadedDense;
+	AVLTree<std::string, unsigned> loadedWords;
+	AVLStream::read(stream, loadedDense, DeltaCodec<long>(), VarintCodec<int>());
+	EXPECT_TRUE(sameItems(loadedDense, expectedDense));
+	AVLStream::read(stream, loadedWords, StringCodec(), VarintCodec<unsigned>());
+	EXPECT_TRUE(sameItems(loadedWords, expectedWords));
+	AVLStream::read(stream, loadedDense, DeltaCodec<long>(), VarintCodec<int>());
+	EXPECT_TRUE(sameItems(loadedDense, expectedDense));
+}
+
+// a writer thread and a reader on the two ends of a Unix socket
+TEST(AVLStream, UnixSocket)
+{
+	int fds[2];
+	ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+	AVLTree<int, int> tree;
+	std::map<int, int> expected;
+	for(int key = 0; key < 200000; ++key)
+	{
+		tree.insert(std::make_pair(key * 7, key));
+		expected[key * 7] = key;
+	}
+
+	std::thread writer([&tree, &fds]()
+	{
+		FdStreamBuf buffer(fds[0]);
+		std::ostream out(&buffer);
+		AVLStream::write(out, tree, DeltaCodec<int>(), VarintCodec<int>());
+		close(fds[0]);
+	});
+
+	AggregateTree<int, int> loaded;
+	{
+		FdStreamBuf buffer(fds[1]);
+		std::istream in(&buffer);
+		AVLStream::read(in, loaded, DeltaCodec<int>(), VarintCodec<int>());
+	}
+	writer.join();
+	close(fds[1]);
+
+	EXPECT_TRUE(sameItems(loaded, expected));
+	// augmented trees get their caches built while reading
+	EXPECT_EQ(10 + 11 + 12, loaded.aggregate(70, 84));
+}
+
+TEST(AVLStream, RejectsBadStreams)
+{
+	AVLTree<int, int> tree;
+	for(int key = 0; key < 100; ++key)
+	{
+		tree.insert(std::make_pair(key, key));
+	}
+	std::stringstream stream;
+	AVLStream::write(stream, tree);
+	std::string bytes = stream.str();
+
+	TrackingAVLTree<int, int> loaded;
+	loaded.insert(std::make_pair(-1, -1));
+
+	std::stringstream truncated(bytes.substr(0, bytes.size() - 3));
+	EXPECT_THROW(AVLStream::read(truncated, loaded), std::runtime_error);
+	// the nodes read before the stream ran out are all freed
+	EXPECT_EQ(1U, loaded.liveNodes());
+
+	std::stringstream notATree("not a tree at all");
+	EXPECT_THROW(AVLStream::read(notATree, loaded), std::runtime_error);
+
+	// swap the first two keys
+	std::string swapped = bytes;
+	size_t first = bytes.size() - 100 * 2 * sizeof(int);
+	swapped[first] = 1;
+	swapped[first + 2 * sizeof(int)] = 0;
+	std::stringstream unsorted(swapped);
+	EXPECT_THROW(AVLStream::read(unsorted, loaded), std::runtime_error);
+
+	// a failed read leaves the tree as it was
+	EXPECT_EQ(-1, loaded.begin()->first);
+	EXPECT_EQ(-1, loaded.find(-1)->second);
+}
@@ -0,0 +1,143 @@
+#include <veb_set.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <iterator>
+#include <set>
+
+// checks every query on the set against a std::set of the same keys, probing
+// at, just around and between the keys
+testing::AssertionResult sameQueries(VEBSet const & set, std::set<uint32_t> const & expected, std::vector<uint32_t> const & probes)
+{
+	if(set.size() != expected.size())
+	{
+		return testing::AssertionFailure() << "size() is " << set.size() << ", expected " << expected.size();
+	}
+	if(!expected.empty() && (set.min() != *expected.begin() || set.max() != *expected.rbegin()))
+	{
+		return testing::AssertionFailure() << "min() or max() is wrong";
+	}
+
+	for(uint32_t probe : probes)
+	{
+		uint32_t result = 0;
+		if(set.contains(probe) != (expected.count(probe) == 1))
+		{
+			return testing::AssertionFailure() << "contains() is wrong for " << probe;
+		}
+
+		std::set<uint32_t>::const_iterator upper = expected.upper_bound(probe);
+		bool found = set.successor(probe, result);
+		if(found != (upper != expected.end()) || (found && result != *upper))
+		{
+			return testing::AssertionFailure() << "successor() is wrong for " << probe;
+		}
+
+		std::set<uint32_t>::const_iterator lower = expected.lower_bound(probe);
+		found = set.lowerBound(probe, result);
+		if(found != (lower != expected.end()) || (found && result != *lower))
+		{
+			return testing::AssertionFailure() << "lowerBound() is wrong for " << probe;
+		}
+
+		found = set.predecessor(probe, result);
+		if(found != (lower != expected.begin()) || (found && result != *std::prev(lower)))
+		{
+			return testing::AssertionFailure() << "predecessor() is wrong for " << probe;
+		}
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(VEBSet, EmptySet)
+{
+	VEBSet set;
+	uint32_t result;
+
+	EXPECT_TRUE(set.empty());
+	EXPECT_FALSE(set.contains(0));
+	EXPECT_FALSE(set.successor(0, result));
+	EXPECT_FALSE(set.predecessor(UINT32_MAX, result));
+	EXPECT_FALSE(set.remove(5));
+}
+
+TEST(VEBSet, Extremes)
+{
+	VEBSet set;
+	std::set<uint32_t> expected;
+	std::vector<uint32_t> probes = {0, 1, 62, 63, 64, 65535, 65536, UINT32_MAX - 1, UINT32_MAX};
+
+	for(uint32_t key : probes)
+	{
+		EXPECT_TRUE(set.insert(key));
+		EXPECT_FALSE(set.insert(key));
+		expected.insert(key);
+		ASSERT_TRUE(sameQueries(set, expected, probes));
+	}
+	for(uint32_t key : probes)
+	{
+		EXPECT_TRUE(set.remove(key));
+		expected.erase(key);
+		ASSERT_TRUE(sameQueries(set, expected, probes));
+	}
+	EXPECT_TRUE(set.empty());
+}
+
+TEST(VEBSet, Random10x1000ele)
+{
+	std::vector<RandomSeed> seeds = makeRandomSeedVector(10, 5279);
+	for(RandomSeed seed : seeds)
+	{
+		VEBSet set;
+		std::set<uint32_t> expected;
+
+		// half the keys are dense so clusters fill up, half are spread out
+		std::vector<uint32_t> keys = makeRandomNumberVector<uint32_t>(500, 0, 4000, seed, true);
+		std::vector<uint32_t> sparse = makeRandomNumberVector<uint32_t>(500, 0, UINT32_MAX, seed, true);
+		keys.insert(keys.end(), sparse.begin(), sparse.end());
+
+		std::vector<uint32_t> probes = makeRandomNumberVector<uint32_t>(500, 0, 4100, seed + 1, true);
+		for(uint32_t key : keys)
+		{
+			probes.push_back(key);
+			probes.push_back(key + 1);
+			probes.push_back(key - 1);
+		}
+
+		for(uint32_t key : keys)
+		{
+			set.insert(key);
+			expected.insert(key);
+		}
+		ASSERT_TRUE(sameQueries(set, expected, probes));
+
+		for(size_t index = 0; index < keys.size(); index += 2)
+		{
+			EXPECT_EQ(expected.erase(keys[index]) == 1, set.remove(keys[index]));
+		}
+		ASSERT_TRUE(sameQueries(set, expected, probes));
+
+		set.clear();
+		expected.clear();
+		ASSERT_TRUE(sameQueries(set, expected, probes));
+	}
+}
+
+TEST(VEBSet, FromAVLTree)
+{
+	AVLTree<uint32_t, int> tree;
+	std::set<uint32_t> expected;
+
+	std::vector<uint32_t> keys = makeRandomNumberVector<uint32_t>(1000, 0, 100000, 1187, true);
+	for(uint32_t key : keys)
+	{
+		tree.insert(std::make_pair(key, 0));
+		expected.insert(key);
+	}
+
+	VEBSet set = makeVEBSet(tree);
+	EXPECT_TRUE(sameQueries(set, expected, keys));
+}
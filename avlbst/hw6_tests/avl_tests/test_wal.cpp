@@ -0,0 +1,231 @@
+#include "check_avl.h"
+#include <avl_wal.h>
+
+#include <random_generator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// a store whose log can be swapped for one that refuses every write
+class FailingStore : public DurableAVLStore<int, int>
+{
+public:
+	FailingStore(std::string const & directory, WALOptions const & options)
+	: DurableAVLStore<int, int>(directory, options), saved_(-1)
+	{
+	}
+
+	void breakLog()
+	{
+		saved_ = log_fd_;
+		log_fd_ = open("/dev/null", O_RDONLY);
+	}
+
+	void fixLog()
+	{
+		close(log_fd_);
+		log_fd_ = saved_;
+	}
+
+private:
+	int saved_;
+};
+
+template<typename Key, typename Value>
+testing::AssertionResult sameContents(AVLTree<Key, Value> const & tree, std::map<Key, Value> const & expected)
+{
+	if(!tree.isBalanced())
+	{
+		return testing::AssertionFailure() << "tree is not balanced";
+	}
+	typename std::map<Key, Value>::const_iterator expectedIt = expected.begin();
+	for(typename AVLTree<Key, Value>::iterator it = tree.begin(); it != tree.end(); ++it, ++expectedIt)
+	{
+		if(expectedIt == expected.end())
+		{
+			return testing::AssertionFailure() << "extra key " << it->first;
+		}
+		if(it->first != expectedIt->first || it->second != expectedIt->second)
+		{
+			return testing::AssertionFailure() << "expected key " << expectedIt->first << " but found " << it->first;
+		}
+	}
+	if(expectedIt != expected.end())
+	{
+		return testing::AssertionFailure() << "missing key " << expectedIt->first;
+	}
+	return testing::AssertionSuccess();
+}
+
+TEST(DurableAVLStore, ReopenReplaysLog)
+{
+	std::string directory = makeTempDirectory("avl_wal");
+	std::vector<int> keys = makeRandomNumberVector<int>(2000, 0, 500, 108, true);
+	std::map<int, int> expected;
+	{
+		DurableAVLStore<int, int> store(directory);
+		EXPECT_EQ(0U, store.replayed());
+		for(size_t i = 0; i < keys.size(); ++i)
+		{
+			if(i % 4 == 3)
+			{
+				store.remove(keys[i]);
+				expected.erase(keys[i]);
+			}
+			else
+			{
+				store.insert(keys[i], static_cast<int>(i));
+				expected[keys[i]] = static_cast<int>(i);
+			}
+		}
+		EXPECT_TRUE(sameContents(store.tree(), expected));
+	}
+
+	DurableAVLStore<int, int> reopened(directory);
+	EXPECT_EQ(keys.size(), reopened.replayed());
+	EXPECT_TRUE(sameContents(reopened.tree(), expected));
+	removeTempDirectory(directory);
+}
+
+TEST(DurableAVLStore, CheckpointsEmptyTheLog)
+{
+	std::string directory = makeTempDirectory("avl_wal");
+	WALOptions options;
+	options.group_size = 16;
+	options.checkpoint_every = 100;
+	std::map<std::string, unsigned> expected;
+	std::vector<std::string> words = makeRandomAlphaStringVector(1050, 109, 8, true);
+	{
+		DurableAVLStore<std::string, unsigned, StringCodec, VarintCodec<unsigned>> store(directory, options);
+		for(size_t i = 0; i < words.size(); ++i)
+		{
+			store.insert(words[i], static_cast<unsigned>(i));
+			expected[words[i]] = static_cast<unsigned>(i);
+		}
+	}
+
+	// only the operations after the last checkpoint are replayed
+	DurableAVLStore<std::string, unsigned, StringCodec, VarintCodec<unsigned>> reopened(directory, options);
+	EXPECT_EQ(50U, reopened.replayed());
+	EXPECT_TRUE(sameContents(reopened.tree(), expected));
+
+	reopened.checkpoint();
+	DurableAVLStore<std::string, unsigned, StringCodec, VarintCodec<unsigned>> again(directory, options);
+	EXPECT_EQ(0U, again.replayed());
+	EXPECT_TRUE(sameContents(again.tree(), expected));
+	removeTempDirectory(directory);
+}
+
+// a crash in a child process loses only the group that was never committed
+TEST(DurableAVLStore, CrashLosesOnlyUncommittedGroup)
+{
+	std::string directory = makeTempDirectory("avl_wal");
+	WALOptions options;
+	options.group_size = 10;
+
+	pid_t child = fork();
+	ASSERT_GE(child, 0);
+	if(child == 0)
+	{
+		DurableAVLStore<int, int> store(directory, options);
+		for(int key = 0; key < 25; ++key)
+		{
+			store.insert(key, key * key);
+		}
+		_exit(0);
+	}
+	int status;
+	waitpid(child, &status, 0);
+
+	std::map<int, int> expected;
+	for(int key = 0; key < 20; ++key)
+	{
+		expected[key] = key * key;
+	}
+	DurableAVLStore<int, int> reopened(directory, options);
+	EXPECT_EQ(20U, reopened.replayed());
+	EXPECT_TRUE(sameContents(reopened.tree(), expected));
+	removeTempDirectory(directory);
+}
+
+TEST(DurableAVLStore, TornTailIsCutOff)
+{
+	std::string directory = makeTempDirectory("avl_wal");
+	std::map<int, int> expected;
+	{
+		DurableAVLStore<int, int> store(directory);
+		for(int key = 0; key < 100; ++key)
+		{
+			store.insert(key, -key);
+			expected[key] = -key;
+		}
+	}
+	// half of a record, as if the machine died while writing it
+	{
+		std::ofstream log((directory + "/wal").c_str(), std::ios::binary | std::ios::app);
+		log.write("\x09\x00\x00\x00\x12\x34", 6);
+	}
+	{
+		DurableAVLStore<int, int> store(directory);
+		EXPECT_EQ(100U, store.replayed());
+		EXPECT_TRUE(sameContents(store.tree(), expected));
+		store.insert(1000, 1);
+		expected[1000] = 1;
+	}
+
+	// the record written after the repair is not lost behind the torn one
+	DurableAVLStore<int, int> reopened(directory);
+	EXPECT_EQ(101U, reopened.replayed());
+	EXPECT_TRUE(sameContents(reopened.tree(), expected));
+	removeTempDirectory(directory);
+}
+
+// an operation whose group cannot be written is not applied, and the group
+// before it is written by the next commit
+TEST(DurableAVLStore, FailedWriteLeavesTreeUnchanged)
+{
+	std::string directory = makeTempDirectory("avl_wal");
+	WALOptions options;
+	options.group_size = 3;
+	std::map<int, int> expected;
+	{
+		FailingStore store(directory, options);
+		for(int key = 0; key < 5; ++key)
+		{
+			store.insert(key, key);
+			expected[key] = key;
+		}
+
+		store.breakLog();
+		EXPECT_THROW(store.insert(5, 5), std::runtime_error);
+		EXPECT_TRUE(sameContents(store.tree(), expected));
+		EXPECT_THROW(store.sync(), std::runtime_error);
+		store.fixLog();
+
+		store.remove(0);
+		expected.erase(0);
+		EXPECT_TRUE(sameContents(store.tree(), expected));
+	}
+
+	DurableAVLStore<int, int> reopened(directory, options);
+	EXPECT_EQ(6U, reopened.replayed());
+	EXPECT_TRUE(sameContents(reopened.tree(), expected));
+
+	options.group_size = 1;
+	FailingStore store(directory, options);
+	store.breakLog();
+	EXPECT_THROW(store.remove(1), std::runtime_error);
+	store.fixLog();
+	EXPECT_TRUE(sameContents(store.tree(), expected));
+	removeTempDirectory(directory);
+}
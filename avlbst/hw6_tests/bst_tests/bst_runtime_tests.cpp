@@ -8,7 +8,11 @@
 #include <random_generator.h>
 
 #include <gtest/gtest.h>
+#include <chrono>
 #include <iostream>
+#include <vector>
+
+#include <unistd.h>
 
 // runtime test for inserting a key in balanced order
 TEST(BSTRuntime, InsertBalanced)
@@ -234,6 +238,58 @@ TEST(BSTRuntime, IteratorBalanced)
 	EXPECT_TRUE(runtimeEvaluator.meetsComplexity(RuntimeEvaluator::TimeComplexity::LINEAR));
 }
 
+// findBatch() against a loop of find() calls on a tree larger than the
+// last-level cache, so that the lower levels of every lookup miss. Reports the numbers rather than a complexity, and wall time, as
+// the point is how much of the memory latency overlaps.
+TEST(BSTRuntime, FindBatchLargeTree)
+{
+	// larger than the last-level cache, and never less than 2^20 nodes
+	uint64_t numElements = 1 << 20;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	long cacheBytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	// a node and the shared_ptr control block allocated with it
+	uint64_t nodeBytes = sizeof(Node<uint64_t, uint64_t>) + 16;
+	while(cacheBytes > 0 && numElements * nodeBytes < static_cast<uint64_t>(cacheBytes))
+	{
+		numElements *= 2;
+	}
+	std::cout << "last-level cache " << cacheBytes / 1024 << " KiB, ";
+#endif
+	std::cout << numElements << " nodes" << std::endl;
+
+	// random keys, so the tree's shape has nothing to do with where its
+	// nodes sit in memory
+	BinarySearchTree<uint64_t, uint64_t> tree;
+	std::vector<uint64_t> elements = makeRandomNumberVector<uint64_t>(numElements, 0, 1ULL << 44, 3271, false);
+	for(uint64_t element : elements)
+	{
+		tree.insert(std::make_pair(element, element));
+	}
+	std::vector<uint64_t> lookups;
+	for(uint64_t i = 0; i < (1 << 20); ++i)
+	{
+		lookups.push_back(elements[(i * 7919) % numElements]);
+	}
 
+	uint64_t found = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(uint64_t key : lookups)
+	{
+		found += tree.find(key) != tree.end();
+	}
+	std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+	std::vector<BinarySearchTree<uint64_t, uint64_t>::iterator> results;
+	tree.findBatch(lookups, results);
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	EXPECT_EQ(lookups.size(), found);
+	for(size_t i = 0; i < lookups.size(); ++i)
+	{
+		ASSERT_EQ(lookups[i], results[i]->first);
+	}
 
-
+	double loopTime = std::chrono::duration<double, std::milli>(middle - start).count();
+	double batchTime = std::chrono::duration<double, std::milli>(end - middle).count();
+	std::cout << lookups.size() << " lookups: " << loopTime << " ms with find(), " << batchTime << " ms with findBatch(), " << loopTime / batchTime << "x" << std::endl;
+	EXPECT_LT(batchTime, loopTime);
+}
@@ -124,6 +124,47 @@ TEST(BSTFind, InvalidFind)
 	EXPECT_EQ(testTree.find(7), testTree.end());
 }
 
+TEST(BSTFind, BatchEmptyTree)
+{
+	BinarySearchTree<int, int> testTree;
+
+	std::vector<BinarySearchTree<int, int>::iterator> results;
+	testTree.findBatch(std::vector<int>({1, 2, 3}), results);
+
+	ASSERT_EQ(3, results.size());
+	for(size_t index = 0; index < results.size(); ++index)
+	{
+		EXPECT_EQ(testTree.end(), results[index]);
+	}
+}
+
+TEST(BSTFind, BatchRandom)
+{
+	const RandomSeed masterSeed = 2727;
+
+	BinarySearchTree<int, int> testTree;
+
+	std::set<int> randomData = makeRandomIntSet(1000, masterSeed);
+	fillTree(testTree, randomData, masterSeed + 1);
+
+	// a mix of hits and misses, longer than one lookup group
+	std::vector<int> keys = makeRandomIntVector(300, masterSeed + 2, true);
+	keys.insert(keys.end(), randomData.begin(), randomData.end());
+
+	std::vector<BinarySearchTree<int, int>::iterator> results;
+	testTree.findBatch(keys, results);
+
+	ASSERT_EQ(keys.size(), results.size());
+	for(size_t index = 0; index < keys.size(); ++index)
+	{
+		EXPECT_EQ(testTree.find(keys[index]), results[index]);
+		if(randomData.find(keys[index]) != randomData.end())
+		{
+			EXPECT_EQ(keys[index], results[index]->first);
+		}
+	}
+}
+
 
 TEST(BSTInsert, Duplicates)
 {
@@ -141,6 +182,164 @@ TEST(BSTInsert, Duplicates)
 }
 
 
+TEST(BSTInsertHint, AppendAtEnd)
+{
+	BinarySearchTree<int, int> testTree;
+	std::set<int> keys;
+
+	for(int key = 0; key < 20; ++key)
+	{
+		BinarySearchTree<int, int>::iterator it = testTree.insert(testTree.end(), std::make_pair(key, key * 2));
+		EXPECT_EQ(key, it->first);
+		keys.insert(key);
+	}
+
+	EXPECT_TRUE(verifyBST(testTree, keys));
+}
+
+TEST(BSTInsertHint, AfterLastInsert)
+{
+	BinarySearchTree<int, int> testTree;
+	testTree.insert(std::make_pair(50, 50));
+	testTree.insert(std::make_pair(25, 25));
+	testTree.insert(std::make_pair(75, 75));
+
+	// keys between 25 and 50, each hinted with the previous insert
+	BinarySearchTree<int, int>::iterator last = testTree.find(25);
+	for(int key = 26; key < 50; ++key)
+	{
+		last = testTree.emplace_hint(last, key, key);
+		EXPECT_EQ(key, last->first);
+	}
+
+	std::set<int> keys({25, 50, 75});
+	for(int key = 26; key < 50; ++key)
+	{
+		keys.insert(key);
+	}
+	EXPECT_TRUE(verifyBST(testTree, keys));
+}
+
+TEST(BSTInsertHint, WrongHint)
+{
+	BinarySearchTree<int, int> testTree;
+	testTree.insert(std::make_pair(5, 5));
+	testTree.insert(std::make_pair(3, 3));
+	testTree.insert(std::make_pair(8, 8));
+
+	// none of these belong next to their hint
+	testTree.insert(testTree.find(8), std::make_pair(1, 1));
+	testTree.insert(testTree.end(), std::make_pair(4, 4));
+	testTree.insert(testTree.find(3), std::make_pair(9, 9));
+	testTree.insert(testTree.find(5), std::make_pair(8, 80));
+
+	EXPECT_TRUE(verifyBST(testTree, std::set<int>({1, 3, 4, 5, 8, 9})));
+	EXPECT_EQ(80, testTree.find(8)->second);
+}
+
+// value type that counts how often it is copied
+struct CopyCounter
+{
+	static int copies;
+	int value;
+
+	CopyCounter(int v = 0): value(v) {}
+	CopyCounter(const CopyCounter & other): value(other.value) { ++copies; }
+	CopyCounter(CopyCounter && other): value(other.value) {}
+	CopyCounter & operator=(const CopyCounter & other) { value = other.value; ++copies; return *this; }
+	CopyCounter & operator=(CopyCounter && other) { value = other.value; return *this; }
+};
+int CopyCounter::copies = 0;
+
+TEST(BSTInsertMove, NoValueCopies)
+{
+	BinarySearchTree<int, CopyCounter> testTree;
+	CopyCounter::copies = 0;
+
+	testTree.insert(std::make_pair(2, CopyCounter(20)));
+	testTree.insert(std::make_pair(1, CopyCounter(10)));
+	testTree.insert(std::make_pair(2, CopyCounter(21)));
+	testTree.emplace(3, CopyCounter(30));
+	testTree.try_emplace(4, 40);
+	testTree.insert_or_assign(1, CopyCounter(11));
+	testTree.emplace_hint(testTree.end(), 5, CopyCounter(50));
+
+	EXPECT_EQ(0, CopyCounter::copies);
+	EXPECT_EQ(11, testTree.find(1)->second.value);
+	EXPECT_EQ(21, testTree.find(2)->second.value);
+	EXPECT_EQ(40, testTree.find(4)->second.value);
+	EXPECT_TRUE(verifyBST(testTree, std::set<int>({1, 2, 3, 4, 5})));
+}
+
+TEST(BSTInsertMove, MoveOnlyValue)
+{
+	BinarySearchTree<int, std::unique_ptr<int>> testTree;
+
+	testTree.insert(std::make_pair(5, std::unique_ptr<int>(new int(5))));
+	testTree.try_emplace(3, new int(3));
+	testTree.insert_or_assign(5, std::unique_ptr<int>(new int(6)));
+
+	EXPECT_EQ(3, *testTree.find(3)->second);
+	EXPECT_EQ(6, *testTree.find(5)->second);
+	EXPECT_TRUE(verifyBST(testTree, std::set<int>({3, 5})));
+}
+
+TEST(BSTInsertMove, ExistingKeys)
+{
+	BinarySearchTree<int, std::string> testTree;
+
+	EXPECT_TRUE(testTree.emplace(1, "one").second);
+	EXPECT_TRUE(testTree.try_emplace(2, 3, 'x').second);
+
+	// neither of these replace the stored value
+	std::pair<BinarySearchTree<int, std::string>::iterator, bool> result = testTree.emplace(1, "uno");
+	EXPECT_FALSE(result.second);
+	EXPECT_EQ("one", result.first->second);
+
+	std::string moved("dos");
+	EXPECT_FALSE(testTree.try_emplace(2, std::move(moved)).second);
+	EXPECT_EQ("dos", moved);
+	EXPECT_EQ("xxx", testTree.find(2)->second);
+
+	// but insert_or_assign does
+	EXPECT_FALSE(testTree.insert_or_assign(2, "two").second);
+	EXPECT_TRUE(testTree.insert_or_assign(3, "three").second);
+	EXPECT_EQ("two", testTree.find(2)->second);
+	EXPECT_EQ("three", testTree.find(3)->second);
+}
+
+TEST(BSTUpsert, Counters)
+{
+	BinarySearchTree<std::string, int> testTree;
+	std::vector<std::string> words = {"b", "a", "c", "a", "b", "a"};
+
+	for(size_t index = 0; index < words.size(); ++index)
+	{
+		testTree.upsert(words[index], [](int & count) { ++count; });
+	}
+
+	EXPECT_EQ(3, testTree.find("a")->second);
+	EXPECT_EQ(2, testTree.find("b")->second);
+	EXPECT_EQ(1, testTree.find("c")->second);
+	EXPECT_TRUE(verifyBST(testTree, std::set<std::string>({"a", "b", "c"})));
+}
+
+TEST(BSTUpsert, Modify)
+{
+	BinarySearchTree<int, std::string> testTree;
+	testTree.insert(std::make_pair(1, std::string("one")));
+
+	EXPECT_TRUE(testTree.modify(1, [](std::string & value) { value += "!"; }));
+	EXPECT_FALSE(testTree.modify(2, [](std::string & value) { value = "two"; }));
+
+	EXPECT_EQ("one!", testTree.find(1)->second);
+	EXPECT_EQ(testTree.end(), testTree.find(2));
+
+	std::pair<BinarySearchTree<int, std::string>::iterator, bool> result = testTree.upsert(2, [](std::string & value) { value = "two"; });
+	EXPECT_TRUE(result.second);
+	EXPECT_EQ("two", result.first->second);
+}
+
 
 TEST(BSTInsert, BasicRandom)
 {
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 
 #include <initializer_list>
+#include <iterator>
 #include <utility>
 
 TEST(BSTRemove, EmptyTree)
@@ -143,6 +144,119 @@ TEST(BSTRemove, Random50x30ele)
 
 }
 
+TEST(BSTPop, MinMax)
+{
+	BinarySearchTree<int, int> testTree;
+	std::set<int> randomData = makeRandomIntSet(30, 3131);
+	fillTree(testTree, randomData, 3132);
+
+	// alternate ends, checking the cached extremes after every removal
+	while(!randomData.empty())
+	{
+		ASSERT_EQ(*randomData.begin(), testTree.begin()->first);
+		ASSERT_EQ(*randomData.rbegin(), testTree.rbegin()->first);
+
+		if(randomData.size() % 2 == 0)
+		{
+			testTree.pop_min();
+			randomData.erase(randomData.begin());
+		}
+		else
+		{
+			testTree.pop_max();
+			randomData.erase(std::prev(randomData.end()));
+		}
+		ASSERT_TRUE(verifyBST(testTree, randomData));
+	}
+
+	EXPECT_EQ(testTree.end(), testTree.begin());
+	EXPECT_EQ(testTree.rend(), testTree.rbegin());
+	testTree.pop_min();
+	testTree.pop_max();
+	EXPECT_TRUE(testTree.empty());
+}
+
+TEST(BSTPop, ExtremesAfterRemove)
+{
+	BinarySearchTree<int, int> testTree;
+	testTree.insert(std::make_pair(5, 5));
+	testTree.insert(std::make_pair(2, 2));
+	testTree.insert(std::make_pair(8, 8));
+	testTree.insert(std::make_pair(1, 1));
+	testTree.insert(std::make_pair(9, 9));
+
+	testTree.remove(1);
+	testTree.remove(9);
+	EXPECT_EQ(2, testTree.begin()->first);
+	EXPECT_EQ(8, testTree.rbegin()->first);
+
+	// reverse iteration visits every item from the top down
+	std::vector<int> keys;
+	for(BinarySearchTree<int, int>::reverse_iterator it = testTree.rbegin(); it != testTree.rend(); ++it)
+	{
+		keys.push_back(it->first);
+	}
+	EXPECT_EQ(std::vector<int>({8, 5, 2}), keys);
+
+	testTree.clear();
+	EXPECT_EQ(testTree.end(), testTree.begin());
+}
+
+TEST(BSTErase, Iterator)
+{
+	BinarySearchTree<int, int> testTree;
+	std::set<int> randomData = makeRandomIntSet(30, 3211);
+	fillTree(testTree, randomData, 3212);
+
+	// erase every other item, checking the returned successor
+	BinarySearchTree<int, int>::iterator it = testTree.begin();
+	std::set<int>::iterator expected = randomData.begin();
+	while(it != testTree.end())
+	{
+		expected = randomData.erase(expected);
+		it = testTree.erase(it);
+		if(expected == randomData.end())
+		{
+			EXPECT_EQ(testTree.end(), it);
+			break;
+		}
+		ASSERT_EQ(*expected, it->first);
+		++it;
+		++expected;
+	}
+	EXPECT_TRUE(verifyBST(testTree, randomData));
+}
+
+TEST(BSTErase, Range)
+{
+	BinarySearchTree<int, int> testTree;
+	std::set<int> randomData = makeRandomIntSet(40, 3221);
+	fillTree(testTree, randomData, 3222);
+
+	// empty range is a no-op
+	BinarySearchTree<int, int>::iterator first = testTree.begin();
+	EXPECT_EQ(first, testTree.erase(first, first));
+	EXPECT_TRUE(verifyBST(testTree, randomData));
+
+	// middle of the tree
+	std::set<int>::iterator lo = std::next(randomData.begin(), 10);
+	std::set<int>::iterator hi = std::next(randomData.begin(), 20);
+	BinarySearchTree<int, int>::iterator last = testTree.find(*hi);
+	EXPECT_EQ(last, testTree.erase(testTree.find(*lo), last));
+	randomData.erase(lo, hi);
+	EXPECT_TRUE(verifyBST(testTree, randomData));
+
+	// through the end
+	lo = std::next(randomData.begin(), 5);
+	testTree.erase(testTree.find(*lo), testTree.end());
+	randomData.erase(lo, randomData.end());
+	EXPECT_TRUE(verifyBST(testTree, randomData));
+	EXPECT_EQ(*randomData.rbegin(), testTree.rbegin()->first);
+
+	testTree.erase(testTree.begin(), testTree.end());
+	EXPECT_TRUE(testTree.empty());
+}
+
 // extensive combined insert-remove test
 // author credit: Shreya Havaldar
 TEST(BSTStress, InsertRemove)
@@ -0,0 +1,165 @@
+#ifndef INTERVAL_TREE_H
+#define INTERVAL_TREE_H
+
+#include "avlbst.h"
+#include <memory>
+#include <utility>
+#include <vector>
+
+// An AVLNode that also caches the largest end point in its subtree.
+template <typename Key, typename Value>
+class IntervalNode : public AVLNode<Key, Value> {
+public:
+  IntervalNode(std::pair<const Key, Value> &&item,
+               std::shared_ptr<AVLNode<Key, Value>> parent);
+  virtual ~IntervalNode();
+
+  const Value &getMaxEnd() const;
+  void setMaxEnd(const Value &max_end);
+
+protected:
+  Value max_end_;
+};
+
+// -------------------------------------------------
+// Begin implementations for the IntervalNode class.
+// -------------------------------------------------
+
+template <class Key, class Value>
+IntervalNode<Key, Value>::IntervalNode(
+    std::pair<const Key, Value> &&item,
+    std::shared_ptr<AVLNode<Key, Value>> parent)
+    : AVLNode<Key, Value>(std::move(item), parent),
+      max_end_(this->getValue()) {}
+
+template <class Key, class Value> IntervalNode<Key, Value>::~IntervalNode() {}
+
+template <class Key, class Value>
+const Value &IntervalNode<Key, Value>::getMaxEnd() const {
+  return max_end_;
+}
+
+template <class Key, class Value>
+void IntervalNode<Key, Value>::setMaxEnd(const Value &max_end) {
+  max_end_ = max_end;
+}
+
+// -----------------------------------------------
+// End implementations for the IntervalNode class.
+// -----------------------------------------------
+
+// An AVL tree of closed intervals [start, end], keyed by start with the end
+// as the value (so at most one interval per start point). Each node caches
+// the largest end in its subtree, which lets overlapping() skip every
+// subtree that ends before the query begins.
+//
+// Values must only be changed through the tree (insert, insert_or_assign,
+// upsert, modify), not by writing through an iterator, so that the cached
+// ends stay current.
+template <class Key, class Value = Key>
+class IntervalTree : public AVLTree<Key, Value> {
+public:
+  typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+
+  // Sets out to the intervals that overlap [lo, hi], in order of start.
+  // Only subtrees holding at least one overlap are entered besides the two
+  // search paths, so this is O(log n) when nothing overlaps and never more
+  // than O(log n) per interval reported.
+  void overlapping(const Key &lo, const Key &hi,
+                   std::vector<iterator> &out) const;
+  // Returns true if any interval overlaps [lo, hi], in O(log n).
+  bool overlaps(const Key &lo, const Key &hi) const;
+
+protected:
+  virtual std::shared_ptr<AVLNode<Key, Value>>
+  makeNode(std::pair<const Key, Value> &&item,
+           std::shared_ptr<AVLNode<Key, Value>> parent);
+  virtual void updateNode(std::shared_ptr<AVLNode<Key, Value>> n);
+  virtual void updatePath(std::shared_ptr<AVLNode<Key, Value>> n);
+
+  static const IntervalNode<Key, Value> *asInterval(const Node<Key, Value> *n);
+};
+
+template <class Key, class Value>
+void IntervalTree<Key, Value>::overlapping(const Key &lo, const Key &hi,
+                                           std::vector<iterator> &out) const {
+  out.clear();
+
+  // in-order walk that skips subtrees ending before lo and stops at the
+  // first start after hi
+  std::vector<std::shared_ptr<Node<Key, Value>>> stack;
+  std::shared_ptr<Node<Key, Value>> n = this->root_;
+  while (true) {
+    while (n != nullptr && !(asInterval(n.get())->getMaxEnd() < lo)) {
+      stack.push_back(n);
+      n = n->getLeft();
+    }
+    if (stack.empty())
+      return;
+    n = stack.back();
+    stack.pop_back();
+    if (hi < n->getKey())
+      return;
+    if (!(n->getValue() < lo))
+      out.push_back(this->makeIterator(n));
+    n = n->getRight();
+  }
+}
+
+template <class Key, class Value>
+bool IntervalTree<Key, Value>::overlaps(const Key &lo, const Key &hi) const {
+  // go left whenever the left subtree reaches lo: if it holds no overlap,
+  // nothing to the right does either, as everything there starts later
+  const Node<Key, Value> *n = this->root_.get();
+  while (n != nullptr && !(asInterval(n)->getMaxEnd() < lo)) {
+    const Node<Key, Value> *left = n->getLeft().get();
+    if (left != nullptr && !(asInterval(left)->getMaxEnd() < lo))
+      n = left;
+    else if (hi < n->getKey())
+      return false;
+    else if (!(n->getValue() < lo))
+      return true;
+    else
+      n = n->getRight().get();
+  }
+  return false;
+}
+
+template <class Key, class Value>
+std::shared_ptr<AVLNode<Key, Value>>
+IntervalTree<Key, Value>::makeNode(
+    std::pair<const Key, Value> &&item,
+    std::shared_ptr<AVLNode<Key, Value>> parent) {
+  return std::make_shared<IntervalNode<Key, Value>>(std::move(item), parent);
+}
+
+// The largest end is n's own or one cached by a child.
+template <class Key, class Value>
+void IntervalTree<Key, Value>::updateNode(
+    std::shared_ptr<AVLNode<Key, Value>> n) {
+  IntervalNode<Key, Value> *node =
+      static_cast<IntervalNode<Key, Value> *>(n.get());
+  const Value *max_end = &node->getValue();
+  const Node<Key, Value> *left = node->getLeft().get();
+  const Node<Key, Value> *right = node->getRight().get();
+  if (left != nullptr && *max_end < asInterval(left)->getMaxEnd())
+    max_end = &asInterval(left)->getMaxEnd();
+  if (right != nullptr && *max_end < asInterval(right)->getMaxEnd())
+    max_end = &asInterval(right)->getMaxEnd();
+  node->setMaxEnd(*max_end);
+}
+
+template <class Key, class Value>
+void IntervalTree<Key, Value>::updatePath(
+    std::shared_ptr<AVLNode<Key, Value>> n) {
+  for (; n != nullptr; n = n->getParent_AVL())
+    updateNode(n);
+}
+
+template <class Key, class Value>
+const IntervalNode<Key, Value> *
+IntervalTree<Key, Value>::asInterval(const Node<Key, Value> *n) {
+  return static_cast<const IntervalNode<Key, Value> *>(n);
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef MERKLE_TREE_H
+#define MERKLE_TREE_H
+
+#include "avlbst.h"
+#include "bloom_filter.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// An AVLNode that also caches a hash of its own item and one of its whole
+// subtree.
+template <typename Key, typename Value>
+class MerkleNode : public AVLNode<Key, Value> {
+public:
+  MerkleNode(std::pair<const Key, Value> &&item,
+             std::shared_ptr<AVLNode<Key, Value>> parent, uint64_t item_hash);
+  virtual ~MerkleNode();
+
+  uint64_t getItemHash() const;
+  void setItemHash(uint64_t item_hash);
+  uint64_t getHash() const;
+  void setHash(uint64_t hash);
+
+protected:
+  uint64_t item_hash_;
+  uint64_t hash_;
+};
+
+// -----------------------------------------------
+// Begin implementations for the MerkleNode class.
+// -----------------------------------------------
+
+template <class Key, class Value>
+MerkleNode<Key, Value>::MerkleNode(std::pair<const Key, Value> &&item,
+                                   std::shared_ptr<AVLNode<Key, Value>> parent,
+                                   uint64_t item_hash)
+    : AVLNode<Key, Value>(std::move(item), parent), item_hash_(item_hash),
+      hash_(item_hash) {}
+
+template <class Key, class Value> MerkleNode<Key, Value>::~MerkleNode() {}
+
+template <class Key, class Value>
+uint64_t MerkleNode<Key, Value>::getItemHash() const {
+  return item_hash_;
+}
+
+template <class Key, class Value>
+void MerkleNode<Key, Value>::setItemHash(uint64_t item_hash) {
+  item_hash_ = item_hash;
+}
+
+template <class Key, class Value>
+uint64_t MerkleNode<Key, Value>::getHash() const {
+  return hash_;
+}
+
+template <class Key, class Value>
+void MerkleNode<Key, Value>::setHash(uint64_t hash) {
+  hash_ = hash;
+}
+
+// ---------------------------------------------
+// End implementations for the MerkleNode class.
+// ---------------------------------------------
+
+// An AVL tree whose nodes cache a hash of their subtree's items, so that two
+// replicas can be compared in O(1) and their differences found by looking
+// only at the parts that differ.
+//
+// A subtree's hash is the sum (mod 2^64) of strongly mixed per-item hashes
+// rather than a hash of the children's hashes. It depends only on the items,
+// never on the shape of the tree, so replicas that were built in different
+// orders (and so are balanced differently) still hash the same, and the
+// hash of any key range can be read off one tree in O(log n).
+//
+// Values must only be changed through the tree (insert, insert_or_assign,
+// upsert, modify), not by writing through an iterator, so that the cached
+// hashes stay current.
+template <class Key, class Value, class KeyHash = std::hash<Key>,
+          class ValueHash = std::hash<Value>>
+class MerkleTree : public AVLTree<Key, Value> {
+public:
+  // Hash of all items; equal trees have equal hashes.
+  uint64_t hash() const;
+  // Sets out to the keys, in order, that are in only one of the trees or
+  // have different values in each. Takes O(log^2 n) per difference and O(1)
+  // when the trees are equal.
+  void diff(const MerkleTree &other, std::vector<Key> &out) const;
+
+protected:
+  typedef MerkleNode<Key, Value> MNode;
+
+  virtual std::shared_ptr<AVLNode<Key, Value>>
+  makeNode(std::pair<const Key, Value> &&item,
+           std::shared_ptr<AVLNode<Key, Value>> parent);
+  virtual void updateNode(std::shared_ptr<AVLNode<Key, Value>> n);
+  virtual void updatePath(std::shared_ptr<AVLNode<Key, Value>> n);
+  virtual void valueChanged(std::shared_ptr<Node<Key, Value>> node);
+
+  static uint64_t itemHash(const Key &key, const Value &value);
+  static uint64_t mix(uint64_t x);
+  static uint64_t hashOf(const Node<Key, Value> *n);
+  uint64_t hashBelow(const Key &bound, bool inclusive) const;
+  uint64_t hashBetween(const Key *lo, const Key *hi) const;
+  void diffRange(const Node<Key, Value> *n, const Key *lo, const Key *hi,
+                 const MerkleTree &other, std::vector<Key> &out) const;
+  static void collectBetween(const Node<Key, Value> *n, const Key *lo,
+                             const Key *hi, std::vector<Key> &out);
+};
+
+template <class Key, class Value, class KeyHash, class ValueHash>
+uint64_t MerkleTree<Key, Value, KeyHash, ValueHash>::hash() const {
+  return hashOf(this->root_.get());
+}
+
+template <class Key, class Value, class KeyHash, class ValueHash>
+void MerkleTree<Key, Value, KeyHash, ValueHash>::diff(
+    const MerkleTree &other, std::vector<Key> &out) const {
+  out.clear();
+  diffRange(this->root_.get(), nullptr, nullptr, other, out);
+}
+
+template <class Key, class Value, class KeyHash, class ValueHash>
+std::shared_ptr<AVLNode<Key, Value>>
+MerkleTree<Key, Value, KeyHash, ValueHash>::makeNode(
+    std::pair<const Key, Value> &&item,
+    std::shared_ptr<AVLNode<Key, Value>> parent) {
+  uint64_t item_hash = itemHash(item.first, item.second);
+  return std::make_shared<MNode>(std::move(item), parent, item_hash);
+}
+
+template <class Key, class Value, class KeyHash, class ValueHash>
+void MerkleTree<Key, Value, KeyHash, ValueHash>::updateNode(
+    std::shared_ptr<AVLNode<Key, Value>> n) {
+  MNode *node = static_cast<MNode *>(n.get());
+  node->setHash(hashOf(node->getLeft().get()) + node->getItemHash() +
+                hashOf(node->getRight().get()));
+}
+
+template <class Key, class Value, class KeyHash, class ValueHash>
+void MerkleTree<Key, Value, KeyHash, ValueHash>::updatePath(
+    std::shared_ptr<AVLNode<Key, Value>> n) {
+  for (; n != nullptr; n = n->getParent_AVL())
+    updateNode(n);
+}
+
+// The node's own item hash is only recomputed here, when its value changes.
+template <class Key, class Value, class KeyHash, class ValueHash>
+void MerkleTree<Key, Value, KeyHash, ValueHash>::valueChanged(
+    std::shared_ptr<Node<Key, Value>> node) {
+  static_cast<MNode *>(node.get())
+      ->setItemHash(itemHash(node->getKey(), node->getValue()));
+  AVLTree<Key, Value>::valueChanged(node);
+}
+
+template <class Key, class Value, class KeyHash, class ValueHash>
+uint64_t MerkleTree<Key, Value, KeyHash, ValueHash>::itemHash(
+    const Key &key, const Value &value) {
+  return mix(mix(KeyHash()(key)) + ValueHash()(value));
+}
+
+// The splitmix64 finalizer, shared with BloomFilter. Item hashes are
+// summed, so they must look uniformly random even when std::hash is the
+// identity.
+template <class Key, class Value, class KeyHash, class ValueHash>
+uint64_t MerkleTree<Key, Value, KeyHash, ValueHash>::mix(uint64_t x) {
+  return BloomFilter::mix(x);
+}
+
+template <class Key, class Value, class KeyHash, class ValueHash>
+uint64_t MerkleTree<Key, Value, KeyHash, ValueHash>::hashOf(
+    const Node<Key, Value> *n) {
+  return n == nullptr ? 0 : static_cast<const MNode *>(n)->getHash();
+}
+
+// Hash of the keys < bound (or <= bound), picking up whole left subtrees on
+// one descent.
+template <class Key, class Value, class KeyHash, class ValueHash>
+uint64_t MerkleTree<Key, Value, KeyHash, ValueHash>::hashBelow(
+    const Key &bound, bool inclusive) const {
+  uint64_t sum = 0;
+  const Node<Key, Value> *n = this->root_.get();
+  while (n != nullptr) {
+    if (n->getKey() < bound || (inclusive && !(bound < n->getKey()))) {
+      sum += hashOf(n->getLeft().get()) +
+             static_cast<const MNode *>(n)->getItemHash();
+      n = n->getRight().get();
+    } else
+      n = n->getLeft().get();
+  }
+  return sum;
+}
+
+// Hash of the keys strictly between lo and hi, a null bound being open.
+template <class Key, class Value, class KeyHash, class ValueHash>
+uint64_t MerkleTree<Key, Value, KeyHash, ValueHash>::hashBetween(
+    const Key *lo, const Key *hi) const {
+  uint64_t below_hi = hi == nullptr ? hash() : hashBelow(*hi, false);
+  uint64_t up_to_lo = lo == nullptr ? 0 : hashBelow(*lo, true);
+  return below_hi - up_to_lo;
+}
+
+// n roots the subtree of this tree holding exactly the keys strictly between
+// lo and hi. Subtrees that hash the same as that range of other are skipped;
+// otherwise n's own item is compared and both sides are searched. Where this
+// tree has nothing left, everything other has in the range differs.
+template <class Key, class Value, class KeyHash, class ValueHash>
+void MerkleTree<Key, Value, KeyHash, ValueHash>::diffRange(
+    const Node<Key, Value> *n, const Key *lo, const Key *hi,
+    const MerkleTree &other, std::vector<Key> &out) const {
+  if (hashOf(n) == other.hashBetween(lo, hi))
+    return;
+  if (n == nullptr) {
+    collectBetween(other.root_.get(), lo, hi, out);
+    return;
+  }
+
+  diffRange(n->getLeft().get(), lo, &n->getKey(), other, out);
+  std::shared_ptr<Node<Key, Value>> match = other.internalFind(n->getKey());
+  if (match == nullptr ||
+      static_cast<const MNode *>(match.get())->getItemHash() !=
+          static_cast<const MNode *>(n)->getItemHash())
+    out.push_back(n->getKey());
+  diffRange(n->getRight().get(), &n->getKey(), hi, other, out);
+}
+
+// Appends the keys strictly between lo and hi in the subtree at n, in order.
+template <class Key, class Value, class KeyHash, class ValueHash>
+void MerkleTree<Key, Value, KeyHash, ValueHash>::collectBetween(
+    const Node<Key, Value> *n, const Key *lo, const Key *hi,
+    std::vector<Key> &out) {
+  if (n == nullptr)
+    return;
+  bool above_lo = lo == nullptr || *lo < n->getKey();
+  bool below_hi = hi == nullptr || n->getKey() < *hi;
+  if (above_lo)
+    collectBetween(n->getLeft().get(), lo, hi, out);
+  if (above_lo && below_hi)
+    out.push_back(n->getKey());
+  if (below_hi)
+    collectBetween(n->getRight().get(), lo, hi, out);
+}
+
+#endif
@@ -0,0 +1,730 @@
+#ifndef PAGED_BTREE_H
+#define PAGED_BTREE_H
+
+#include "buffer_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// The first page of a PagedBTree file.
+struct PagedBTreeMeta {
+  char magic[8];
+  uint32_t version;
+  uint32_t key_size;
+  uint32_t value_size;
+  uint32_t page_size;
+  uint32_t root;
+  uint32_t pages;
+  // head of the list of freed pages, or 0
+  uint32_t free;
+  uint32_t height;
+  uint64_t size;
+};
+
+// A B+-tree kept in a file of BufferPool pages, for indices larger than
+// memory. It has the same find / insert / remove / ordered iteration
+// interface as BinarySearchTree, so code written against one works with
+// the other, but keys and values must be trivially copyable as they are
+// stored bytewise.
+//
+// Items live in the leaves, which are chained in key order; internal pages
+// hold separator keys, each the smallest key that may be found under the
+// child to its right. Every page but the root is kept at least half full:
+// an overfull page is split in two, and an underfull one takes items from a
+// sibling or is merged into it. Freed pages are reused before the file
+// grows.
+//
+// Changes reach the file as the buffer pool evicts pages, and all of them
+// on flush() or destruction. There is no log, so a crash can leave a file
+// with only some of its pages written.
+template <typename Key, typename Value> class PagedBTree {
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<Value>::value,
+                "PagedBTree stores keys and values bytewise");
+
+public:
+  typedef std::pair<const Key, Value> Item;
+  static const uint32_t kVersion = 1;
+  // Enough for the pages pinned along the deepest path plus the siblings
+  // a split or merge touches.
+  static const size_t kMinFrames = 16;
+
+  // Opens the tree in path, creating it if the file is empty, with a pool
+  // of frames pages.
+  explicit PagedBTree(const std::string &path, size_t frames = 1024);
+  // Writes back everything, as flush() would.
+  ~PagedBTree();
+
+  // Holds a pin on its leaf, so the pool must have a frame for each live
+  // iterator. The item is a copy of the one on the page, and like the
+  // iterator itself is no longer valid after the tree is changed.
+  class iterator {
+  public:
+    iterator();
+    iterator(const iterator &other);
+    iterator &operator=(const iterator &other);
+
+    const Item &operator*() const;
+    const Item *operator->() const;
+
+    bool operator==(const iterator &rhs) const;
+    bool operator!=(const iterator &rhs) const;
+
+    iterator &operator++();
+
+  protected:
+    friend class PagedBTree<Key, Value>;
+    iterator(const BufferPool::Page &leaf, size_t slot);
+    // Moves past the end of exhausted leaves, then copies out the item.
+    void settle();
+
+    BufferPool::Page leaf_;
+    size_t slot_;
+    typename std::aligned_storage<sizeof(Item), alignof(Item)>::type item_;
+  };
+
+  // Sets the key's value, inserting it if needed.
+  void insert(const Item &item);
+  void remove(const Key &key);
+  void clear();
+  bool empty() const;
+  size_t size() const;
+
+  iterator begin() const;
+  iterator end() const;
+  iterator find(const Key &key) const;
+  // The first item whose key is not less than key, or end().
+  iterator lower_bound(const Key &key) const;
+
+  // Writes back every changed page and fsyncs the file.
+  void flush();
+  const BufferPool &pool() const;
+  size_t height() const;
+
+protected:
+  PagedBTree(const PagedBTree &);
+  PagedBTree &operator=(const PagedBTree &);
+
+  enum Kind : uint8_t { kLeaf = 1, kInternal = 2, kFree = 3 };
+  // kind, unused byte, uint16 count, uint32 next leaf or free page
+  static const size_t kHeader = 8;
+  static const size_t kLeafCapacity =
+      (BufferPool::kPageSize - kHeader) / (sizeof(Key) + sizeof(Value));
+  static const size_t kInternalCapacity =
+      (BufferPool::kPageSize - kHeader - sizeof(uint32_t)) /
+      (sizeof(Key) + sizeof(uint32_t));
+  static_assert(kLeafCapacity >= 3 && kInternalCapacity >= 3,
+                "keys and values are too large for a page");
+
+  static const char *magic() { return "PAGEDBT"; }
+
+  // Page layout. Leaves hold an array of keys then one of values; internal
+  // pages an array of keys then one of children, one more than the keys.
+  // Fields are copied in and out as the arrays need not be aligned.
+  static bool isLeaf(const char *p) { return p[0] == kLeaf; }
+  static size_t count(const char *p);
+  static void setCount(char *p, size_t count);
+  static uint32_t next(const char *p);
+  static void setNext(char *p, uint32_t next);
+  static char *keyAt(char *p, size_t i) {
+    return p + kHeader + i * sizeof(Key);
+  }
+  static Key key(const char *p, size_t i);
+  static char *valueAt(char *p, size_t i);
+  static char *childAt(char *p, size_t i);
+  static uint32_t child(const char *p, size_t i);
+  // The first key not less than key (in a leaf), or greater than it (in an
+  // internal page, to pick the child to descend to).
+  static size_t lowerBound(const char *p, const Key &key);
+  static size_t upperBound(const char *p, const Key &key);
+
+  static void readLeaf(char *p, std::vector<Key> &keys,
+                       std::vector<Value> &values);
+  static void writeLeaf(char *p, const std::vector<Key> &keys,
+                        const std::vector<Value> &values, size_t lo,
+                        size_t hi);
+  static void readInternal(char *p, std::vector<Key> &keys,
+                           std::vector<uint32_t> &children);
+  static void writeInternal(char *p, const std::vector<Key> &keys,
+                            const std::vector<uint32_t> &children,
+                            size_t lo, size_t hi);
+
+  uint32_t allocate();
+  void release(const BufferPool::Page &page);
+  void releaseSubtree(uint32_t page);
+  bool insertInto(uint32_t page, const Key &key, const Value &value,
+                  Key &split_key, uint32_t &split_page);
+  bool removeFrom(uint32_t page, const Key &key);
+  void rebalance(const BufferPool::Page &parent, size_t index);
+  BufferPool::Page leafFor(const Key &key) const;
+  void writeMeta();
+
+  mutable BufferPool pool_;
+  PagedBTreeMeta meta_;
+};
+
+// -------------------------------------------------------
+// Begin implementations for the PagedBTree::iterator class.
+// -------------------------------------------------------
+
+template <class Key, class Value>
+PagedBTree<Key, Value>::iterator::iterator() : slot_(0) {}
+
+template <class Key, class Value>
+PagedBTree<Key, Value>::iterator::iterator(const iterator &other)
+    : leaf_(other.leaf_), slot_(other.slot_) {
+  if (leaf_.valid())
+    new (&item_) Item(*other);
+}
+
+template <class Key, class Value>
+typename PagedBTree<Key, Value>::iterator &
+PagedBTree<Key, Value>::iterator::operator=(const iterator &other) {
+  leaf_ = other.leaf_;
+  slot_ = other.slot_;
+  if (leaf_.valid())
+    new (&item_) Item(*other);
+  return *this;
+}
+
+template <class Key, class Value>
+PagedBTree<Key, Value>::iterator::iterator(const BufferPool::Page &leaf,
+                                           size_t slot)
+    : leaf_(leaf), slot_(slot) {
+  settle();
+}
+
+template <class Key, class Value>
+const typename PagedBTree<Key, Value>::Item &
+PagedBTree<Key, Value>::iterator::operator*() const {
+  return *reinterpret_cast<const Item *>(&item_);
+}
+
+template <class Key, class Value>
+const typename PagedBTree<Key, Value>::Item *
+PagedBTree<Key, Value>::iterator::operator->() const {
+  return reinterpret_cast<const Item *>(&item_);
+}
+
+template <class Key, class Value>
+bool PagedBTree<Key, Value>::iterator::operator==(const iterator &rhs) const {
+  if (!leaf_.valid() || !rhs.leaf_.valid())
+    return leaf_.valid() == rhs.leaf_.valid();
+  return leaf_.id() == rhs.leaf_.id() && slot_ == rhs.slot_;
+}
+
+template <class Key, class Value>
+bool PagedBTree<Key, Value>::iterator::operator!=(const iterator &rhs) const {
+  return !(*this == rhs);
+}
+
+template <class Key, class Value>
+typename PagedBTree<Key, Value>::iterator &
+PagedBTree<Key, Value>::iterator::operator++() {
+  slot_++;
+  settle();
+  return *this;
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::iterator::settle() {
+  while (leaf_.valid() && slot_ == count(leaf_.data())) {
+    uint32_t following = next(leaf_.data());
+    if (following == 0)
+      leaf_ = BufferPool::Page();
+    else
+      leaf_ = leaf_.pool()->pin(following);
+    slot_ = 0;
+  }
+  if (leaf_.valid()) {
+    Value value;
+    std::memcpy(&value, valueAt(leaf_.data(), slot_), sizeof(Value));
+    new (&item_) Item(key(leaf_.data(), slot_), value);
+  }
+}
+
+// -----------------------------------------------------
+// End implementations for the PagedBTree::iterator class.
+// -----------------------------------------------------
+
+// -----------------------------------------------
+// Begin implementations for the PagedBTree class.
+// -----------------------------------------------
+
+template <class Key, class Value>
+const size_t PagedBTree<Key, Value>::kMinFrames;
+
+template <class Key, class Value>
+PagedBTree<Key, Value>::PagedBTree(const std::string &path, size_t frames)
+    : pool_(path, std::max(frames, kMinFrames)) {
+  if (pool_.filePages() == 0) {
+    std::memset(&meta_, 0, sizeof(meta_));
+    std::memcpy(meta_.magic, magic(), 8);
+    meta_.version = kVersion;
+    meta_.key_size = sizeof(Key);
+    meta_.value_size = sizeof(Value);
+    meta_.page_size = BufferPool::kPageSize;
+    meta_.root = 1;
+    meta_.pages = 2;
+    meta_.height = 1;
+    pool_.pinNew(meta_.root).data()[0] = kLeaf;
+    writeMeta();
+    return;
+  }
+
+  std::memcpy(&meta_, pool_.pin(0).data(), sizeof(meta_));
+  if (std::memcmp(meta_.magic, magic(), 8) != 0)
+    throw std::runtime_error(path + " does not hold a paged B+-tree");
+  if (meta_.version != kVersion)
+    throw std::runtime_error("unsupported paged B+-tree version in " + path);
+  if (meta_.key_size != sizeof(Key) || meta_.value_size != sizeof(Value) ||
+      meta_.page_size != BufferPool::kPageSize)
+    throw std::runtime_error(path + " holds keys or values of another type");
+  if (meta_.pages > pool_.filePages() || meta_.root >= meta_.pages)
+    throw std::runtime_error(path + " is truncated");
+}
+
+template <class Key, class Value> PagedBTree<Key, Value>::~PagedBTree() {
+  try {
+    flush();
+  } catch (const std::runtime_error &) {
+    // nothing more can be done about it here
+  }
+}
+
+// Splits propagate up from the leaf; a split of the root adds a level.
+template <class Key, class Value>
+void PagedBTree<Key, Value>::insert(const Item &item) {
+  Key split_key;
+  uint32_t split_page;
+  if (!insertInto(meta_.root, item.first, item.second, split_key,
+                  split_page))
+    return;
+  uint32_t root = allocate();
+  BufferPool::Page page = pool_.pinNew(root);
+  char *p = page.data();
+  p[0] = kInternal;
+  setCount(p, 1);
+  std::memcpy(keyAt(p, 0), &split_key, sizeof(Key));
+  std::memcpy(childAt(p, 0), &meta_.root, sizeof(uint32_t));
+  std::memcpy(childAt(p, 1), &split_page, sizeof(uint32_t));
+  meta_.root = root;
+  meta_.height++;
+}
+
+// An internal root left with a single child is replaced by that child.
+template <class Key, class Value>
+void PagedBTree<Key, Value>::remove(const Key &key) {
+  if (!removeFrom(meta_.root, key))
+    return;
+  BufferPool::Page root = pool_.pin(meta_.root);
+  if (!isLeaf(root.data()) && count(root.data()) == 0) {
+    meta_.root = child(root.data(), 0);
+    meta_.height--;
+    release(root);
+  }
+}
+
+template <class Key, class Value> void PagedBTree<Key, Value>::clear() {
+  releaseSubtree(meta_.root);
+  meta_.root = allocate();
+  pool_.pinNew(meta_.root).data()[0] = kLeaf;
+  meta_.height = 1;
+  meta_.size = 0;
+}
+
+template <class Key, class Value> bool PagedBTree<Key, Value>::empty() const {
+  return meta_.size == 0;
+}
+
+template <class Key, class Value> size_t PagedBTree<Key, Value>::size() const {
+  return meta_.size;
+}
+
+template <class Key, class Value>
+typename PagedBTree<Key, Value>::iterator
+PagedBTree<Key, Value>::begin() const {
+  BufferPool::Page page = pool_.pin(meta_.root);
+  while (!isLeaf(page.data()))
+    page = pool_.pin(child(page.data(), 0));
+  return iterator(page, 0);
+}
+
+template <class Key, class Value>
+typename PagedBTree<Key, Value>::iterator PagedBTree<Key, Value>::end() const {
+  return iterator();
+}
+
+template <class Key, class Value>
+typename PagedBTree<Key, Value>::iterator
+PagedBTree<Key, Value>::find(const Key &key) const {
+  iterator it = lower_bound(key);
+  if (it != end() && key < it->first)
+    return end();
+  return it;
+}
+
+template <class Key, class Value>
+typename PagedBTree<Key, Value>::iterator
+PagedBTree<Key, Value>::lower_bound(const Key &key) const {
+  BufferPool::Page leaf = leafFor(key);
+  return iterator(leaf, lowerBound(leaf.data(), key));
+}
+
+template <class Key, class Value> void PagedBTree<Key, Value>::flush() {
+  writeMeta();
+  pool_.flush();
+}
+
+template <class Key, class Value>
+const BufferPool &PagedBTree<Key, Value>::pool() const {
+  return pool_;
+}
+
+template <class Key, class Value>
+size_t PagedBTree<Key, Value>::height() const {
+  return meta_.height;
+}
+
+template <class Key, class Value>
+size_t PagedBTree<Key, Value>::count(const char *p) {
+  uint16_t n;
+  std::memcpy(&n, p + 2, sizeof(n));
+  return n;
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::setCount(char *p, size_t count) {
+  uint16_t n = static_cast<uint16_t>(count);
+  std::memcpy(p + 2, &n, sizeof(n));
+}
+
+template <class Key, class Value>
+uint32_t PagedBTree<Key, Value>::next(const char *p) {
+  uint32_t n;
+  std::memcpy(&n, p + 4, sizeof(n));
+  return n;
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::setNext(char *p, uint32_t next) {
+  std::memcpy(p + 4, &next, sizeof(next));
+}
+
+template <class Key, class Value>
+Key PagedBTree<Key, Value>::key(const char *p, size_t i) {
+  Key k;
+  std::memcpy(&k, p + kHeader + i * sizeof(Key), sizeof(Key));
+  return k;
+}
+
+template <class Key, class Value>
+char *PagedBTree<Key, Value>::valueAt(char *p, size_t i) {
+  return p + kHeader + kLeafCapacity * sizeof(Key) + i * sizeof(Value);
+}
+
+template <class Key, class Value>
+char *PagedBTree<Key, Value>::childAt(char *p, size_t i) {
+  return p + kHeader + kInternalCapacity * sizeof(Key) + i * sizeof(uint32_t);
+}
+
+template <class Key, class Value>
+uint32_t PagedBTree<Key, Value>::child(const char *p, size_t i) {
+  uint32_t c;
+  std::memcpy(&c, p + kHeader + kInternalCapacity * sizeof(Key) +
+                      i * sizeof(uint32_t),
+              sizeof(c));
+  return c;
+}
+
+template <class Key, class Value>
+size_t PagedBTree<Key, Value>::lowerBound(const char *p, const Key &k) {
+  size_t lo = 0, hi = count(p);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (key(p, mid) < k)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+template <class Key, class Value>
+size_t PagedBTree<Key, Value>::upperBound(const char *p, const Key &k) {
+  size_t lo = 0, hi = count(p);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (k < key(p, mid))
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::readLeaf(char *p, std::vector<Key> &keys,
+                                      std::vector<Value> &values) {
+  size_t n = count(p);
+  size_t first = keys.size();
+  keys.resize(first + n);
+  values.resize(first + n);
+  if (n == 0)
+    return;
+  std::memcpy(&keys[first], keyAt(p, 0), n * sizeof(Key));
+  std::memcpy(&values[first], valueAt(p, 0), n * sizeof(Value));
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::writeLeaf(char *p, const std::vector<Key> &keys,
+                                       const std::vector<Value> &values,
+                                       size_t lo, size_t hi) {
+  p[0] = kLeaf;
+  setCount(p, hi - lo);
+  if (hi == lo)
+    return;
+  std::memcpy(keyAt(p, 0), &keys[lo], (hi - lo) * sizeof(Key));
+  std::memcpy(valueAt(p, 0), &values[lo], (hi - lo) * sizeof(Value));
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::readInternal(char *p, std::vector<Key> &keys,
+                                          std::vector<uint32_t> &children) {
+  size_t n = count(p);
+  size_t first = keys.size();
+  keys.resize(first + n);
+  if (n > 0)
+    std::memcpy(&keys[first], keyAt(p, 0), n * sizeof(Key));
+  first = children.size();
+  children.resize(first + n + 1);
+  std::memcpy(&children[first], childAt(p, 0), (n + 1) * sizeof(uint32_t));
+}
+
+// Writes keys [lo, hi) and the children on either side of them.
+template <class Key, class Value>
+void PagedBTree<Key, Value>::writeInternal(
+    char *p, const std::vector<Key> &keys,
+    const std::vector<uint32_t> &children, size_t lo, size_t hi) {
+  p[0] = kInternal;
+  setCount(p, hi - lo);
+  if (hi > lo)
+    std::memcpy(keyAt(p, 0), &keys[lo], (hi - lo) * sizeof(Key));
+  std::memcpy(childAt(p, 0), &children[lo], (hi - lo + 1) * sizeof(uint32_t));
+}
+
+template <class Key, class Value> uint32_t PagedBTree<Key, Value>::allocate() {
+  if (meta_.free == 0)
+    return meta_.pages++;
+  uint32_t page = meta_.free;
+  meta_.free = next(pool_.pin(page).data());
+  return page;
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::release(const BufferPool::Page &page) {
+  char *p = page.data();
+  p[0] = kFree;
+  setCount(p, 0);
+  setNext(p, meta_.free);
+  page.dirty();
+  meta_.free = page.id();
+}
+
+template <class Key, class Value>
+void PagedBTree<Key, Value>::releaseSubtree(uint32_t id) {
+  BufferPool::Page page = pool_.pin(id);
+  if (!isLeaf(page.data()))
+    for (size_t i = 0; i <= count(page.data()); i++)
+      releaseSubtree(child(page.data(), i));
+  release(page);
+}
+
+// Inserts into the subtree under page. If that overfills the page it is
+// split, and the new right half and the smallest key under it are returned
+// for the parent to link in.
+template <class Key, class Value>
+bool PagedBTree<Key, Value>::insertInto(uint32_t id, const Key &k,
+                                        const Value &value, Key &split_key,
+                                        uint32_t &split_page) {
+  BufferPool::Page page = pool_.pin(id);
+  char *p = page.data();
+  size_t n = count(p);
+
+  if (isLeaf(p)) {
+    size_t i = lowerBound(p, k);
+    page.dirty();
+    if (i < n && !(k < key(p, i))) {
+      std::memcpy(valueAt(p, i), &value, sizeof(Value));
+      return false;
+    }
+    meta_.size++;
+    if (n < kLeafCapacity) {
+      std::memmove(keyAt(p, i + 1), keyAt(p, i), (n - i) * sizeof(Key));
+      std::memmove(valueAt(p, i + 1), valueAt(p, i), (n - i) * sizeof(Value));
+      std::memcpy(keyAt(p, i), &k, sizeof(Key));
+      std::memcpy(valueAt(p, i), &value, sizeof(Value));
+      setCount(p, n + 1);
+      return false;
+    }
+
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    readLeaf(p, keys, values);
+    keys.insert(keys.begin() + i, k);
+    values.insert(values.begin() + i, value);
+    split_page = allocate();
+    BufferPool::Page right = pool_.pinNew(split_page);
+    size_t half = keys.size() / 2;
+    writeLeaf(p, keys, values, 0, half);
+    writeLeaf(right.data(), keys, values, half, keys.size());
+    setNext(right.data(), next(p));
+    setNext(p, split_page);
+    split_key = keys[half];
+    return true;
+  }
+
+  size_t i = upperBound(p, k);
+  Key child_key;
+  uint32_t child_page;
+  if (!insertInto(child(p, i), k, value, child_key, child_page))
+    return false;
+  page.dirty();
+  if (n < kInternalCapacity) {
+    std::memmove(keyAt(p, i + 1), keyAt(p, i), (n - i) * sizeof(Key));
+    std::memmove(childAt(p, i + 2), childAt(p, i + 1),
+                 (n - i) * sizeof(uint32_t));
+    std::memcpy(keyAt(p, i), &child_key, sizeof(Key));
+    std::memcpy(childAt(p, i + 1), &child_page, sizeof(uint32_t));
+    setCount(p, n + 1);
+    return false;
+  }
+
+  // the middle key moves up to the parent
+  std::vector<Key> keys;
+  std::vector<uint32_t> children;
+  readInternal(p, keys, children);
+  keys.insert(keys.begin() + i, child_key);
+  children.insert(children.begin() + i + 1, child_page);
+  split_page = allocate();
+  BufferPool::Page right = pool_.pinNew(split_page);
+  size_t half = keys.size() / 2;
+  writeInternal(p, keys, children, 0, half);
+  writeInternal(right.data(), keys, children, half + 1, keys.size());
+  split_key = keys[half];
+  return true;
+}
+
+// Removes key from the subtree under page, rebalancing any child left less
+// than half full. Returns whether the key was there.
+template <class Key, class Value>
+bool PagedBTree<Key, Value>::removeFrom(uint32_t id, const Key &k) {
+  BufferPool::Page page = pool_.pin(id);
+  char *p = page.data();
+  size_t n = count(p);
+
+  if (isLeaf(p)) {
+    size_t i = lowerBound(p, k);
+    if (i == n || k < key(p, i))
+      return false;
+    std::memmove(keyAt(p, i), keyAt(p, i + 1), (n - i - 1) * sizeof(Key));
+    std::memmove(valueAt(p, i), valueAt(p, i + 1),
+                 (n - i - 1) * sizeof(Value));
+    setCount(p, n - 1);
+    page.dirty();
+    meta_.size--;
+    return true;
+  }
+
+  size_t i = upperBound(p, k);
+  if (!removeFrom(child(p, i), k))
+    return false;
+  BufferPool::Page below = pool_.pin(child(p, i));
+  size_t minimum = kInternalCapacity / 2;
+  if (isLeaf(below.data()))
+    minimum = kLeafCapacity / 2;
+  if (count(below.data()) < minimum)
+    rebalance(page, i);
+  return true;
+}
+
+// Evens out the underfull child at index with a neighbour, or merges the
+// two if they fit in one page. Internal pages pass their separator key
+// through the parent.
+template <class Key, class Value>
+void PagedBTree<Key, Value>::rebalance(const BufferPool::Page &parent,
+                                       size_t index) {
+  char *p = parent.data();
+  size_t n = count(p);
+  size_t l = index > 0 ? index - 1 : 0;
+  BufferPool::Page left = pool_.pin(child(p, l));
+  BufferPool::Page right = pool_.pin(child(p, l + 1));
+  left.dirty();
+  right.dirty();
+  parent.dirty();
+
+  bool merge;
+  if (isLeaf(left.data())) {
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    readLeaf(left.data(), keys, values);
+    readLeaf(right.data(), keys, values);
+    merge = keys.size() <= kLeafCapacity;
+    if (merge) {
+      writeLeaf(left.data(), keys, values, 0, keys.size());
+      setNext(left.data(), next(right.data()));
+    } else {
+      size_t half = keys.size() / 2;
+      writeLeaf(left.data(), keys, values, 0, half);
+      writeLeaf(right.data(), keys, values, half, keys.size());
+      std::memcpy(keyAt(p, l), &keys[half], sizeof(Key));
+    }
+  } else {
+    std::vector<Key> keys;
+    std::vector<uint32_t> children;
+    readInternal(left.data(), keys, children);
+    keys.push_back(key(p, l));
+    readInternal(right.data(), keys, children);
+    merge = keys.size() <= kInternalCapacity;
+    if (merge) {
+      writeInternal(left.data(), keys, children, 0, keys.size());
+    } else {
+      size_t half = keys.size() / 2;
+      writeInternal(left.data(), keys, children, 0, half);
+      writeInternal(right.data(), keys, children, half + 1, keys.size());
+      std::memcpy(keyAt(p, l), &keys[half], sizeof(Key));
+    }
+  }
+
+  if (merge) {
+    release(right);
+    std::memmove(keyAt(p, l), keyAt(p, l + 1), (n - l - 1) * sizeof(Key));
+    std::memmove(childAt(p, l + 1), childAt(p, l + 2),
+                 (n - l - 1) * sizeof(uint32_t));
+    setCount(p, n - 1);
+  }
+}
+
+template <class Key, class Value>
+BufferPool::Page PagedBTree<Key, Value>::leafFor(const Key &k) const {
+  BufferPool::Page page = pool_.pin(meta_.root);
+  while (!isLeaf(page.data()))
+    page = pool_.pin(child(page.data(), upperBound(page.data(), k)));
+  return page;
+}
+
+template <class Key, class Value> void PagedBTree<Key, Value>::writeMeta() {
+  std::memcpy(pool_.pinNew(0).data(), &meta_, sizeof(meta_));
+}
+
+// ---------------------------------------------
+// End implementations for the PagedBTree class.
+// ---------------------------------------------
+
+#endif
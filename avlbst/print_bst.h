@@ -13,6 +13,20 @@
 // maximum depth of tree to actually print.
 #define PPBST_MAX_HEIGHT 6
 
+// Prints a value if it supports operator<<, otherwise a placeholder,
+// so that trees of unprintable (e.g. move-only) values can still be printed.
+template<typename T>
+auto ppbstPrintValue(std::ostream & out, T const & value, int) -> decltype(out << value, void())
+{
+    out << value;
+}
+
+template<typename T>
+void ppbstPrintValue(std::ostream & out, T const &, long)
+{
+    out << "<value>";
+}
+
 // Returns the node's distance from the given root.
 // 1 means that it is the root.
 // Returns -1 (not found) if the distance is more than PPBST_MAX_HEIGHT,
@@ -280,7 +294,7 @@ void BinarySearchTree<Key, Value>::printRoot (std::shared_ptr<Node<Key, Value>>
             }
             else
             {
-                std::cout << elementIter->second;
+                ppbstPrintValue(std::cout, elementIter->second, 0);
             }
 
             std::cout << ')' << std::endl;
@@ -0,0 +1,736 @@
+#ifndef RADIX_TREE_H
+#define RADIX_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Turns a key into the byte string the radix tree indexes, such that
+// comparing the byte strings lexicographically gives the same order as the
+// keys. Specialize this for other key types.
+template <class Key, class Enable = void> struct RadixKeyTraits;
+
+// Integers are stored big-endian, with the sign bit flipped for signed types
+// so that negative numbers sort first.
+template <class Key>
+struct RadixKeyTraits<
+    Key, typename std::enable_if<std::is_integral<Key>::value>::type> {
+  static std::string encode(const Key &key) {
+    typedef typename std::make_unsigned<Key>::type Unsigned;
+    Unsigned bits = static_cast<Unsigned>(key);
+    if (std::is_signed<Key>::value)
+      bits ^= static_cast<Unsigned>(Unsigned(1) << (sizeof(Key) * 8 - 1));
+    std::string bytes(sizeof(Key), '\0');
+    for (size_t i = sizeof(Key); i-- > 0;) {
+      bytes[i] = static_cast<char>(bits & 0xFF);
+      bits = static_cast<Unsigned>(bits >> 8);
+    }
+    return bytes;
+  }
+};
+
+// Strings are their own bytes. Keys may be prefixes of each other.
+template <> struct RadixKeyTraits<std::string> {
+  static std::string encode(const std::string &key) { return key; }
+};
+
+// An ordered map in the style of an adaptive radix tree (ART). It descends
+// one key byte per level instead of comparing whole keys, so a lookup costs
+// O(key length) regardless of how many keys are stored. Inner nodes grow
+// and shrink between 4, 16, 48 and 256 children to stay dense, and chains
+// of single-child nodes are collapsed into a prefix stored on the node
+// below (path compression).
+//
+// A key that ends exactly at an inner node (one string key being a prefix
+// of another) is kept in that node's end leaf, which sorts before its
+// children. Any insert or remove invalidates iterators.
+template <class Key, class Value> class RadixTree {
+protected:
+  enum NodeType { kLeaf, kNode4, kNode16, kNode48, kNode256 };
+
+  struct NodeBase {
+    explicit NodeBase(NodeType t) : type(t) {}
+    virtual ~NodeBase() {}
+    NodeType type;
+  };
+  typedef std::unique_ptr<NodeBase> NodePtr;
+
+  struct Leaf : NodeBase {
+    Leaf(std::string &&b, const std::pair<const Key, Value> &kv)
+        : NodeBase(kLeaf), bytes(std::move(b)), item(kv) {}
+    std::string bytes;
+    std::pair<const Key, Value> item;
+  };
+
+  struct Inner : NodeBase {
+    explicit Inner(NodeType t) : NodeBase(t), count(0) {}
+    // key bytes skipped over between the parent's edge and this node
+    std::string prefix;
+    // the key ending exactly here, if any
+    NodePtr end_leaf;
+    uint16_t count;
+  };
+
+  struct Node4 : Inner {
+    Node4() : Inner(kNode4) {}
+    uint8_t keys[4];
+    NodePtr children[4];
+  };
+
+  struct Node16 : Inner {
+    Node16() : Inner(kNode16) {}
+    uint8_t keys[16];
+    NodePtr children[16];
+  };
+
+  struct Node48 : Inner {
+    Node48() : Inner(kNode48) { std::memset(index, 0, sizeof(index)); }
+    // slot + 1 of each byte's child, 0 if none
+    uint8_t index[256];
+    NodePtr children[48];
+  };
+
+  struct Node256 : Inner {
+    Node256() : Inner(kNode256) {}
+    NodePtr children[256];
+  };
+
+public:
+  class iterator {
+  public:
+    iterator();
+
+    std::pair<const Key, Value> &operator*() const;
+    std::pair<const Key, Value> *operator->() const;
+
+    bool operator==(const iterator &rhs) const;
+    bool operator!=(const iterator &rhs) const;
+
+    iterator &operator++();
+
+  protected:
+    friend class RadixTree<Key, Value>;
+
+    // An inner node on the path and the last child byte taken from it (-1
+    // if none yet, only its end leaf).
+    struct Frame {
+      const Inner *node;
+      int pos;
+    };
+
+    void leftmost(const NodeBase *n);
+
+    std::vector<Frame> stack_;
+    Leaf *current_;
+  };
+
+  RadixTree();
+
+  void insert(const std::pair<const Key, Value> &keyValuePair);
+  void remove(const Key &key);
+  void clear();
+
+  iterator begin() const;
+  iterator end() const;
+  iterator find(const Key &key) const;
+
+  bool empty() const;
+  size_t size() const;
+
+protected:
+  static NodePtr *findChild(Inner *n, uint8_t byte);
+  static const NodeBase *nextChild(const Inner *n, int after, int &byte);
+  static void addChild(NodePtr &ref, uint8_t byte, NodePtr child);
+  static void removeChild(NodePtr &ref, uint8_t byte);
+  static void shrink(NodePtr &ref);
+  static void copyHeader(Inner *to, Inner *from);
+
+  void insertAt(NodePtr &ref, std::string &bytes, size_t depth,
+                const std::pair<const Key, Value> &keyValuePair);
+  bool removeAt(NodePtr &ref, const std::string &bytes, size_t depth);
+
+  NodePtr root_;
+  size_t size_;
+};
+
+// -----------------------------------------------
+// Begin implementations for the iterator class.
+// -----------------------------------------------
+
+template <class Key, class Value>
+RadixTree<Key, Value>::iterator::iterator() : current_(NULL) {}
+
+template <class Key, class Value>
+std::pair<const Key, Value> &
+RadixTree<Key, Value>::iterator::operator*() const {
+  return current_->item;
+}
+
+template <class Key, class Value>
+std::pair<const Key, Value> *
+RadixTree<Key, Value>::iterator::operator->() const {
+  return &current_->item;
+}
+
+template <class Key, class Value>
+bool RadixTree<Key, Value>::iterator::operator==(const iterator &rhs) const {
+  return current_ == rhs.current_;
+}
+
+template <class Key, class Value>
+bool RadixTree<Key, Value>::iterator::operator!=(const iterator &rhs) const {
+  return current_ != rhs.current_;
+}
+
+// Goes back up to the nearest node with a later child and takes the
+// smallest leaf under that child.
+template <class Key, class Value>
+typename RadixTree<Key, Value>::iterator &
+RadixTree<Key, Value>::iterator::operator++() {
+  while (!stack_.empty()) {
+    Frame &top = stack_.back();
+    int byte;
+    const NodeBase *child = nextChild(top.node, top.pos, byte);
+    if (child != NULL) {
+      top.pos = byte;
+      leftmost(child);
+      return *this;
+    }
+    stack_.pop_back();
+  }
+  current_ = NULL;
+  return *this;
+}
+
+// Descends from n to its smallest leaf, pushing the inner nodes passed.
+template <class Key, class Value>
+void RadixTree<Key, Value>::iterator::leftmost(const NodeBase *n) {
+  while (n->type != kLeaf) {
+    const Inner *inner = static_cast<const Inner *>(n);
+    Frame frame = {inner, -1};
+    stack_.push_back(frame);
+    if (inner->end_leaf) {
+      n = inner->end_leaf.get();
+      break;
+    }
+    n = nextChild(inner, -1, stack_.back().pos);
+  }
+  current_ = static_cast<Leaf *>(const_cast<NodeBase *>(n));
+}
+
+// -----------------------------------------------
+// End implementations for the iterator class.
+// -----------------------------------------------
+
+template <class Key, class Value>
+RadixTree<Key, Value>::RadixTree() : size_(0) {}
+
+// Inserts the pair, overwriting the value if the key is already present.
+template <class Key, class Value>
+void RadixTree<Key, Value>::insert(
+    const std::pair<const Key, Value> &keyValuePair) {
+  std::string bytes = RadixKeyTraits<Key>::encode(keyValuePair.first);
+  insertAt(root_, bytes, 0, keyValuePair);
+}
+
+template <class Key, class Value>
+void RadixTree<Key, Value>::remove(const Key &key) {
+  std::string bytes = RadixKeyTraits<Key>::encode(key);
+  if (removeAt(root_, bytes, 0))
+    size_--;
+}
+
+template <class Key, class Value> void RadixTree<Key, Value>::clear() {
+  root_.reset();
+  size_ = 0;
+}
+
+template <class Key, class Value>
+typename RadixTree<Key, Value>::iterator RadixTree<Key, Value>::begin() const {
+  iterator it;
+  if (root_)
+    it.leftmost(root_.get());
+  return it;
+}
+
+template <class Key, class Value>
+typename RadixTree<Key, Value>::iterator RadixTree<Key, Value>::end() const {
+  return iterator();
+}
+
+// Descends one key byte per level, checking compressed prefixes on the way.
+// The path is kept so the returned iterator can be advanced.
+template <class Key, class Value>
+typename RadixTree<Key, Value>::iterator
+RadixTree<Key, Value>::find(const Key &key) const {
+  std::string bytes = RadixKeyTraits<Key>::encode(key);
+  iterator it;
+  NodeBase *n = root_.get();
+  size_t depth = 0;
+  while (n != NULL && n->type != kLeaf) {
+    Inner *inner = static_cast<Inner *>(n);
+    const std::string &prefix = inner->prefix;
+    if (bytes.compare(depth, prefix.size(), prefix) != 0)
+      return end();
+    depth += prefix.size();
+
+    typename iterator::Frame frame = {inner, -1};
+    it.stack_.push_back(frame);
+    if (depth == bytes.size()) {
+      n = inner->end_leaf.get();
+      break;
+    }
+    uint8_t byte = static_cast<uint8_t>(bytes[depth]);
+    NodePtr *child = findChild(inner, byte);
+    if (child == NULL)
+      return end();
+    it.stack_.back().pos = byte;
+    n = child->get();
+    depth++;
+  }
+  if (n == NULL || static_cast<Leaf *>(n)->bytes != bytes)
+    return end();
+  it.current_ = static_cast<Leaf *>(n);
+  return it;
+}
+
+template <class Key, class Value> bool RadixTree<Key, Value>::empty() const {
+  return size_ == 0;
+}
+
+template <class Key, class Value> size_t RadixTree<Key, Value>::size() const {
+  return size_;
+}
+
+// Returns the link to n's child for byte, or NULL if it has none. Node16
+// compares all 16 keys at once where SSE2 is available.
+template <class Key, class Value>
+typename RadixTree<Key, Value>::NodePtr *
+RadixTree<Key, Value>::findChild(Inner *n, uint8_t byte) {
+  switch (n->type) {
+  case kNode4: {
+    Node4 *node = static_cast<Node4 *>(n);
+    for (int i = 0; i < node->count; i++) {
+      if (node->keys[i] == byte)
+        return &node->children[i];
+    }
+    return NULL;
+  }
+  case kNode16: {
+    Node16 *node = static_cast<Node16 *>(n);
+#if defined(__SSE2__)
+    __m128i cmp = _mm_cmpeq_epi8(
+        _mm_set1_epi8(static_cast<char>(byte)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(node->keys)));
+    int mask = _mm_movemask_epi8(cmp) & ((1 << node->count) - 1);
+    if (mask != 0)
+      return &node->children[__builtin_ctz(mask)];
+#else
+    for (int i = 0; i < node->count; i++) {
+      if (node->keys[i] == byte)
+        return &node->children[i];
+    }
+#endif
+    return NULL;
+  }
+  case kNode48: {
+    Node48 *node = static_cast<Node48 *>(n);
+    if (node->index[byte] == 0)
+      return NULL;
+    return &node->children[node->index[byte] - 1];
+  }
+  case kNode256: {
+    Node256 *node = static_cast<Node256 *>(n);
+    if (!node->children[byte])
+      return NULL;
+    return &node->children[byte];
+  }
+  default:
+    return NULL;
+  }
+}
+
+// Returns n's child with the smallest byte greater than after (which may be
+// -1) and sets byte to it, or returns NULL if there is none.
+template <class Key, class Value>
+const typename RadixTree<Key, Value>::NodeBase *
+RadixTree<Key, Value>::nextChild(const Inner *n, int after, int &byte) {
+  switch (n->type) {
+  case kNode4: {
+    const Node4 *node = static_cast<const Node4 *>(n);
+    for (int i = 0; i < node->count; i++) {
+      if (node->keys[i] > after) {
+        byte = node->keys[i];
+        return node->children[i].get();
+      }
+    }
+    return NULL;
+  }
+  case kNode16: {
+    const Node16 *node = static_cast<const Node16 *>(n);
+    for (int i = 0; i < node->count; i++) {
+      if (node->keys[i] > after) {
+        byte = node->keys[i];
+        return node->children[i].get();
+      }
+    }
+    return NULL;
+  }
+  case kNode48: {
+    const Node48 *node = static_cast<const Node48 *>(n);
+    for (int b = after + 1; b < 256; b++) {
+      if (node->index[b] != 0) {
+        byte = b;
+        return node->children[node->index[b] - 1].get();
+      }
+    }
+    return NULL;
+  }
+  case kNode256: {
+    const Node256 *node = static_cast<const Node256 *>(n);
+    for (int b = after + 1; b < 256; b++) {
+      if (node->children[b]) {
+        byte = b;
+        return node->children[b].get();
+      }
+    }
+    return NULL;
+  }
+  default:
+    return NULL;
+  }
+}
+
+// Moves the prefix and end leaf of one inner node to its replacement.
+template <class Key, class Value>
+void RadixTree<Key, Value>::copyHeader(Inner *to, Inner *from) {
+  to->prefix.swap(from->prefix);
+  to->end_leaf = std::move(from->end_leaf);
+  to->count = from->count;
+}
+
+// Adds child under byte to the inner node in ref, which has no child there.
+// A full node is replaced by the next larger kind.
+template <class Key, class Value>
+void RadixTree<Key, Value>::addChild(NodePtr &ref, uint8_t byte,
+                                     NodePtr child) {
+  Inner *n = static_cast<Inner *>(ref.get());
+  switch (n->type) {
+  case kNode4:
+  case kNode16: {
+    // both keep their keys sorted
+    uint8_t *keys;
+    NodePtr *children;
+    int capacity;
+    if (n->type == kNode4) {
+      keys = static_cast<Node4 *>(n)->keys;
+      children = static_cast<Node4 *>(n)->children;
+      capacity = 4;
+    } else {
+      keys = static_cast<Node16 *>(n)->keys;
+      children = static_cast<Node16 *>(n)->children;
+      capacity = 16;
+    }
+
+    if (n->count < capacity) {
+      int i = n->count;
+      while (i > 0 && keys[i - 1] > byte) {
+        keys[i] = keys[i - 1];
+        children[i] = std::move(children[i - 1]);
+        i--;
+      }
+      keys[i] = byte;
+      children[i] = std::move(child);
+      n->count++;
+      return;
+    }
+
+    if (n->type == kNode4) {
+      Node16 *grown = new Node16();
+      NodePtr grown_ptr(grown);
+      copyHeader(grown, n);
+      for (int i = 0; i < 4; i++) {
+        grown->keys[i] = keys[i];
+        grown->children[i] = std::move(children[i]);
+      }
+      ref = std::move(grown_ptr);
+    } else {
+      Node48 *grown = new Node48();
+      NodePtr grown_ptr(grown);
+      copyHeader(grown, n);
+      for (int i = 0; i < 16; i++) {
+        grown->index[keys[i]] = static_cast<uint8_t>(i + 1);
+        grown->children[i] = std::move(children[i]);
+      }
+      ref = std::move(grown_ptr);
+    }
+    addChild(ref, byte, std::move(child));
+    return;
+  }
+  case kNode48: {
+    Node48 *node = static_cast<Node48 *>(n);
+    if (node->count < 48) {
+      int slot = 0;
+      while (node->children[slot])
+        slot++;
+      node->index[byte] = static_cast<uint8_t>(slot + 1);
+      node->children[slot] = std::move(child);
+      node->count++;
+      return;
+    }
+    Node256 *grown = new Node256();
+    NodePtr grown_ptr(grown);
+    copyHeader(grown, n);
+    for (int b = 0; b < 256; b++) {
+      if (node->index[b] != 0)
+        grown->children[b] = std::move(node->children[node->index[b] - 1]);
+    }
+    ref = std::move(grown_ptr);
+    addChild(ref, byte, std::move(child));
+    return;
+  }
+  case kNode256: {
+    Node256 *node = static_cast<Node256 *>(n);
+    node->children[byte] = std::move(child);
+    node->count++;
+    return;
+  }
+  default:
+    return;
+  }
+}
+
+// Drops the child under byte from the inner node in ref, then lets shrink()
+// pick a smaller node kind if that is now enough.
+template <class Key, class Value>
+void RadixTree<Key, Value>::removeChild(NodePtr &ref, uint8_t byte) {
+  Inner *n = static_cast<Inner *>(ref.get());
+  switch (n->type) {
+  case kNode4:
+  case kNode16: {
+    uint8_t *keys;
+    NodePtr *children;
+    if (n->type == kNode4) {
+      keys = static_cast<Node4 *>(n)->keys;
+      children = static_cast<Node4 *>(n)->children;
+    } else {
+      keys = static_cast<Node16 *>(n)->keys;
+      children = static_cast<Node16 *>(n)->children;
+    }
+    int i = 0;
+    while (keys[i] != byte)
+      i++;
+    for (; i + 1 < n->count; i++) {
+      keys[i] = keys[i + 1];
+      children[i] = std::move(children[i + 1]);
+    }
+    children[i].reset();
+    break;
+  }
+  case kNode48: {
+    Node48 *node = static_cast<Node48 *>(n);
+    node->children[node->index[byte] - 1].reset();
+    node->index[byte] = 0;
+    break;
+  }
+  case kNode256:
+    static_cast<Node256 *>(n)->children[byte].reset();
+    break;
+  default:
+    return;
+  }
+  n->count--;
+  shrink(ref);
+}
+
+// Replaces the inner node in ref with something smaller when it has become
+// sparse: a smaller node kind, its only leaf, or (merging prefixes) its only
+// child.
+template <class Key, class Value>
+void RadixTree<Key, Value>::shrink(NodePtr &ref) {
+  Inner *n = static_cast<Inner *>(ref.get());
+
+  // nothing left but the end leaf
+  if (n->count == 0) {
+    NodePtr leaf = std::move(n->end_leaf);
+    ref = std::move(leaf);
+    return;
+  }
+
+  // a single child and no end leaf: this node is pure path
+  if (n->count == 1 && !n->end_leaf) {
+    int byte;
+    nextChild(n, -1, byte);
+    NodePtr child = std::move(*findChild(n, static_cast<uint8_t>(byte)));
+    if (child->type != kLeaf) {
+      Inner *inner = static_cast<Inner *>(child.get());
+      inner->prefix = n->prefix + static_cast<char>(byte) + inner->prefix;
+    }
+    ref = std::move(child);
+    return;
+  }
+
+  if (n->type == kNode16 && n->count <= 3) {
+    Node16 *node = static_cast<Node16 *>(n);
+    Node4 *shrunk = new Node4();
+    NodePtr shrunk_ptr(shrunk);
+    copyHeader(shrunk, n);
+    for (int i = 0; i < node->count; i++) {
+      shrunk->keys[i] = node->keys[i];
+      shrunk->children[i] = std::move(node->children[i]);
+    }
+    ref = std::move(shrunk_ptr);
+  } else if (n->type == kNode48 && n->count <= 12) {
+    Node48 *node = static_cast<Node48 *>(n);
+    Node16 *shrunk = new Node16();
+    NodePtr shrunk_ptr(shrunk);
+    copyHeader(shrunk, n);
+    int i = 0;
+    for (int b = 0; b < 256; b++) {
+      if (node->index[b] != 0) {
+        shrunk->keys[i] = static_cast<uint8_t>(b);
+        shrunk->children[i] = std::move(node->children[node->index[b] - 1]);
+        i++;
+      }
+    }
+    ref = std::move(shrunk_ptr);
+  } else if (n->type == kNode256 && n->count <= 37) {
+    Node256 *node = static_cast<Node256 *>(n);
+    Node48 *shrunk = new Node48();
+    NodePtr shrunk_ptr(shrunk);
+    copyHeader(shrunk, n);
+    int slot = 0;
+    for (int b = 0; b < 256; b++) {
+      if (node->children[b]) {
+        shrunk->index[b] = static_cast<uint8_t>(slot + 1);
+        shrunk->children[slot] = std::move(node->children[b]);
+        slot++;
+      }
+    }
+    ref = std::move(shrunk_ptr);
+  }
+}
+
+// Inserts below the link ref, whose node starts at key byte depth.
+template <class Key, class Value>
+void RadixTree<Key, Value>::insertAt(
+    NodePtr &ref, std::string &bytes, size_t depth,
+    const std::pair<const Key, Value> &keyValuePair) {
+  if (!ref) {
+    ref.reset(new Leaf(std::move(bytes), keyValuePair));
+    size_++;
+    return;
+  }
+
+  // a leaf in the way: overwrite it, or split it off under a new Node4 at
+  // the first byte where the two keys differ
+  if (ref->type == kLeaf) {
+    Leaf *leaf = static_cast<Leaf *>(ref.get());
+    if (leaf->bytes == bytes) {
+      leaf->item.second = keyValuePair.second;
+      return;
+    }
+    size_t common = depth;
+    while (common < bytes.size() && common < leaf->bytes.size() &&
+           bytes[common] == leaf->bytes[common])
+      common++;
+
+    Node4 *split = new Node4();
+    NodePtr split_ptr(split);
+    split->prefix = bytes.substr(depth, common - depth);
+    NodePtr old = std::move(ref);
+    ref = std::move(split_ptr);
+    if (leaf->bytes.size() == common)
+      split->end_leaf = std::move(old);
+    else
+      addChild(ref, static_cast<uint8_t>(leaf->bytes[common]), std::move(old));
+    insertAt(ref, bytes, depth, keyValuePair);
+    return;
+  }
+
+  // the key leaves the compressed prefix part way: split the prefix
+  Inner *n = static_cast<Inner *>(ref.get());
+  size_t matched = 0;
+  while (matched < n->prefix.size() && depth + matched < bytes.size() &&
+         n->prefix[matched] == bytes[depth + matched])
+    matched++;
+  if (matched < n->prefix.size()) {
+    Node4 *split = new Node4();
+    NodePtr split_ptr(split);
+    split->prefix = n->prefix.substr(0, matched);
+    uint8_t edge = static_cast<uint8_t>(n->prefix[matched]);
+    n->prefix.erase(0, matched + 1);
+    NodePtr old = std::move(ref);
+    ref = std::move(split_ptr);
+    addChild(ref, edge, std::move(old));
+    insertAt(ref, bytes, depth, keyValuePair);
+    return;
+  }
+  depth += n->prefix.size();
+
+  // the key ends at this node
+  if (depth == bytes.size()) {
+    insertAt(n->end_leaf, bytes, depth, keyValuePair);
+    return;
+  }
+
+  uint8_t byte = static_cast<uint8_t>(bytes[depth]);
+  NodePtr *child = findChild(n, byte);
+  if (child != NULL) {
+    insertAt(*child, bytes, depth + 1, keyValuePair);
+    return;
+  }
+  addChild(ref, byte, NodePtr(new Leaf(std::move(bytes), keyValuePair)));
+  size_++;
+}
+
+// Removes the key below the link ref, whose node starts at key byte depth.
+// Returns whether it was there.
+template <class Key, class Value>
+bool RadixTree<Key, Value>::removeAt(NodePtr &ref, const std::string &bytes,
+                                     size_t depth) {
+  if (!ref)
+    return false;
+  if (ref->type == kLeaf) {
+    if (static_cast<Leaf *>(ref.get())->bytes != bytes)
+      return false;
+    ref.reset();
+    return true;
+  }
+
+  Inner *n = static_cast<Inner *>(ref.get());
+  if (bytes.compare(depth, n->prefix.size(), n->prefix) != 0)
+    return false;
+  depth += n->prefix.size();
+
+  if (depth == bytes.size()) {
+    if (!n->end_leaf)
+      return false;
+    n->end_leaf.reset();
+    shrink(ref);
+    return true;
+  }
+
+  uint8_t byte = static_cast<uint8_t>(bytes[depth]);
+  NodePtr *child = findChild(n, byte);
+  if (child == NULL)
+    return false;
+  if ((*child)->type == kLeaf) {
+    if (static_cast<Leaf *>(child->get())->bytes != bytes)
+      return false;
+    removeChild(ref, byte);
+    return true;
+  }
+  return removeAt(*child, bytes, depth + 1);
+}
+
+#endif
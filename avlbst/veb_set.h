@@ -0,0 +1,347 @@
+#ifndef VEB_SET_H
+#define VEB_SET_H
+
+#include "avlbst.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+// Index of the lowest / highest set bit of a non-zero 64-bit word, with the
+// builtins where the compiler has them and a halving search elsewhere.
+#if defined(__GNUC__) || defined(__clang__)
+#define VEB_LOWEST_BIT(bits) __builtin_ctzll(bits)
+#define VEB_HIGHEST_BIT(bits) (63 - __builtin_clzll(bits))
+#else
+inline int vebLowestBit(uint64_t bits) {
+  int index = 0;
+  for (int shift = 32; shift > 0; shift /= 2)
+    if ((bits & ((uint64_t(1) << shift) - 1)) == 0) {
+      bits >>= shift;
+      index += shift;
+    }
+  return index;
+}
+inline int vebHighestBit(uint64_t bits) {
+  int index = 0;
+  for (int shift = 32; shift > 0; shift /= 2)
+    if (bits >> shift) {
+      bits >>= shift;
+      index += shift;
+    }
+  return index;
+}
+#define VEB_LOWEST_BIT(bits) vebLowestBit(bits)
+#define VEB_HIGHEST_BIT(bits) vebHighestBit(bits)
+#endif
+
+// A set of 32-bit integers with van Emde Boas successor and predecessor
+// queries: each step halves the number of key bits still to look at, so a
+// query takes O(log log U) = 5 levels however many keys are stored, where a
+// search tree takes O(log n) pointer hops.
+//
+// Each node covers keys of some bit width. It keeps its minimum and maximum
+// directly and sends the high half of a key's bits to a summary of non-empty
+// clusters and the low half into that cluster. Clusters are created on
+// demand and kept in a hash map, so memory grows with the keys stored rather
+// than the 2^32 universe. Nodes of 6 bits or fewer are a single 64-bit
+// bitmap.
+class VEBSet {
+public:
+  VEBSet();
+
+  // Returns false if key was already in the set.
+  bool insert(uint32_t key);
+  // Returns false if key was not in the set.
+  bool remove(uint32_t key);
+  void clear();
+
+  bool contains(uint32_t key) const;
+  // Set result to the smallest key > key (successor), the smallest key >= key
+  // (lowerBound) or the largest key < key (predecessor). Each returns false
+  // if there is no such key.
+  bool successor(uint32_t key, uint32_t &result) const;
+  bool lowerBound(uint32_t key, uint32_t &result) const;
+  bool predecessor(uint32_t key, uint32_t &result) const;
+
+  // Only valid on a non-empty set.
+  uint32_t min() const;
+  uint32_t max() const;
+
+  bool empty() const;
+  size_t size() const;
+
+protected:
+  struct Node {
+    explicit Node(int width);
+
+    bool isEmpty() const;
+    uint32_t minKey() const;
+    uint32_t maxKey() const;
+    uint32_t high(uint32_t key) const { return key >> low_bits; }
+    uint32_t low(uint32_t key) const { return key & ((1u << low_bits) - 1); }
+    uint32_t join(uint32_t h, uint32_t l) const {
+      return (h << low_bits) | l;
+    }
+    Node *cluster(uint32_t h) const;
+
+    // insert and remove expect key to be absent / present
+    void insert(uint32_t key);
+    void remove(uint32_t key);
+    bool contains(uint32_t key) const;
+    bool successor(uint32_t key, uint32_t &result) const;
+    bool predecessor(uint32_t key, uint32_t &result) const;
+
+    int width;
+    int low_bits;
+    // bitmap leaves only
+    uint64_t bits;
+    // inner nodes only; min is not also stored in a cluster, but max is
+    bool empty;
+    uint32_t min;
+    uint32_t max;
+    std::unique_ptr<Node> summary;
+    std::unordered_map<uint32_t, std::unique_ptr<Node>> clusters;
+  };
+
+  static const int kLeafWidth = 6;
+
+  Node root_;
+  size_t size_;
+};
+
+// Builds a VEBSet of the keys of an AVL tree.
+template <class Value> VEBSet makeVEBSet(const AVLTree<uint32_t, Value> &tree) {
+  VEBSet set;
+  for (typename AVLTree<uint32_t, Value>::iterator it = tree.begin();
+       it != tree.end(); ++it)
+    set.insert(it->first);
+  return set;
+}
+
+// -----------------------------------------------
+// Begin implementations for the VEBSet::Node class.
+// -----------------------------------------------
+
+inline VEBSet::Node::Node(int width)
+    : width(width), low_bits(width / 2), bits(0), empty(true), min(0),
+      max(0) {}
+
+inline bool VEBSet::Node::isEmpty() const {
+  return width <= kLeafWidth ? bits == 0 : empty;
+}
+
+inline uint32_t VEBSet::Node::minKey() const {
+  return width <= kLeafWidth ? VEB_LOWEST_BIT(bits) : min;
+}
+
+inline uint32_t VEBSet::Node::maxKey() const {
+  return width <= kLeafWidth ? VEB_HIGHEST_BIT(bits) : max;
+}
+
+inline VEBSet::Node *VEBSet::Node::cluster(uint32_t h) const {
+  std::unordered_map<uint32_t, std::unique_ptr<Node>>::const_iterator it =
+      clusters.find(h);
+  return it == clusters.end() ? NULL : it->second.get();
+}
+
+inline void VEBSet::Node::insert(uint32_t key) {
+  if (width <= kLeafWidth) {
+    bits |= uint64_t(1) << key;
+    return;
+  }
+  if (empty) {
+    min = max = key;
+    empty = false;
+    return;
+  }
+
+  // the new key may become min, in which case the old min goes down instead
+  if (key < min)
+    std::swap(key, min);
+  if (key > max)
+    max = key;
+
+  uint32_t h = high(key);
+  std::unique_ptr<Node> &c = clusters[h];
+  if (!c) {
+    c.reset(new Node(low_bits));
+    if (!summary)
+      summary.reset(new Node(width - low_bits));
+    summary->insert(h);
+  }
+  c->insert(low(key));
+}
+
+inline void VEBSet::Node::remove(uint32_t key) {
+  if (width <= kLeafWidth) {
+    bits &= ~(uint64_t(1) << key);
+    return;
+  }
+  if (min == max) {
+    empty = true;
+    return;
+  }
+
+  // removing min: the smallest clustered key becomes min and leaves its
+  // cluster
+  if (key == min) {
+    uint32_t h = summary->minKey();
+    key = join(h, cluster(h)->minKey());
+    min = key;
+  }
+
+  uint32_t h = high(key);
+  Node *c = cluster(h);
+  c->remove(low(key));
+  if (c->isEmpty()) {
+    clusters.erase(h);
+    summary->remove(h);
+  }
+
+  if (key == max) {
+    if (summary->isEmpty())
+      max = min;
+    else {
+      uint32_t hm = summary->maxKey();
+      max = join(hm, cluster(hm)->maxKey());
+    }
+  }
+}
+
+inline bool VEBSet::Node::contains(uint32_t key) const {
+  if (width <= kLeafWidth)
+    return (bits >> key) & 1;
+  if (empty)
+    return false;
+  if (key == min || key == max)
+    return true;
+  Node *c = cluster(high(key));
+  return c != NULL && c->contains(low(key));
+}
+
+inline bool VEBSet::Node::successor(uint32_t key, uint32_t &result) const {
+  if (width <= kLeafWidth) {
+    uint64_t above = key >= 63 ? 0 : bits & (~uint64_t(0) << (key + 1));
+    if (above == 0)
+      return false;
+    result = VEB_LOWEST_BIT(above);
+    return true;
+  }
+  if (empty || key >= max)
+    return false;
+  if (key < min) {
+    result = min;
+    return true;
+  }
+
+  // in key's own cluster, or else the first key of the next cluster
+  uint32_t h = high(key);
+  Node *c = cluster(h);
+  uint32_t l;
+  if (c != NULL && low(key) < c->maxKey()) {
+    c->successor(low(key), l);
+    result = join(h, l);
+    return true;
+  }
+  uint32_t hs;
+  if (summary && summary->successor(h, hs)) {
+    result = join(hs, cluster(hs)->minKey());
+    return true;
+  }
+  return false;
+}
+
+inline bool VEBSet::Node::predecessor(uint32_t key, uint32_t &result) const {
+  if (width <= kLeafWidth) {
+    uint64_t below = bits & ((uint64_t(1) << key) - 1);
+    if (below == 0)
+      return false;
+    result = VEB_HIGHEST_BIT(below);
+    return true;
+  }
+  if (empty || key <= min)
+    return false;
+  if (key > max) {
+    result = max;
+    return true;
+  }
+
+  // in key's own cluster, or else the last key of the previous cluster, or
+  // else min (which no cluster holds)
+  uint32_t h = high(key);
+  Node *c = cluster(h);
+  uint32_t l;
+  if (c != NULL && low(key) > c->minKey()) {
+    c->predecessor(low(key), l);
+    result = join(h, l);
+    return true;
+  }
+  uint32_t hp;
+  if (summary && summary->predecessor(h, hp)) {
+    result = join(hp, cluster(hp)->maxKey());
+    return true;
+  }
+  result = min;
+  return true;
+}
+
+// -----------------------------------------------
+// End implementations for the VEBSet::Node class.
+// -----------------------------------------------
+
+inline VEBSet::VEBSet() : root_(32), size_(0) {}
+
+inline bool VEBSet::insert(uint32_t key) {
+  if (root_.contains(key))
+    return false;
+  root_.insert(key);
+  size_++;
+  return true;
+}
+
+inline bool VEBSet::remove(uint32_t key) {
+  if (!root_.contains(key))
+    return false;
+  root_.remove(key);
+  size_--;
+  return true;
+}
+
+inline void VEBSet::clear() {
+  root_.summary.reset();
+  root_.clusters.clear();
+  root_.empty = true;
+  size_ = 0;
+}
+
+inline bool VEBSet::contains(uint32_t key) const {
+  return root_.contains(key);
+}
+
+inline bool VEBSet::successor(uint32_t key, uint32_t &result) const {
+  return root_.successor(key, result);
+}
+
+inline bool VEBSet::lowerBound(uint32_t key, uint32_t &result) const {
+  if (root_.contains(key)) {
+    result = key;
+    return true;
+  }
+  return root_.successor(key, result);
+}
+
+inline bool VEBSet::predecessor(uint32_t key, uint32_t &result) const {
+  return root_.predecessor(key, result);
+}
+
+inline uint32_t VEBSet::min() const { return root_.minKey(); }
+
+inline uint32_t VEBSet::max() const { return root_.maxKey(); }
+
+inline bool VEBSet::empty() const { return size_ == 0; }
+
+inline size_t VEBSet::size() const { return size_; }
+
+#endif